@@ -1,3 +1,35 @@
-C:/VulkanSDK/1.3.239.0/Bin/glslc.exe triangleMesh.vert -o triangleMesh.vert.spv
-C:/VulkanSDK/1.3.239.0/Bin/glslc.exe textured_lit.frag -o textured_lit.frag.spv
-pause
\ No newline at end of file
+@echo off
+rem compiles the shaders the engine loads and checks every module with spirv-val.
+rem the build runs it before VulkanApp with nopause, the .spv files come from here and are never edited by hand
+cd /d "%~dp0"
+set BIN=C:/VulkanSDK/1.3.239.0/Bin
+
+call :compile triangleMesh.vert.spv triangleMesh.vert || goto :failed
+call :compile packedMesh.vert.spv packedMesh.vert -DWITH_COLOR || goto :failed
+call :compile packedMeshNoColor.vert.spv packedMesh.vert || goto :failed
+call :compile depthOnly.vert.spv depthOnly.vert || goto :failed
+call :compile triangleMeshInstanced.vert.spv triangleMesh.vert -DINSTANCED || goto :failed
+call :compile packedMeshInstanced.vert.spv packedMesh.vert -DINSTANCED -DWITH_COLOR || goto :failed
+call :compile packedMeshNoColorInstanced.vert.spv packedMesh.vert -DINSTANCED || goto :failed
+call :compile depthOnlyInstanced.vert.spv depthOnly.vert -DINSTANCED || goto :failed
+call :compile triangleMeshIndirect.vert.spv triangleMesh.vert -DINDIRECT || goto :failed
+call :compile packedMeshIndirect.vert.spv packedMesh.vert -DINDIRECT -DWITH_COLOR || goto :failed
+call :compile packedMeshNoColorIndirect.vert.spv packedMesh.vert -DINDIRECT || goto :failed
+call :compile depthOnlyIndirect.vert.spv depthOnly.vert -DINDIRECT || goto :failed
+call :compile cull.comp.spv cull.comp || goto :failed
+call :compile textured_lit.frag.spv textured_lit.frag || goto :failed
+call :compile textured_lit_alphatest.frag.spv textured_lit.frag -DALPHA_TEST || goto :failed
+
+if not "%1"=="nopause" pause
+exit /b 0
+
+:failed
+echo Shader compilation failed
+if not "%1"=="nopause" pause
+exit /b 1
+
+rem output, source, then the defines
+:compile
+%BIN%/glslc.exe %3 %4 %2 -o %1 || exit /b 1
+%BIN%/spirv-val.exe --target-env vulkan1.0 %1 || exit /b 1
+exit /b 0
@@ -0,0 +1,60 @@
+#version 450
+
+//position only vertex shader for depth passes, shared by every vertex format.
+//full vertices read their vec3 as (x, y, z, 1), packed ones their quantized position, which the object's matrix maps back.
+//compiled again with INSTANCED for instance groups and with INDIRECT for the GPU scene
+layout (location = 0) in vec4 vPosition;
+#ifdef INSTANCED
+//model matrix of the instance, from the instance buffer bound next to the vertex streams
+layout (location = 4) in mat4 vInstanceMatrix;
+#endif
+
+layout(set = 0, binding = 0) uniform  CameraBuffer{
+	mat4 view;
+	mat4 proj;
+	mat4 viewproj;
+} cameraData;
+
+#ifdef INSTANCED
+layout( push_constant ) uniform constants
+{
+	//the instances take gl_InstanceIndex, the object's index is pushed
+	uint objectIndex;
+} PushConstants;
+#endif
+
+#ifndef INDIRECT
+//render matrices of the frame's objects, see WriteObjectTransforms in VulkanEngine.cpp. the draw's firstInstance is the object's index
+layout(std430, set = 0, binding = 3) readonly buffer TransformBuffer{
+	mat4 renderMatrices[];
+} transformBuffer;
+#endif
+
+#ifdef INDIRECT
+//objects of the GPU scene, see GPUObjectData in VkGpuScene.h. the draw's firstInstance is the object's index
+struct ObjectData
+{
+	mat4 renderMatrix;
+	vec4 boundingSphere;
+	uint firstIndex;
+	uint indexCount;
+	int vertexOffset;
+	uint batch;
+};
+
+layout(std430, set = 0, binding = 2) readonly buffer ObjectBuffer{
+	ObjectData objects[];
+} objectBuffer;
+#endif
+
+void main()
+{
+#ifdef INSTANCED
+	mat4 transformMatrix = (cameraData.viewproj * vInstanceMatrix * transformBuffer.renderMatrices[PushConstants.objectIndex]);
+#elif defined(INDIRECT)
+	mat4 transformMatrix = (cameraData.viewproj * objectBuffer.objects[gl_InstanceIndex].renderMatrix);
+#else
+	mat4 transformMatrix = (cameraData.viewproj * transformBuffer.renderMatrices[gl_InstanceIndex]);
+#endif
+	gl_Position = transformMatrix * vec4(vPosition.xyz, 1.0f);
+}
@@ -0,0 +1,88 @@
+#version 450
+
+//packed vertex layouts, see VertexFormat in VkMesh.h.
+//compiled twice: with WITH_COLOR for VertexFormat::Packed, without it for VertexFormat::PackedNoColor.
+//both again with INSTANCED for instance groups and with INDIRECT for the GPU scene.
+//the object's matrix has the dequantization folded in either way
+
+//position quantized inside the mesh bounds, the object's matrix maps it back to local space
+layout (location = 0) in vec4 vPosition;
+//octahedral encoded normal
+layout (location = 1) in vec2 vNormal;
+#ifdef WITH_COLOR
+layout (location = 2) in vec4 vColor;
+#endif
+layout (location = 3) in vec2 vTexCoord;
+#ifdef INSTANCED
+//model matrix of the instance, from the instance buffer bound next to the vertex streams
+layout (location = 4) in mat4 vInstanceMatrix;
+#endif
+
+layout (location = 0) out vec3 outColor;
+layout (location = 1) out vec2 texCoord;
+
+layout(set = 0, binding = 0) uniform  CameraBuffer{
+	mat4 view;
+	mat4 proj;
+	mat4 viewproj;
+} cameraData;
+
+#ifdef INSTANCED
+layout( push_constant ) uniform constants
+{
+	//the instances take gl_InstanceIndex, the object's index is pushed
+	uint objectIndex;
+} PushConstants;
+#endif
+
+#ifndef INDIRECT
+//render matrices of the frame's objects, see WriteObjectTransforms in VulkanEngine.cpp. the draw's firstInstance is the object's index
+layout(std430, set = 0, binding = 3) readonly buffer TransformBuffer{
+	mat4 renderMatrices[];
+} transformBuffer;
+#endif
+
+#ifdef INDIRECT
+//objects of the GPU scene, see GPUObjectData in VkGpuScene.h. the draw's firstInstance is the object's index
+struct ObjectData
+{
+	mat4 renderMatrix;
+	vec4 boundingSphere;
+	uint firstIndex;
+	uint indexCount;
+	int vertexOffset;
+	uint batch;
+};
+
+layout(std430, set = 0, binding = 2) readonly buffer ObjectBuffer{
+	ObjectData objects[];
+} objectBuffer;
+#endif
+
+vec3 octahedralDecode(vec2 e)
+{
+	vec3 v = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+	float t = max(-v.z, 0.0f);
+	v.x += v.x >= 0.0f ? -t : t;
+	v.y += v.y >= 0.0f ? -t : t;
+	return normalize(v);
+}
+
+void main()
+{
+#ifdef INSTANCED
+	mat4 transformMatrix = (cameraData.viewproj * vInstanceMatrix * transformBuffer.renderMatrices[PushConstants.objectIndex]);
+#elif defined(INDIRECT)
+	mat4 transformMatrix = (cameraData.viewproj * objectBuffer.objects[gl_InstanceIndex].renderMatrix);
+#else
+	mat4 transformMatrix = (cameraData.viewproj * transformBuffer.renderMatrices[gl_InstanceIndex]);
+#endif
+	gl_Position = transformMatrix * vPosition;
+#ifdef WITH_COLOR
+	outColor = vColor.rgb;
+#else
+	//the importer stores the normal as the color, so rebuild it from the normal
+	outColor = octahedralDecode(vNormal);
+#endif
+	texCoord = vTexCoord;
+}
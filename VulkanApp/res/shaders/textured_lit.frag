@@ -21,6 +21,13 @@ layout(set = 1, binding = 0) uniform sampler2D tex1;
 
 void main()
 {
-	vec3 color = texture(tex1, texCoord).xyz;
-	outFragColor = vec4(color, 1.0f);
+	vec4 color = texture(tex1, texCoord);
+
+#ifdef ALPHA_TEST
+	//cutout materials (leaves, glass, torches) drop their transparent texels
+	if (color.a < 0.5f)
+		discard;
+#endif
+
+	outFragColor = vec4(color.xyz, 1.0f);
 }
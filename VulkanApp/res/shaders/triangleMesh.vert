@@ -1,9 +1,16 @@
 #version 450
 
+//compiled again with INSTANCED for instance groups, the instance's matrix is applied after the object's matrix.
+//with INDIRECT for the GPU scene, the object's matrix comes from the GPU scene instead of the transform buffer
+
 layout (location = 0) in vec3 vPosition;
 layout (location = 1) in vec3 vNormal;
 layout (location = 2) in vec3 vColor;
 layout (location = 3) in vec2 vTexCoord;
+#ifdef INSTANCED
+//model matrix of the instance, from the instance buffer bound next to the vertex streams
+layout (location = 4) in mat4 vInstanceMatrix;
+#endif
 
 layout (location = 0) out vec3 outColor;
 layout (location = 1) out vec2 texCoord;
@@ -14,15 +21,47 @@ layout(set = 0, binding = 0) uniform  CameraBuffer{
 	mat4 viewproj;
 } cameraData;
 
+#ifdef INSTANCED
 layout( push_constant ) uniform constants
 {
-	vec4 data;
-	mat4 render_matrix;
+	//the instances take gl_InstanceIndex, the object's index is pushed
+	uint objectIndex;
 } PushConstants;
+#endif
+
+#ifndef INDIRECT
+//render matrices of the frame's objects, see WriteObjectTransforms in VulkanEngine.cpp. the draw's firstInstance is the object's index
+layout(std430, set = 0, binding = 3) readonly buffer TransformBuffer{
+	mat4 renderMatrices[];
+} transformBuffer;
+#endif
+
+#ifdef INDIRECT
+//objects of the GPU scene, see GPUObjectData in VkGpuScene.h. the draw's firstInstance is the object's index
+struct ObjectData
+{
+	mat4 renderMatrix;
+	vec4 boundingSphere;
+	uint firstIndex;
+	uint indexCount;
+	int vertexOffset;
+	uint batch;
+};
+
+layout(std430, set = 0, binding = 2) readonly buffer ObjectBuffer{
+	ObjectData objects[];
+} objectBuffer;
+#endif
 
 void main()
 {
-	mat4 transformMatrix = (cameraData.viewproj * PushConstants.render_matrix);
+#ifdef INSTANCED
+	mat4 transformMatrix = (cameraData.viewproj * vInstanceMatrix * transformBuffer.renderMatrices[PushConstants.objectIndex]);
+#elif defined(INDIRECT)
+	mat4 transformMatrix = (cameraData.viewproj * objectBuffer.objects[gl_InstanceIndex].renderMatrix);
+#else
+	mat4 transformMatrix = (cameraData.viewproj * transformBuffer.renderMatrices[gl_InstanceIndex]);
+#endif
 	gl_Position = transformMatrix * vec4(vPosition, 1.0f);
 	outColor = vColor;
 	texCoord = vTexCoord;
@@ -0,0 +1,309 @@
+#include "Benchmarks.h"
+
+#include "VkMesh.h"
+#include "VkObjLoader.h"
+#include "VkParallel.h"
+#include "VulkanEngine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+
+namespace Benchmarks
+{
+	namespace
+	{
+		using Clock = std::chrono::high_resolution_clock;
+
+		template<typename Function>
+		double MeasureBestMs(int iterations, Function&& function)
+		{
+			double best = 0.0;
+			for (int i = 0; i < iterations; i++)
+			{
+				const auto start = Clock::now();
+				function();
+				const double elapsed = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+				if (i == 0 || elapsed < best)
+					best = elapsed;
+			}
+
+			return best;
+		}
+	}
+
+	void RunObjImport(const char* filename, int iterations)
+	{
+		std::cout << "OBJ import benchmark: " << filename << ", best of " << iterations << " runs" << std::endl;
+
+		//full imports, including deduplication
+		VKE::Mesh reference;
+		const double tinyObjMs = MeasureBestMs(iterations, [&]() { reference.LoadFromObjTinyObj(filename); });
+
+		VKE::Mesh mesh;
+		const double parallelMs = MeasureBestMs(iterations, [&]() { mesh.LoadFromObj(filename); });
+
+		const bool identical = reference.Vertices.size() == mesh.Vertices.size() && reference.Indices == mesh.Indices &&
+			memcmp(reference.Vertices.data(), mesh.Vertices.data(), mesh.Vertices.size() * sizeof(VKE::Vertex)) == 0;
+
+		//parsing only, to show how the chunked parser scales with the thread count
+		const uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+
+		std::vector<VKE::Vertex> corners;
+		std::vector<uint32_t> triangleMaterials;
+		std::vector<VKE::MeshMaterial> materials;
+		std::string error;
+		const double singleThreadMs = MeasureBestMs(iterations, [&]() { VKE::ObjLoader::LoadTriangles(filename, corners, triangleMaterials, materials, error, 1); });
+		const double allThreadsMs = MeasureBestMs(iterations, [&]() { VKE::ObjLoader::LoadTriangles(filename, corners, triangleMaterials, materials, error, hardwareThreads); });
+
+		std::cout << "  tinyobj import:          " << tinyObjMs << " ms" << std::endl;
+		std::cout << "  parallel import:         " << parallelMs << " ms (" << tinyObjMs / parallelMs << "x)" << std::endl;
+		std::cout << "  parse, 1 thread:         " << singleThreadMs << " ms" << std::endl;
+		std::cout << "  parse, all threads (" << hardwareThreads << "): " << allThreadsMs << " ms (" << singleThreadMs / allThreadsMs << "x)" << std::endl;
+		std::cout << "  results identical:       " << (identical ? "yes" : "NO") << std::endl;
+	}
+
+	void RunObjectCulling(int iterations)
+	{
+		const uint32_t objectCounts[] = { 10000, 100000, 1000000 };
+		const uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+		const VKE::CullPath supportedPath = VKE::ObjectCuller::GetSupportedPath();
+
+		std::cout << "Object culling benchmark: best of " << iterations << " runs, " << VKE::GetCullPathName(supportedPath) << " supported" << std::endl;
+
+		//started once like the engine's, so the threads aren't part of the measurement
+		VKE::WorkerPool workers;
+		workers.Init(hardwareThreads);
+
+		//only the bounds are read
+		VKE::Mesh mesh;
+		mesh.BoundsMin = glm::vec3(-1.0f);
+		mesh.BoundsMax = glm::vec3(1.0f);
+
+		//the engine's camera, looking at the origin from above
+		glm::mat4 projection = glm::perspective(glm::radians(70.f), 1700.f / 900.f, 0.1f, 200.0f);
+		projection[1][1] *= -1;
+		const VKE::Frustum frustum = VKE::Frustum::FromMatrix(projection * glm::translate(glm::vec3(0.f, -6.f, -10.f)));
+
+		for (uint32_t objectCount : objectCounts)
+		{
+			//a square grid around the camera, most of it outside the frustum
+			const uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(double(objectCount))));
+
+			std::vector<VKE::RenderObject> objects(objectCount);
+			for (uint32_t i = 0; i < objectCount; i++)
+			{
+				objects[i].mesh = &mesh;
+				objects[i].material = nullptr;
+				objects[i].transformMatrix = glm::translate(glm::vec3(float(i % side) - side * 0.5f, 0.0f, float(i / side) - side * 0.5f) * 3.0f);
+			}
+
+			VKE::ObjectCuller culler;
+			const double updateMs = MeasureBestMs(iterations, [&]() { culler.Update(objects.data(), objectCount, workers, 1); });
+			const double updateAllThreadsMs = MeasureBestMs(iterations, [&]() { culler.Update(objects.data(), objectCount, workers, hardwareThreads); });
+
+			std::vector<uint32_t> reference(objectCount);
+			std::vector<uint32_t> visible(objectCount);
+			uint32_t referenceCount = 0;
+			uint32_t visibleCount = 0;
+			bool identical = true;
+
+			const double scalarMs = MeasureBestMs(iterations, [&]() { referenceCount = culler.Cull(frustum, reference.data(), workers, 1, VKE::CullPath::Scalar); });
+
+			auto measurePath = [&](VKE::CullPath path, uint32_t threadCount)
+			{
+				const double milliseconds = MeasureBestMs(iterations, [&]() { visibleCount = culler.Cull(frustum, visible.data(), workers, threadCount, path); });
+				identical = identical && visibleCount == referenceCount && std::equal(visible.begin(), visible.begin() + visibleCount, reference.begin());
+				return milliseconds;
+			};
+
+			const double sseMs = measurePath(VKE::CullPath::SSE, 1);
+			const double avx2Ms = supportedPath == VKE::CullPath::AVX2 ? measurePath(VKE::CullPath::AVX2, 1) : 0.0;
+			const double allThreadsMs = measurePath(supportedPath, hardwareThreads);
+
+			std::cout << "  " << objectCount << " objects, " << referenceCount << " visible:" << std::endl;
+			std::cout << "    update bounds:         " << updateMs << " ms, all threads (" << hardwareThreads << "): " << updateAllThreadsMs << " ms" << std::endl;
+			std::cout << "    scalar:                " << scalarMs << " ms" << std::endl;
+			std::cout << "    SSE:                   " << sseMs << " ms (" << scalarMs / sseMs << "x)" << std::endl;
+			if (supportedPath == VKE::CullPath::AVX2)
+			{
+				std::cout << "    AVX2:                  " << avx2Ms << " ms (" << scalarMs / avx2Ms << "x)" << std::endl;
+			}
+			std::cout << "    " << VKE::GetCullPathName(supportedPath) << ", all threads:      " << allThreadsMs << " ms (" << scalarMs / allThreadsMs << "x)" << std::endl;
+			std::cout << "    results identical:     " << (identical ? "yes" : "NO") << std::endl;
+		}
+	}
+
+	void RunUniformWrites(VKE::VulkanEngine& engine, int iterations)
+	{
+		//uniform updates of this many frames per run, cycling through the frame slots like the renderer does
+		constexpr int FRAMES = 100000;
+		constexpr int SLOTS = 2;
+
+		std::cout << "Uniform write benchmark: " << FRAMES << " frames, best of " << iterations << " runs" << std::endl;
+
+		VKE::GPUCameraData camera = {};
+		camera.viewproj = glm::mat4(1.0f);
+
+		VKE::AllocatedBuffer mappedPerWrite[SLOTS];
+		VKE::MappedBuffer persistent[SLOTS];
+		for (int slot = 0; slot < SLOTS; slot++)
+		{
+			mappedPerWrite[slot] = engine.CreateBuffer(sizeof(VKE::GPUCameraData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VKE::MemoryClass::FrameData);
+			persistent[slot] = engine.CreateMappedBuffer(sizeof(VKE::GPUCameraData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+		}
+
+		//what the renderer did before: map, copy and unmap every frame
+		const double mapPerWriteMs = MeasureBestMs(iterations, [&]()
+		{
+			for (int frame = 0; frame < FRAMES; frame++)
+			{
+				camera.viewproj[3][0] = static_cast<float>(frame);
+
+				void* data;
+				vmaMapMemory(engine.m_Allocator, mappedPerWrite[frame % SLOTS].Allocation, &data);
+				memcpy(data, &camera, sizeof(VKE::GPUCameraData));
+				vmaUnmapMemory(engine.m_Allocator, mappedPerWrite[frame % SLOTS].Allocation);
+			}
+		});
+
+		//mapped once, flushed only when the memory isn't host coherent
+		const double persistentMs = MeasureBestMs(iterations, [&]()
+		{
+			for (int frame = 0; frame < FRAMES; frame++)
+			{
+				camera.viewproj[3][0] = static_cast<float>(frame);
+
+				*persistent[frame % SLOTS].As<VKE::GPUCameraData>() = camera;
+				engine.FlushMappedBuffer(persistent[frame % SLOTS], 0, sizeof(VKE::GPUCameraData));
+			}
+		});
+
+		std::cout << "  map, copy, unmap:        " << mapPerWriteMs * 1000000.0 / FRAMES << " ns per write" << std::endl;
+		std::cout << "  persistent mapping:      " << persistentMs * 1000000.0 / FRAMES << " ns per write (" << mapPerWriteMs / persistentMs << "x)" << std::endl;
+		std::cout << "  host coherent:           " << (persistent[0].NeedsFlush ? "no, writes are flushed" : "yes") << std::endl;
+
+		for (int slot = 0; slot < SLOTS; slot++)
+		{
+			vmaDestroyBuffer(engine.m_Allocator, mappedPerWrite[slot].Buffer, mappedPerWrite[slot].Allocation);
+			vmaDestroyBuffer(engine.m_Allocator, persistent[slot].Buffer.Buffer, persistent[slot].Buffer.Allocation);
+		}
+	}
+
+	void RunDrawRecording(VKE::VulkanEngine& engine, int iterations)
+	{
+		const uint32_t objectCounts[] = { 10000, 100000, 1000000 };
+
+		std::cout << "Draw recording benchmark: best of " << iterations << " runs";
+		if (!engine.m_GpuDrivenSupported)
+		{
+			std::cout << ", the device can't draw the GPU scene" << std::endl;
+			return;
+		}
+		std::cout << ", " << (engine.m_CmdDrawIndexedIndirectCount != nullptr ? "with" : "without") << " draw counts" << std::endl;
+
+		VKE::Mesh* meshes[] = { engine.GetMesh("monkey"), engine.GetMesh("triangle") };
+
+		std::vector<VKE::RenderObject> scene = std::move(engine.m_Renderables);
+		const bool gpuDriven = engine.m_GpuDriven;
+		const uint32_t recordingThreads = engine.m_RecordingThreads;
+		const bool frustumCulling = engine.m_FrustumCulling;
+
+		//every object is recorded, the CPU culling would leave only the few thousand in front of the camera
+		engine.m_FrustumCulling = false;
+		const uint32_t hardwareThreads = std::min(std::max(1u, std::thread::hardware_concurrency()), VKE::MAX_RECORDING_THREADS);
+
+		VkDevice device = engine.GetDevice();
+		VkCommandBuffer cmd = engine.m_UploadContext.m_CommandBuffer;
+
+		//only the recording is timed, the command buffer is never submitted
+		auto recordFrame = [&]()
+		{
+			VKE::FrameData& frame = engine.GetCurrentFrame();
+			frame.deletionQueue.Flush();
+			frame.cpuArena.Reset();
+			frame.transientAllocator.Reset();
+
+			VkCommandBufferBeginInfo beginInfo = VKE::VkInit::CommandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+			vkBeginCommandBuffer(cmd, &beginInfo);
+
+			const double milliseconds = engine.RecordScene(cmd, 0);
+
+			vkEndCommandBuffer(cmd);
+			vkResetCommandPool(device, engine.m_UploadContext.m_CommandPool, 0);
+			return milliseconds;
+		};
+
+		for (uint32_t objectCount : objectCounts)
+		{
+			//a square grid of both meshes, most of it outside the frustum
+			const uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(double(objectCount))));
+
+			engine.m_Renderables.clear();
+			engine.m_Renderables.reserve(objectCount);
+			for (uint32_t i = 0; i < objectCount; i++)
+			{
+				VKE::RenderObject object;
+				object.mesh = meshes[i % 2];
+				object.material = engine.GetMaterial("defaultMesh", object.mesh->Format, object.mesh->Layout);
+				object.transformMatrix = glm::translate(glm::vec3(float(i % side) - side * 0.5f, 0.0f, float(i / side) - side * 0.5f) * 3.0f);
+				engine.m_Renderables.push_back(object);
+			}
+			engine.MarkRenderablesChanged();
+
+			const auto buildStart = Clock::now();
+			engine.m_GpuScene.Build(engine, engine.m_Renderables.data(), objectCount);
+			engine.FlushUploads();
+			const double buildMs = std::chrono::duration<double, std::milli>(Clock::now() - buildStart).count();
+
+			double cpuMs = 0.0;
+			double threadedMs = 0.0;
+			double gpuMs = 0.0;
+			VKE::DrawStatistics cpuStatistics;
+			VKE::DrawStatistics gpuStatistics;
+			for (int i = 0; i < iterations; i++)
+			{
+				engine.m_GpuDriven = false;
+				engine.m_RecordingThreads = 1;
+				const double cpuRun = recordFrame();
+				cpuStatistics = engine.m_FrameDrawStatistics;
+
+				//the same draws split across secondary command buffers
+				engine.m_RecordingThreads = hardwareThreads;
+				const double threadedRun = recordFrame();
+
+				engine.m_GpuDriven = true;
+				engine.m_RecordingThreads = 1;
+				const double gpuRun = recordFrame();
+				gpuStatistics = engine.m_FrameDrawStatistics;
+
+				cpuMs = i == 0 ? cpuRun : std::min(cpuMs, cpuRun);
+				threadedMs = i == 0 ? threadedRun : std::min(threadedMs, threadedRun);
+				gpuMs = i == 0 ? gpuRun : std::min(gpuMs, gpuRun);
+			}
+
+			std::cout << "  " << objectCount << " objects:" << std::endl;
+			std::cout << "    draw per object:       " << cpuMs << " ms, " << cpuStatistics.Draws << " draws" << std::endl;
+			std::cout << "    " << hardwareThreads << " recording threads:  " << threadedMs << " ms (" << cpuMs / threadedMs << "x)" << std::endl;
+			std::cout << "    GPU scene:             " << gpuMs << " ms, " << gpuStatistics.Draws << " draws (" << cpuMs / gpuMs << "x), built in " << buildMs << " ms" << std::endl;
+		}
+
+		engine.m_GpuScene.Clear(engine);
+		engine.GetCurrentFrame().deletionQueue.Flush();
+
+		engine.m_Renderables = std::move(scene);
+		engine.m_GpuDriven = gpuDriven;
+		engine.m_RecordingThreads = recordingThreads;
+		engine.m_FrustumCulling = frustumCulling;
+		if (gpuDriven)
+		{
+			engine.m_GpuScene.Build(engine, engine.m_Renderables.data(), static_cast<uint32_t>(engine.m_Renderables.size()));
+			engine.FlushUploads();
+		}
+	}
+}
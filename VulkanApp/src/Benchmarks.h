@@ -0,0 +1,24 @@
+#pragma once
+
+namespace VKE
+{
+	class VulkanEngine;
+}
+
+namespace Benchmarks
+{
+	//compares the multithreaded OBJ import against the tinyobjloader path
+	void RunObjImport(const char* filename, int iterations);
+
+	//compares the scalar, SSE and AVX2 frustum tests of the ObjectCuller on one and on every thread, for 10k to 1M objects
+	void RunObjectCulling(int iterations);
+
+	//compares the CPU cost of mapping the per-frame uniform buffers for every write against writing into persistent mappings.
+	//the engine has to be initialized
+	void RunUniformWrites(VKE::VulkanEngine& engine, int iterations);
+
+	//compares the CPU time of recording a frame of 10k, 100k and 1M objects drawn one by one, on one and on every thread,
+	//against the GPU scene's indirect draws.
+	//the engine has to be initialized
+	void RunDrawRecording(VKE::VulkanEngine& engine, int iterations);
+}
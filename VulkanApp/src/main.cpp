@@ -1,14 +1,111 @@
 #include "VulkanEngine.h"
 
-int main()
+#include "Benchmarks.h"
+
+#include <cstdlib>
+#include <cstring>
+
+int main(int argc, char** argv)
 {
+	//benchmarks run without bringing up the renderer: --bench-obj [file]
+	if (argc > 1 && strcmp(argv[1], "--bench-obj") == 0)
+	{
+		Benchmarks::RunObjImport(argc > 2 ? argv[2] : "res/assets/lost_empire.obj", 5);
+		return 0;
+	}
+
+	//--bench-culling, the same for the CPU frustum culling
+	if (argc > 1 && strcmp(argv[1], "--bench-culling") == 0)
+	{
+		Benchmarks::RunObjectCulling(20);
+		return 0;
+	}
+
 	VKE::VulkanEngine* vkEngine = new VKE::VulkanEngine;
 
+	//--bench-uniforms runs the uniform write benchmark on the initialized engine instead of the render loop
+	bool benchUniforms = false;
+	//--bench-draws runs the draw recording benchmark the same way
+	bool benchDraws = false;
+
+	//--lod-bias <steps> makes level of detail selection coarser (positive) or finer (negative)
+	//--depth-prepass draws the opaque objects depth only before the main pass
+	//--no-upload-batch submits every startup upload on its own, to compare the startup time against the batched upload
+	//--no-defrag turns the background defragmentation of the device memory off
+	//--stress-instances scales the triangle grid up to 100k instances
+	//--no-instancing draws the triangle grid as one object per triangle, to compare against the instanced draw
+	//--no-draw-sort draws the objects in scene order instead of sorting them by state, to compare the bind counts
+	//--no-frustum-culling draws every object, also those outside the frustum
+	//--record-threads <count> records the draws on that many threads, 1 records them all into the primary command buffer
+	//--gpu-driven culls the objects in a compute shader and draws them with indirect draws
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--lod-bias") == 0 && i + 1 < argc)
+		{
+			vkEngine->m_LodBias = static_cast<float>(atof(argv[i + 1]));
+		}
+		else if (strcmp(argv[i], "--depth-prepass") == 0)
+		{
+			vkEngine->m_DepthPrepass = true;
+		}
+		else if (strcmp(argv[i], "--no-upload-batch") == 0)
+		{
+			vkEngine->m_BatchStartupUploads = false;
+		}
+		else if (strcmp(argv[i], "--no-defrag") == 0)
+		{
+			vkEngine->m_BackgroundDefragmentation = false;
+		}
+		else if (strcmp(argv[i], "--stress-instances") == 0)
+		{
+			vkEngine->m_TriangleInstanceCount = 100000;
+		}
+		else if (strcmp(argv[i], "--no-instancing") == 0)
+		{
+			vkEngine->m_Instancing = false;
+		}
+		else if (strcmp(argv[i], "--no-draw-sort") == 0)
+		{
+			vkEngine->m_SortDrawList = false;
+		}
+		else if (strcmp(argv[i], "--record-threads") == 0 && i + 1 < argc)
+		{
+			vkEngine->m_RecordingThreads = static_cast<uint32_t>(atoi(argv[i + 1]));
+		}
+		else if (strcmp(argv[i], "--no-frustum-culling") == 0)
+		{
+			vkEngine->m_FrustumCulling = false;
+		}
+		else if (strcmp(argv[i], "--gpu-driven") == 0)
+		{
+			vkEngine->m_GpuDriven = true;
+		}
+		else if (strcmp(argv[i], "--bench-uniforms") == 0)
+		{
+			benchUniforms = true;
+		}
+		else if (strcmp(argv[i], "--bench-draws") == 0)
+		{
+			benchDraws = true;
+		}
+	}
+
 	vkEngine->Init();
-	vkEngine->Run();
+	if (benchUniforms)
+	{
+		Benchmarks::RunUniformWrites(*vkEngine, 5);
+	}
+	else if (benchDraws)
+	{
+		Benchmarks::RunDrawRecording(*vkEngine, 5);
+	}
+	else
+	{
+		vkEngine->Run();
+	}
 	vkEngine->Cleanup();
 
 	delete vkEngine;
 
 	return 0;
-}
\ No newline at end of file
+}
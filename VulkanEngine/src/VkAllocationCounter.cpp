@@ -0,0 +1,122 @@
+#include "VkAllocationCounter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace VKE
+{
+	namespace
+	{
+		std::atomic<uint64_t> s_HeapAllocations = 0;
+	}
+
+	uint64_t GetHeapAllocationCount()
+	{
+		return s_HeapAllocations.load(std::memory_order_relaxed);
+	}
+}
+
+#ifdef VKE_COUNT_ALLOCATIONS
+namespace
+{
+	void* CountedAllocate(std::size_t size)
+	{
+		VKE::s_HeapAllocations.fetch_add(1, std::memory_order_relaxed);
+		return std::malloc(size > 0 ? size : 1);
+	}
+
+	void* CountedAllocateAligned(std::size_t size, std::align_val_t alignment)
+	{
+		VKE::s_HeapAllocations.fetch_add(1, std::memory_order_relaxed);
+
+		const std::size_t align = static_cast<std::size_t>(alignment);
+#ifdef _WIN32
+		return _aligned_malloc(size > 0 ? size : 1, align);
+#else
+		//aligned_alloc wants the size to be a multiple of the alignment
+		const std::size_t alignedSize = size > 0 ? (size + align - 1) & ~(align - 1) : align;
+		if (alignedSize < size)
+			return nullptr;
+
+		return std::aligned_alloc(align, alignedSize);
+#endif
+	}
+
+	void FreeAligned(void* memory)
+	{
+#ifdef _WIN32
+		_aligned_free(memory);
+#else
+		std::free(memory);
+#endif
+	}
+}
+
+//every form is replaced, so whatever allocates memory frees it with the matching function
+void* operator new(std::size_t size)
+{
+	void* memory = CountedAllocate(size);
+	if (memory == nullptr)
+		throw std::bad_alloc();
+
+	return memory;
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	return CountedAllocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	return CountedAllocate(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+	void* memory = CountedAllocateAligned(size, alignment);
+	if (memory == nullptr)
+		throw std::bad_alloc();
+
+	return memory;
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return CountedAllocateAligned(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return CountedAllocateAligned(size, alignment);
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+
+void operator delete(void* memory, std::align_val_t) noexcept { FreeAligned(memory); }
+void operator delete[](void* memory, std::align_val_t) noexcept { FreeAligned(memory); }
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept { FreeAligned(memory); }
+void operator delete[](void* memory, std::size_t, std::align_val_t) noexcept { FreeAligned(memory); }
+void operator delete(void* memory, std::align_val_t, const std::nothrow_t&) noexcept { FreeAligned(memory); }
+void operator delete[](void* memory, std::align_val_t, const std::nothrow_t&) noexcept { FreeAligned(memory); }
+#endif
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+
+namespace VKE
+{
+	//builds with VKE_COUNT_ALLOCATIONS (premake5 --count-allocations) replace the global operator new, aligned forms
+	//included, and count every allocation made through it, on every thread. the counter tells whether a stretch of
+	//code allocated: read it before and after. malloc isn't counted, the frame arena counts its own heap fallbacks
+#ifdef VKE_COUNT_ALLOCATIONS
+	constexpr bool HEAP_ALLOCATIONS_COUNTED = true;
+#else
+	constexpr bool HEAP_ALLOCATIONS_COUNTED = false;
+#endif
+
+	//allocations since startup, always 0 when they aren't counted
+	uint64_t GetHeapAllocationCount();
+}
@@ -0,0 +1,52 @@
+#include "VkCulling.h"
+
+namespace VKE
+{
+	Frustum Frustum::FromMatrix(const glm::mat4& viewProjection)
+	{
+		//Gribb and Hartmann: the planes are sums and differences of the matrix rows.
+		//vulkan clip space has z in [0, w], so the near plane is the third row alone
+		const glm::mat4 m = glm::transpose(viewProjection);
+
+		Frustum frustum;
+		frustum.Planes[0] = m[3] + m[0]; //left
+		frustum.Planes[1] = m[3] - m[0]; //right
+		frustum.Planes[2] = m[3] + m[1]; //bottom
+		frustum.Planes[3] = m[3] - m[1]; //top
+		frustum.Planes[4] = m[2];        //near
+		frustum.Planes[5] = m[3] - m[2]; //far
+
+		for (glm::vec4& plane : frustum.Planes)
+		{
+			plane /= glm::length(glm::vec3(plane));
+		}
+
+		return frustum;
+	}
+
+	bool Frustum::IntersectsSphere(const glm::vec3& center, float radius) const
+	{
+		for (const glm::vec4& plane : Planes)
+		{
+			if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+				return false;
+		}
+
+		return true;
+	}
+
+	float GetMaxScale(const glm::mat4& transform)
+	{
+		const float scaleX = glm::length(glm::vec3(transform[0]));
+		const float scaleY = glm::length(glm::vec3(transform[1]));
+		const float scaleZ = glm::length(glm::vec3(transform[2]));
+
+		return glm::max(scaleX, glm::max(scaleY, scaleZ));
+	}
+
+	bool IsConeBackfacing(const glm::vec3& center, float radius, const glm::vec3& coneAxis, float coneCutoff, const glm::vec3& cameraPosition)
+	{
+		const glm::vec3 toCenter = center - cameraPosition;
+		return glm::dot(toCenter, coneAxis) >= coneCutoff * glm::length(toCenter) + radius;
+	}
+}
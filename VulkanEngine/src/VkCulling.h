@@ -0,0 +1,22 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+namespace VKE
+{
+	//view frustum as six inward facing planes (xyz normal, w distance), extracted from a view-projection matrix
+	struct Frustum
+	{
+		glm::vec4 Planes[6];
+
+		static Frustum FromMatrix(const glm::mat4& viewProjection);
+
+		bool IntersectsSphere(const glm::vec3& center, float radius) const;
+	};
+
+	//largest axis scale of a transform, bounding spheres are scaled by it
+	float GetMaxScale(const glm::mat4& transform);
+
+	//normal cone test: true if every triangle inside the sphere faces away from the camera
+	bool IsConeBackfacing(const glm::vec3& center, float radius, const glm::vec3& coneAxis, float coneCutoff, const glm::vec3& cameraPosition);
+}
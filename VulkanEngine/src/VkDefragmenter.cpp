@@ -0,0 +1,380 @@
+#include "VkDefragmenter.h"
+
+#include "VkInit.h"
+#include "VulkanEngine.h"
+
+#include <iostream>
+
+namespace VKE
+{
+	namespace
+	{
+		double ToMegabytes(VkDeviceSize bytes)
+		{
+			return double(bytes) / (1024.0 * 1024.0);
+		}
+	}
+
+	void Defragmenter::Update(VulkanEngine& engine, VkCommandBuffer cmd, uint64_t frameNumber)
+	{
+		if (m_PassPending)
+		{
+			//the frame the pass was recorded into is done and its deletion queue destroyed the old resources,
+			//every frame after it used the new ones
+			if (frameNumber < m_PassEndFrame)
+				return;
+
+			m_PassPending = false;
+
+			if (vmaEndDefragmentationPass(engine.m_Allocator, m_Context) == VK_SUCCESS)
+			{
+				End(engine, frameNumber);
+				return;
+			}
+		}
+
+		if (!IsRunning() && !Begin(engine, frameNumber))
+			return;
+
+		//an upload still on its way could land in a resource after it was copied
+		if (!engine.m_StagingRing.IsIdle())
+			return;
+
+		VmaDefragmentationPassMoveInfo moves[MOVES_PER_PASS];
+		VmaDefragmentationPassInfo pass = {};
+		pass.moveCount = MOVES_PER_PASS;
+		pass.pMoves = moves;
+		vmaBeginDefragmentationPass(engine.m_Allocator, m_Context, &pass);
+
+		//everything planned has been moved
+		if (pass.moveCount == 0)
+		{
+			vmaEndDefragmentationPass(engine.m_Allocator, m_Context);
+			End(engine, frameNumber);
+			return;
+		}
+
+		MoveResources(engine, cmd, moves, pass.moveCount);
+
+		m_PassPending = true;
+		m_PassEndFrame = frameNumber + FRAME_OVERLAP;
+		m_Statistics.Passes++;
+	}
+
+	void Defragmenter::Finish(VulkanEngine& engine)
+	{
+		if (!IsRunning())
+			return;
+
+		//the retired resources went with the frames' deletion queues
+		if (m_PassPending)
+		{
+			m_PassPending = false;
+
+			vmaEndDefragmentationPass(engine.m_Allocator, m_Context);
+		}
+
+		End(engine, 0);
+	}
+
+	void Defragmenter::PrintStatistics() const
+	{
+		std::cout << "Defragmentation: " << m_Statistics.Cycles << " cycles in " << m_Statistics.Passes << " passes moved " << m_Statistics.AllocationsMoved
+			<< " allocations (" << ToMegabytes(m_Statistics.BytesMoved) << " MB) and reclaimed " << ToMegabytes(m_Statistics.BytesFreed) << " MB in "
+			<< m_Statistics.BlocksFreed << " blocks, " << m_Statistics.TexturesSkipped << " textures skipped without a spare descriptor set" << std::endl;
+	}
+
+	bool Defragmenter::Begin(VulkanEngine& engine, uint64_t frameNumber)
+	{
+		if (frameNumber < m_NextCycleFrame || !engine.m_StagingRing.IsIdle())
+			return false;
+
+		//memory in the device local blocks that no allocation uses, as of the residency manager's last update
+		VkDeviceSize reclaimable = 0;
+		for (const HeapStatistics& heap : engine.m_Residency.GetHeapStatistics())
+		{
+			if (heap.Flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+			{
+				reclaimable += heap.BlockBytes - std::min(heap.AllocationBytes, heap.BlockBytes);
+			}
+		}
+
+		if (reclaimable < MIN_RECLAIMABLE_BYTES)
+			return false;
+
+		m_Movables.clear();
+		m_MovableIndices.clear();
+
+		FrameVector<VmaAllocation> allocations(engine.GetFrameArena());
+
+		//textures get a spare set per binding, a moved texture is written into it while the current set may still be in use.
+		//the texture pools grow to make room for them, a texture whose spare can't be allocated stays where it is and is counted
+		for (auto& [path, texture] : engine.m_LoadedTextures)
+		{
+			if (texture.ImageView == VK_NULL_HANDLE)
+				continue;
+
+			bool movable = true;
+			for (Texture::Binding& binding : texture.Bindings)
+			{
+				if (binding.Spare == VK_NULL_HANDLE)
+				{
+					binding.Spare = engine.AllocateTextureSet();
+				}
+
+				movable = movable && binding.Spare != VK_NULL_HANDLE;
+			}
+
+			if (!movable)
+			{
+				m_Statistics.TexturesSkipped++;
+				continue;
+			}
+
+			Movable entry;
+			entry.MovedTexture = &texture;
+			m_Movables.push_back(entry);
+			allocations.push_back(texture.Image.Allocation);
+		}
+
+		FrameVector<GeometryAllocation> geometryAllocations(engine.GetFrameArena());
+		engine.m_Geometry.GetAllocations(geometryAllocations);
+
+		for (const GeometryAllocation& geometry : geometryAllocations)
+		{
+			Movable entry;
+			entry.MovedBuffer = geometry.Buffer;
+			entry.BufferSize = geometry.Size;
+			entry.BufferUsage = geometry.Usage;
+			m_Movables.push_back(entry);
+			allocations.push_back(geometry.Buffer->Allocation);
+		}
+
+		for (size_t i = 0; i < allocations.size(); i++)
+		{
+			m_MovableIndices[allocations[i]] = i;
+		}
+
+		//no limits, the passes bound the work per frame
+		VmaDefragmentationInfo2 info = {};
+		info.flags = VMA_DEFRAGMENTATION_FLAG_INCREMENTAL;
+		info.allocationCount = static_cast<uint32_t>(allocations.size());
+		info.pAllocations = allocations.data();
+		info.maxCpuBytesToMove = VK_WHOLE_SIZE;
+		info.maxCpuAllocationsToMove = UINT32_MAX;
+		info.maxGpuBytesToMove = VK_WHOLE_SIZE;
+		info.maxGpuAllocationsToMove = UINT32_MAX;
+
+		m_CycleStatistics = {};
+		VkResult result = vmaDefragmentationBegin(engine.m_Allocator, &info, &m_CycleStatistics, &m_Context);
+
+		if (result != VK_NOT_READY || m_Context == VK_NULL_HANDLE)
+		{
+			vmaDefragmentationEnd(engine.m_Allocator, m_Context);
+			m_Context = VK_NULL_HANDLE;
+			m_NextCycleFrame = frameNumber + COOLDOWN_FRAMES;
+			return false;
+		}
+
+		m_Statistics.Cycles++;
+		return true;
+	}
+
+	void Defragmenter::End(VulkanEngine& engine, uint64_t frameNumber)
+	{
+		//the statistics VMA collected over the passes are final once the context is gone
+		vmaDefragmentationEnd(engine.m_Allocator, m_Context);
+		m_Context = VK_NULL_HANDLE;
+
+		m_Statistics.AllocationsMoved += m_CycleStatistics.allocationsMoved;
+		m_Statistics.BytesMoved += m_CycleStatistics.bytesMoved;
+		m_Statistics.BlocksFreed += m_CycleStatistics.deviceMemoryBlocksFreed;
+		m_Statistics.BytesFreed += m_CycleStatistics.bytesFreed;
+
+		//free space VMA keeps in its blocks often can't be packed any better, a cycle without moves is only counted
+		if (m_CycleStatistics.allocationsMoved > 0)
+		{
+			std::cout << "Defragmentation finished: moved " << m_CycleStatistics.allocationsMoved << " allocations (" << ToMegabytes(m_CycleStatistics.bytesMoved)
+				<< " MB), reclaimed " << ToMegabytes(m_CycleStatistics.bytesFreed) << " MB in " << m_CycleStatistics.deviceMemoryBlocksFreed << " blocks" << std::endl;
+		}
+
+		m_Movables.clear();
+		m_MovableIndices.clear();
+		m_NextCycleFrame = frameNumber + COOLDOWN_FRAMES;
+	}
+
+	void Defragmenter::MoveResources(VulkanEngine& engine, VkCommandBuffer cmd, const VmaDefragmentationPassMoveInfo* moves, uint32_t moveCount)
+	{
+		VkDevice device = engine.GetDevice();
+		FrameArena& arena = engine.GetFrameArena();
+		//the replaced resources are destroyed with this frame's deletion queue, once the GPU is done with the frame that copies out of them
+		FrameDeletionQueue& deletionQueue = engine.GetFrameDeletionQueue();
+
+		struct BufferMove
+		{
+			VkBuffer Source;
+			VkBuffer Destination;
+			VkDeviceSize Size;
+		};
+
+		struct ImageMove
+		{
+			VkImage Source;
+			VkImage Destination;
+			VkExtent3D Extent;
+		};
+
+		FrameVector<BufferMove> bufferMoves(arena);
+		FrameVector<ImageMove> imageMoves(arena);
+		bufferMoves.reserve(moveCount);
+		imageMoves.reserve(moveCount);
+
+		FrameVector<VkImageMemoryBarrier> toTransfer(arena);
+		FrameVector<VkImageMemoryBarrier> imagesToShader(arena);
+		FrameVector<VkBufferMemoryBarrier> buffersToVertexInput(arena);
+		toTransfer.reserve(2 * moveCount);
+		imagesToShader.reserve(moveCount);
+		buffersToVertexInput.reserve(moveCount);
+
+		VkImageSubresourceRange range;
+		range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		range.baseMipLevel = 0;
+		range.levelCount = 1;
+		range.baseArrayLayer = 0;
+		range.layerCount = 1;
+
+		//create the new resources in the memory VMA picked for them
+		for (uint32_t i = 0; i < moveCount; i++)
+		{
+			const VmaDefragmentationPassMoveInfo& move = moves[i];
+			Movable& movable = m_Movables[m_MovableIndices.at(move.allocation)];
+
+			if (movable.MovedBuffer != nullptr)
+			{
+				VkBufferCreateInfo bufferInfo = {};
+				bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+				bufferInfo.size = movable.BufferSize;
+				bufferInfo.usage = movable.BufferUsage;
+
+				VkBuffer buffer;
+				VkResult result = vkCreateBuffer(device, &bufferInfo, nullptr, &buffer);
+				assert(result == VK_SUCCESS);
+				result = vkBindBufferMemory(device, buffer, move.memory, move.offset);
+				assert(result == VK_SUCCESS);
+
+				bufferMoves.push_back({ movable.MovedBuffer->Buffer, buffer, movable.BufferSize });
+
+				VkBufferMemoryBarrier barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+				barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.buffer = buffer;
+				barrier.offset = 0;
+				barrier.size = VK_WHOLE_SIZE;
+				buffersToVertexInput.push_back(barrier);
+
+				//the meshes find their buffers through the pools, they draw from the new one from now on
+				deletionQueue.Push([device, oldBuffer = movable.MovedBuffer->Buffer]()
+				{
+					vkDestroyBuffer(device, oldBuffer, nullptr);
+				});
+				movable.MovedBuffer->Buffer = buffer;
+			}
+			else
+			{
+				Texture& texture = *movable.MovedTexture;
+
+				VkImageCreateInfo imageInfo = VkInit::ImageCreateInfo(texture.Image.Format,
+					VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, texture.Image.Extent);
+
+				VkImage image;
+				VkResult result = vkCreateImage(device, &imageInfo, nullptr, &image);
+				assert(result == VK_SUCCESS);
+				result = vkBindImageMemory(device, image, move.memory, move.offset);
+				assert(result == VK_SUCCESS);
+
+				imageMoves.push_back({ texture.Image.Image, image, texture.Image.Extent });
+
+				VkImageMemoryBarrier barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.subresourceRange = range;
+
+				//earlier frames sampled the old image, nothing reads it after the copy
+				barrier.image = texture.Image.Image;
+				barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+				barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+				barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+				barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+				toTransfer.push_back(barrier);
+
+				barrier.image = image;
+				barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+				barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+				barrier.srcAccessMask = 0;
+				barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				toTransfer.push_back(barrier);
+
+				barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+				barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+				barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+				imagesToShader.push_back(barrier);
+
+				VkImageViewCreateInfo viewInfo = VkInit::ImageViewCreateInfo(texture.Image.Format, image, VK_IMAGE_ASPECT_COLOR_BIT);
+				VkImageView imageView;
+				result = vkCreateImageView(device, &viewInfo, nullptr, &imageView);
+				assert(result == VK_SUCCESS);
+
+				//the frames in flight may still have the current sets bound, so the new view goes into the spares and they trade places.
+				//the old sets are only written again by a later pass, after this one ended
+				for (Texture::Binding& binding : texture.Bindings)
+				{
+					engine.WriteTextureDescriptor(binding.Spare, binding.Sampler, imageView);
+					std::swap(*binding.Set, binding.Spare);
+				}
+
+				//only the handles, the memory now belongs to the allocation at its new place
+				deletionQueue.Push([device, oldImage = texture.Image.Image, oldView = texture.ImageView]()
+				{
+					vkDestroyImageView(device, oldView, nullptr);
+					vkDestroyImage(device, oldImage, nullptr);
+				});
+
+				texture.Image.Image = image;
+				texture.ImageView = imageView;
+			}
+		}
+
+		if (!toTransfer.empty())
+		{
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+				0, nullptr, 0, nullptr, static_cast<uint32_t>(toTransfer.size()), toTransfer.data());
+		}
+
+		for (const BufferMove& bufferMove : bufferMoves)
+		{
+			VkBufferCopy copy;
+			copy.srcOffset = 0;
+			copy.dstOffset = 0;
+			copy.size = bufferMove.Size;
+			vkCmdCopyBuffer(cmd, bufferMove.Source, bufferMove.Destination, 1, &copy);
+		}
+
+		for (const ImageMove& imageMove : imageMoves)
+		{
+			VkImageCopy copy = {};
+			copy.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			copy.srcSubresource.layerCount = 1;
+			copy.dstSubresource = copy.srcSubresource;
+			copy.extent = imageMove.Extent;
+			vkCmdCopyImage(cmd, imageMove.Source, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, imageMove.Destination, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+		}
+
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+			0, nullptr, static_cast<uint32_t>(buffersToVertexInput.size()), buffersToVertexInput.data(), static_cast<uint32_t>(imagesToShader.size()), imagesToShader.data());
+	}
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "VkTypes.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace VKE
+{
+	class VulkanEngine;
+	struct Texture;
+
+	//defragmentation counters since startup
+	struct DefragmentationStatistics
+	{
+		uint64_t Cycles = 0;
+		uint64_t Passes = 0;
+		uint64_t AllocationsMoved = 0;
+		uint64_t BytesMoved = 0;
+		//device memory blocks VMA could free once their allocations were moved out
+		uint64_t BlocksFreed = 0;
+		uint64_t BytesFreed = 0;
+		//textures a cycle left where they were because no spare descriptor set could be allocated for them
+		uint64_t TexturesSkipped = 0;
+	};
+
+	//moves the textures and geometry buffers into fewer device memory blocks in the background, using VMA's incremental
+	//defragmentation. each pass moves a few allocations: the copies into the new resources are recorded into the frame's
+	//command buffer and every reference is switched to them right away, the old resources are destroyed and the pass
+	//committed once the frames in flight that may still read them are done
+	class Defragmenter
+	{
+	public:
+		//allocations moved by one pass
+		static constexpr uint32_t MOVES_PER_PASS = 4;
+		//a cycle starts once the device local blocks hold this much memory no allocation uses
+		static constexpr VkDeviceSize MIN_RECLAIMABLE_BYTES = 16 * 1024 * 1024;
+		//frames to wait after a cycle before looking again
+		static constexpr uint64_t COOLDOWN_FRAMES = 600;
+
+		//once per frame with the frame's command buffer recording, outside of a render pass
+		void Update(VulkanEngine& engine, VkCommandBuffer cmd, uint64_t frameNumber);
+		//with the device idle, ends a running cycle
+		void Finish(VulkanEngine& engine);
+
+		//while a cycle runs the allocations it may move must not be freed
+		bool IsRunning() const { return m_Context != VK_NULL_HANDLE; }
+
+		const DefragmentationStatistics& GetStatistics() const { return m_Statistics; }
+		void PrintStatistics() const;
+
+	private:
+		//something defragmentation may move and the references to patch
+		struct Movable
+		{
+			Texture* MovedTexture = nullptr;
+			AllocatedBuffer* MovedBuffer = nullptr;
+			VkDeviceSize BufferSize = 0;
+			VkBufferUsageFlags BufferUsage = 0;
+		};
+
+		bool Begin(VulkanEngine& engine, uint64_t frameNumber);
+		void End(VulkanEngine& engine, uint64_t frameNumber);
+
+		//records the copies of a pass's moves and switches the references
+		void MoveResources(VulkanEngine& engine, VkCommandBuffer cmd, const VmaDefragmentationPassMoveInfo* moves, uint32_t moveCount);
+
+		VmaDefragmentationContext m_Context = VK_NULL_HANDLE;
+		VmaDefragmentationStats m_CycleStatistics = {};
+
+		std::vector<Movable> m_Movables;
+		std::unordered_map<VmaAllocation, size_t> m_MovableIndices;
+
+		//a pass is in flight until the frame it was recorded into has finished
+		bool m_PassPending = false;
+		uint64_t m_PassEndFrame = 0;
+
+		uint64_t m_NextCycleFrame = 0;
+
+		DefragmentationStatistics m_Statistics;
+	};
+}
@@ -0,0 +1,85 @@
+#include "VkDrawList.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace VKE
+{
+	namespace DrawKey
+	{
+		namespace
+		{
+			uint64_t Field(uint32_t value, uint32_t bits)
+			{
+				return uint64_t(value) & ((uint64_t(1) << bits) - 1);
+			}
+		}
+
+		uint64_t Make(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t pool, uint32_t mesh, float depth)
+		{
+			const uint32_t maxDepth = (1u << DEPTH_BITS) - 1;
+			const uint32_t quantizedDepth = static_cast<uint32_t>(std::clamp(depth, 0.0f, 1.0f) * float(maxDepth));
+
+			uint64_t key = Field(pass, PASS_BITS);
+			key = (key << PIPELINE_BITS) | Field(pipeline, PIPELINE_BITS);
+			key = (key << MATERIAL_BITS) | Field(material, MATERIAL_BITS);
+			key = (key << POOL_BITS) | Field(pool, POOL_BITS);
+			key = (key << MESH_BITS) | Field(mesh, MESH_BITS);
+			key = (key << DEPTH_BITS) | Field(quantizedDepth, DEPTH_BITS);
+			return key;
+		}
+	}
+
+	void RadixSortDraws(DrawEntry* entries, DrawEntry* scratch, uint32_t count)
+	{
+		if (count < 2)
+			return;
+
+		DrawEntry* source = entries;
+		DrawEntry* destination = scratch;
+
+		for (uint32_t shift = 0; shift < 64; shift += 8)
+		{
+			uint32_t offsets[256] = {};
+			for (uint32_t i = 0; i < count; i++)
+			{
+				offsets[(source[i].Key >> shift) & 0xFF]++;
+			}
+
+			//every key has the same digit, the pass would keep the order as it is
+			if (offsets[(source[0].Key >> shift) & 0xFF] == count)
+				continue;
+
+			uint32_t offset = 0;
+			for (uint32_t digit = 0; digit < 256; digit++)
+			{
+				const uint32_t digitCount = offsets[digit];
+				offsets[digit] = offset;
+				offset += digitCount;
+			}
+
+			//stable, so the lower digits sorted by the earlier passes stay in order
+			for (uint32_t i = 0; i < count; i++)
+			{
+				destination[offsets[(source[i].Key >> shift) & 0xFF]++] = source[i];
+			}
+
+			std::swap(source, destination);
+		}
+
+		if (source != entries)
+		{
+			memcpy(entries, source, count * sizeof(DrawEntry));
+		}
+	}
+
+	DrawStatistics& DrawStatistics::operator+=(const DrawStatistics& other)
+	{
+		Draws += other.Draws;
+		PipelineBinds += other.PipelineBinds;
+		DescriptorSetBinds += other.DescriptorSetBinds;
+		VertexBufferBinds += other.VertexBufferBinds;
+		PushConstants += other.PushConstants;
+		return *this;
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+
+namespace VKE
+{
+	//64 bit key ordering the draws of a pass, from the most significant bits down:
+	//pass, pipeline, material (its descriptor set), geometry pool (its vertex buffers), mesh and quantized distance to the camera.
+	//sorting by it keeps draws that share state next to each other, front to back where they share everything but the mesh's place
+	namespace DrawKey
+	{
+		constexpr uint32_t PASS_BITS = 2;
+		constexpr uint32_t PIPELINE_BITS = 12;
+		constexpr uint32_t MATERIAL_BITS = 12;
+		constexpr uint32_t POOL_BITS = 3;
+		constexpr uint32_t MESH_BITS = 11;
+		constexpr uint32_t DEPTH_BITS = 24;
+
+		static_assert(PASS_BITS + PIPELINE_BITS + MATERIAL_BITS + POOL_BITS + MESH_BITS + DEPTH_BITS == 64, "the fields fill the key");
+
+		//ids wider than their field wrap around, which only costs binds. depth is a fraction of the far plane, clamped to [0, 1]
+		uint64_t Make(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t pool, uint32_t mesh, float depth);
+	}
+
+	//what a pass draws, one entry per object
+	struct DrawEntry
+	{
+		uint64_t Key;
+		uint32_t Index;
+	};
+
+	//sorts by key with an LSD radix sort over 8 bit digits. digits every key shares are skipped, which for the
+	//state fields is most of them. scratch needs room for count entries
+	void RadixSortDraws(DrawEntry* entries, DrawEntry* scratch, uint32_t count);
+
+	//indices into the renderables in the order a pass draws them, in the frame arena
+	struct DrawList
+	{
+		const uint32_t* Order = nullptr;
+		uint32_t Count = 0;
+	};
+
+	//state changes recorded by DrawObjects
+	struct DrawStatistics
+	{
+		uint64_t Draws = 0;
+		uint64_t PipelineBinds = 0;
+		uint64_t DescriptorSetBinds = 0;
+		uint64_t VertexBufferBinds = 0;
+		uint64_t PushConstants = 0;
+
+		DrawStatistics& operator+=(const DrawStatistics& other);
+	};
+}
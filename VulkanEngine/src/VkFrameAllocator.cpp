@@ -0,0 +1,65 @@
+#include "VkFrameAllocator.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+
+namespace VKE
+{
+	void FrameAllocator::Init(VmaAllocator allocator, const MappedBuffer& buffer, VkDeviceSize baseOffset, VkDeviceSize size,
+		VkDeviceSize uniformAlignment, VkDeviceSize storageAlignment)
+	{
+		m_Allocator = allocator;
+		m_Buffer = buffer;
+
+		m_BaseOffset = baseOffset;
+		m_Size = size;
+		m_Used = 0;
+		m_Flushed = 0;
+		m_HighWaterMark = 0;
+
+		m_UniformAlignment = std::max<VkDeviceSize>(uniformAlignment, 1);
+		m_StorageAlignment = std::max<VkDeviceSize>(storageAlignment, 1);
+
+		assert(baseOffset % m_UniformAlignment == 0 && baseOffset % m_StorageAlignment == 0);
+	}
+
+	TransientAllocation FrameAllocator::Allocate(VkDeviceSize size, VkDeviceSize alignment)
+	{
+		assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+		//the slice starts aligned, so aligning the offset within it aligns the offset in the buffer
+		const VkDeviceSize offset = (m_Used + alignment - 1) & ~(alignment - 1);
+		if (offset + size > m_Size)
+		{
+			std::cout << "Frame allocator out of space: " << size << " bytes requested, " << m_Size - m_Used << " of " << m_Size << " left" << std::endl;
+			std::abort();
+		}
+
+		m_Used = offset + size;
+		m_HighWaterMark = std::max(m_HighWaterMark, m_Used);
+
+		TransientAllocation allocation;
+		allocation.Buffer = m_Buffer.Buffer.Buffer;
+		allocation.Offset = static_cast<uint32_t>(m_BaseOffset + offset);
+		allocation.Data = m_Buffer.Data + m_BaseOffset + offset;
+		return allocation;
+	}
+
+	void FrameAllocator::Flush()
+	{
+		if (m_Buffer.NeedsFlush && m_Used > m_Flushed)
+		{
+			vmaFlushAllocation(m_Allocator, m_Buffer.Buffer.Allocation, m_BaseOffset + m_Flushed, m_Used - m_Flushed);
+		}
+
+		m_Flushed = m_Used;
+	}
+
+	void FrameAllocator::Reset()
+	{
+		m_Used = 0;
+		m_Flushed = 0;
+	}
+}
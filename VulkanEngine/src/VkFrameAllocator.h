@@ -0,0 +1,69 @@
+#pragma once
+
+#include "VkTypes.h"
+
+#include <cstdint>
+
+namespace VKE
+{
+	//space handed out by a frame allocator. Offset is from the start of Buffer, to be used as a dynamic offset
+	struct TransientAllocation
+	{
+		VkBuffer Buffer = VK_NULL_HANDLE;
+		uint32_t Offset = 0;
+		void* Data = nullptr;
+	};
+
+	//linear allocator for data that lives for a single frame, bumping through a frame's slice of one mapped buffer.
+	//every frame in flight owns a slice, so the one buffer can be bound with the same descriptors by every frame
+	//and only the dynamic offsets change. the slice is reset once the frame's fence has signalled
+	class FrameAllocator
+	{
+	public:
+		static constexpr VkDeviceSize DEFAULT_SIZE = 4 * 1024 * 1024;
+
+		//the slice [baseOffset, baseOffset + size) of buffer, baseOffset has to satisfy both alignments
+		void Init(VmaAllocator allocator, const MappedBuffer& buffer, VkDeviceSize baseOffset, VkDeviceSize size,
+			VkDeviceSize uniformAlignment, VkDeviceSize storageAlignment);
+
+		//alignment has to be a power of two. a full slice aborts in every build: the frame's descriptors are bound to this
+		//buffer, space in another one couldn't be reached through them. GetHighWaterMark tells how close frames come
+		TransientAllocation Allocate(VkDeviceSize size, VkDeviceSize alignment);
+		TransientAllocation AllocateUniform(VkDeviceSize size) { return Allocate(size, m_UniformAlignment); }
+		TransientAllocation AllocateStorage(VkDeviceSize size) { return Allocate(size, m_StorageAlignment); }
+
+		//copies value into a new uniform allocation
+		template<typename T>
+		TransientAllocation PushUniform(const T& value)
+		{
+			TransientAllocation allocation = AllocateUniform(sizeof(T));
+			*static_cast<T*>(allocation.Data) = value;
+
+			return allocation;
+		}
+
+		//makes everything allocated since the reset visible to the GPU, before the frame is submitted
+		void Flush();
+		//only once the GPU is done with the frame
+		void Reset();
+
+		VkDeviceSize GetUsedSize() const { return m_Used; }
+		VkDeviceSize GetSize() const { return m_Size; }
+		//most bytes used by a single frame
+		VkDeviceSize GetHighWaterMark() const { return m_HighWaterMark; }
+
+	private:
+		VmaAllocator m_Allocator = VK_NULL_HANDLE;
+		MappedBuffer m_Buffer = {};
+
+		VkDeviceSize m_BaseOffset = 0;
+		VkDeviceSize m_Size = 0;
+		VkDeviceSize m_Used = 0;
+		//end of the range already flushed
+		VkDeviceSize m_Flushed = 0;
+		VkDeviceSize m_HighWaterMark = 0;
+
+		VkDeviceSize m_UniformAlignment = 1;
+		VkDeviceSize m_StorageAlignment = 1;
+	};
+}
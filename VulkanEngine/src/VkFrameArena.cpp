@@ -0,0 +1,94 @@
+#include "VkFrameArena.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+
+namespace VKE
+{
+	void FrameArena::Init(size_t size)
+	{
+		assert(m_Memory == nullptr);
+
+		m_Memory = static_cast<uint8_t*>(std::malloc(size));
+		assert(m_Memory != nullptr);
+
+		m_Size = size;
+		m_Used = 0;
+		m_HighWaterMark = 0;
+	}
+
+	void FrameArena::Destroy()
+	{
+		Reset();
+
+		std::free(m_Memory);
+		m_Memory = nullptr;
+		m_Size = 0;
+	}
+
+	void* FrameArena::Allocate(size_t size, size_t alignment)
+	{
+		assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+		//aligned in the address space, the start of the memory is only aligned as far as malloc guarantees
+		const uintptr_t base = reinterpret_cast<uintptr_t>(m_Memory);
+		const uintptr_t address = (base + m_Used + alignment - 1) & ~uintptr_t(alignment - 1);
+		const size_t offset = address - base;
+
+		if (offset + size <= m_Size)
+		{
+			m_Used = offset + size;
+			m_HighWaterMark = std::max(m_HighWaterMark, m_Used + m_OverflowBytes);
+			return m_Memory + offset;
+		}
+
+		//the header goes in front of the aligned allocation
+		const size_t blockSize = sizeof(OverflowBlock) + alignment + size;
+		OverflowBlock* block = static_cast<OverflowBlock*>(std::malloc(blockSize));
+		assert(block != nullptr);
+
+		block->Next = m_Overflow;
+		m_Overflow = block;
+
+		m_OverflowBytes += blockSize;
+		m_OverflowCount++;
+		m_HighWaterMark = std::max(m_HighWaterMark, m_Used + m_OverflowBytes);
+
+		const uintptr_t start = reinterpret_cast<uintptr_t>(block + 1);
+		return reinterpret_cast<void*>((start + alignment - 1) & ~uintptr_t(alignment - 1));
+	}
+
+	void FrameArena::Free(void* memory, size_t size)
+	{
+		uint8_t* bytes = static_cast<uint8_t*>(memory);
+		if (bytes >= m_Memory && bytes + size == m_Memory + m_Used)
+		{
+			m_Used = bytes - m_Memory;
+		}
+	}
+
+	void FrameArena::Reset()
+	{
+		while (m_Overflow != nullptr)
+		{
+			OverflowBlock* next = m_Overflow->Next;
+			std::free(m_Overflow);
+			m_Overflow = next;
+		}
+
+		m_OverflowBytes = 0;
+		m_Used = 0;
+	}
+
+	void FrameDeletionQueue::Flush()
+	{
+		while (m_Head != nullptr)
+		{
+			Entry* entry = m_Head;
+			m_Head = entry->Next;
+
+			entry->Invoke(entry->Function);
+		}
+	}
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace VKE
+{
+	//linear allocator for CPU data that lives for a single frame: draw lists, barrier and descriptor write arrays, deletion callbacks.
+	//every frame in flight owns one, reset once the frame's fence has signalled, so what a frame allocated stays valid until the GPU
+	//is done with it. only the thread recording the frame allocates from it, there is no locking.
+	//
+	//the memory is allocated once by Init. a frame that needs more falls back to the heap, those blocks are freed by the next reset
+	//and counted, so the high water mark tells how large the arena should have been
+	class FrameArena
+	{
+	public:
+		static constexpr size_t DEFAULT_SIZE = 1024 * 1024;
+
+		void Init(size_t size = DEFAULT_SIZE);
+		void Destroy();
+
+		//alignment has to be a power of two. the memory is uninitialized
+		void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+		//gives the space back if it was the last allocation, otherwise it is only reclaimed by the reset
+		void Free(void* memory, size_t size);
+
+		template<typename T>
+		T* AllocateArray(size_t count)
+		{
+			return static_cast<T*>(Allocate(count * sizeof(T), alignof(T)));
+		}
+
+		//the destructor is never called, only for types that don't need it
+		template<typename T, typename... Args>
+		T* New(Args&&... args)
+		{
+			static_assert(std::is_trivially_destructible_v<T>, "the arena doesn't run destructors");
+			return new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+		}
+
+		//only once nothing allocated since the last reset is used anymore
+		void Reset();
+
+		size_t GetUsedSize() const { return m_Used; }
+		size_t GetSize() const { return m_Size; }
+		//most bytes used by a single frame, heap fallbacks included
+		size_t GetHighWaterMark() const { return m_HighWaterMark; }
+		//allocations that didn't fit and went to the heap, since startup
+		uint64_t GetOverflowCount() const { return m_OverflowCount; }
+
+	private:
+		//header of a heap fallback, the allocation follows it
+		struct OverflowBlock
+		{
+			OverflowBlock* Next;
+		};
+
+		uint8_t* m_Memory = nullptr;
+		size_t m_Size = 0;
+		size_t m_Used = 0;
+		size_t m_HighWaterMark = 0;
+
+		OverflowBlock* m_Overflow = nullptr;
+		size_t m_OverflowBytes = 0;
+		uint64_t m_OverflowCount = 0;
+	};
+
+	//STL allocator handing out memory of a frame arena, for containers that only live for the frame.
+	//deallocation only gives back the arena's last allocation, reserving up front avoids wasting the space of grown arrays
+	template<typename T>
+	class ArenaAllocator
+	{
+	public:
+		using value_type = T;
+
+		ArenaAllocator(FrameArena& arena) : m_Arena(&arena) {}
+
+		template<typename U>
+		ArenaAllocator(const ArenaAllocator<U>& other) : m_Arena(other.GetArena()) {}
+
+		T* allocate(size_t count) { return m_Arena->AllocateArray<T>(count); }
+		void deallocate(T* memory, size_t count) { m_Arena->Free(memory, count * sizeof(T)); }
+
+		FrameArena* GetArena() const { return m_Arena; }
+
+		template<typename U>
+		bool operator==(const ArenaAllocator<U>& other) const { return m_Arena == other.GetArena(); }
+		template<typename U>
+		bool operator!=(const ArenaAllocator<U>& other) const { return m_Arena != other.GetArena(); }
+
+	private:
+		FrameArena* m_Arena;
+	};
+
+	template<typename T>
+	using FrameVector = std::vector<T, ArenaAllocator<T>>;
+
+	//deletion queue of a frame in flight: the functions run once the frame's fence has signalled, in reverse order.
+	//functions and their captures are stored in the frame's arena instead of in std::functions on the heap
+	class FrameDeletionQueue
+	{
+	public:
+		void Init(FrameArena& arena) { m_Arena = &arena; }
+
+		template<typename F>
+		void Push(F&& function)
+		{
+			using Function = std::decay_t<F>;
+
+			Entry* entry = m_Arena->New<Entry>();
+			entry->Function = new (m_Arena->Allocate(sizeof(Function), alignof(Function))) Function(std::forward<F>(function));
+			entry->Invoke = [](void* stored)
+			{
+				Function* function = static_cast<Function*>(stored);
+				(*function)();
+				function->~Function();
+			};
+
+			entry->Next = m_Head;
+			m_Head = entry;
+		}
+
+		//before the arena is reset
+		void Flush();
+		bool IsEmpty() const { return m_Head == nullptr; }
+
+	private:
+		struct Entry
+		{
+			void* Function;
+			void (*Invoke)(void*);
+			Entry* Next;
+		};
+
+		FrameArena* m_Arena = nullptr;
+		//the last pushed, so walking the list runs them in reverse order
+		Entry* m_Head = nullptr;
+	};
+}
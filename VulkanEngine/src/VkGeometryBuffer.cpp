@@ -0,0 +1,352 @@
+#include "VkGeometryBuffer.h"
+
+#include "VulkanEngine.h"
+
+#include <algorithm>
+#include <bit>
+#include <iostream>
+#include <unordered_map>
+
+namespace VKE
+{
+	namespace
+	{
+		//transfer source too, compaction and defragmentation copy the buffers into their replacements
+		constexpr VkBufferUsageFlags VERTEX_BUFFER_USAGE = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+		constexpr VkBufferUsageFlags INDEX_BUFFER_USAGE = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+		//doubles the default capacity until needed more elements fit behind the live ones. buffers that were grown
+		//shrink again once enough was freed, evicted meshes give their memory back that way
+		uint32_t GetCompactedCapacity(const RangeAllocator& allocator, uint32_t needed, uint32_t defaultCapacity)
+		{
+			uint64_t capacity = defaultCapacity;
+			while (capacity < uint64_t(allocator.GetUsedSize()) + needed)
+			{
+				capacity *= 2;
+			}
+
+			return static_cast<uint32_t>(std::min<uint64_t>(capacity, UINT32_MAX));
+		}
+
+		void PrintRangeStatistics(const char* name, const char* unit, const RangeAllocator& allocator)
+		{
+			std::cout << name << ": " << allocator.GetUsedSize() << " of " << allocator.GetCapacity() << " " << unit << " used by "
+				<< allocator.GetAllocationCount() << " ranges, largest free range " << allocator.GetLargestFreeBlock() << std::endl;
+		}
+	}
+
+	void GeometryBuffer::Destroy(VulkanEngine& engine)
+	{
+		for (auto& formatPools : m_Pools)
+		{
+			for (GeometryPool& pool : formatPools)
+			{
+				for (uint32_t stream = 0; stream < pool.StreamCount; stream++)
+				{
+					vmaDestroyBuffer(engine.m_Allocator, pool.Streams[stream].Buffer, pool.Streams[stream].Allocation);
+				}
+
+				pool = GeometryPool{};
+			}
+		}
+
+		if (m_IndexBuffer.Buffer != VK_NULL_HANDLE)
+		{
+			vmaDestroyBuffer(engine.m_Allocator, m_IndexBuffer.Buffer, m_IndexBuffer.Allocation);
+			m_IndexBuffer = {};
+		}
+
+		m_Indices.Init(0);
+	}
+
+	bool GeometryBuffer::Allocate(VulkanEngine& engine, Mesh& mesh)
+	{
+		const uint32_t vertexCount = mesh.GetVertexCount();
+		const uint32_t indexCount = mesh.GetIndexCount();
+
+		GeometryPool& pool = GetOrCreatePool(engine, mesh.Format, mesh.Layout, vertexCount);
+
+		if (m_IndexBuffer.Buffer == VK_NULL_HANDLE)
+		{
+			m_Indices.Init(std::max(DEFAULT_INDEX_CAPACITY, std::bit_ceil(indexCount)));
+			CreateIndexBuffer(engine);
+		}
+
+		const uint32_t vertexOffset = pool.Vertices.Allocate(vertexCount);
+		if (vertexOffset == RangeAllocator::INVALID_OFFSET)
+			return false;
+
+		const uint32_t firstIndex = m_Indices.Allocate(indexCount);
+		if (firstIndex == RangeAllocator::INVALID_OFFSET)
+		{
+			pool.Vertices.Free(vertexOffset);
+			return false;
+		}
+
+		mesh.Geometry = { vertexOffset, vertexCount, firstIndex, indexCount };
+		return true;
+	}
+
+	void GeometryBuffer::Free(Mesh& mesh)
+	{
+		if (mesh.Geometry.VertexCount == 0)
+			return;
+
+		GeometryPool& pool = m_Pools[static_cast<size_t>(mesh.Format)][static_cast<size_t>(mesh.Layout)];
+		pool.Vertices.Free(mesh.Geometry.VertexOffset);
+		m_Indices.Free(mesh.Geometry.FirstIndex);
+
+		mesh.Geometry = {};
+	}
+
+	void GeometryBuffer::RecordUpload(StagingRing& ring, const Mesh& mesh, const StagingAllocation& staging) const
+	{
+		const GeometryPool* pool = GetPool(mesh.Format, mesh.Layout);
+		assert(pool != nullptr && mesh.Geometry.VertexCount > 0);
+
+		VkCommandBuffer cmd = ring.GetCommandBuffer();
+
+		//the streams of a split mesh follow each other in the staging buffer
+		VkDeviceSize sourceOffset = staging.Offset;
+		for (uint32_t stream = 0; stream < pool->StreamCount; stream++)
+		{
+			VkBufferCopy copy;
+			copy.srcOffset = sourceOffset;
+			copy.dstOffset = VkDeviceSize(mesh.Geometry.VertexOffset) * pool->StreamStrides[stream];
+			copy.size = VkDeviceSize(mesh.Geometry.VertexCount) * pool->StreamStrides[stream];
+			vkCmdCopyBuffer(cmd, staging.Buffer, pool->Streams[stream].Buffer, 1, &copy);
+			ring.ReleaseBuffer(pool->Streams[stream].Buffer, copy.dstOffset, copy.size);
+
+			sourceOffset += copy.size;
+		}
+
+		VkBufferCopy copy;
+		copy.srcOffset = sourceOffset;
+		copy.dstOffset = VkDeviceSize(mesh.Geometry.FirstIndex) * sizeof(uint32_t);
+		copy.size = VkDeviceSize(mesh.Geometry.IndexCount) * sizeof(uint32_t);
+		vkCmdCopyBuffer(cmd, staging.Buffer, m_IndexBuffer.Buffer, 1, &copy);
+		ring.ReleaseBuffer(m_IndexBuffer.Buffer, copy.dstOffset, copy.size);
+	}
+
+	void GeometryBuffer::WriteDirect(VulkanEngine& engine, const Mesh& mesh) const
+	{
+		const GeometryPool* pool = GetPool(mesh.Format, mesh.Layout);
+		assert(pool != nullptr && mesh.Geometry.VertexCount > 0);
+
+		//mapped only while writing, defragmentation may move the buffers between uploads
+		uint8_t* streams[2] = {};
+		for (uint32_t stream = 0; stream < pool->StreamCount; stream++)
+		{
+			VkResult result = vmaMapMemory(engine.m_Allocator, pool->Streams[stream].Allocation, (void**)&streams[stream]);
+			assert(result == VK_SUCCESS);
+
+			streams[stream] += VkDeviceSize(mesh.Geometry.VertexOffset) * pool->StreamStrides[stream];
+		}
+
+		mesh.WriteGpuVertices(streams[0], streams[1]);
+
+		uint8_t* indices;
+		VkResult result = vmaMapMemory(engine.m_Allocator, m_IndexBuffer.Allocation, (void**)&indices);
+		assert(result == VK_SUCCESS);
+
+		const VkDeviceSize indexOffset = VkDeviceSize(mesh.Geometry.FirstIndex) * sizeof(uint32_t);
+		const VkDeviceSize indexSize = VkDeviceSize(mesh.Geometry.IndexCount) * sizeof(uint32_t);
+		memcpy(indices + indexOffset, mesh.GetIndexData(), indexSize);
+
+		//nothing to flush on host coherent memory
+		for (uint32_t stream = 0; stream < pool->StreamCount; stream++)
+		{
+			const VkDeviceSize stride = pool->StreamStrides[stream];
+			vmaFlushAllocation(engine.m_Allocator, pool->Streams[stream].Allocation, VkDeviceSize(mesh.Geometry.VertexOffset) * stride, VkDeviceSize(mesh.Geometry.VertexCount) * stride);
+			vmaUnmapMemory(engine.m_Allocator, pool->Streams[stream].Allocation);
+		}
+
+		vmaFlushAllocation(engine.m_Allocator, m_IndexBuffer.Allocation, indexOffset, indexSize);
+		vmaUnmapMemory(engine.m_Allocator, m_IndexBuffer.Allocation);
+	}
+
+	void GeometryBuffer::Compact(VulkanEngine& engine, const std::vector<Mesh*>& meshes, const Mesh* pending)
+	{
+		//copy regions from an old buffer into its replacement
+		struct BufferCopies
+		{
+			AllocatedBuffer Source = {};
+			VkBuffer Destination = VK_NULL_HANDLE;
+			std::vector<VkBufferCopy> Regions = {};
+		};
+
+		std::vector<BufferCopies> copies;
+		std::vector<RangeMove> moves;
+
+		for (auto& formatPools : m_Pools)
+		{
+			for (GeometryPool& pool : formatPools)
+			{
+				if (!pool.IsCreated())
+					continue;
+
+				const bool pendingPool = pending != nullptr && pending->Format == pool.Format && pending->Layout == pool.Layout;
+				pool.Vertices.Compact(GetCompactedCapacity(pool.Vertices, pendingPool ? pending->GetVertexCount() : 0, DEFAULT_VERTEX_CAPACITY), moves);
+
+				AllocatedBuffer oldStreams[2] = { pool.Streams[0], pool.Streams[1] };
+				CreatePoolStreams(engine, pool);
+
+				for (uint32_t stream = 0; stream < pool.StreamCount; stream++)
+				{
+					BufferCopies streamCopies{ oldStreams[stream], pool.Streams[stream].Buffer };
+					for (const RangeMove& move : moves)
+					{
+						const VkDeviceSize stride = pool.StreamStrides[stream];
+						streamCopies.Regions.push_back({ move.SourceOffset * stride, move.DestinationOffset * stride, move.Size * stride });
+					}
+
+					copies.push_back(std::move(streamCopies));
+				}
+
+				std::unordered_map<uint32_t, uint32_t> newOffsets;
+				for (const RangeMove& move : moves)
+				{
+					newOffsets[move.SourceOffset] = move.DestinationOffset;
+				}
+
+				for (Mesh* mesh : meshes)
+				{
+					if (mesh->Geometry.VertexCount > 0 && mesh->Format == pool.Format && mesh->Layout == pool.Layout)
+					{
+						mesh->Geometry.VertexOffset = newOffsets.at(mesh->Geometry.VertexOffset);
+					}
+				}
+			}
+		}
+
+		if (m_IndexBuffer.Buffer != VK_NULL_HANDLE)
+		{
+			m_Indices.Compact(GetCompactedCapacity(m_Indices, pending != nullptr ? pending->GetIndexCount() : 0, DEFAULT_INDEX_CAPACITY), moves);
+
+			BufferCopies indexCopies{ m_IndexBuffer };
+			CreateIndexBuffer(engine);
+			indexCopies.Destination = m_IndexBuffer.Buffer;
+
+			std::unordered_map<uint32_t, uint32_t> newOffsets;
+			for (const RangeMove& move : moves)
+			{
+				indexCopies.Regions.push_back({ move.SourceOffset * sizeof(uint32_t), move.DestinationOffset * sizeof(uint32_t), move.Size * sizeof(uint32_t) });
+				newOffsets[move.SourceOffset] = move.DestinationOffset;
+			}
+
+			copies.push_back(std::move(indexCopies));
+
+			for (Mesh* mesh : meshes)
+			{
+				if (mesh->Geometry.VertexCount > 0)
+				{
+					mesh->Geometry.FirstIndex = newOffsets.at(mesh->Geometry.FirstIndex);
+				}
+			}
+		}
+
+		engine.ImmediateSubmit([&](VkCommandBuffer cmd)
+		{
+			for (const BufferCopies& bufferCopies : copies)
+			{
+				if (!bufferCopies.Regions.empty())
+				{
+					vkCmdCopyBuffer(cmd, bufferCopies.Source.Buffer, bufferCopies.Destination, static_cast<uint32_t>(bufferCopies.Regions.size()), bufferCopies.Regions.data());
+				}
+			}
+		});
+
+		for (const BufferCopies& bufferCopies : copies)
+		{
+			vmaDestroyBuffer(engine.m_Allocator, bufferCopies.Source.Buffer, bufferCopies.Source.Allocation);
+		}
+	}
+
+	const GeometryPool* GeometryBuffer::GetPool(VertexFormat format, VertexLayout layout) const
+	{
+		const GeometryPool& pool = m_Pools[static_cast<size_t>(format)][static_cast<size_t>(layout)];
+		return pool.IsCreated() ? &pool : nullptr;
+	}
+
+	void GeometryBuffer::GetAllocations(FrameVector<GeometryAllocation>& outAllocations)
+	{
+		for (auto& formatPools : m_Pools)
+		{
+			for (GeometryPool& pool : formatPools)
+			{
+				for (uint32_t stream = 0; stream < pool.StreamCount; stream++)
+				{
+					outAllocations.push_back({ &pool.Streams[stream], VkDeviceSize(pool.Vertices.GetCapacity()) * pool.StreamStrides[stream], VERTEX_BUFFER_USAGE });
+				}
+			}
+		}
+
+		if (m_IndexBuffer.Buffer != VK_NULL_HANDLE)
+		{
+			outAllocations.push_back({ &m_IndexBuffer, VkDeviceSize(m_Indices.GetCapacity()) * sizeof(uint32_t), INDEX_BUFFER_USAGE });
+		}
+	}
+
+	void GeometryBuffer::PrintStatistics() const
+	{
+		for (const auto& formatPools : m_Pools)
+		{
+			for (const GeometryPool& pool : formatPools)
+			{
+				if (!pool.IsCreated())
+					continue;
+
+				const std::string name = std::string("Geometry pool ") + GetVertexFormatName(pool.Format) + "/" + GetVertexLayoutName(pool.Layout);
+				PrintRangeStatistics(name.c_str(), "vertices", pool.Vertices);
+			}
+		}
+
+		if (m_IndexBuffer.Buffer != VK_NULL_HANDLE)
+		{
+			PrintRangeStatistics("Geometry indices", "indices", m_Indices);
+		}
+	}
+
+	GeometryPool& GeometryBuffer::GetOrCreatePool(VulkanEngine& engine, VertexFormat format, VertexLayout layout, uint32_t minCapacity)
+	{
+		GeometryPool& pool = m_Pools[static_cast<size_t>(format)][static_cast<size_t>(layout)];
+		if (pool.IsCreated())
+			return pool;
+
+		pool.Format = format;
+		pool.Layout = layout;
+
+		const uint32_t stride = GetVertexStride(format);
+		if (layout == VertexLayout::Split)
+		{
+			pool.StreamCount = 2;
+			pool.StreamStrides[0] = GetPositionStride(format);
+			pool.StreamStrides[1] = stride - GetPositionStride(format);
+		}
+		else
+		{
+			pool.StreamCount = 1;
+			pool.StreamStrides[0] = stride;
+		}
+
+		pool.Vertices.Init(std::max(DEFAULT_VERTEX_CAPACITY, std::bit_ceil(minCapacity)));
+		CreatePoolStreams(engine, pool);
+
+		return pool;
+	}
+
+	void GeometryBuffer::CreatePoolStreams(VulkanEngine& engine, GeometryPool& pool)
+	{
+		for (uint32_t stream = 0; stream < pool.StreamCount; stream++)
+		{
+			pool.Streams[stream] = engine.CreateBuffer(size_t(pool.Vertices.GetCapacity()) * pool.StreamStrides[stream],
+				VERTEX_BUFFER_USAGE, MemoryClass::Geometry);
+		}
+	}
+
+	void GeometryBuffer::CreateIndexBuffer(VulkanEngine& engine)
+	{
+		m_IndexBuffer = engine.CreateBuffer(size_t(m_Indices.GetCapacity()) * sizeof(uint32_t),
+			INDEX_BUFFER_USAGE, MemoryClass::Geometry);
+	}
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "VkFrameArena.h"
+#include "VkMesh.h"
+#include "VkRangeAllocator.h"
+#include "VkStagingRing.h"
+#include "VkTypes.h"
+
+#include <vector>
+
+namespace VKE
+{
+	class VulkanEngine;
+
+	//vertex arena of one format and layout. a draw's vertexOffset counts in vertices of the bound stride,
+	//so meshes can only share vertex buffers with meshes of the same format and layout
+	struct GeometryPool
+	{
+		VertexFormat Format = VertexFormat::Full;
+		VertexLayout Layout = VertexLayout::Interleaved;
+
+		//ranges in vertices, the same range is used in every stream
+		RangeAllocator Vertices;
+
+		//binding 0 and, for split layouts, the attribute stream of binding 1
+		AllocatedBuffer Streams[2] = {};
+		uint32_t StreamStrides[2] = {};
+		uint32_t StreamCount = 0;
+
+		bool IsCreated() const { return StreamCount > 0; }
+	};
+
+	//one of the device local buffers of a geometry buffer, with what it was created with
+	struct GeometryAllocation
+	{
+		AllocatedBuffer* Buffer = nullptr;
+		VkDeviceSize Size = 0;
+		VkBufferUsageFlags Usage = 0;
+	};
+
+	//every mesh's vertices and indices, sub-allocated from a few large device local buffers:
+	//one vertex pool per vertex format and layout and one index buffer shared by all of them.
+	//switching meshes only changes firstIndex and vertexOffset of the draw, and the vertex buffers only when the pool changes
+	class GeometryBuffer
+	{
+	public:
+		static constexpr uint32_t DEFAULT_VERTEX_CAPACITY = 1 << 20;
+		static constexpr uint32_t DEFAULT_INDEX_CAPACITY = 1 << 22;
+
+		void Destroy(VulkanEngine& engine);
+
+		//reserves the mesh's ranges and stores them in mesh.Geometry, returns false if its pool or the index buffer is too full.
+		//the data still has to be copied in with RecordUpload, or written with WriteDirect
+		bool Allocate(VulkanEngine& engine, Mesh& mesh);
+		//gives the mesh's ranges back. the caller makes sure no frame in flight still draws it
+		void Free(Mesh& mesh);
+
+		//records the copies of the mesh's data out of a staging ring reservation laid out like UploadMesh writes it
+		//(the vertices in the mesh's layout, followed by the indices) and releases the written ranges to the graphics queue
+		void RecordUpload(StagingRing& ring, const Mesh& mesh, const StagingAllocation& staging) const;
+		//writes the mesh's data through a mapping, for buffers placed in host visible memory. no frame in flight may read its ranges
+		void WriteDirect(VulkanEngine& engine, const Mesh& mesh) const;
+
+		//packs the live ranges of every pool and of the index buffer into new buffers, sized to fit them and pending
+		//(grown or shrunk in powers of two of the default capacity), and patches the ranges of the given meshes. the GPU has to be idle
+		void Compact(VulkanEngine& engine, const std::vector<Mesh*>& meshes, const Mesh* pending = nullptr);
+
+		//nullptr if no mesh of this format and layout has been allocated yet
+		const GeometryPool* GetPool(VertexFormat format, VertexLayout layout) const;
+		VkBuffer GetIndexBuffer() const { return m_IndexBuffer.Buffer; }
+
+		//every buffer of the pools and the index buffer. meshes find their buffers through the pools when drawing,
+		//so replacing a buffer here moves the geometry of every mesh in it
+		void GetAllocations(FrameVector<GeometryAllocation>& outAllocations);
+
+		void PrintStatistics() const;
+
+	private:
+		GeometryPool& GetOrCreatePool(VulkanEngine& engine, VertexFormat format, VertexLayout layout, uint32_t minCapacity);
+
+		void CreatePoolStreams(VulkanEngine& engine, GeometryPool& pool);
+		void CreateIndexBuffer(VulkanEngine& engine);
+
+		GeometryPool m_Pools[static_cast<size_t>(VertexFormat::Count)][static_cast<size_t>(VertexLayout::Count)];
+
+		//ranges in indices
+		RangeAllocator m_Indices;
+		AllocatedBuffer m_IndexBuffer = {};
+	};
+}
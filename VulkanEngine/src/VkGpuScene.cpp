@@ -0,0 +1,415 @@
+#include "VkGpuScene.h"
+
+#include "VkInit.h"
+#include "VkUtils.h"
+#include "VulkanEngine.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <tuple>
+
+namespace VKE
+{
+	namespace
+	{
+		//push constants of cull.comp
+		struct CullConstants
+		{
+			glm::vec4 Planes[6];
+			uint32_t ObjectCount;
+			//compact the visible commands with the counts, otherwise every object writes its own command
+			uint32_t Compact;
+		};
+
+		enum CullBinding : uint32_t
+		{
+			OBJECT_BINDING = 0,
+			BATCH_BINDING = 1,
+			COMMAND_BINDING = 2,
+			COUNT_BINDING = 3,
+			CULL_BINDING_COUNT
+		};
+	}
+
+	bool GpuScene::Init(VulkanEngine& engine, bool drawCount)
+	{
+		VkDevice device = engine.GetDevice();
+		m_DrawCount = drawCount;
+
+		VkShaderModule cullShader;
+		if (!VkUtils::LoadShaderModule("res/shaders/cull.comp.spv", device, &cullShader))
+		{
+			std::cout << "Error when building the culling compute shader module, GPU-driven rendering is disabled" << std::endl;
+			return false;
+		}
+
+		std::cout << "Culling compute shader successfully loaded" << std::endl;
+
+		VkDescriptorSetLayoutBinding bindings[CULL_BINDING_COUNT];
+		for (uint32_t binding = 0; binding < CULL_BINDING_COUNT; binding++)
+		{
+			bindings[binding] = VkInit::DescriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, binding);
+		}
+
+		VkDescriptorSetLayoutCreateInfo setInfo = {};
+		setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		setInfo.bindingCount = CULL_BINDING_COUNT;
+		setInfo.pBindings = bindings;
+
+		VkResult result = vkCreateDescriptorSetLayout(device, &setInfo, nullptr, &m_CullSetLayout);
+		assert(result == VK_SUCCESS);
+
+		VkPushConstantRange pushConstant;
+		pushConstant.offset = 0;
+		pushConstant.size = sizeof(CullConstants);
+		pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+		VkPipelineLayoutCreateInfo layoutInfo = VkInit::PipelineLayoutCreateInfo();
+		layoutInfo.setLayoutCount = 1;
+		layoutInfo.pSetLayouts = &m_CullSetLayout;
+		layoutInfo.pushConstantRangeCount = 1;
+		layoutInfo.pPushConstantRanges = &pushConstant;
+
+		result = vkCreatePipelineLayout(device, &layoutInfo, nullptr, &m_CullPipelineLayout);
+		assert(result == VK_SUCCESS);
+
+		VkComputePipelineCreateInfo pipelineInfo = {};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage = VkInit::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT, cullShader);
+		pipelineInfo.layout = m_CullPipelineLayout;
+
+		result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_CullPipeline);
+		assert(result == VK_SUCCESS);
+
+		vkDestroyShaderModule(device, cullShader, nullptr);
+
+		//a culling set per frame in flight, the engine's pool is kept for the texture sets
+		VkDescriptorPoolSize poolSize = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, CULL_BINDING_COUNT * FRAME_OVERLAP };
+
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.maxSets = FRAME_OVERLAP;
+		poolInfo.poolSizeCount = 1;
+		poolInfo.pPoolSizes = &poolSize;
+
+		result = vkCreateDescriptorPool(device, &poolInfo, nullptr, &m_DescriptorPool);
+		assert(result == VK_SUCCESS);
+
+		m_Frames.resize(FRAME_OVERLAP);
+		for (FrameResources& frame : m_Frames)
+		{
+			VkDescriptorSetAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+			allocInfo.descriptorPool = m_DescriptorPool;
+			allocInfo.descriptorSetCount = 1;
+			allocInfo.pSetLayouts = &m_CullSetLayout;
+
+			result = vkAllocateDescriptorSets(device, &allocInfo, &frame.CullSet);
+			assert(result == VK_SUCCESS);
+		}
+
+		return true;
+	}
+
+	void GpuScene::Destroy(VulkanEngine& engine)
+	{
+		Clear(engine);
+
+		VkDevice device = engine.GetDevice();
+		vkDestroyPipeline(device, m_CullPipeline, nullptr);
+		vkDestroyPipelineLayout(device, m_CullPipelineLayout, nullptr);
+		vkDestroyDescriptorSetLayout(device, m_CullSetLayout, nullptr);
+		vkDestroyDescriptorPool(device, m_DescriptorPool, nullptr);
+
+		m_Frames.clear();
+	}
+
+	bool GpuScene::CanDraw(const RenderObject& object)
+	{
+		return object.instances == nullptr && object.material != nullptr && object.material->indirectPipeline != VK_NULL_HANDLE;
+	}
+
+	void GpuScene::Build(VulkanEngine& engine, const RenderObject* objects, uint32_t count)
+	{
+		Clear(engine);
+
+		m_SourceObjects = objects;
+		m_SourceCount = count;
+
+		//objects sharing a material and a pool go into the same batch, ordered by pipeline so the batches of one are drawn in a row.
+		//sorted by that key the objects of a batch are next to each other, in the order they were given.
+		//the arrays are members that keep their capacity, a rebuild of the same scene doesn't allocate
+		m_SortedObjects.clear();
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const RenderObject& object = objects[i];
+			if (!CanDraw(object))
+				continue;
+
+			SortedObject sorted;
+			sorted.PipelineSortId = object.material->pipelineSortId;
+			sorted.MaterialSortId = object.material->sortId;
+			sorted.Pool = engine.m_Geometry.GetPool(object.mesh->Format, object.mesh->Layout);
+			sorted.Object = i;
+			m_SortedObjects.push_back(sorted);
+
+			MeshSnapshot snapshot;
+			snapshot.SceneMesh = object.mesh;
+			snapshot.FirstIndex = object.mesh->Geometry.FirstIndex;
+			snapshot.VertexOffset = object.mesh->Geometry.VertexOffset;
+			m_Meshes.push_back(snapshot);
+		}
+
+		if (m_SortedObjects.empty())
+			return;
+
+		std::sort(m_SortedObjects.begin(), m_SortedObjects.end(), [](const SortedObject& a, const SortedObject& b)
+		{
+			return std::tie(a.PipelineSortId, a.MaterialSortId, a.Pool, a.Object) < std::tie(b.PipelineSortId, b.MaterialSortId, b.Pool, b.Object);
+		});
+
+		//every mesh once
+		std::sort(m_Meshes.begin(), m_Meshes.end(), [](const MeshSnapshot& a, const MeshSnapshot& b) { return std::less<Mesh*>()(a.SceneMesh, b.SceneMesh); });
+		m_Meshes.erase(std::unique(m_Meshes.begin(), m_Meshes.end(), [](const MeshSnapshot& a, const MeshSnapshot& b) { return a.SceneMesh == b.SceneMesh; }), m_Meshes.end());
+
+		//an object's index is its command's place without compaction
+		const uint32_t objectCount = static_cast<uint32_t>(m_SortedObjects.size());
+		m_ObjectData.resize(objectCount);
+		m_FirstCommands.clear();
+
+		for (uint32_t command = 0; command < objectCount; command++)
+		{
+			const SortedObject& sorted = m_SortedObjects[command];
+			const RenderObject& object = objects[sorted.Object];
+
+			if (command == 0 || std::tie(sorted.PipelineSortId, sorted.MaterialSortId, sorted.Pool) !=
+				std::tie(m_SortedObjects[command - 1].PipelineSortId, m_SortedObjects[command - 1].MaterialSortId, m_SortedObjects[command - 1].Pool))
+			{
+				GpuBatch batch;
+				batch.BatchMaterial = object.material;
+				batch.Pool = sorted.Pool;
+				batch.FirstCommand = command;
+				m_Batches.push_back(batch);
+				m_FirstCommands.push_back(command);
+			}
+			m_Batches.back().Capacity++;
+
+			const Mesh& mesh = *object.mesh;
+
+			//the finest level of detail, levels aren't selected on the GPU
+			const Submesh* submesh = mesh.Submeshes.empty() ? nullptr : &mesh.Submeshes[object.submesh];
+			const MeshLod* lod = submesh && submesh->LodCount > 0 ? &mesh.Lods[submesh->FirstLod] : nullptr;
+
+			GPUObjectData& data = m_ObjectData[command];
+			data.RenderMatrix = mesh.Format == VertexFormat::Full ? object.transformMatrix : object.transformMatrix * mesh.GetDequantizationMatrix();
+			data.BoundingSphere = glm::vec4(glm::vec3(object.transformMatrix * glm::vec4(mesh.GetBoundsCenter(), 1.0f)), mesh.GetBoundsRadius() * GetMaxScale(object.transformMatrix));
+			data.FirstIndex = mesh.Geometry.FirstIndex + (lod != nullptr ? lod->FirstIndex : 0);
+			data.IndexCount = lod != nullptr ? lod->IndexCount : mesh.Geometry.IndexCount;
+			data.VertexOffset = static_cast<int32_t>(mesh.Geometry.VertexOffset);
+			data.Batch = static_cast<uint32_t>(m_Batches.size() - 1);
+		}
+
+		m_ObjectCount = objectCount;
+
+		const size_t objectSize = objectCount * sizeof(GPUObjectData);
+		const size_t batchSize = m_Batches.size() * sizeof(uint32_t);
+
+		m_Objects = engine.CreateBuffer(objectSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, MemoryClass::Geometry);
+		m_BatchOffsets = engine.CreateBuffer(batchSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, MemoryClass::Geometry);
+
+		UploadBuffer(engine, m_Objects, m_ObjectData.data(), objectSize);
+		UploadBuffer(engine, m_BatchOffsets, m_FirstCommands.data(), batchSize);
+
+		//only the culling shader writes them
+		for (FrameResources& frame : m_Frames)
+		{
+			frame.Commands = engine.CreateBuffer(objectCount * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, MemoryClass::Geometry);
+			frame.Counts = engine.CreateBuffer(batchSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, MemoryClass::Geometry);
+		}
+
+		m_Version++;
+		m_BuildCount++;
+	}
+
+	void GpuScene::Clear(VulkanEngine& engine)
+	{
+		if (m_ObjectCount > 0)
+		{
+			RetireBuffers(engine);
+		}
+
+		m_ObjectCount = 0;
+		m_UploadToken = 0;
+		m_Batches.clear();
+		m_Meshes.clear();
+	}
+
+	bool GpuScene::Update(VulkanEngine& engine, uint32_t frameIndex, VkDescriptorSet globalSet)
+	{
+		if (!IsBuilt())
+			return false;
+
+		//every mesh is touched, so the residency manager streams back the ones that were evicted
+		bool ready = true;
+		bool moved = false;
+		for (const MeshSnapshot& snapshot : m_Meshes)
+		{
+			const Mesh& mesh = *snapshot.SceneMesh;
+			if (!engine.m_Residency.Touch(mesh.ResidencyHandle) || !engine.m_StagingRing.IsAcquired(mesh.UploadToken))
+			{
+				ready = false;
+				continue;
+			}
+
+			moved = moved || mesh.Geometry.FirstIndex != snapshot.FirstIndex || mesh.Geometry.VertexOffset != snapshot.VertexOffset;
+		}
+
+		//the textures too, DrawIndirect only checks whether they are resident
+		for (const GpuBatch& batch : m_Batches)
+		{
+			if (batch.BatchMaterial->texture != nullptr)
+			{
+				engine.m_Residency.Touch(batch.BatchMaterial->texture->ResidencyHandle);
+			}
+		}
+
+		if (!ready)
+			return false;
+
+		//restreamed or compacted, the ranges in the object buffer are stale
+		if (moved)
+		{
+			Build(engine, m_SourceObjects, m_SourceCount);
+		}
+
+		if (!IsBuilt() || !engine.m_StagingRing.IsAcquired(m_UploadToken))
+			return false;
+
+		//the frame's sets aren't in use now that its fence has signalled
+		FrameResources& frame = m_Frames[frameIndex];
+		if (frame.Version != m_Version)
+		{
+			VkDescriptorBufferInfo bufferInfos[CULL_BINDING_COUNT] =
+			{
+				{ m_Objects.Buffer, 0, VK_WHOLE_SIZE },
+				{ m_BatchOffsets.Buffer, 0, VK_WHOLE_SIZE },
+				{ frame.Commands.Buffer, 0, VK_WHOLE_SIZE },
+				{ frame.Counts.Buffer, 0, VK_WHOLE_SIZE }
+			};
+
+			VkWriteDescriptorSet writes[CULL_BINDING_COUNT + 1];
+			for (uint32_t binding = 0; binding < CULL_BINDING_COUNT; binding++)
+			{
+				writes[binding] = VkInit::WritDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frame.CullSet, &bufferInfos[binding], binding);
+			}
+
+			//the indirect vertex shaders read the objects from the global set
+			writes[CULL_BINDING_COUNT] = VkInit::WritDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, globalSet, &bufferInfos[OBJECT_BINDING], VulkanEngine::OBJECT_BUFFER_BINDING);
+
+			vkUpdateDescriptorSets(engine.GetDevice(), CULL_BINDING_COUNT + 1, writes, 0, nullptr);
+			frame.Version = m_Version;
+		}
+
+		return true;
+	}
+
+	void GpuScene::CmdCull(VkCommandBuffer cmd, uint32_t frameIndex, const Frustum& frustum)
+	{
+		const FrameResources& frame = m_Frames[frameIndex];
+
+		VkMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+
+		if (m_DrawCount)
+		{
+			vkCmdFillBuffer(cmd, frame.Counts.Buffer, 0, m_Batches.size() * sizeof(uint32_t), 0);
+
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+		}
+
+		CullConstants constants;
+		memcpy(constants.Planes, frustum.Planes, sizeof(constants.Planes));
+		constants.ObjectCount = m_ObjectCount;
+		constants.Compact = m_DrawCount ? 1 : 0;
+
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_CullPipeline);
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_CullPipelineLayout, 0, 1, &frame.CullSet, 0, nullptr);
+		vkCmdPushConstants(cmd, m_CullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullConstants), &constants);
+		vkCmdDispatch(cmd, (m_ObjectCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+		//the draws of the render pass read the commands and counts
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+	}
+
+	void GpuScene::PrintStatistics() const
+	{
+		if (m_BuildCount == 0)
+			return;
+
+		std::cout << "GPU scene: " << m_ObjectCount << " objects in " << m_Batches.size() << " batches, built " << m_BuildCount << " times, "
+			<< (m_DrawCount ? "compacted with draw counts" : "culled objects drawn with no instances") << std::endl;
+	}
+
+	void GpuScene::RetireBuffers(VulkanEngine& engine)
+	{
+		FrameDeletionQueue& deletionQueue = engine.GetFrameDeletionQueue();
+		VmaAllocator allocator = engine.m_Allocator;
+
+		deletionQueue.Push([allocator, objects = m_Objects, batchOffsets = m_BatchOffsets]()
+		{
+			vmaDestroyBuffer(allocator, objects.Buffer, objects.Allocation);
+			vmaDestroyBuffer(allocator, batchOffsets.Buffer, batchOffsets.Allocation);
+		});
+
+		for (FrameResources& frame : m_Frames)
+		{
+			deletionQueue.Push([allocator, commands = frame.Commands, counts = frame.Counts]()
+			{
+				vmaDestroyBuffer(allocator, commands.Buffer, commands.Allocation);
+				vmaDestroyBuffer(allocator, counts.Buffer, counts.Allocation);
+			});
+
+			frame.Commands = {};
+			frame.Counts = {};
+		}
+
+		m_Objects = {};
+		m_BatchOffsets = {};
+	}
+
+	void GpuScene::UploadBuffer(VulkanEngine& engine, AllocatedBuffer& buffer, const void* data, size_t size)
+	{
+		//placed like the geometry, written directly where that is
+		if (engine.m_MemoryPlacement.IsDirect(MemoryClass::Geometry))
+		{
+			void* mapped;
+			VkResult result = vmaMapMemory(engine.m_Allocator, buffer.Allocation, &mapped);
+			assert(result == VK_SUCCESS);
+
+			memcpy(mapped, data, size);
+
+			vmaFlushAllocation(engine.m_Allocator, buffer.Allocation, 0, size);
+			vmaUnmapMemory(engine.m_Allocator, buffer.Allocation);
+			return;
+		}
+
+		StagingAllocation staging = engine.m_StagingRing.Reserve(size);
+		memcpy(staging.Data, data, size);
+
+		VkBufferCopy copy;
+		copy.srcOffset = staging.Offset;
+		copy.dstOffset = 0;
+		copy.size = size;
+		vkCmdCopyBuffer(engine.m_StagingRing.GetCommandBuffer(), staging.Buffer, buffer.Buffer, 1, &copy);
+		engine.m_StagingRing.ReleaseBuffer(buffer.Buffer, 0, size);
+
+		m_UploadToken = engine.m_StagingRing.GetRecordingToken();
+	}
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "VkCulling.h"
+#include "VkMesh.h"
+#include "VkTypes.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace VKE
+{
+	class VulkanEngine;
+	struct GeometryPool;
+	struct Material;
+	struct RenderObject;
+
+	//an object of the GPU scene as the culling and the indirect vertex shaders read it, std430
+	struct GPUObjectData
+	{
+		//model matrix, with the dequantization of packed meshes folded in
+		glm::mat4 RenderMatrix;
+		//world space bounding sphere, radius in w
+		glm::vec4 BoundingSphere;
+		uint32_t FirstIndex;
+		uint32_t IndexCount;
+		int32_t VertexOffset;
+		uint32_t Batch;
+	};
+
+	//objects sharing a material and a geometry pool, drawn with one indirect draw. their commands are
+	//[FirstCommand, FirstCommand + Capacity) of the command buffer, the culling shader counts how many of them it wrote
+	struct GpuBatch
+	{
+		Material* BatchMaterial = nullptr;
+		const GeometryPool* Pool = nullptr;
+		uint32_t FirstCommand = 0;
+		uint32_t Capacity = 0;
+	};
+
+	//the render objects as storage buffers, drawn without walking them on the CPU. every frame a compute shader tests the
+	//objects' bounding spheres against the frustum and writes a VkDrawIndexedIndirectCommand for each visible one, grouped by
+	//batch, and the frame draws each batch with a single vkCmdDrawIndexedIndirectCount. the vertex shaders find the object's
+	//matrix through the command's firstInstance, which is the object's index.
+	//
+	//the data is written once by Build. the scene is built again when the geometry of one of its meshes moved, and
+	//isn't drawn while one of them is evicted or still uploading
+	class GpuScene
+	{
+	public:
+		//threads of a culling workgroup, matches local_size_x in cull.comp
+		static constexpr uint32_t CULL_GROUP_SIZE = 64;
+
+		//creates the culling pipeline. drawCount is whether VK_KHR_draw_indirect_count is enabled,
+		//without it every object keeps its command and culled ones are written with no instances.
+		//returns false without creating anything if the culling shader can't be loaded, the scene can't be drawn then
+		bool Init(VulkanEngine& engine, bool drawCount);
+		//with the device idle, the buffers go with the frame's deletion queue
+		void Destroy(VulkanEngine& engine);
+
+		//objects without instances whose material has an indirect pipeline, the others are left to DrawObjects
+		static bool CanDraw(const RenderObject& object);
+
+		//uploads the objects CanDraw takes, replacing what was built before. the objects are read again when the scene is rebuilt
+		void Build(VulkanEngine& engine, const RenderObject* objects, uint32_t count);
+		void Clear(VulkanEngine& engine);
+		bool IsBuilt() const { return m_ObjectCount > 0; }
+
+		//once per frame after its fence, before CmdCull. touches the scene's meshes and textures and rebuilds it if the geometry moved,
+		//points the frame's descriptors at the current buffers. returns whether the scene can be drawn this frame
+		bool Update(VulkanEngine& engine, uint32_t frameIndex, VkDescriptorSet globalSet);
+
+		//outside of a render pass: writes the draw commands of the objects inside the frustum
+		void CmdCull(VkCommandBuffer cmd, uint32_t frameIndex, const Frustum& frustum);
+
+		const std::vector<GpuBatch>& GetBatches() const { return m_Batches; }
+		VkBuffer GetCommandBuffer(uint32_t frameIndex) const { return m_Frames[frameIndex].Commands.Buffer; }
+		VkBuffer GetCountBuffer(uint32_t frameIndex) const { return m_Frames[frameIndex].Counts.Buffer; }
+		bool UsesDrawCount() const { return m_DrawCount; }
+
+		uint32_t GetObjectCount() const { return m_ObjectCount; }
+		uint32_t GetBuildCount() const { return m_BuildCount; }
+		void PrintStatistics() const;
+
+	private:
+		//what the frame's culling writes, the frames in flight each have their own
+		struct FrameResources
+		{
+			AllocatedBuffer Commands = {};
+			AllocatedBuffer Counts = {};
+			VkDescriptorSet CullSet = VK_NULL_HANDLE;
+			//m_Version its descriptors point at
+			uint64_t Version = 0;
+		};
+
+		//an object Build takes, sorted into its batch
+		struct SortedObject
+		{
+			uint32_t PipelineSortId = 0;
+			uint32_t MaterialSortId = 0;
+			const GeometryPool* Pool = nullptr;
+			//index in the objects Build was called with
+			uint32_t Object = 0;
+		};
+
+		//geometry of a mesh as the scene was built with it
+		struct MeshSnapshot
+		{
+			Mesh* SceneMesh = nullptr;
+			uint32_t FirstIndex = 0;
+			uint32_t VertexOffset = 0;
+		};
+
+		//the buffers are destroyed once the frames in flight are done with them
+		void RetireBuffers(VulkanEngine& engine);
+		void UploadBuffer(VulkanEngine& engine, AllocatedBuffer& buffer, const void* data, size_t size);
+
+		VkDescriptorSetLayout m_CullSetLayout = VK_NULL_HANDLE;
+		VkPipelineLayout m_CullPipelineLayout = VK_NULL_HANDLE;
+		VkPipeline m_CullPipeline = VK_NULL_HANDLE;
+		VkDescriptorPool m_DescriptorPool = VK_NULL_HANDLE;
+		bool m_DrawCount = false;
+
+		//what Build was called with
+		const RenderObject* m_SourceObjects = nullptr;
+		uint32_t m_SourceCount = 0;
+
+		AllocatedBuffer m_Objects = {};
+		//first command of every batch
+		AllocatedBuffer m_BatchOffsets = {};
+		uint32_t m_ObjectCount = 0;
+		uint64_t m_UploadToken = 0;
+		uint64_t m_Version = 0;
+
+		std::vector<GpuBatch> m_Batches;
+		std::vector<MeshSnapshot> m_Meshes;
+
+		//Build's working arrays, kept between builds with their capacity
+		std::vector<SortedObject> m_SortedObjects;
+		std::vector<GPUObjectData> m_ObjectData;
+		//FirstCommand of every batch, what m_BatchOffsets is uploaded from
+		std::vector<uint32_t> m_FirstCommands;
+
+		//one per frame in flight
+		std::vector<FrameResources> m_Frames;
+
+		uint32_t m_BuildCount = 0;
+	};
+}
@@ -297,6 +297,19 @@ namespace VKE
 		return info;
 	}
 
+	VkCommandBufferInheritanceInfo VkInit::CommandBufferInheritanceInfo(VkRenderPass renderPass, uint32_t subpass, VkFramebuffer framebuffer)
+	{
+		VkCommandBufferInheritanceInfo info = {};
+		info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		info.pNext = nullptr;
+
+		info.renderPass = renderPass;
+		info.subpass = subpass;
+		info.framebuffer = framebuffer;
+		info.occlusionQueryEnable = VK_FALSE;
+		return info;
+	}
+
 	VkSubmitInfo VkInit::SubmitInfo(VkCommandBuffer* cmd)
 	{
 		VkSubmitInfo info = {};
@@ -33,6 +33,7 @@ namespace VKE
 		static VkSemaphoreCreateInfo SemaphoreCreateInfo(VkSemaphoreCreateFlags semaphoreCreateFlags);
 
 		static VkCommandBufferBeginInfo CommandBufferBeginInfo(VkCommandBufferUsageFlags flags = 0);
+		static VkCommandBufferInheritanceInfo CommandBufferInheritanceInfo(VkRenderPass renderPass, uint32_t subpass, VkFramebuffer framebuffer);
 		static VkSubmitInfo SubmitInfo(VkCommandBuffer* cmd);
 
 		static VkSamplerCreateInfo SamplerCreateInfo(VkFilter filters, VkSamplerAddressMode samplerAddressMode = VK_SAMPLER_ADDRESS_MODE_REPEAT);
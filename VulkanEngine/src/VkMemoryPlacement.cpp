@@ -0,0 +1,176 @@
+#include "VkMemoryPlacement.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+namespace VKE
+{
+	namespace
+	{
+		VmaAllocationCreateInfo MakeAllocationInfo(VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, uint32_t memoryTypeBits)
+		{
+			VmaAllocationCreateInfo info = {};
+			info.usage = VMA_MEMORY_USAGE_UNKNOWN;
+			info.requiredFlags = required;
+			info.preferredFlags = preferred;
+			info.memoryTypeBits = memoryTypeBits;
+			return info;
+		}
+	}
+
+	const char* GetMemoryClassName(MemoryClass memoryClass)
+	{
+		switch (memoryClass)
+		{
+		case MemoryClass::Geometry:
+			return "geometry";
+		case MemoryClass::Image:
+			return "images";
+		case MemoryClass::FrameData:
+			return "frame data";
+		case MemoryClass::Staging:
+			return "staging";
+		default:
+			return "unknown";
+		}
+	}
+
+	void MemoryPlacement::Init(VmaAllocator allocator)
+	{
+		m_Allocator = allocator;
+
+		const VkPhysicalDeviceMemoryProperties* memoryProperties;
+		vmaGetMemoryProperties(m_Allocator, &memoryProperties);
+
+		//device local types the CPU can't map, host types outside of VRAM, and the device local ones it can map
+		uint32_t deviceTypes = 0;
+		uint32_t hostTypes = 0;
+		uint32_t barTypes = 0;
+		uint32_t largeBarTypes = 0;
+
+		for (uint32_t type = 0; type < memoryProperties->memoryTypeCount; type++)
+		{
+			const VkMemoryPropertyFlags flags = memoryProperties->memoryTypes[type].propertyFlags;
+			const VkDeviceSize heapSize = memoryProperties->memoryHeaps[memoryProperties->memoryTypes[type].heapIndex].size;
+
+			const bool deviceLocal = (flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0;
+			const bool hostVisible = (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+
+			if (deviceLocal && hostVisible)
+			{
+				barTypes |= 1u << type;
+				if (heapSize > LEGACY_BAR_SIZE)
+				{
+					largeBarTypes |= 1u << type;
+				}
+			}
+			else if (deviceLocal)
+			{
+				deviceTypes |= 1u << type;
+			}
+			else if (hostVisible)
+			{
+				hostTypes |= 1u << type;
+			}
+		}
+
+		m_HostVisibleDeviceLocal = barTypes != 0;
+		m_ResizableBar = largeBarTypes != 0;
+
+		const VkMemoryPropertyFlags deviceLocal = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		const VkMemoryPropertyFlags hostVisible = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+		const VkMemoryPropertyFlags hostCoherent = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+		//what only the GPU uses stays out of the host visible types, the small BAR window is kept for what the CPU writes every frame.
+		//an integrated GPU has nothing but host visible device local memory
+		const uint32_t gpuOnlyTypes = deviceTypes != 0 ? deviceTypes : UINT32_MAX;
+
+		if (m_ResizableBar)
+		{
+			Place(MemoryClass::Geometry, HostAccess::SequentialWrite, true, MakeAllocationInfo(deviceLocal | hostVisible, hostCoherent, largeBarTypes));
+		}
+		else
+		{
+			Place(MemoryClass::Geometry, HostAccess::None, false, MakeAllocationInfo(deviceLocal, 0, gpuOnlyTypes));
+		}
+
+		//optimal tiling can't be written through a mapping, images are copied in even when their memory is host visible
+		Place(MemoryClass::Image, HostAccess::None, false, MakeAllocationInfo(deviceLocal, 0, gpuOnlyTypes));
+
+		//small and rewritten every frame, the GPU reads it from VRAM if any of it is host visible and over PCIe otherwise
+		if (m_HostVisibleDeviceLocal)
+		{
+			Place(MemoryClass::FrameData, HostAccess::SequentialWrite, true, MakeAllocationInfo(deviceLocal | hostVisible, hostCoherent, barTypes));
+		}
+		else
+		{
+			Place(MemoryClass::FrameData, HostAccess::SequentialWrite, true, MakeAllocationInfo(hostVisible, hostCoherent, UINT32_MAX));
+		}
+
+		//staging buffers are only copied from once, they belong in system memory where there is any.
+		//the staging ring doesn't flush its writes
+		Place(MemoryClass::Staging, HostAccess::SequentialWrite, true, MakeAllocationInfo(hostVisible | hostCoherent, 0, hostTypes != 0 ? hostTypes : UINT32_MAX));
+	}
+
+	void MemoryPlacement::PrintReport() const
+	{
+		const VkPhysicalDeviceMemoryProperties* memoryProperties;
+		vmaGetMemoryProperties(m_Allocator, &memoryProperties);
+
+		VkDeviceSize barSize = 0;
+		for (uint32_t type = 0; type < memoryProperties->memoryTypeCount; type++)
+		{
+			const VkMemoryPropertyFlags flags = memoryProperties->memoryTypes[type].propertyFlags;
+			if ((flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) && (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT))
+			{
+				barSize = std::max(barSize, memoryProperties->memoryHeaps[memoryProperties->memoryTypes[type].heapIndex].size);
+			}
+		}
+
+		std::cout << "Memory placement: ";
+		if (m_ResizableBar)
+		{
+			std::cout << "resizable BAR or integrated GPU, " << barSize / (1024 * 1024) << " MB of host visible device local memory" << std::endl;
+		}
+		else if (m_HostVisibleDeviceLocal)
+		{
+			std::cout << "BAR window of " << barSize / (1024 * 1024) << " MB, kept for frame data" << std::endl;
+		}
+		else
+		{
+			std::cout << "no host visible device local memory" << std::endl;
+		}
+
+		for (size_t i = 0; i < static_cast<size_t>(MemoryClass::Count); i++)
+		{
+			const MemoryPlacementInfo& placement = m_Classes[i];
+
+			std::cout << "  " << GetMemoryClassName(static_cast<MemoryClass>(i)) << ": ";
+			if (placement.MemoryType == UINT32_MAX)
+			{
+				std::cout << "no memory type fits" << std::endl;
+				continue;
+			}
+
+			const VkMemoryPropertyFlags flags = memoryProperties->memoryTypes[placement.MemoryType].propertyFlags;
+			std::cout << "memory type " << placement.MemoryType << " (" << ((flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ? "device local" : "system memory")
+				<< ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ? ", host visible" : "") << "), "
+				<< (placement.Direct ? "written directly" : "uploaded through staging copies") << std::endl;
+		}
+	}
+
+	void MemoryPlacement::Place(MemoryClass memoryClass, HostAccess access, bool direct, const VmaAllocationCreateInfo& allocationInfo)
+	{
+		MemoryPlacementInfo& placement = m_Classes[static_cast<size_t>(memoryClass)];
+		placement.AllocationInfo = allocationInfo;
+		placement.Access = access;
+		placement.Direct = direct;
+
+		//the buffers and images may narrow the types down further, this is the type VMA would pick without them
+		if (vmaFindMemoryTypeIndex(m_Allocator, UINT32_MAX, &allocationInfo, &placement.MemoryType) != VK_SUCCESS)
+		{
+			placement.MemoryType = UINT32_MAX;
+		}
+	}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "VkTypes.h"
+
+#include <cstdint>
+
+namespace VKE
+{
+	//how the CPU touches a resource's memory, modelled on VMA_MEMORY_USAGE_AUTO and its host access flags,
+	//which the VMA version in Dependencies predates
+	enum class HostAccess : uint8_t
+	{
+		//only the GPU reads and writes it
+		None,
+		//written once front to back through a mapping, never read back
+		SequentialWrite
+	};
+
+	//what the engine allocates. each class is placed once at startup, from the memory types the device exposes
+	enum class MemoryClass : uint8_t
+	{
+		//vertex and index buffers
+		Geometry,
+		//textures and attachments, optimally tiled
+		Image,
+		//uniforms and transient data rewritten every frame
+		FrameData,
+		//upload sources copied from on the GPU
+		Staging,
+		Count
+	};
+
+	const char* GetMemoryClassName(MemoryClass memoryClass);
+
+	//where a class lives and how the CPU gets its data in there
+	struct MemoryPlacementInfo
+	{
+		VmaAllocationCreateInfo AllocationInfo = {};
+		HostAccess Access = HostAccess::None;
+		//written through a mapping instead of copied from a staging buffer
+		bool Direct = false;
+		//the type VMA picks for it, UINT32_MAX if none fits
+		uint32_t MemoryType = UINT32_MAX;
+	};
+
+	//picks the memory of every MemoryClass. with resizable BAR, or on an integrated GPU, all of the device local memory is
+	//host visible and uploads are written straight into it. otherwise the host visible part of VRAM is the 256 MB window
+	//the PCIe BAR gives, kept for the per-frame data, and geometry goes through staging copies
+	class MemoryPlacement
+	{
+	public:
+		//a host visible device local heap larger than this is taken for resizable BAR
+		static constexpr VkDeviceSize LEGACY_BAR_SIZE = 256 * 1024 * 1024;
+
+		void Init(VmaAllocator allocator);
+
+		const MemoryPlacementInfo& Get(MemoryClass memoryClass) const { return m_Classes[static_cast<size_t>(memoryClass)]; }
+		const VmaAllocationCreateInfo& GetAllocationInfo(MemoryClass memoryClass) const { return Get(memoryClass).AllocationInfo; }
+		bool IsDirect(MemoryClass memoryClass) const { return Get(memoryClass).Direct; }
+
+		bool HasResizableBar() const { return m_ResizableBar; }
+		//startup report of the path chosen for every class
+		void PrintReport() const;
+
+	private:
+		void Place(MemoryClass memoryClass, HostAccess access, bool direct, const VmaAllocationCreateInfo& allocationInfo);
+
+		VmaAllocator m_Allocator = VK_NULL_HANDLE;
+		bool m_ResizableBar = false;
+		bool m_HostVisibleDeviceLocal = false;
+
+		MemoryPlacementInfo m_Classes[static_cast<size_t>(MemoryClass::Count)];
+	};
+}
@@ -1,9 +1,234 @@
 #include "VkMesh.h"
+#include "VkMeshCache.h"
+#include "VkMeshlets.h"
+#include "VkMeshOptimizer.h"
+#include "VkMeshSimplifier.h"
+#include "VkObjLoader.h"
+
 #include <tinyobjloader/tiny_obj_loader.h>
 
+#include <glm/common.hpp>
+#include <glm/packing.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtx/transform.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <unordered_map>
+
 namespace VKE
 {
-	VertexInputDescription Vertex::GetVertexDescription()
+	namespace
+	{
+		//hashes the raw bits of every attribute, so only bit-identical vertices get merged
+		struct VertexHash
+		{
+			size_t operator()(const Vertex& vertex) const
+			{
+				uint32_t words[sizeof(Vertex) / sizeof(uint32_t)];
+				memcpy(words, &vertex, sizeof(Vertex));
+
+				//FNV-1a over the 32 bit words of the vertex
+				size_t hash = 2166136261u;
+				for (uint32_t word : words)
+				{
+					hash = (hash ^ word) * 16777619u;
+				}
+
+				return hash;
+			}
+		};
+
+		//compares the same bits VertexHash hashed. operator== compares floats, where -0 equals 0 and NaN equals nothing:
+		//equal vertices could hash apart and a NaN vertex would never find itself
+		struct VertexEqual
+		{
+			bool operator()(const Vertex& a, const Vertex& b) const
+			{
+				return memcmp(&a, &b, sizeof(Vertex)) == 0;
+			}
+		};
+
+		//octahedral mapping of a unit vector onto [-1, 1]^2
+		glm::vec2 OctahedralEncode(glm::vec3 normal)
+		{
+			const float length = glm::abs(normal.x) + glm::abs(normal.y) + glm::abs(normal.z);
+			if (length == 0.0f)
+				return glm::vec2(0.0f);
+
+			normal /= length;
+
+			glm::vec2 encoded = glm::vec2(normal.x, normal.y);
+			if (normal.z < 0.0f)
+			{
+				//fold the lower hemisphere over the diagonals
+				const glm::vec2 signs = glm::vec2(encoded.x >= 0.0f ? 1.0f : -1.0f, encoded.y >= 0.0f ? 1.0f : -1.0f);
+				encoded = (1.0f - glm::abs(glm::vec2(encoded.y, encoded.x))) * signs;
+			}
+
+			return encoded;
+		}
+
+		//size of the quantization grid, flat axes get a unit extent so they don't divide by zero
+		glm::vec3 GetQuantizationExtent(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+		{
+			glm::vec3 extent = boundsMax - boundsMin;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				if (extent[axis] <= 0.0f)
+					extent[axis] = 1.0f;
+			}
+
+			return extent;
+		}
+
+		VkVertexInputAttributeDescription MakeAttribute(uint32_t location, VkFormat format, uint32_t offset)
+		{
+			VkVertexInputAttributeDescription attribute = {};
+			attribute.binding = 0;
+			attribute.location = location;
+			attribute.format = format;
+			attribute.offset = offset;
+
+			return attribute;
+		}
+
+		//moves every attribute but the position into binding 1, with the position bytes taken out of the stride
+		void SplitPositionStream(VertexInputDescription& description, uint32_t positionStride)
+		{
+			const uint32_t stride = description.Bindings[0].stride;
+			description.Bindings[0].stride = positionStride;
+
+			VkVertexInputBindingDescription attributeBinding = {};
+			attributeBinding.binding = 1;
+			attributeBinding.stride = stride - positionStride;
+			attributeBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+			description.Bindings.push_back(attributeBinding);
+
+			for (VkVertexInputAttributeDescription& attribute : description.Attributes)
+			{
+				if (attribute.location == 0)
+					continue;
+
+				attribute.binding = 1;
+				attribute.offset -= positionStride;
+			}
+		}
+	}
+
+	uint32_t GetVertexStride(VertexFormat format)
+	{
+		switch (format)
+		{
+		case VertexFormat::Packed:
+			return sizeof(PackedVertex);
+		case VertexFormat::PackedNoColor:
+			return sizeof(PackedVertexNoColor);
+		default:
+			return sizeof(Vertex);
+		}
+	}
+
+	uint32_t GetPositionStride(VertexFormat format)
+	{
+		static_assert(offsetof(Vertex, Position) == 0 && offsetof(PackedVertex, Position) == 0 && offsetof(PackedVertexNoColor, Position) == 0,
+			"the position stream is split off the front of every vertex");
+
+		return format == VertexFormat::Full ? sizeof(Vertex::Position) : sizeof(PackedVertex::Position);
+	}
+
+	const char* GetVertexFormatName(VertexFormat format)
+	{
+		switch (format)
+		{
+		case VertexFormat::Packed:
+			return "packed";
+		case VertexFormat::PackedNoColor:
+			return "packedNoColor";
+		default:
+			return "full";
+		}
+	}
+
+	const char* GetVertexLayoutName(VertexLayout layout)
+	{
+		return layout == VertexLayout::Split ? "split" : "interleaved";
+	}
+
+	VertexInputDescription GetVertexDescription(VertexFormat format, VertexLayout layout)
+	{
+		if (format == VertexFormat::Full)
+			return Vertex::GetVertexDescription(layout);
+
+		VertexInputDescription description;
+
+		VkVertexInputBindingDescription mainBinding = {};
+		mainBinding.binding = 0;
+		mainBinding.stride = GetVertexStride(format);
+		mainBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+		description.Bindings.push_back(mainBinding);
+
+		//locations match the full layout, the packed vertex shaders decode them back to floats
+		description.Attributes.push_back(MakeAttribute(0, VK_FORMAT_R16G16B16A16_UNORM, offsetof(PackedVertex, Position)));
+		description.Attributes.push_back(MakeAttribute(1, VK_FORMAT_R16G16_SNORM, offsetof(PackedVertex, Normal)));
+		description.Attributes.push_back(MakeAttribute(3, VK_FORMAT_R16G16_SFLOAT, offsetof(PackedVertex, UV)));
+
+		if (format == VertexFormat::Packed)
+		{
+			description.Attributes.push_back(MakeAttribute(2, VK_FORMAT_R8G8B8A8_UNORM, offsetof(PackedVertex, Color)));
+		}
+
+		if (layout == VertexLayout::Split)
+		{
+			SplitPositionStream(description, GetPositionStride(format));
+		}
+
+		return description;
+	}
+
+	void AddInstanceAttributes(VertexInputDescription& description)
+	{
+		VkVertexInputBindingDescription instanceBinding = {};
+		instanceBinding.binding = INSTANCE_BINDING;
+		instanceBinding.stride = sizeof(glm::mat4);
+		instanceBinding.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+		description.Bindings.push_back(instanceBinding);
+
+		//a mat4 attribute is four vec4 columns in consecutive locations
+		for (uint32_t column = 0; column < 4; column++)
+		{
+			VkVertexInputAttributeDescription attribute = {};
+			attribute.binding = INSTANCE_BINDING;
+			attribute.location = INSTANCE_MATRIX_LOCATION + column;
+			attribute.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+			attribute.offset = column * sizeof(glm::vec4);
+
+			description.Attributes.push_back(attribute);
+		}
+	}
+
+	VertexInputDescription GetPositionDescription(VertexFormat format, VertexLayout layout)
+	{
+		VertexInputDescription description = GetVertexDescription(format, layout);
+
+		//interleaved meshes keep their full stride, the other attributes are simply skipped
+		description.Bindings.resize(1);
+		description.Attributes.erase(std::remove_if(description.Attributes.begin(), description.Attributes.end(),
+			[](const VkVertexInputAttributeDescription& attribute) { return attribute.location != 0; }), description.Attributes.end());
+
+		return description;
+	}
+
+	bool Vertex::operator==(const Vertex& other) const
+	{
+		return Position == other.Position && Normal == other.Normal && Color == other.Color && UV == other.UV;
+	}
+
+	VertexInputDescription Vertex::GetVertexDescription(VertexLayout layout)
 	{
 		VertexInputDescription description;
 
@@ -48,24 +273,81 @@ namespace VKE
 		description.Attributes.push_back(colorAttribute);
 		description.Attributes.push_back(uvAttribute);
 
+		if (layout == VertexLayout::Split)
+		{
+			SplitPositionStream(description, sizeof(Vertex::Position));
+		}
+
 		return description;		
 	}
 
+	void Mesh::WriteGpuVertices(void* destination) const
+	{
+		uint8_t* output = static_cast<uint8_t*>(destination);
+		WriteGpuVertices(output, output + GetAttributeStreamOffset());
+	}
+
+	void Mesh::WriteGpuVertices(void* positionDestination, void* attributeDestination) const
+	{
+		const uint8_t* source = static_cast<const uint8_t*>(GetGpuVertexData());
+
+		if (Layout == VertexLayout::Interleaved)
+		{
+			memcpy(positionDestination, source, GetGpuVertexSize());
+			return;
+		}
+
+		const uint32_t vertexCount = GetVertexCount();
+		const uint32_t stride = GetVertexStride(Format);
+		const uint32_t positionStride = GetPositionStride(Format);
+		const uint32_t attributeStride = stride - positionStride;
+
+		uint8_t* positions = static_cast<uint8_t*>(positionDestination);
+		uint8_t* attributes = static_cast<uint8_t*>(attributeDestination);
+
+		for (uint32_t i = 0; i < vertexCount; i++)
+		{
+			memcpy(positions + i * positionStride, source + i * stride, positionStride);
+			memcpy(attributes + i * attributeStride, source + i * stride + positionStride, attributeStride);
+		}
+	}
+
 	bool Mesh::LoadFromObj(const char* filename)
+	{
+		std::vector<Vertex> corners;
+		std::vector<uint32_t> triangleMaterials;
+		std::string error;
+
+		if (!ObjLoader::LoadTriangles(filename, corners, triangleMaterials, Materials, error))
+		{
+			std::cerr << filename << ": " << error << std::endl;
+			return false;
+		}
+
+		BuildIndexed(filename, corners, triangleMaterials);
+
+		return true;
+	}
+
+	bool Mesh::LoadFromObjTinyObj(const char* filename)
 	{
 		//attrib will contain the vertex arrays of the file
 		tinyobj::attrib_t attrib;
 		//shapes contains the info for each separate object in the file
 		std::vector<tinyobj::shape_t> shapes;
-		//materials contains the information about the material of each shape, but we won't use it.
+		//materials contains the information about the material of each shape
 		std::vector<tinyobj::material_t> materials;
 
 		//error and warning output from the load function
 		std::string warn;
 		std::string err;
 
+		//the material library is looked up next to the OBJ
+		const std::filesystem::path directory = std::filesystem::path(filename).parent_path();
+		const std::string materialDirectory = directory.empty() ? std::string() : directory.generic_string() + "/";
+
 		//load the OBJ file
-		bool result = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename, nullptr);
+		bool result = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename, materialDirectory.c_str());
 
 		//make sure to output the warnings to the console, in case there are issues with the file
 		if (!warn.empty()) 
@@ -84,6 +366,32 @@ namespace VKE
 		if (!result)
 			return false;
 
+		size_t cornerCount = 0;
+		for (size_t s = 0; s < shapes.size(); s++)
+		{
+			cornerCount += shapes[s].mesh.num_face_vertices.size() * 3;
+		}
+
+		std::vector<Vertex> corners;
+		corners.reserve(cornerCount);
+
+		Materials.clear();
+		for (const tinyobj::material_t& material : materials)
+		{
+			MeshMaterial meshMaterial;
+			meshMaterial.Name = material.name;
+			meshMaterial.DiffuseColor = glm::vec3(material.diffuse[0], material.diffuse[1], material.diffuse[2]);
+			meshMaterial.DiffuseTexture = material.diffuse_texname.empty() ? std::string() : (directory / material.diffuse_texname).generic_string();
+			meshMaterial.AlphaTexture = material.alpha_texname.empty() ? std::string() : (directory / material.alpha_texname).generic_string();
+			Materials.push_back(meshMaterial);
+		}
+
+		//faces without a material share a default one, added the first time it is needed
+		uint32_t defaultMaterial = ~0u;
+
+		std::vector<uint32_t> triangleMaterials;
+		triangleMaterials.reserve(cornerCount / 3);
+
 		// Loop over shapes
 		for (size_t s = 0; s < shapes.size(); s++) 
 		{
@@ -92,7 +400,18 @@ namespace VKE
 			for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) 
 			{
 				//hardcode loading to triangles
-				int fv = 3;
+				const size_t fv = 3;
+
+				const int materialId = shapes[s].mesh.material_ids[f];
+				if (materialId < 0 && defaultMaterial == ~0u)
+				{
+					defaultMaterial = static_cast<uint32_t>(Materials.size());
+					MeshMaterial material;
+					material.Name = "default";
+					Materials.push_back(material);
+				}
+
+				triangleMaterials.push_back(materialId < 0 ? defaultMaterial : static_cast<uint32_t>(materialId));
 
 				// Loop over vertices in the face.
 				for (size_t v = 0; v < fv; v++) {
@@ -127,12 +446,352 @@ namespace VKE
 					new_vert.UV.x = ux;
 					new_vert.UV.y = 1 - uy;
 
-					Vertices.push_back(new_vert);
+					corners.push_back(new_vert);
 				}
 				index_offset += fv;
 			}
 		}
 
+		BuildIndexed(filename, corners, triangleMaterials);
+
+		return true;
+	}
+
+	void Mesh::BuildIndexed(const char* name, const std::vector<Vertex>& corners, const std::vector<uint32_t>& triangleMaterials)
+	{
+		const size_t cornerCount = corners.size();
+		const size_t triangleCount = cornerCount / 3;
+
+		//counting sort of the triangles by material, stable so the file order survives within a submesh
+		const uint32_t materialCount = triangleMaterials.empty() ? 1 : *std::max_element(triangleMaterials.begin(), triangleMaterials.end()) + 1;
+
+		std::vector<uint32_t> materialOffsets(materialCount + 1, 0);
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			materialOffsets[(triangleMaterials.empty() ? 0 : triangleMaterials[t]) + 1]++;
+		}
+
+		for (uint32_t m = 0; m < materialCount; m++)
+		{
+			materialOffsets[m + 1] += materialOffsets[m];
+		}
+
+		std::vector<uint32_t> triangleOrder(triangleCount);
+		{
+			std::vector<uint32_t> fill(materialOffsets.begin(), materialOffsets.end() - 1);
+			for (size_t t = 0; t < triangleCount; t++)
+			{
+				triangleOrder[fill[triangleMaterials.empty() ? 0 : triangleMaterials[t]]++] = static_cast<uint32_t>(t);
+			}
+		}
+
+		//every face corner becomes an index, but only unique (position, normal, uv) tuples become vertices
+		std::unordered_map<Vertex, uint32_t, VertexHash, VertexEqual> uniqueVertices;
+		uniqueVertices.reserve(cornerCount);
+
+		CacheMapping.reset();
+		Vertices.clear();
+		Indices.clear();
+		Indices.reserve(cornerCount);
+
+		for (uint32_t triangle : triangleOrder)
+		{
+			for (uint32_t corner = 0; corner < 3; corner++)
+			{
+				const Vertex& vertex = corners[triangle * 3 + corner];
+
+				//reuse the vertex if we have already seen the same tuple
+				auto [it, inserted] = uniqueVertices.try_emplace(vertex, static_cast<uint32_t>(Vertices.size()));
+				if (inserted)
+				{
+					Vertices.push_back(vertex);
+				}
+
+				Indices.push_back(it->second);
+			}
+		}
+
+		Submeshes.clear();
+		for (uint32_t m = 0; m < materialCount; m++)
+		{
+			if (materialOffsets[m + 1] == materialOffsets[m])
+				continue;
+
+			Submesh submesh = {};
+			submesh.MaterialIndex = m;
+			submesh.FirstIndex = materialOffsets[m] * 3;
+			submesh.IndexCount = (materialOffsets[m + 1] - materialOffsets[m]) * 3;
+			Submeshes.push_back(submesh);
+		}
+
+		if (Materials.empty())
+		{
+			MeshMaterial material;
+			material.Name = "default";
+			Materials.push_back(material);
+		}
+
+		const size_t unindexedBytes = cornerCount * sizeof(Vertex);
+		const size_t indexedBytes = Vertices.size() * sizeof(Vertex) + Indices.size() * sizeof(uint32_t);
+
+		std::cout << "Mesh " << name << ": " << cornerCount << " vertices before deduplication, " << Vertices.size() << " after ("
+			<< Indices.size() << " indices, " << Submeshes.size() << " submeshes). Memory " << unindexedBytes / 1024 << " KB -> " << indexedBytes / 1024 << " KB";
+
+		if (unindexedBytes > 0)
+		{
+			std::cout << " (" << 100.0 * (1.0 - double(indexedBytes) / double(unindexedBytes)) << "% saved)";
+		}
+
+		std::cout << std::endl;
+
+		ComputeBounds();
+	}
+
+	void Mesh::SetSingleSubmesh()
+	{
+		Submesh submesh = {};
+		submesh.FirstIndex = 0;
+		submesh.IndexCount = static_cast<uint32_t>(Indices.size());
+
+		Submeshes = { submesh };
+
+		if (Materials.empty())
+		{
+			MeshMaterial material;
+			material.Name = "default";
+			Materials.push_back(material);
+		}
+	}
+
+	void Mesh::Optimize(const char* name)
+	{
+		const VertexCacheStatistics before = MeshOptimizer::AnalyzeVertexCache(Indices, static_cast<uint32_t>(Vertices.size()));
+
+		//triangles are reordered within their submesh, the material ranges stay where they are
+		std::vector<std::vector<uint32_t>> submeshIndices(Submeshes.size());
+		std::vector<std::vector<uint32_t>> submeshClusters(Submeshes.size());
+		size_t clusterCount = 0;
+
+		for (size_t i = 0; i < Submeshes.size(); i++)
+		{
+			const Submesh& submesh = Submeshes[i];
+			submeshIndices[i].assign(Indices.begin() + submesh.FirstIndex, Indices.begin() + submesh.FirstIndex + submesh.IndexCount);
+
+			MeshOptimizer::OptimizeVertexCache(submeshIndices[i], static_cast<uint32_t>(Vertices.size()), submeshClusters[i]);
+			std::copy(submeshIndices[i].begin(), submeshIndices[i].end(), Indices.begin() + submesh.FirstIndex);
+
+			clusterCount += submeshClusters[i].size();
+		}
+
+		const VertexCacheStatistics afterCache = MeshOptimizer::AnalyzeVertexCache(Indices, static_cast<uint32_t>(Vertices.size()));
+
+		//allow the overdraw pass to give up 5% of the cache efficiency
+		for (size_t i = 0; i < Submeshes.size(); i++)
+		{
+			MeshOptimizer::OptimizeOverdraw(submeshIndices[i], Vertices, submeshClusters[i], 1.05f);
+			std::copy(submeshIndices[i].begin(), submeshIndices[i].end(), Indices.begin() + Submeshes[i].FirstIndex);
+		}
+
+		MeshOptimizer::OptimizeVertexFetch(Indices, Vertices);
+
+		const VertexCacheStatistics after = MeshOptimizer::AnalyzeVertexCache(Indices, static_cast<uint32_t>(Vertices.size()));
+
+		std::cout << "Mesh " << name << ": ACMR " << before.ACMR << " -> " << afterCache.ACMR << " (vertex cache) -> " << after.ACMR << " (overdraw)"
+			<< ", ATVR " << before.ATVR << " -> " << after.ATVR << " (" << clusterCount << " clusters)" << std::endl;
+	}
+
+	void Mesh::GenerateLods(const char* name)
+	{
+		//levels keep halving the triangle count until simplification stalls
+		constexpr uint32_t MAX_LOD_COUNT = 8;
+		constexpr size_t MIN_LOD_TRIANGLES = 16;
+
+		//no level may move the surface by more than a quarter of the mesh size
+		const float maxError = GetBoundsRadius() * 0.5f;
+
+		//triangles and largest error of every level over all submeshes, for the log
+		std::vector<size_t> levelTriangles;
+		std::vector<float> levelErrors;
+
+		Lods.clear();
+
+		//every submesh gets its own chain, simplification keeps the borders between materials in place
+		for (Submesh& submesh : Submeshes)
+		{
+			submesh.FirstLod = static_cast<uint32_t>(Lods.size());
+			Lods.push_back({ submesh.FirstIndex, submesh.IndexCount, 0.0f });
+
+			std::vector<uint32_t> previous(Indices.begin() + submesh.FirstIndex, Indices.begin() + submesh.FirstIndex + submesh.IndexCount);
+			float previousError = 0.0f;
+
+			while (Lods.size() - submesh.FirstLod < MAX_LOD_COUNT - 1 && previous.size() / 3 > MIN_LOD_TRIANGLES)
+			{
+				std::vector<uint32_t> simplified;
+				const float error = MeshSimplifier::Simplify(Vertices, previous, previous.size() / 6 * 3, maxError - previousError, simplified);
+
+				//not worth another level if it barely got smaller
+				if (simplified.empty() || simplified.size() > previous.size() * 9 / 10)
+					break;
+
+				std::vector<uint32_t> clusters;
+				MeshOptimizer::OptimizeVertexCache(simplified, static_cast<uint32_t>(Vertices.size()), clusters);
+
+				//errors add up, as every level is simplified from the one before
+				previousError += error;
+
+				Lods.push_back({ static_cast<uint32_t>(Indices.size()), static_cast<uint32_t>(simplified.size()), previousError });
+				Indices.insert(Indices.end(), simplified.begin(), simplified.end());
+
+				previous.swap(simplified);
+			}
+
+			//dropping the mesh altogether is as wrong as its diameter
+			Lods.push_back({ static_cast<uint32_t>(Indices.size()), 0, std::max(GetBoundsRadius() * 2.0f, previousError) });
+			submesh.LodCount = static_cast<uint32_t>(Lods.size()) - submesh.FirstLod;
+
+			for (uint32_t level = 0; level + 1 < submesh.LodCount; level++)
+			{
+				if (level >= levelTriangles.size())
+				{
+					levelTriangles.push_back(0);
+					levelErrors.push_back(0.0f);
+				}
+
+				const MeshLod& lod = Lods[submesh.FirstLod + level];
+				levelTriangles[level] += lod.IndexCount / 3;
+				levelErrors[level] = std::max(levelErrors[level], lod.Error);
+			}
+		}
+
+		std::cout << "Mesh " << name << ": " << levelTriangles.size() << " levels of detail, triangles";
+		for (size_t i = 0; i < levelTriangles.size(); i++)
+		{
+			std::cout << (i == 0 ? " " : " / ") << levelTriangles[i];
+		}
+
+		std::cout << ", errors";
+		for (size_t i = 0; i < levelErrors.size(); i++)
+		{
+			std::cout << (i == 0 ? " " : " / ") << levelErrors[i];
+		}
+
+		std::cout << std::endl;
+	}
+
+	void Mesh::BuildMeshlets(const char* name)
+	{
+		Meshlets.clear();
+
+		uint32_t triangleCount = 0;
+		for (Submesh& submesh : Submeshes)
+		{
+			submesh.FirstMeshlet = static_cast<uint32_t>(Meshlets.size());
+			MeshletBuilder::Build(Vertices, Indices, submesh.FirstIndex, submesh.IndexCount, Meshlets);
+			submesh.MeshletCount = static_cast<uint32_t>(Meshlets.size()) - submesh.FirstMeshlet;
+
+			triangleCount += submesh.IndexCount / 3;
+		}
+
+		std::cout << "Mesh " << name << ": " << Meshlets.size() << " meshlets, " << (Meshlets.empty() ? 0.0 : double(triangleCount) / Meshlets.size()) << " triangles per meshlet" << std::endl;
+	}
+
+	float Mesh::GetBoundsRadius() const
+	{
+		return glm::length(BoundsMax - BoundsMin) * 0.5f;
+	}
+
+	bool Mesh::LoadFromObjCached(const char* filename, VertexFormat format)
+	{
+		if (MeshCache::Load(filename, format, *this))
+		{
+			std::cout << "Mesh " << filename << ": loaded " << GetVertexCount() << " vertices and " << GetIndexCount() << " indices from " << MeshCache::GetCachePath(filename) << std::endl;
+			return true;
+		}
+
+		if (!LoadFromObj(filename))
+			return false;
+
+		Optimize(filename);
+		GenerateLods(filename);
+		BuildMeshlets(filename);
+		EncodeVertices(format);
+
+		if (!MeshCache::Write(filename, *this))
+		{
+			std::cout << "WARN: could not write mesh cache " << MeshCache::GetCachePath(filename) << std::endl;
+		}
+
 		return true;
 	}
+
+	void Mesh::ComputeBounds()
+	{
+		const Vertex* vertices = GetVertexData();
+		const uint32_t vertexCount = GetVertexCount();
+
+		if (vertexCount == 0)
+		{
+			BoundsMin = BoundsMax = glm::vec3(0.0f);
+			return;
+		}
+
+		BoundsMin = BoundsMax = vertices[0].Position;
+		for (uint32_t i = 1; i < vertexCount; i++)
+		{
+			BoundsMin = glm::min(BoundsMin, vertices[i].Position);
+			BoundsMax = glm::max(BoundsMax, vertices[i].Position);
+		}
+	}
+
+	glm::mat4 Mesh::GetDequantizationMatrix() const
+	{
+		if (Format == VertexFormat::Full)
+			return glm::mat4(1.0f);
+
+		//positions are stored as (p - min) / extent
+		return glm::translate(BoundsMin) * glm::scale(GetQuantizationExtent(BoundsMin, BoundsMax));
+	}
+
+	glm::vec3 Mesh::GetDequantizationScale() const
+	{
+		return Format == VertexFormat::Full ? glm::vec3(1.0f) : GetQuantizationExtent(BoundsMin, BoundsMax);
+	}
+
+	void Mesh::EncodeVertices(VertexFormat format)
+	{
+		Format = format;
+		PackedVertices.clear();
+
+		if (format == VertexFormat::Full)
+			return;
+
+		const Vertex* vertices = GetVertexData();
+		const uint32_t vertexCount = GetVertexCount();
+		const uint32_t stride = GetVertexStride(format);
+
+		const glm::vec3 extent = GetQuantizationExtent(BoundsMin, BoundsMax);
+
+		PackedVertices.resize(static_cast<size_t>(vertexCount) * stride);
+
+		for (uint32_t i = 0; i < vertexCount; i++)
+		{
+			const Vertex& vertex = vertices[i];
+
+			PackedVertex packed;
+
+			const glm::vec3 position = glm::clamp((vertex.Position - BoundsMin) / extent, 0.0f, 1.0f);
+			const uint64_t quantized = glm::packUnorm4x16(glm::vec4(position, 1.0f));
+			memcpy(packed.Position, &quantized, sizeof(packed.Position));
+
+			packed.Normal = glm::packSnorm2x16(OctahedralEncode(vertex.Normal));
+			packed.UV = glm::packHalf2x16(vertex.UV);
+			packed.Color = glm::packUnorm4x8(glm::vec4(glm::clamp(vertex.Color, 0.0f, 1.0f), 1.0f));
+
+			//PackedVertexNoColor is a prefix of PackedVertex
+			memcpy(PackedVertices.data() + static_cast<size_t>(i) * stride, &packed, stride);
+		}
+
+		const size_t fullBytes = static_cast<size_t>(vertexCount) * sizeof(Vertex);
+		std::cout << "Mesh vertices packed to " << stride << " bytes: " << fullBytes / 1024 << " KB -> " << PackedVertices.size() / 1024 << " KB" << std::endl;
+	}
 }
\ No newline at end of file
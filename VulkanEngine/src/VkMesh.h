@@ -4,8 +4,11 @@
 
 #include <glm\vec3.hpp>
 #include <glm\vec2.hpp>
+#include <glm\mat4x4.hpp>
 
 #include <iostream>
+#include <memory>
+#include <string>
 #include <vector>
 
 namespace VKE
@@ -18,6 +21,27 @@ namespace VKE
 		VkPipelineVertexInputStateCreateFlags Flags = 0;
 	};
 
+	//how the vertex attributes are spread over vertex buffer bindings
+	enum class VertexLayout : uint32_t
+	{
+		//every attribute in binding 0
+		Interleaved = 0,
+		//positions alone in binding 0, the other attributes in binding 1, so depth only passes fetch just the positions
+		Split = 1,
+
+		Count
+	};
+
+	//where a mesh lives in the GeometryBuffer: a range of vertices in the pool of its format and layout and a range of the shared index buffer.
+	//an empty range means the mesh isn't uploaded
+	struct GeometryRange
+	{
+		uint32_t VertexOffset = 0;
+		uint32_t VertexCount = 0;
+		uint32_t FirstIndex = 0;
+		uint32_t IndexCount = 0;
+	};
+
 	struct Vertex
 	{
 		glm::vec3 Position;
@@ -25,14 +49,205 @@ namespace VKE
 		glm::vec3 Color;
 		glm::vec2 UV;
 
-		static VertexInputDescription GetVertexDescription();
+		bool operator==(const Vertex& other) const;
+
+		static VertexInputDescription GetVertexDescription(VertexLayout layout = VertexLayout::Interleaved);
+	};
+
+	//GPU side layout of a mesh's vertex stream
+	enum class VertexFormat : uint32_t
+	{
+		//Vertex as is, 44 bytes
+		Full = 0,
+		//PackedVertex, 20 bytes
+		Packed = 1,
+		//PackedVertexNoColor, 16 bytes. the shader uses the normal as color, like the importer does
+		PackedNoColor = 2,
+
+		Count
+	};
+
+	//position quantized to 16 bit UNORM inside the mesh bounds (w is always 1),
+	//octahedral normal as 2x16 bit SNORM, UV as 2 halfs and color as RGBA8 UNORM
+	struct PackedVertex
+	{
+		uint16_t Position[4];
+		uint32_t Normal;
+		uint32_t UV;
+		uint32_t Color;
 	};
 
+	struct PackedVertexNoColor
+	{
+		uint16_t Position[4];
+		uint32_t Normal;
+		uint32_t UV;
+	};
+
+	uint32_t GetVertexStride(VertexFormat format);
+	//size of the position, which comes first in every format
+	uint32_t GetPositionStride(VertexFormat format);
+	const char* GetVertexFormatName(VertexFormat format);
+	const char* GetVertexLayoutName(VertexLayout layout);
+	VertexInputDescription GetVertexDescription(VertexFormat format, VertexLayout layout = VertexLayout::Interleaved);
+	//binding 0 with just the position at location 0, for depth only pipelines
+	VertexInputDescription GetPositionDescription(VertexFormat format, VertexLayout layout);
+
+	//vertex buffer binding of the per instance model matrices, after the position and attribute streams
+	constexpr uint32_t INSTANCE_BINDING = 2;
+	//the matrix's columns take this location and the three after it
+	constexpr uint32_t INSTANCE_MATRIX_LOCATION = 4;
+	//adds the per instance model matrix read by the instanced vertex shaders
+	void AddInstanceAttributes(VertexInputDescription& description);
+
+	//range of the index buffer holding one level of detail.
+	//Error is how far (object space) the level may deviate from the full resolution surface
+	struct MeshLod
+	{
+		uint32_t FirstIndex;
+		uint32_t IndexCount;
+		float Error;
+	};
+
+	//cluster of up to MAX_MESHLET_TRIANGLES consecutive triangles of the finest level of detail.
+	//the sphere bounds the triangles, the cone bounds their normals so whole clusters can be culled as backfacing
+	struct Meshlet
+	{
+		uint32_t FirstIndex;
+		uint32_t IndexCount;
+
+		glm::vec3 Center;
+		float Radius;
+
+		glm::vec3 ConeAxis;
+		//sine of the cone half angle widened to a hemisphere, 1 when the cluster can't be backface culled
+		float ConeCutoff;
+	};
+
+	//material descriptor read from the OBJ's material library. texture paths are relative to the working directory
+	struct MeshMaterial
+	{
+		std::string Name;
+		glm::vec3 DiffuseColor = glm::vec3(1.0f);
+		std::string DiffuseTexture;
+		//a separate alpha map marks the material as alpha tested
+		std::string AlphaTexture;
+	};
+
+	//triangles of one material. LOD0 is the range [FirstIndex, FirstIndex + IndexCount) of the shared index buffer,
+	//the submesh's levels of detail and meshlets are ranges into the mesh's Lods and Meshlets
+	struct Submesh
+	{
+		uint32_t MaterialIndex;
+		uint32_t FirstIndex;
+		uint32_t IndexCount;
+
+		uint32_t FirstLod;
+		uint32_t LodCount;
+
+		uint32_t FirstMeshlet;
+		uint32_t MeshletCount;
+	};
+
+	class MappedFile;
+
 	struct Mesh
 	{
 		std::vector<Vertex> Vertices;
-		AllocatedBuffer VertexBuffer;
+		std::vector<uint32_t> Indices;
+
+		//one range per material, sorted by material. every imported mesh has at least one
+		std::vector<Submesh> Submeshes;
+		std::vector<MeshMaterial> Materials;
+
+		//levels of detail of every submesh, finest first. they share the vertices and live one after the other in the index buffer.
+		//the last level of a submesh is empty, its error is the mesh diameter
+		std::vector<MeshLod> Lods;
+
+		//clusters covering the finest level of detail of every submesh, in index buffer order
+		std::vector<Meshlet> Meshlets;
+
+		//local space bounding box, computed at import
+		glm::vec3 BoundsMin = glm::vec3(0.0f);
+		glm::vec3 BoundsMax = glm::vec3(0.0f);
+
+		//when the mesh comes from the binary cache its streams are read in place from the mapping
+		std::shared_ptr<MappedFile> CacheMapping;
+		const Vertex* MappedVertices = nullptr;
+		const uint32_t* MappedIndices = nullptr;
+		uint32_t MappedVertexCount = 0;
+		uint32_t MappedIndexCount = 0;
+
+		//layout of the vertex buffer, the packed stream is encoded from the full vertices at import
+		VertexFormat Format = VertexFormat::Full;
+		//chosen at upload, split meshes store all positions first and the other attributes after them
+		VertexLayout Layout = VertexLayout::Interleaved;
+		std::vector<uint8_t> PackedVertices;
+		const uint8_t* MappedPackedVertices = nullptr;
+
+		//ranges in the engine's GeometryBuffer, set at upload
+		GeometryRange Geometry;
+		//staging ring submission carrying the data, the mesh is drawn once the graphics queue has acquired it
+		uint64_t UploadToken = 0;
+		//handle of the engine's residency manager, UINT32_MAX until the mesh is uploaded
+		uint32_t ResidencyHandle = UINT32_MAX;
+		//small id of the mesh in the draw sort key, set at upload
+		uint32_t SortId = 0;
+
+		const Vertex* GetVertexData() const { return CacheMapping ? MappedVertices : Vertices.data(); }
+		uint32_t GetVertexCount() const { return CacheMapping ? MappedVertexCount : static_cast<uint32_t>(Vertices.size()); }
+		const uint32_t* GetIndexData() const { return CacheMapping ? MappedIndices : Indices.data(); }
+		uint32_t GetIndexCount() const { return CacheMapping ? MappedIndexCount : static_cast<uint32_t>(Indices.size()); }
+
+		const uint8_t* GetPackedVertexData() const { return CacheMapping ? MappedPackedVertices : PackedVertices.data(); }
+
+		//vertex stream in the mesh's format, this is what gets uploaded
+		const void* GetGpuVertexData() const { return Format == VertexFormat::Full ? static_cast<const void*>(GetVertexData()) : GetPackedVertexData(); }
+		size_t GetGpuVertexSize() const { return static_cast<size_t>(GetVertexCount()) * GetVertexStride(Format); }
+
+		//writes the GetGpuVertexSize() bytes of the vertex buffer in the mesh's Layout
+		void WriteGpuVertices(void* destination) const;
+		//the same into separate streams, attributes is only written for a split mesh
+		void WriteGpuVertices(void* positions, void* attributes) const;
+		//where the attribute stream starts in the output of WriteGpuVertices for a split mesh
+		size_t GetAttributeStreamOffset() const { return Layout == VertexLayout::Split ? static_cast<size_t>(GetVertexCount()) * GetPositionStride(Format) : 0; }
+
+		//maps the quantized positions back into local space, to be applied before the model matrix
+		glm::mat4 GetDequantizationMatrix() const;
+		//the same mapping as position * scale + offset, an identity for full vertices
+		glm::vec3 GetDequantizationScale() const;
+		glm::vec3 GetDequantizationOffset() const { return Format == VertexFormat::Full ? glm::vec3(0.0f) : BoundsMin; }
+
+		//encodes the full vertices into the given format
+		void EncodeVertices(VertexFormat format);
+
+		void ComputeBounds();
+
+		//fills Vertices and Indices from a flat triangle list, merging bit-identical vertices.
+		//the triangles are grouped into one submesh per entry of triangleMaterials (one material index per triangle),
+		//an empty triangleMaterials puts everything into a single submesh
+		void BuildIndexed(const char* name, const std::vector<Vertex>& corners, const std::vector<uint32_t>& triangleMaterials = {});
+
+		//a single submesh covering the whole index buffer, for meshes that are built by hand
+		void SetSingleSubmesh();
+
+		//reorders the triangles of every submesh for the post-transform cache and overdraw, then the vertices for fetch locality
+		void Optimize(const char* name);
+
+		//simplifies every submesh into a chain of levels of detail with half the triangles each and appends them to Indices
+		void GenerateLods(const char* name);
+
+		//splits the finest level of detail of every submesh into meshlets with culling bounds
+		void BuildMeshlets(const char* name);
+
+		glm::vec3 GetBoundsCenter() const { return (BoundsMin + BoundsMax) * 0.5f; }
+		float GetBoundsRadius() const;
 
+		//imports with the multithreaded ObjLoader
 		bool LoadFromObj(const char* filename);
+		//single threaded import through tinyobjloader, kept as a reference for benchmarking
+		bool LoadFromObjTinyObj(const char* filename);
+		//loads from the .vkmesh cache when it is up to date, otherwise imports the OBJ and writes the cache
+		bool LoadFromObjCached(const char* filename, VertexFormat format = VertexFormat::Full);
 	};
 }
@@ -0,0 +1,536 @@
+#include "VkMeshCache.h"
+#include "VkObjLoader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+namespace VKE
+{
+	namespace
+	{
+		size_t AlignUp(size_t value, size_t alignment)
+		{
+			return (value + alignment - 1) & ~(alignment - 1);
+		}
+
+		//64 bit FNV-1a over 8 byte words, the tail is hashed byte by byte
+		uint64_t HashBytes(const uint8_t* data, size_t size)
+		{
+			uint64_t hash = 14695981039346656037ull;
+			const uint64_t prime = 1099511628211ull;
+
+			size_t i = 0;
+			for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+			{
+				uint64_t word;
+				memcpy(&word, data + i, sizeof(uint64_t));
+				hash = (hash ^ word) * prime;
+			}
+
+			for (; i < size; i++)
+			{
+				hash = (hash ^ data[i]) * prime;
+			}
+
+			return hash;
+		}
+
+		//a file that can't be read leaves the info untouched
+		bool QueryFileInfo(const char* path, uint64_t& outSize, int64_t& outModifiedTime, MappedFile& outMapping)
+		{
+			std::error_code error;
+
+			const uintmax_t size = std::filesystem::file_size(path, error);
+			if (error)
+				return false;
+
+			const auto modifiedTime = std::filesystem::last_write_time(path, error);
+			if (error)
+				return false;
+
+			if (!outMapping.Open(path))
+				return false;
+
+			outSize = static_cast<uint64_t>(size);
+			outModifiedTime = static_cast<int64_t>(modifiedTime.time_since_epoch().count());
+			return true;
+		}
+
+		//[first, first + count) lies inside [0, size)
+		bool IsRangeInside(uint64_t first, uint64_t count, uint64_t size)
+		{
+			return first <= size && count <= size - first;
+		}
+
+		const MeshCacheSection* FindSection(const MeshCacheSection* sections, uint32_t count, MeshCacheSectionType type)
+		{
+			for (uint32_t i = 0; i < count; i++)
+			{
+				if (sections[i].Type == type)
+					return &sections[i];
+			}
+
+			return nullptr;
+		}
+	}
+
+	MappedFile::~MappedFile()
+	{
+		Close();
+	}
+
+	bool MappedFile::Open(const char* path)
+	{
+		Close();
+
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+		{
+			CloseHandle(file);
+			return false;
+		}
+
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping == nullptr)
+		{
+			CloseHandle(file);
+			return false;
+		}
+
+		void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (data == nullptr)
+		{
+			CloseHandle(mapping);
+			CloseHandle(file);
+			return false;
+		}
+
+		m_FileHandle = file;
+		m_MappingHandle = mapping;
+		m_Data = static_cast<const uint8_t*>(data);
+		m_Size = static_cast<size_t>(fileSize.QuadPart);
+#else
+		int fd = open(path, O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat fileStat;
+		if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+		{
+			close(fd);
+			return false;
+		}
+
+		void* data = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			close(fd);
+			return false;
+		}
+
+		m_FileDescriptor = fd;
+		m_Data = static_cast<const uint8_t*>(data);
+		m_Size = static_cast<size_t>(fileStat.st_size);
+#endif
+
+		return true;
+	}
+
+	void MappedFile::Close()
+	{
+		if (m_Data == nullptr)
+			return;
+
+#ifdef _WIN32
+		UnmapViewOfFile(m_Data);
+		CloseHandle(m_MappingHandle);
+		CloseHandle(m_FileHandle);
+		m_MappingHandle = nullptr;
+		m_FileHandle = nullptr;
+#else
+		munmap(const_cast<uint8_t*>(m_Data), m_Size);
+		close(m_FileDescriptor);
+		m_FileDescriptor = -1;
+#endif
+
+		m_Data = nullptr;
+		m_Size = 0;
+	}
+
+	std::string MeshCache::GetCachePath(const char* sourceFile)
+	{
+		return std::string(sourceFile) + ".vkmesh";
+	}
+
+	bool MeshCache::QuerySourceInfo(const char* sourceFile, MeshSourceInfo& outInfo)
+	{
+		//hash through a mapping so we never copy the source into a buffer
+		MappedFile source;
+		if (!QueryFileInfo(sourceFile, outInfo.Size, outInfo.ModifiedTime, source))
+			return false;
+
+		outInfo.Hash = HashBytes(source.GetData(), source.GetSize());
+
+		outInfo.MaterialLibrary = ObjLoader::FindMaterialLibrary(sourceFile, reinterpret_cast<const char*>(source.GetData()), source.GetSize());
+		outInfo.MaterialLibrarySize = 0;
+		outInfo.MaterialLibraryModifiedTime = 0;
+		outInfo.MaterialLibraryHash = HashBytes(reinterpret_cast<const uint8_t*>(outInfo.MaterialLibrary.data()), outInfo.MaterialLibrary.size());
+
+		MappedFile library;
+		if (!outInfo.MaterialLibrary.empty() && QueryFileInfo(outInfo.MaterialLibrary.c_str(), outInfo.MaterialLibrarySize, outInfo.MaterialLibraryModifiedTime, library))
+		{
+			outInfo.MaterialLibraryHash ^= HashBytes(library.GetData(), library.GetSize());
+		}
+
+		return true;
+	}
+
+	bool MeshCache::Load(const char* sourceFile, VertexFormat format, Mesh& outMesh)
+	{
+		MeshSourceInfo sourceInfo;
+		if (!QuerySourceInfo(sourceFile, sourceInfo))
+			return false;
+
+		const std::string cachePath = GetCachePath(sourceFile);
+
+		auto mapping = std::make_shared<MappedFile>();
+		if (!mapping->Open(cachePath.c_str()))
+			return false;
+
+		const uint8_t* data = mapping->GetData();
+		const size_t size = mapping->GetSize();
+
+		if (size < sizeof(MeshCacheHeader))
+			return false;
+
+		MeshCacheHeader header;
+		memcpy(&header, data, sizeof(MeshCacheHeader));
+
+		if (header.Magic != MESH_CACHE_MAGIC || header.Version != MESH_CACHE_VERSION)
+		{
+			std::cout << "Mesh cache " << cachePath << " has an unsupported version, rebuilding." << std::endl;
+			return false;
+		}
+
+		if (header.SourceSize != sourceInfo.Size || header.SourceModifiedTime != sourceInfo.ModifiedTime || header.SourceHash != sourceInfo.Hash ||
+			header.MaterialLibrarySize != sourceInfo.MaterialLibrarySize || header.MaterialLibraryModifiedTime != sourceInfo.MaterialLibraryModifiedTime ||
+			header.MaterialLibraryHash != sourceInfo.MaterialLibraryHash)
+		{
+			std::cout << "Mesh cache " << cachePath << " is out of date, rebuilding." << std::endl;
+			return false;
+		}
+
+		if (header.Format != format)
+		{
+			std::cout << "Mesh cache " << cachePath << " was built for another vertex format, rebuilding." << std::endl;
+			return false;
+		}
+
+		const size_t tableEnd = sizeof(MeshCacheHeader) + header.SectionCount * sizeof(MeshCacheSection);
+		if (size < tableEnd)
+			return false;
+
+		const MeshCacheSection* sections = reinterpret_cast<const MeshCacheSection*>(data + sizeof(MeshCacheHeader));
+
+		for (uint32_t i = 0; i < header.SectionCount; i++)
+		{
+			if (sections[i].Offset % MESH_CACHE_ALIGNMENT != 0 || !IsRangeInside(sections[i].Offset, sections[i].Size, size))
+				return false;
+		}
+
+		const MeshCacheSection* vertexSection = FindSection(sections, header.SectionCount, MeshCacheSectionType::Vertices);
+		const MeshCacheSection* indexSection = FindSection(sections, header.SectionCount, MeshCacheSectionType::Indices);
+
+		if (vertexSection == nullptr || vertexSection->ElementSize != sizeof(Vertex))
+			return false;
+
+		if (indexSection != nullptr && indexSection->ElementSize != sizeof(uint32_t))
+			return false;
+
+		const MeshCacheSection* lodSection = FindSection(sections, header.SectionCount, MeshCacheSectionType::Lods);
+		if (lodSection != nullptr && lodSection->ElementSize != sizeof(MeshLod))
+			return false;
+
+		const MeshCacheSection* meshletSection = FindSection(sections, header.SectionCount, MeshCacheSectionType::Meshlets);
+		if (meshletSection != nullptr && meshletSection->ElementSize != sizeof(Meshlet))
+			return false;
+
+		//every mesh is written with at least one submesh and material
+		const MeshCacheSection* submeshSection = FindSection(sections, header.SectionCount, MeshCacheSectionType::Submeshes);
+		const MeshCacheSection* materialSection = FindSection(sections, header.SectionCount, MeshCacheSectionType::Materials);
+		const MeshCacheSection* stringSection = FindSection(sections, header.SectionCount, MeshCacheSectionType::Strings);
+
+		if (submeshSection == nullptr || submeshSection->ElementSize != sizeof(Submesh) || submeshSection->Size == 0)
+			return false;
+
+		if (materialSection == nullptr || materialSection->ElementSize != sizeof(MeshCacheMaterial) || stringSection == nullptr)
+			return false;
+
+		const Submesh* submeshes = reinterpret_cast<const Submesh*>(data + submeshSection->Offset);
+		const uint64_t submeshCount = submeshSection->Size / sizeof(Submesh);
+		const uint64_t materialCount = materialSection->Size / sizeof(MeshCacheMaterial);
+
+		//without an index stream the ranges index the vertices directly
+		const uint64_t vertexCount = vertexSection->Size / sizeof(Vertex);
+		const uint64_t indexCount = indexSection != nullptr ? indexSection->Size / sizeof(uint32_t) : vertexCount;
+
+		const MeshLod* lods = lodSection != nullptr ? reinterpret_cast<const MeshLod*>(data + lodSection->Offset) : nullptr;
+		const uint64_t lodCount = lodSection != nullptr ? lodSection->Size / sizeof(MeshLod) : 0;
+
+		const Meshlet* meshlets = meshletSection != nullptr ? reinterpret_cast<const Meshlet*>(data + meshletSection->Offset) : nullptr;
+		const uint64_t meshletCount = meshletSection != nullptr ? meshletSection->Size / sizeof(Meshlet) : 0;
+
+		//the draws read these ranges without checking them, a cache with one outside its section is rebuilt
+		bool rangesValid = true;
+		for (uint64_t i = 0; i < submeshCount && rangesValid; i++)
+		{
+			const Submesh& submesh = submeshes[i];
+			rangesValid = submesh.MaterialIndex < materialCount && IsRangeInside(submesh.FirstIndex, submesh.IndexCount, indexCount) &&
+				IsRangeInside(submesh.FirstLod, submesh.LodCount, lodCount) && IsRangeInside(submesh.FirstMeshlet, submesh.MeshletCount, meshletCount);
+		}
+
+		for (uint64_t i = 0; i < lodCount && rangesValid; i++)
+		{
+			rangesValid = IsRangeInside(lods[i].FirstIndex, lods[i].IndexCount, indexCount);
+		}
+
+		for (uint64_t i = 0; i < meshletCount && rangesValid; i++)
+		{
+			rangesValid = IsRangeInside(meshlets[i].FirstIndex, meshlets[i].IndexCount, indexCount);
+		}
+
+		if (!rangesValid)
+		{
+			std::cout << "Mesh cache " << cachePath << " has ranges outside of its sections, rebuilding." << std::endl;
+			return false;
+		}
+
+		//an index past MappedVertexCount would make the GPU read outside the mesh's vertices.
+		//one pass over the mapped stream, the maximum without a branch per index
+		if (indexSection != nullptr && indexCount > 0)
+		{
+			const uint32_t* indices = reinterpret_cast<const uint32_t*>(data + indexSection->Offset);
+
+			uint32_t maxIndex = 0;
+			for (uint64_t i = 0; i < indexCount; i++)
+			{
+				maxIndex = std::max(maxIndex, indices[i]);
+			}
+
+			if (maxIndex >= vertexCount)
+			{
+				std::cout << "Mesh cache " << cachePath << " has indices past its " << vertexCount << " vertices, rebuilding." << std::endl;
+				return false;
+			}
+		}
+
+		const MeshCacheMaterial* cacheMaterials = reinterpret_cast<const MeshCacheMaterial*>(data + materialSection->Offset);
+		const char* strings = reinterpret_cast<const char*>(data + stringSection->Offset);
+
+		for (uint64_t i = 0; i < materialCount; i++)
+		{
+			const MeshCacheMaterial& material = cacheMaterials[i];
+			if (uint64_t(material.NameOffset) + material.NameLength > stringSection->Size ||
+				uint64_t(material.DiffuseTextureOffset) + material.DiffuseTextureLength > stringSection->Size ||
+				uint64_t(material.AlphaTextureOffset) + material.AlphaTextureLength > stringSection->Size)
+				return false;
+		}
+
+		const MeshCacheSection* packedSection = FindSection(sections, header.SectionCount, MeshCacheSectionType::PackedVertices);
+		if (format != VertexFormat::Full)
+		{
+			if (packedSection == nullptr || packedSection->ElementSize != GetVertexStride(format) ||
+				packedSection->Size / packedSection->ElementSize != vertexSection->Size / sizeof(Vertex))
+				return false;
+		}
+
+		outMesh.Vertices.clear();
+		outMesh.Indices.clear();
+
+		outMesh.MappedVertices = reinterpret_cast<const Vertex*>(data + vertexSection->Offset);
+		outMesh.MappedVertexCount = static_cast<uint32_t>(vertexSection->Size / sizeof(Vertex));
+
+		//the index stream is optional, a mesh without one is drawn with a sequential index range
+		outMesh.MappedIndices = indexSection ? reinterpret_cast<const uint32_t*>(data + indexSection->Offset) : nullptr;
+		outMesh.MappedIndexCount = indexSection ? static_cast<uint32_t>(indexSection->Size / sizeof(uint32_t)) : 0;
+
+		//the level table is tiny, so it is copied out instead of being read in place
+		outMesh.Lods.assign(lods, lods + lodCount);
+		outMesh.Meshlets.assign(meshlets, meshlets + meshletCount);
+
+		outMesh.Submeshes.assign(submeshes, submeshes + submeshCount);
+
+		outMesh.Materials.clear();
+		for (uint64_t i = 0; i < materialCount; i++)
+		{
+			const MeshCacheMaterial& cacheMaterial = cacheMaterials[i];
+
+			MeshMaterial material;
+			material.Name.assign(strings + cacheMaterial.NameOffset, cacheMaterial.NameLength);
+			material.DiffuseColor = glm::vec3(cacheMaterial.DiffuseColor[0], cacheMaterial.DiffuseColor[1], cacheMaterial.DiffuseColor[2]);
+			material.DiffuseTexture.assign(strings + cacheMaterial.DiffuseTextureOffset, cacheMaterial.DiffuseTextureLength);
+			material.AlphaTexture.assign(strings + cacheMaterial.AlphaTextureOffset, cacheMaterial.AlphaTextureLength);
+			outMesh.Materials.push_back(material);
+		}
+
+		outMesh.Format = format;
+		outMesh.PackedVertices.clear();
+		outMesh.MappedPackedVertices = format != VertexFormat::Full ? data + packedSection->Offset : nullptr;
+
+		outMesh.BoundsMin = glm::vec3(header.BoundsMin[0], header.BoundsMin[1], header.BoundsMin[2]);
+		outMesh.BoundsMax = glm::vec3(header.BoundsMax[0], header.BoundsMax[1], header.BoundsMax[2]);
+
+		outMesh.CacheMapping = std::move(mapping);
+
+		return true;
+	}
+
+	bool MeshCache::Write(const char* sourceFile, const Mesh& mesh)
+	{
+		MeshSourceInfo sourceInfo;
+		if (!QuerySourceInfo(sourceFile, sourceInfo))
+			return false;
+
+		std::vector<MeshCacheSection> sections;
+		std::vector<const void*> sectionData;
+
+		auto addSection = [&](MeshCacheSectionType type, uint32_t elementSize, uint64_t count, const void* payload)
+		{
+			MeshCacheSection section = {};
+			section.Type = type;
+			section.ElementSize = elementSize;
+			section.Size = count * elementSize;
+
+			sections.push_back(section);
+			sectionData.push_back(payload);
+		};
+
+		addSection(MeshCacheSectionType::Vertices, sizeof(Vertex), mesh.GetVertexCount(), mesh.GetVertexData());
+
+		if (mesh.GetIndexCount() > 0)
+		{
+			addSection(MeshCacheSectionType::Indices, sizeof(uint32_t), mesh.GetIndexCount(), mesh.GetIndexData());
+		}
+
+		if (!mesh.Lods.empty())
+		{
+			addSection(MeshCacheSectionType::Lods, sizeof(MeshLod), mesh.Lods.size(), mesh.Lods.data());
+		}
+
+		if (!mesh.Meshlets.empty())
+		{
+			addSection(MeshCacheSectionType::Meshlets, sizeof(Meshlet), mesh.Meshlets.size(), mesh.Meshlets.data());
+		}
+
+		//the strings of all materials go into one blob, the material table points into it
+		std::vector<MeshCacheMaterial> cacheMaterials;
+		std::string strings;
+
+		auto addString = [&strings](const std::string& value, uint32_t& outOffset, uint32_t& outLength)
+		{
+			outOffset = static_cast<uint32_t>(strings.size());
+			outLength = static_cast<uint32_t>(value.size());
+			strings += value;
+		};
+
+		for (const MeshMaterial& material : mesh.Materials)
+		{
+			MeshCacheMaterial cacheMaterial = {};
+			addString(material.Name, cacheMaterial.NameOffset, cacheMaterial.NameLength);
+			addString(material.DiffuseTexture, cacheMaterial.DiffuseTextureOffset, cacheMaterial.DiffuseTextureLength);
+			addString(material.AlphaTexture, cacheMaterial.AlphaTextureOffset, cacheMaterial.AlphaTextureLength);
+
+			for (int channel = 0; channel < 3; channel++)
+			{
+				cacheMaterial.DiffuseColor[channel] = material.DiffuseColor[channel];
+			}
+
+			cacheMaterials.push_back(cacheMaterial);
+		}
+
+		addSection(MeshCacheSectionType::Submeshes, sizeof(Submesh), mesh.Submeshes.size(), mesh.Submeshes.data());
+		addSection(MeshCacheSectionType::Materials, sizeof(MeshCacheMaterial), cacheMaterials.size(), cacheMaterials.data());
+		addSection(MeshCacheSectionType::Strings, sizeof(char), strings.size(), strings.data());
+
+		if (mesh.Format != VertexFormat::Full)
+		{
+			addSection(MeshCacheSectionType::PackedVertices, GetVertexStride(mesh.Format), mesh.GetVertexCount(), mesh.GetPackedVertexData());
+		}
+
+		const uint32_t sectionCount = static_cast<uint32_t>(sections.size());
+
+		size_t offset = AlignUp(sizeof(MeshCacheHeader) + sectionCount * sizeof(MeshCacheSection), MESH_CACHE_ALIGNMENT);
+		for (uint32_t i = 0; i < sectionCount; i++)
+		{
+			sections[i].Offset = offset;
+			offset = AlignUp(offset + sections[i].Size, MESH_CACHE_ALIGNMENT);
+		}
+
+		MeshCacheHeader header = {};
+		header.Magic = MESH_CACHE_MAGIC;
+		header.Version = MESH_CACHE_VERSION;
+		header.SourceSize = sourceInfo.Size;
+		header.SourceModifiedTime = sourceInfo.ModifiedTime;
+		header.SourceHash = sourceInfo.Hash;
+		header.MaterialLibrarySize = sourceInfo.MaterialLibrarySize;
+		header.MaterialLibraryModifiedTime = sourceInfo.MaterialLibraryModifiedTime;
+		header.MaterialLibraryHash = sourceInfo.MaterialLibraryHash;
+		header.SectionCount = sectionCount;
+		header.Format = mesh.Format;
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			header.BoundsMin[axis] = mesh.BoundsMin[axis];
+			header.BoundsMax[axis] = mesh.BoundsMax[axis];
+		}
+
+		//write to a temporary file first so an interrupted write never leaves a valid-looking cache behind
+		const std::string cachePath = GetCachePath(sourceFile);
+		const std::string tempPath = cachePath + ".tmp";
+
+		{
+			std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+			if (!file.is_open())
+				return false;
+
+			const char padding[MESH_CACHE_ALIGNMENT] = {};
+
+			file.write(reinterpret_cast<const char*>(&header), sizeof(MeshCacheHeader));
+			file.write(reinterpret_cast<const char*>(sections.data()), sectionCount * sizeof(MeshCacheSection));
+
+			size_t written = sizeof(MeshCacheHeader) + sectionCount * sizeof(MeshCacheSection);
+			for (uint32_t i = 0; i < sectionCount; i++)
+			{
+				file.write(padding, sections[i].Offset - written);
+				file.write(static_cast<const char*>(sectionData[i]), sections[i].Size);
+				written = sections[i].Offset + sections[i].Size;
+			}
+
+			if (!file.good())
+				return false;
+		}
+
+		std::error_code error;
+		std::filesystem::rename(tempPath, cachePath, error);
+
+		return !error;
+	}
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "VkMesh.h"
+
+#include <string>
+
+namespace VKE
+{
+	//read-only memory mapping of a whole file
+	class MappedFile
+	{
+	public:
+		MappedFile() = default;
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		bool Open(const char* path);
+		void Close();
+
+		const uint8_t* GetData() const { return m_Data; }
+		size_t GetSize() const { return m_Size; }
+
+	private:
+		const uint8_t* m_Data = nullptr;
+		size_t m_Size = 0;
+
+#ifdef _WIN32
+		void* m_FileHandle = nullptr;
+		void* m_MappingHandle = nullptr;
+#else
+		int m_FileDescriptor = -1;
+#endif
+	};
+
+	//identity of the source file a cache was built from, and of the material library it references.
+	//a library that is referenced but missing has size and time 0, its hash still covers the path
+	struct MeshSourceInfo
+	{
+		uint64_t Size = 0;
+		int64_t ModifiedTime = 0;
+		uint64_t Hash = 0;
+
+		std::string MaterialLibrary;
+		uint64_t MaterialLibrarySize = 0;
+		int64_t MaterialLibraryModifiedTime = 0;
+		uint64_t MaterialLibraryHash = 0;
+	};
+
+	//versioned binary container for imported meshes (.vkmesh next to the source file).
+	//the file is a MeshCacheHeader, a table of MeshCacheSections and the section payloads,
+	//each aligned to MESH_CACHE_ALIGNMENT so they can be read in place from the mapping
+	constexpr uint32_t MESH_CACHE_MAGIC = 0x434D4B56; //"VKMC"
+	constexpr uint32_t MESH_CACHE_VERSION = 6;
+	constexpr uint32_t MESH_CACHE_ALIGNMENT = 16;
+
+	enum class MeshCacheSectionType : uint32_t
+	{
+		Vertices = 0,
+		Indices = 1,
+		//vertex stream in the header's VertexFormat, absent for VertexFormat::Full
+		PackedVertices = 2,
+		//MeshLod ranges into the index stream
+		Lods = 3,
+		//Meshlet clusters of the finest level
+		Meshlets = 4,
+		//Submesh ranges, one per material
+		Submeshes = 5,
+		//MeshCacheMaterials, their names and paths are ranges of the Strings section
+		Materials = 6,
+		Strings = 7
+	};
+
+	//MeshMaterial with the strings replaced by ranges of the string section
+	struct MeshCacheMaterial
+	{
+		uint32_t NameOffset;
+		uint32_t NameLength;
+		uint32_t DiffuseTextureOffset;
+		uint32_t DiffuseTextureLength;
+		uint32_t AlphaTextureOffset;
+		uint32_t AlphaTextureLength;
+		float DiffuseColor[3];
+	};
+
+	struct MeshCacheSection
+	{
+		MeshCacheSectionType Type;
+		uint32_t ElementSize;
+		uint64_t Offset;
+		uint64_t Size;
+	};
+
+	struct MeshCacheHeader
+	{
+		uint32_t Magic;
+		uint32_t Version;
+
+		uint64_t SourceSize;
+		int64_t SourceModifiedTime;
+		uint64_t SourceHash;
+
+		//the materials are read from the library, editing it alone makes the cache stale too
+		uint64_t MaterialLibrarySize;
+		int64_t MaterialLibraryModifiedTime;
+		uint64_t MaterialLibraryHash;
+
+		float BoundsMin[3];
+		float BoundsMax[3];
+
+		uint32_t SectionCount;
+		VertexFormat Format;
+	};
+
+	class MeshCache
+	{
+	public:
+		//path of the cache file belonging to an OBJ source
+		static std::string GetCachePath(const char* sourceFile);
+
+		//reads size, modification time and content hash of the source and of its material library, returns false if the source can't be read
+		static bool QuerySourceInfo(const char* sourceFile, MeshSourceInfo& outInfo);
+
+		//maps the cache of the source into the mesh, returns false if it is missing, stale or built for another vertex format
+		static bool Load(const char* sourceFile, VertexFormat format, Mesh& outMesh);
+
+		//writes the imported mesh next to its source
+		static bool Write(const char* sourceFile, const Mesh& mesh);
+	};
+}
@@ -0,0 +1,360 @@
+#include "VkMeshOptimizer.h"
+
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+#include <numeric>
+
+namespace VKE
+{
+	namespace
+	{
+		//FIFO cache emulation with timestamps: a vertex is cached if it was inserted less than CACHE_SIZE insertions ago.
+		//bumping the timestamp by more than the cache size flushes it
+		struct FifoCache
+		{
+			std::vector<uint32_t> InsertTime;
+			uint32_t Timestamp = MeshOptimizer::CACHE_SIZE + 1;
+
+			explicit FifoCache(uint32_t vertexCount) : InsertTime(vertexCount, 0) {}
+
+			//returns 1 on a miss
+			uint32_t Access(uint32_t vertex)
+			{
+				if (Timestamp - InsertTime[vertex] > MeshOptimizer::CACHE_SIZE)
+				{
+					InsertTime[vertex] = Timestamp++;
+					return 1;
+				}
+
+				return 0;
+			}
+
+			uint32_t AccessTriangle(const uint32_t* triangle)
+			{
+				return Access(triangle[0]) + Access(triangle[1]) + Access(triangle[2]);
+			}
+
+			void Flush()
+			{
+				Timestamp += MeshOptimizer::CACHE_SIZE + 1;
+			}
+		};
+
+		//triangles referencing every vertex, as offsets into a flat list
+		struct TriangleAdjacency
+		{
+			std::vector<uint32_t> Offsets;
+			std::vector<uint32_t> Counts;
+			std::vector<uint32_t> Triangles;
+
+			TriangleAdjacency(const std::vector<uint32_t>& indices, uint32_t vertexCount) : Offsets(vertexCount, 0), Counts(vertexCount, 0), Triangles(indices.size())
+			{
+				for (uint32_t index : indices)
+				{
+					Counts[index]++;
+				}
+
+				uint32_t offset = 0;
+				for (uint32_t v = 0; v < vertexCount; v++)
+				{
+					Offsets[v] = offset;
+					offset += Counts[v];
+				}
+
+				std::vector<uint32_t> fill = Offsets;
+				for (size_t i = 0; i < indices.size(); i++)
+				{
+					Triangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+				}
+			}
+		};
+
+		//Tipsify's fallback when the fanning vertex has no good successor: the most recently touched vertex
+		//with live triangles, or else the next one in input order
+		int64_t SkipDeadEnd(std::vector<uint32_t>& deadEndStack, const std::vector<uint32_t>& liveTriangles, uint32_t& cursor, uint32_t vertexCount)
+		{
+			while (!deadEndStack.empty())
+			{
+				const uint32_t vertex = deadEndStack.back();
+				deadEndStack.pop_back();
+
+				if (liveTriangles[vertex] > 0)
+					return vertex;
+			}
+
+			while (cursor < vertexCount)
+			{
+				if (liveTriangles[cursor] > 0)
+					return cursor;
+
+				cursor++;
+			}
+
+			return -1;
+		}
+	}
+
+	void MeshOptimizer::OptimizeVertexCache(std::vector<uint32_t>& indices, uint32_t vertexCount, std::vector<uint32_t>& outClusters)
+	{
+		outClusters.clear();
+
+		const size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0)
+			return;
+
+		TriangleAdjacency adjacency(indices, vertexCount);
+
+		std::vector<uint32_t> liveTriangles = adjacency.Counts;
+		std::vector<uint32_t> cacheTime(vertexCount, 0);
+		std::vector<bool> emitted(triangleCount, false);
+
+		std::vector<uint32_t> deadEndStack;
+		std::vector<uint32_t> candidates;
+
+		std::vector<uint32_t> result;
+		result.reserve(indices.size());
+
+		uint32_t timestamp = CACHE_SIZE + 1;
+		uint32_t cursor = 0;
+
+		int64_t fanningVertex = SkipDeadEnd(deadEndStack, liveTriangles, cursor, vertexCount);
+		bool startsCluster = true;
+
+		while (fanningVertex >= 0)
+		{
+			if (startsCluster)
+			{
+				outClusters.push_back(static_cast<uint32_t>(result.size()));
+				startsCluster = false;
+			}
+
+			candidates.clear();
+
+			//emit every remaining triangle around the fanning vertex
+			const uint32_t offset = adjacency.Offsets[fanningVertex];
+			for (uint32_t i = 0; i < adjacency.Counts[fanningVertex]; i++)
+			{
+				const uint32_t triangle = adjacency.Triangles[offset + i];
+				if (emitted[triangle])
+					continue;
+
+				for (uint32_t corner = 0; corner < 3; corner++)
+				{
+					const uint32_t vertex = indices[triangle * 3 + corner];
+
+					result.push_back(vertex);
+					deadEndStack.push_back(vertex);
+					candidates.push_back(vertex);
+					liveTriangles[vertex]--;
+
+					if (timestamp - cacheTime[vertex] > CACHE_SIZE)
+					{
+						cacheTime[vertex] = timestamp++;
+					}
+				}
+
+				emitted[triangle] = true;
+			}
+
+			//pick the candidate that will still be in the cache after its remaining triangles are emitted,
+			//preferring the one that entered the cache first
+			int64_t best = -1;
+			uint32_t bestPriority = 0;
+
+			for (uint32_t vertex : candidates)
+			{
+				if (liveTriangles[vertex] == 0)
+					continue;
+
+				uint32_t priority = 0;
+				if (timestamp - cacheTime[vertex] + 2 * liveTriangles[vertex] <= CACHE_SIZE)
+				{
+					priority = timestamp - cacheTime[vertex];
+				}
+
+				if (best < 0 || priority > bestPriority)
+				{
+					best = vertex;
+					bestPriority = priority;
+				}
+			}
+
+			if (best < 0)
+			{
+				best = SkipDeadEnd(deadEndStack, liveTriangles, cursor, vertexCount);
+				startsCluster = true;
+			}
+
+			fanningVertex = best;
+		}
+
+		indices.swap(result);
+	}
+
+	void MeshOptimizer::OptimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& clusters, float threshold)
+	{
+		const size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0 || clusters.empty())
+			return;
+
+		const uint32_t vertexCount = static_cast<uint32_t>(vertices.size());
+
+		//split the hard clusters wherever the cache efficiency up to that point is already close to the cluster's
+		std::vector<uint32_t> boundaries;
+		FifoCache cache(vertexCount);
+
+		for (size_t c = 0; c < clusters.size(); c++)
+		{
+			const size_t begin = clusters[c] / 3;
+			const size_t end = c + 1 < clusters.size() ? clusters[c + 1] / 3 : triangleCount;
+
+			cache.Flush();
+			uint32_t clusterMisses = 0;
+			for (size_t t = begin; t < end; t++)
+			{
+				clusterMisses += cache.AccessTriangle(&indices[t * 3]);
+			}
+
+			const float clusterThreshold = threshold * float(clusterMisses) / float(end - begin);
+
+			boundaries.push_back(static_cast<uint32_t>(begin));
+			cache.Flush();
+
+			uint32_t runningMisses = 0;
+			uint32_t runningTriangles = 0;
+			for (size_t t = begin; t < end; t++)
+			{
+				runningMisses += cache.AccessTriangle(&indices[t * 3]);
+				runningTriangles++;
+
+				if (t + 1 < end && float(runningMisses) / float(runningTriangles) <= clusterThreshold)
+				{
+					boundaries.push_back(static_cast<uint32_t>(t + 1));
+					cache.Flush();
+					runningMisses = 0;
+					runningTriangles = 0;
+				}
+			}
+		}
+
+		boundaries.push_back(static_cast<uint32_t>(triangleCount));
+
+		const size_t clusterCount = boundaries.size() - 1;
+
+		//area weighted centroid of the whole mesh
+		glm::vec3 meshCentroid = glm::vec3(0.0f);
+		float meshArea = 0.0f;
+
+		std::vector<glm::vec3> clusterCentroids(clusterCount, glm::vec3(0.0f));
+		std::vector<glm::vec3> clusterNormals(clusterCount, glm::vec3(0.0f));
+
+		for (size_t c = 0; c < clusterCount; c++)
+		{
+			float clusterArea = 0.0f;
+
+			for (uint32_t t = boundaries[c]; t < boundaries[c + 1]; t++)
+			{
+				const glm::vec3& p0 = vertices[indices[t * 3 + 0]].Position;
+				const glm::vec3& p1 = vertices[indices[t * 3 + 1]].Position;
+				const glm::vec3& p2 = vertices[indices[t * 3 + 2]].Position;
+
+				//the cross product's length is twice the area, which cancels out in the weighting
+				const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+				const float area = glm::length(normal);
+				const glm::vec3 centroid = (p0 + p1 + p2) / 3.0f;
+
+				clusterCentroids[c] += centroid * area;
+				clusterNormals[c] += normal;
+				clusterArea += area;
+			}
+
+			meshCentroid += clusterCentroids[c];
+			meshArea += clusterArea;
+
+			clusterCentroids[c] = clusterArea > 0.0f ? clusterCentroids[c] / clusterArea : vertices[indices[boundaries[c] * 3]].Position;
+		}
+
+		if (meshArea > 0.0f)
+		{
+			meshCentroid /= meshArea;
+		}
+
+		//clusters that face away from the center are more likely to occlude the rest, so draw them first
+		std::vector<float> sortKeys(clusterCount);
+		for (size_t c = 0; c < clusterCount; c++)
+		{
+			const float normalLength = glm::length(clusterNormals[c]);
+			const glm::vec3 direction = normalLength > 0.0f ? clusterNormals[c] / normalLength : glm::vec3(0.0f);
+
+			sortKeys[c] = glm::dot(clusterCentroids[c] - meshCentroid, direction);
+		}
+
+		std::vector<uint32_t> order(clusterCount);
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(), [&sortKeys](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+		std::vector<uint32_t> result;
+		result.reserve(indices.size());
+
+		for (uint32_t c : order)
+		{
+			result.insert(result.end(), indices.begin() + boundaries[c] * 3, indices.begin() + boundaries[c + 1] * 3);
+		}
+
+		indices.swap(result);
+	}
+
+	void MeshOptimizer::OptimizeVertexFetch(std::vector<uint32_t>& indices, std::vector<Vertex>& vertices)
+	{
+		constexpr uint32_t UNUSED = ~0u;
+
+		std::vector<uint32_t> remap(vertices.size(), UNUSED);
+		std::vector<Vertex> result;
+		result.reserve(vertices.size());
+
+		for (uint32_t& index : indices)
+		{
+			if (remap[index] == UNUSED)
+			{
+				remap[index] = static_cast<uint32_t>(result.size());
+				result.push_back(vertices[index]);
+			}
+
+			index = remap[index];
+		}
+
+		vertices.swap(result);
+	}
+
+	VertexCacheStatistics MeshOptimizer::AnalyzeVertexCache(const std::vector<uint32_t>& indices, uint32_t vertexCount)
+	{
+		VertexCacheStatistics statistics;
+
+		const size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0)
+			return statistics;
+
+		FifoCache cache(vertexCount);
+		std::vector<bool> referenced(vertexCount, false);
+
+		uint32_t misses = 0;
+		uint32_t uniqueVertices = 0;
+
+		for (uint32_t index : indices)
+		{
+			misses += cache.Access(index);
+
+			if (!referenced[index])
+			{
+				referenced[index] = true;
+				uniqueVertices++;
+			}
+		}
+
+		statistics.ACMR = float(misses) / float(triangleCount);
+		statistics.ATVR = float(misses) / float(uniqueVertices);
+
+		return statistics;
+	}
+}
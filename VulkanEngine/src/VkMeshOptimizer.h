@@ -0,0 +1,37 @@
+#pragma once
+
+#include "VkMesh.h"
+
+namespace VKE
+{
+	//result of running an index buffer through a simulated FIFO post-transform cache
+	struct VertexCacheStatistics
+	{
+		//vertex shader invocations per triangle, 0.5 is the ideal for a regular grid and 3 the worst case
+		float ACMR = 0.0f;
+		//vertex shader invocations per unique vertex, 1 is the ideal
+		float ATVR = 0.0f;
+	};
+
+	//import time reordering of triangle lists.
+	//the passes are meant to run in order: vertex cache, overdraw, vertex fetch
+	class MeshOptimizer
+	{
+	public:
+		//post-transform cache size the passes optimize for and the statistics simulate
+		static constexpr uint32_t CACHE_SIZE = 16;
+
+		//reorders triangles for post-transform cache locality using Tipsify (Sander et al. 2007).
+		//outClusters receives the first index of every cluster that starts after a dead end, to be used by OptimizeOverdraw
+		static void OptimizeVertexCache(std::vector<uint32_t>& indices, uint32_t vertexCount, std::vector<uint32_t>& outClusters);
+
+		//sorts the clusters so outward facing ones come first, which tends to draw occluders early.
+		//clusters are split further as long as that costs at most threshold times the cache efficiency
+		static void OptimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& clusters, float threshold);
+
+		//renumbers the vertices in the order they are first referenced, dropping unused ones
+		static void OptimizeVertexFetch(std::vector<uint32_t>& indices, std::vector<Vertex>& vertices);
+
+		static VertexCacheStatistics AnalyzeVertexCache(const std::vector<uint32_t>& indices, uint32_t vertexCount);
+	};
+}
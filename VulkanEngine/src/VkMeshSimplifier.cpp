@@ -0,0 +1,339 @@
+#include "VkMeshSimplifier.h"
+
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace VKE
+{
+	namespace
+	{
+		constexpr uint32_t INVALID = ~0u;
+
+		//symmetric 4x4 matrix measuring the sum of squared distances to a set of planes
+		struct Quadric
+		{
+			double A2 = 0, AB = 0, AC = 0, AD = 0;
+			double B2 = 0, BC = 0, BD = 0;
+			double C2 = 0, CD = 0;
+			double D2 = 0;
+
+			static Quadric FromPlane(const glm::dvec3& normal, double distance)
+			{
+				Quadric q;
+				q.A2 = normal.x * normal.x; q.AB = normal.x * normal.y; q.AC = normal.x * normal.z; q.AD = normal.x * distance;
+				q.B2 = normal.y * normal.y; q.BC = normal.y * normal.z; q.BD = normal.y * distance;
+				q.C2 = normal.z * normal.z; q.CD = normal.z * distance;
+				q.D2 = distance * distance;
+				return q;
+			}
+
+			void Add(const Quadric& other)
+			{
+				A2 += other.A2; AB += other.AB; AC += other.AC; AD += other.AD;
+				B2 += other.B2; BC += other.BC; BD += other.BD;
+				C2 += other.C2; CD += other.CD;
+				D2 += other.D2;
+			}
+
+			double Evaluate(const glm::vec3& p) const
+			{
+				const double x = p.x, y = p.y, z = p.z;
+				const double error = A2 * x * x + 2 * AB * x * y + 2 * AC * x * z + 2 * AD * x
+					+ B2 * y * y + 2 * BC * y * z + 2 * BD * y
+					+ C2 * z * z + 2 * CD * z
+					+ D2;
+
+				//rounding can push it slightly below zero
+				return error > 0.0 ? error : 0.0;
+			}
+		};
+
+		struct Collapse
+		{
+			uint32_t From;
+			uint32_t To;
+			double Cost;
+		};
+
+		//vertices sharing the exact same position are welded into one, so attribute seams don't look like borders
+		uint32_t BuildPositionRemap(const std::vector<Vertex>& vertices, std::vector<uint32_t>& outRemap, std::vector<glm::vec3>& outPositions)
+		{
+			struct PositionHash
+			{
+				size_t operator()(const glm::vec3& p) const
+				{
+					uint32_t words[3];
+					memcpy(words, &p, sizeof(words));
+					return (words[0] * 73856093u) ^ (words[1] * 19349663u) ^ (words[2] * 83492791u);
+				}
+			};
+
+			std::unordered_map<glm::vec3, uint32_t, PositionHash> positionIds;
+			positionIds.reserve(vertices.size());
+
+			outRemap.resize(vertices.size());
+			outPositions.clear();
+
+			for (size_t i = 0; i < vertices.size(); i++)
+			{
+				auto [it, inserted] = positionIds.try_emplace(vertices[i].Position, static_cast<uint32_t>(outPositions.size()));
+				if (inserted)
+				{
+					outPositions.push_back(vertices[i].Position);
+				}
+
+				outRemap[i] = it->second;
+			}
+
+			return static_cast<uint32_t>(outPositions.size());
+		}
+
+		inline uint64_t EdgeKey(uint32_t a, uint32_t b)
+		{
+			return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+		}
+	}
+
+	float MeshSimplifier::Simplify(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, size_t targetIndexCount, float maxError, std::vector<uint32_t>& outIndices)
+	{
+		outIndices = indices;
+
+		std::vector<uint32_t> positionOf;
+		std::vector<glm::vec3> positions;
+		const uint32_t positionCount = BuildPositionRemap(vertices, positionOf, positions);
+
+		//every position starts with the planes of the triangles around it
+		std::vector<Quadric> quadrics(positionCount);
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			const glm::dvec3 p0 = positions[positionOf[indices[i + 0]]];
+			const glm::dvec3 p1 = positions[positionOf[indices[i + 1]]];
+			const glm::dvec3 p2 = positions[positionOf[indices[i + 2]]];
+
+			const glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+			const double length = glm::length(normal);
+			if (length == 0.0)
+				continue;
+
+			const glm::dvec3 unitNormal = normal / length;
+			const Quadric plane = Quadric::FromPlane(unitNormal, -glm::dot(unitNormal, p0));
+
+			for (uint32_t corner = 0; corner < 3; corner++)
+			{
+				quadrics[positionOf[indices[i + corner]]].Add(plane);
+			}
+		}
+
+		const double maxCost = double(maxError) * double(maxError);
+		double resultCost = 0.0;
+
+		std::vector<uint32_t> triangleOffsets(positionCount + 1);
+		std::vector<uint32_t> triangleList;
+		std::vector<uint32_t> wedge(positionCount);
+		std::vector<bool> locked(positionCount);
+		std::vector<bool> touched(positionCount);
+		std::vector<uint32_t> vertexRemap(vertices.size());
+		std::unordered_map<uint64_t, uint32_t> edgeUses;
+		std::vector<Collapse> collapses;
+
+		//every pass collapses a set of independent edges, cheapest first
+		while (outIndices.size() > targetIndexCount)
+		{
+			const size_t triangleCount = outIndices.size() / 3;
+
+			//triangles around every position
+			std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+			for (uint32_t index : outIndices)
+			{
+				triangleOffsets[positionOf[index] + 1]++;
+			}
+
+			for (uint32_t p = 0; p < positionCount; p++)
+			{
+				triangleOffsets[p + 1] += triangleOffsets[p];
+			}
+
+			triangleList.resize(outIndices.size());
+			std::vector<uint32_t> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+			for (size_t i = 0; i < outIndices.size(); i++)
+			{
+				triangleList[fill[positionOf[outIndices[i]]]++] = static_cast<uint32_t>(i / 3);
+			}
+
+			//positions with more than one vertex sit on an attribute seam and are kept
+			std::fill(wedge.begin(), wedge.end(), INVALID);
+			std::fill(locked.begin(), locked.end(), false);
+			for (uint32_t index : outIndices)
+			{
+				const uint32_t p = positionOf[index];
+				if (wedge[p] == INVALID)
+				{
+					wedge[p] = index;
+				}
+				else if (wedge[p] != index)
+				{
+					locked[p] = true;
+				}
+			}
+
+			//edges used by a single triangle are borders, by more than two non-manifold. both lock their endpoints
+			edgeUses.clear();
+			edgeUses.reserve(outIndices.size());
+			for (size_t i = 0; i < outIndices.size(); i += 3)
+			{
+				for (uint32_t corner = 0; corner < 3; corner++)
+				{
+					const uint32_t a = positionOf[outIndices[i + corner]];
+					const uint32_t b = positionOf[outIndices[i + (corner + 1) % 3]];
+					edgeUses[EdgeKey(a, b)]++;
+				}
+			}
+
+			for (const auto& [key, uses] : edgeUses)
+			{
+				if (uses != 2)
+				{
+					locked[uint32_t(key >> 32)] = true;
+					locked[uint32_t(key & 0xFFFFFFFF)] = true;
+				}
+			}
+
+			//cheapest allowed direction of every edge
+			collapses.clear();
+			for (const auto& [key, uses] : edgeUses)
+			{
+				const uint32_t a = uint32_t(key >> 32);
+				const uint32_t b = uint32_t(key & 0xFFFFFFFF);
+
+				Quadric combined = quadrics[a];
+				combined.Add(quadrics[b]);
+
+				const double costAToB = locked[a] ? DBL_MAX : combined.Evaluate(positions[b]);
+				const double costBToA = locked[b] ? DBL_MAX : combined.Evaluate(positions[a]);
+
+				if (costAToB == DBL_MAX && costBToA == DBL_MAX)
+					continue;
+
+				if (costAToB <= costBToA)
+					collapses.push_back({ a, b, costAToB });
+				else
+					collapses.push_back({ b, a, costBToA });
+			}
+
+			std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.Cost < y.Cost; });
+
+			for (size_t v = 0; v < vertexRemap.size(); v++)
+			{
+				vertexRemap[v] = static_cast<uint32_t>(v);
+			}
+
+			std::fill(touched.begin(), touched.end(), false);
+
+			//every collapse removes about two triangles
+			const size_t collapseBudget = (triangleCount - targetIndexCount / 3 + 1) / 2;
+			size_t collapseCount = 0;
+
+			for (const Collapse& collapse : collapses)
+			{
+				if (collapseCount >= collapseBudget || collapse.Cost > maxCost)
+					break;
+
+				const uint32_t from = collapse.From;
+				const uint32_t to = collapse.To;
+
+				if (touched[from] || touched[to])
+					continue;
+
+				//the triangles on the collapsed edge must agree on the vertex they use at the destination
+				uint32_t target = INVALID;
+				bool valid = true;
+
+				const glm::vec3 destination = positions[to];
+
+				for (uint32_t t = triangleOffsets[from]; t < triangleOffsets[from + 1] && valid; t++)
+				{
+					const uint32_t* triangle = &outIndices[triangleList[t] * 3];
+
+					bool hasDestination = false;
+					for (uint32_t corner = 0; corner < 3; corner++)
+					{
+						if (positionOf[triangle[corner]] == to)
+						{
+							hasDestination = true;
+
+							if (target == INVALID)
+								target = triangle[corner];
+							else if (target != triangle[corner])
+								valid = false;
+						}
+					}
+
+					if (hasDestination)
+						continue;
+
+					//the triangles that survive must not flip
+					glm::vec3 before[3];
+					glm::vec3 after[3];
+					for (uint32_t corner = 0; corner < 3; corner++)
+					{
+						const uint32_t p = positionOf[triangle[corner]];
+						before[corner] = positions[p];
+						after[corner] = p == from ? destination : positions[p];
+					}
+
+					const glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+					const glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+
+					if (glm::dot(normalBefore, normalAfter) <= 0.0f)
+						valid = false;
+				}
+
+				if (!valid || target == INVALID)
+					continue;
+
+				vertexRemap[wedge[from]] = target;
+				quadrics[to].Add(quadrics[from]);
+
+				//the whole one-ring of the collapsed vertex changed, keep it out of this pass
+				for (uint32_t t = triangleOffsets[from]; t < triangleOffsets[from + 1]; t++)
+				{
+					const uint32_t* triangle = &outIndices[triangleList[t] * 3];
+					touched[positionOf[triangle[0]]] = true;
+					touched[positionOf[triangle[1]]] = true;
+					touched[positionOf[triangle[2]]] = true;
+				}
+
+				resultCost = std::max(resultCost, collapse.Cost);
+				collapseCount++;
+			}
+
+			if (collapseCount == 0)
+				break;
+
+			//apply the collapses and drop the triangles that became degenerate
+			size_t writeIndex = 0;
+			for (size_t i = 0; i < outIndices.size(); i += 3)
+			{
+				const uint32_t a = vertexRemap[outIndices[i + 0]];
+				const uint32_t b = vertexRemap[outIndices[i + 1]];
+				const uint32_t c = vertexRemap[outIndices[i + 2]];
+
+				if (positionOf[a] == positionOf[b] || positionOf[b] == positionOf[c] || positionOf[a] == positionOf[c])
+					continue;
+
+				outIndices[writeIndex++] = a;
+				outIndices[writeIndex++] = b;
+				outIndices[writeIndex++] = c;
+			}
+
+			outIndices.resize(writeIndex);
+		}
+
+		return static_cast<float>(std::sqrt(resultCost));
+	}
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "VkMesh.h"
+
+namespace VKE
+{
+	//edge collapse simplifier driven by quadric error metrics (Garland and Heckbert 1997).
+	//vertices are only ever collapsed onto one of their neighbours, so every level of detail
+	//can index into the same vertex buffer as the original mesh
+	class MeshSimplifier
+	{
+	public:
+		//reduces the triangle list towards targetIndexCount without moving any surface by more than maxError (object space).
+		//vertices on open borders, on attribute seams and with non-manifold edges are never removed.
+		//returns the largest error introduced
+		static float Simplify(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, size_t targetIndexCount, float maxError, std::vector<uint32_t>& outIndices);
+	};
+}
@@ -0,0 +1,131 @@
+#include "VkMeshlets.h"
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace VKE
+{
+	namespace
+	{
+		Meshlet MakeMeshlet(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, uint32_t begin, uint32_t end)
+		{
+			Meshlet meshlet = {};
+			meshlet.FirstIndex = begin;
+			meshlet.IndexCount = end - begin;
+
+			//bounding sphere around the center of the box
+			glm::vec3 boundsMin = vertices[indices[begin]].Position;
+			glm::vec3 boundsMax = boundsMin;
+			for (uint32_t i = begin; i < end; i++)
+			{
+				boundsMin = glm::min(boundsMin, vertices[indices[i]].Position);
+				boundsMax = glm::max(boundsMax, vertices[indices[i]].Position);
+			}
+
+			meshlet.Center = (boundsMin + boundsMax) * 0.5f;
+			for (uint32_t i = begin; i < end; i++)
+			{
+				meshlet.Radius = std::max(meshlet.Radius, glm::length(vertices[indices[i]].Position - meshlet.Center));
+			}
+
+			//normal cone around the average facing of the triangles
+			glm::vec3 normalSum = glm::vec3(0.0f);
+			for (uint32_t i = begin; i < end; i += 3)
+			{
+				const glm::vec3& p0 = vertices[indices[i + 0]].Position;
+				const glm::vec3& p1 = vertices[indices[i + 1]].Position;
+				const glm::vec3& p2 = vertices[indices[i + 2]].Position;
+
+				const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+				const float length = glm::length(normal);
+				if (length > 0.0f)
+				{
+					normalSum += normal / length;
+				}
+			}
+
+			const float sumLength = glm::length(normalSum);
+
+			//a cutoff of 1 never passes the backface test
+			meshlet.ConeAxis = sumLength > 0.0f ? normalSum / sumLength : glm::vec3(0.0f, 0.0f, 1.0f);
+			meshlet.ConeCutoff = 1.0f;
+
+			if (sumLength == 0.0f)
+				return meshlet;
+
+			float minDot = 1.0f;
+			for (uint32_t i = begin; i < end; i += 3)
+			{
+				const glm::vec3& p0 = vertices[indices[i + 0]].Position;
+				const glm::vec3& p1 = vertices[indices[i + 1]].Position;
+				const glm::vec3& p2 = vertices[indices[i + 2]].Position;
+
+				const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+				const float length = glm::length(normal);
+				if (length > 0.0f)
+				{
+					minDot = std::min(minDot, glm::dot(normal / length, meshlet.ConeAxis));
+				}
+			}
+
+			//cones wider than a hemisphere (or close to it) can't be culled
+			if (minDot > 0.1f)
+			{
+				meshlet.ConeCutoff = std::sqrt(1.0f - minDot * minDot);
+			}
+
+			return meshlet;
+		}
+	}
+
+	void MeshletBuilder::Build(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, uint32_t firstIndex, uint32_t indexCount, std::vector<Meshlet>& outMeshlets)
+	{
+		if (indexCount == 0)
+			return;
+
+		//id of the last meshlet that used every vertex
+		std::vector<uint32_t> usedBy(vertices.size(), ~0u);
+
+		uint32_t meshletId = 0;
+		uint32_t meshletBegin = firstIndex;
+		uint32_t meshletVertices = 0;
+		uint32_t meshletTriangles = 0;
+
+		const uint32_t end = firstIndex + indexCount;
+		for (uint32_t i = firstIndex; i < end; i += 3)
+		{
+			uint32_t newVertices = 0;
+			for (uint32_t corner = 0; corner < 3; corner++)
+			{
+				if (usedBy[indices[i + corner]] != meshletId)
+					newVertices++;
+			}
+
+			if (meshletVertices + newVertices > MAX_MESHLET_VERTICES || meshletTriangles + 1 > MAX_MESHLET_TRIANGLES)
+			{
+				outMeshlets.push_back(MakeMeshlet(vertices, indices, meshletBegin, i));
+
+				meshletId++;
+				meshletBegin = i;
+				meshletVertices = 0;
+				meshletTriangles = 0;
+			}
+
+			for (uint32_t corner = 0; corner < 3; corner++)
+			{
+				if (usedBy[indices[i + corner]] != meshletId)
+				{
+					usedBy[indices[i + corner]] = meshletId;
+					meshletVertices++;
+				}
+			}
+
+			meshletTriangles++;
+		}
+
+		outMeshlets.push_back(MakeMeshlet(vertices, indices, meshletBegin, end));
+	}
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "VkMesh.h"
+
+namespace VKE
+{
+	constexpr uint32_t MAX_MESHLET_VERTICES = 64;
+	constexpr uint32_t MAX_MESHLET_TRIANGLES = 124;
+
+	class MeshletBuilder
+	{
+	public:
+		//splits the index range into meshlets of consecutive triangles, in the order they are stored, and appends them to outMeshlets.
+		//run it after the vertex cache optimization so neighbouring triangles end up in the same meshlet
+		static void Build(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, uint32_t firstIndex, uint32_t indexCount, std::vector<Meshlet>& outMeshlets);
+	};
+}
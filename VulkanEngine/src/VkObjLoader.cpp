@@ -0,0 +1,604 @@
+#include "VkObjLoader.h"
+#include "VkMeshCache.h"
+#include "VkParallel.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+namespace VKE
+{
+	namespace
+	{
+		//chunks smaller than this are not worth a thread
+		constexpr size_t MIN_CHUNK_SIZE = 256 * 1024;
+
+		//bit set in ObjCorner::RelativeMask when the index was negative (relative to the end of its chunk so far)
+		constexpr uint32_t RELATIVE_POSITION = 1 << 0;
+		constexpr uint32_t RELATIVE_TEXCOORD = 1 << 1;
+		constexpr uint32_t RELATIVE_NORMAL = 1 << 2;
+
+		//sentinel for an attribute the corner doesn't reference
+		constexpr int32_t MISSING_INDEX = INT32_MIN;
+
+		//material of the triangles before the first usemtl of a chunk, they continue the previous chunk's material
+		constexpr uint32_t INHERITED_MATERIAL = ~0u;
+
+		struct ObjCorner
+		{
+			int32_t Position;
+			int32_t TexCoord;
+			int32_t Normal;
+			uint32_t RelativeMask;
+		};
+
+		struct ObjChunk
+		{
+			const char* Begin = nullptr;
+			const char* End = nullptr;
+
+			std::vector<glm::vec3> Positions;
+			std::vector<glm::vec3> Normals;
+			std::vector<glm::vec2> TexCoords;
+			std::vector<ObjCorner> Corners;
+
+			//usemtl names in the order they appear and the index into them of every triangle
+			std::vector<std::string> MaterialNames;
+			std::vector<uint32_t> TriangleMaterials;
+			std::string MaterialLibrary;
+
+			//offsets of this chunk's data in the merged arrays
+			size_t PositionBase = 0;
+			size_t NormalBase = 0;
+			size_t TexCoordBase = 0;
+			size_t CornerBase = 0;
+
+			std::string Error;
+		};
+
+		inline bool IsSpace(char c)
+		{
+			return c == ' ' || c == '\t';
+		}
+
+		inline const char* SkipSpaces(const char* p, const char* end)
+		{
+			while (p < end && IsSpace(*p))
+				p++;
+
+			return p;
+		}
+
+		inline const char* SkipLine(const char* p, const char* end)
+		{
+			while (p < end && *p != '\n')
+				p++;
+
+			return p < end ? p + 1 : end;
+		}
+
+		inline bool MatchKeyword(const char* p, const char* end, const char* keyword)
+		{
+			const size_t length = strlen(keyword);
+			return static_cast<size_t>(end - p) > length && memcmp(p, keyword, length) == 0 && IsSpace(p[length]);
+		}
+
+		//rest of the line without surrounding whitespace
+		inline std::string ParseName(const char* p, const char* end)
+		{
+			p = SkipSpaces(p, end);
+
+			const char* nameEnd = p;
+			while (nameEnd < end && *nameEnd != '\n')
+				nameEnd++;
+
+			while (nameEnd > p && (IsSpace(nameEnd[-1]) || nameEnd[-1] == '\r'))
+				nameEnd--;
+
+			return std::string(p, nameEnd);
+		}
+
+		inline const char* ParseFloat(const char* p, const char* end, float& out)
+		{
+			p = SkipSpaces(p, end);
+
+			//from_chars doesn't accept an explicit plus sign
+			if (p < end && *p == '+')
+				p++;
+
+			auto [next, error] = std::from_chars(p, end, out);
+			if (error != std::errc())
+			{
+				out = 0.0f;
+				return p;
+			}
+
+			return next;
+		}
+
+		inline const char* ParseInt(const char* p, const char* end, int32_t& out, bool& outValid)
+		{
+			bool negative = false;
+			if (p < end && (*p == '-' || *p == '+'))
+			{
+				negative = *p == '-';
+				p++;
+			}
+
+			const char* digits = p;
+			int32_t value = 0;
+			while (p < end && *p >= '0' && *p <= '9')
+			{
+				value = value * 10 + (*p - '0');
+				p++;
+			}
+
+			outValid = p != digits;
+			out = negative ? -value : value;
+			return p;
+		}
+
+		//converts a 1 based OBJ index into a 0 based absolute index, or a negative one into an index
+		//relative to the start of the chunk, which is fixed up once the chunk's base offset is known
+		inline bool StoreIndex(int32_t value, size_t localCount, uint32_t relativeBit, int32_t& outIndex, uint32_t& outMask)
+		{
+			if (value > 0)
+			{
+				outIndex = value - 1;
+				return true;
+			}
+
+			if (value < 0)
+			{
+				outIndex = static_cast<int32_t>(localCount) + value;
+				outMask |= relativeBit;
+				return true;
+			}
+
+			return false;
+		}
+
+		//parses one "v", "v/vt", "v//vn" or "v/vt/vn" face token
+		inline const char* ParseCorner(const char* p, const char* end, const ObjChunk& chunk, ObjCorner& outCorner, bool& outValid)
+		{
+			outCorner = { MISSING_INDEX, MISSING_INDEX, MISSING_INDEX, 0 };
+
+			int32_t value;
+			bool valid;
+
+			p = ParseInt(p, end, value, valid);
+			outValid = valid && StoreIndex(value, chunk.Positions.size(), RELATIVE_POSITION, outCorner.Position, outCorner.RelativeMask);
+			if (!outValid)
+				return p;
+
+			if (p < end && *p == '/')
+			{
+				p++;
+				if (p < end && *p != '/')
+				{
+					p = ParseInt(p, end, value, valid);
+					if (valid)
+						StoreIndex(value, chunk.TexCoords.size(), RELATIVE_TEXCOORD, outCorner.TexCoord, outCorner.RelativeMask);
+				}
+
+				if (p < end && *p == '/')
+				{
+					p++;
+					p = ParseInt(p, end, value, valid);
+					if (valid)
+						StoreIndex(value, chunk.Normals.size(), RELATIVE_NORMAL, outCorner.Normal, outCorner.RelativeMask);
+				}
+			}
+
+			return p;
+		}
+
+		void ParseChunk(ObjChunk& chunk)
+		{
+			//rough guess of one record every 32 bytes, most of them faces in a typical scene file
+			const size_t estimatedRecords = (chunk.End - chunk.Begin) / 32;
+			chunk.Positions.reserve(estimatedRecords / 4);
+			chunk.Normals.reserve(estimatedRecords / 4);
+			chunk.TexCoords.reserve(estimatedRecords / 4);
+			chunk.Corners.reserve(estimatedRecords * 3 / 2);
+
+			const char* p = chunk.Begin;
+			const char* end = chunk.End;
+
+			ObjCorner polygon[3];
+			uint32_t material = INHERITED_MATERIAL;
+
+			while (p < end)
+			{
+				p = SkipSpaces(p, end);
+				if (p >= end)
+					break;
+
+				if (p[0] == 'v' && p + 1 < end)
+				{
+					if (IsSpace(p[1]))
+					{
+						glm::vec3 position;
+						p = ParseFloat(p + 2, end, position.x);
+						p = ParseFloat(p, end, position.y);
+						p = ParseFloat(p, end, position.z);
+						chunk.Positions.push_back(position);
+					}
+					else if (p[1] == 'n' && p + 2 < end && IsSpace(p[2]))
+					{
+						glm::vec3 normal;
+						p = ParseFloat(p + 3, end, normal.x);
+						p = ParseFloat(p, end, normal.y);
+						p = ParseFloat(p, end, normal.z);
+						chunk.Normals.push_back(normal);
+					}
+					else if (p[1] == 't' && p + 2 < end && IsSpace(p[2]))
+					{
+						glm::vec2 texCoord;
+						p = ParseFloat(p + 3, end, texCoord.x);
+						p = ParseFloat(p, end, texCoord.y);
+						chunk.TexCoords.push_back(texCoord);
+					}
+				}
+				else if (p[0] == 'f' && p + 1 < end && IsSpace(p[1]))
+				{
+					p++;
+
+					//fan triangulate the polygon as it is read: (0, 1, 2), (0, 2, 3), ...
+					uint32_t cornerCount = 0;
+					while (true)
+					{
+						p = SkipSpaces(p, end);
+						if (p >= end || *p == '\r' || *p == '\n')
+							break;
+
+						ObjCorner corner;
+						bool valid;
+						p = ParseCorner(p, end, chunk, corner, valid);
+
+						if (!valid)
+						{
+							chunk.Error = "malformed face record";
+							return;
+						}
+
+						if (cornerCount < 2)
+						{
+							polygon[cornerCount] = corner;
+						}
+						else
+						{
+							polygon[2] = corner;
+							chunk.Corners.push_back(polygon[0]);
+							chunk.Corners.push_back(polygon[1]);
+							chunk.Corners.push_back(polygon[2]);
+							chunk.TriangleMaterials.push_back(material);
+							polygon[1] = polygon[2];
+						}
+
+						cornerCount++;
+					}
+				}
+				else if (MatchKeyword(p, end, "usemtl"))
+				{
+					material = static_cast<uint32_t>(chunk.MaterialNames.size());
+					chunk.MaterialNames.push_back(ParseName(p + 6, end));
+				}
+				else if (MatchKeyword(p, end, "mtllib") && chunk.MaterialLibrary.empty())
+				{
+					chunk.MaterialLibrary = ParseName(p + 6, end);
+				}
+
+				p = SkipLine(p, end);
+			}
+		}
+
+		//mtllib names are relative to the OBJ
+		std::string GetMaterialLibraryPath(const char* filename, const std::string& library)
+		{
+			return (std::filesystem::path(filename).parent_path() / library).generic_string();
+		}
+
+		template<typename T>
+		bool ResolveIndex(int32_t index, bool relative, size_t base, const std::vector<T>& attributes, T& outValue)
+		{
+			const int64_t resolved = relative ? static_cast<int64_t>(base) + index : index;
+			if (resolved < 0 || resolved >= static_cast<int64_t>(attributes.size()))
+				return false;
+
+			outValue = attributes[static_cast<size_t>(resolved)];
+			return true;
+		}
+	}
+
+	std::string ObjLoader::FindMaterialLibrary(const char* filename, const char* data, size_t size)
+	{
+		const char* end = data + size;
+		for (const char* p = data; p < end; p = SkipLine(p, end))
+		{
+			p = SkipSpaces(p, end);
+			if (MatchKeyword(p, end, "mtllib"))
+			{
+				const std::string library = ParseName(p + 6, end);
+				if (!library.empty())
+					return GetMaterialLibraryPath(filename, library);
+			}
+		}
+
+		return std::string();
+	}
+
+	bool ObjLoader::LoadMaterialLibrary(const char* filename, std::vector<MeshMaterial>& outMaterials, std::string& outError)
+	{
+		std::ifstream file(filename);
+		if (!file.is_open())
+		{
+			outError = std::string("could not open ") + filename;
+			return false;
+		}
+
+		const std::filesystem::path directory = std::filesystem::path(filename).parent_path();
+
+		//map statements may carry options before the file name, which is always the last token
+		auto resolveTexture = [&directory](std::istringstream& line)
+		{
+			std::string token;
+			std::string texture;
+			while (line >> token)
+			{
+				texture = token;
+			}
+
+			return texture.empty() ? texture : (directory / texture).generic_string();
+		};
+
+		std::string text;
+		while (std::getline(file, text))
+		{
+			while (!text.empty() && (text.back() == '\r' || IsSpace(text.back())))
+				text.pop_back();
+
+			std::istringstream line(text);
+
+			std::string keyword;
+			if (!(line >> keyword))
+				continue;
+
+			if (keyword == "newmtl")
+			{
+				//names run to the end of the line, like the usemtl ones
+				MeshMaterial material;
+				std::getline(line >> std::ws, material.Name);
+				outMaterials.push_back(material);
+			}
+			else if (outMaterials.empty())
+			{
+				continue;
+			}
+			else if (keyword == "Kd")
+			{
+				glm::vec3& color = outMaterials.back().DiffuseColor;
+				line >> color.x >> color.y >> color.z;
+			}
+			else if (keyword == "map_Kd")
+			{
+				outMaterials.back().DiffuseTexture = resolveTexture(line);
+			}
+			else if (keyword == "map_d")
+			{
+				outMaterials.back().AlphaTexture = resolveTexture(line);
+			}
+		}
+
+		return true;
+	}
+
+	bool ObjLoader::LoadTriangles(const char* filename, std::vector<Vertex>& outCorners, std::vector<uint32_t>& outTriangleMaterials,
+		std::vector<MeshMaterial>& outMaterials, std::string& outError, uint32_t threadCount)
+	{
+		MappedFile file;
+		if (!file.Open(filename))
+		{
+			outError = std::string("could not open ") + filename;
+			return false;
+		}
+
+		const char* data = reinterpret_cast<const char*>(file.GetData());
+		const char* dataEnd = data + file.GetSize();
+
+		if (threadCount == 0)
+		{
+			threadCount = std::max(1u, std::thread::hardware_concurrency());
+		}
+
+		const size_t chunkCount = std::clamp<size_t>(file.GetSize() / MIN_CHUNK_SIZE, 1, threadCount);
+
+		//split at line boundaries, so no record is cut in half
+		std::vector<ObjChunk> chunks(chunkCount);
+		const char* chunkBegin = data;
+		for (size_t i = 0; i < chunkCount; i++)
+		{
+			const char* chunkEnd = dataEnd;
+			if (i + 1 < chunkCount)
+			{
+				chunkEnd = std::max(chunkBegin, data + file.GetSize() * (i + 1) / chunkCount);
+				chunkEnd = SkipLine(chunkEnd, dataEnd);
+			}
+
+			chunks[i].Begin = chunkBegin;
+			chunks[i].End = chunkEnd;
+			chunkBegin = chunkEnd;
+		}
+
+		RunParallel(chunkCount, [&chunks](size_t i) { ParseChunk(chunks[i]); });
+
+		size_t positionCount = 0;
+		size_t normalCount = 0;
+		size_t texCoordCount = 0;
+		size_t cornerCount = 0;
+
+		for (ObjChunk& chunk : chunks)
+		{
+			if (!chunk.Error.empty())
+			{
+				outError = chunk.Error;
+				return false;
+			}
+
+			chunk.PositionBase = positionCount;
+			chunk.NormalBase = normalCount;
+			chunk.TexCoordBase = texCoordCount;
+			chunk.CornerBase = cornerCount;
+
+			positionCount += chunk.Positions.size();
+			normalCount += chunk.Normals.size();
+			texCoordCount += chunk.TexCoords.size();
+			cornerCount += chunk.Corners.size();
+		}
+
+		//resolve the material names against the library, in file order so faces before a usemtl know what they continue
+		outMaterials.clear();
+
+		std::string materialLibrary;
+		for (const ObjChunk& chunk : chunks)
+		{
+			if (!chunk.MaterialLibrary.empty())
+			{
+				materialLibrary = chunk.MaterialLibrary;
+				break;
+			}
+		}
+
+		if (!materialLibrary.empty())
+		{
+			const std::string libraryPath = GetMaterialLibraryPath(filename, materialLibrary);
+
+			std::string libraryError;
+			if (!LoadMaterialLibrary(libraryPath.c_str(), outMaterials, libraryError))
+			{
+				std::cout << "WARN: " << filename << ": " << libraryError << std::endl;
+			}
+		}
+
+		std::unordered_map<std::string, uint32_t> materialIds;
+		for (uint32_t i = 0; i < outMaterials.size(); i++)
+		{
+			materialIds.try_emplace(outMaterials[i].Name, i);
+		}
+
+		auto findMaterial = [&](const std::string& name)
+		{
+			auto [it, inserted] = materialIds.try_emplace(name, static_cast<uint32_t>(outMaterials.size()));
+			if (inserted)
+			{
+				MeshMaterial material;
+				material.Name = name;
+				outMaterials.push_back(material);
+			}
+
+			return it->second;
+		};
+
+		//chunk local material slots to global ids, the extra last slot is what the chunk inherits
+		std::vector<std::vector<uint32_t>> chunkMaterialIds(chunkCount);
+		uint32_t currentMaterial = INHERITED_MATERIAL;
+
+		for (size_t i = 0; i < chunkCount; i++)
+		{
+			const ObjChunk& chunk = chunks[i];
+
+			for (const std::string& name : chunk.MaterialNames)
+			{
+				chunkMaterialIds[i].push_back(findMaterial(name));
+			}
+
+			//inherited triangles come first, if the file starts with some they get a default material
+			const bool inherits = !chunk.TriangleMaterials.empty() && chunk.TriangleMaterials[0] == INHERITED_MATERIAL;
+			if (inherits && currentMaterial == INHERITED_MATERIAL)
+			{
+				currentMaterial = findMaterial("default");
+			}
+
+			chunkMaterialIds[i].push_back(currentMaterial);
+
+			if (!chunk.MaterialNames.empty())
+			{
+				currentMaterial = chunkMaterialIds[i][chunk.MaterialNames.size() - 1];
+			}
+		}
+
+		//concatenate the attribute streams, every chunk copies its own slice
+		std::vector<glm::vec3> positions(positionCount);
+		std::vector<glm::vec3> normals(normalCount);
+		std::vector<glm::vec2> texCoords(texCoordCount);
+
+		RunParallel(chunkCount, [&](size_t i)
+		{
+			const ObjChunk& chunk = chunks[i];
+			std::copy(chunk.Positions.begin(), chunk.Positions.end(), positions.begin() + chunk.PositionBase);
+			std::copy(chunk.Normals.begin(), chunk.Normals.end(), normals.begin() + chunk.NormalBase);
+			std::copy(chunk.TexCoords.begin(), chunk.TexCoords.end(), texCoords.begin() + chunk.TexCoordBase);
+		});
+
+		//expand the corners into their final slots of the output, again one slice per chunk
+		outCorners.clear();
+		outCorners.resize(cornerCount);
+		outTriangleMaterials.clear();
+		outTriangleMaterials.resize(cornerCount / 3);
+
+		RunParallel(chunkCount, [&](size_t i)
+		{
+			ObjChunk& chunk = chunks[i];
+			Vertex* output = outCorners.data() + chunk.CornerBase;
+
+			const std::vector<uint32_t>& materialIds = chunkMaterialIds[i];
+			uint32_t* triangleMaterials = outTriangleMaterials.data() + chunk.CornerBase / 3;
+			for (uint32_t material : chunk.TriangleMaterials)
+			{
+				*triangleMaterials++ = material == INHERITED_MATERIAL ? materialIds.back() : materialIds[material];
+			}
+
+			for (const ObjCorner& corner : chunk.Corners)
+			{
+				Vertex vertex = {};
+
+				if (!ResolveIndex(corner.Position, corner.RelativeMask & RELATIVE_POSITION, chunk.PositionBase, positions, vertex.Position))
+				{
+					chunk.Error = "vertex index out of range";
+					return;
+				}
+
+				if (corner.Normal != MISSING_INDEX)
+				{
+					ResolveIndex(corner.Normal, corner.RelativeMask & RELATIVE_NORMAL, chunk.NormalBase, normals, vertex.Normal);
+				}
+
+				if (corner.TexCoord != MISSING_INDEX && ResolveIndex(corner.TexCoord, corner.RelativeMask & RELATIVE_TEXCOORD, chunk.TexCoordBase, texCoords, vertex.UV))
+				{
+					vertex.UV.y = 1 - vertex.UV.y;
+				}
+
+				//we are setting the vertex color as the vertex normal. This is just for display purposes
+				vertex.Color = vertex.Normal;
+
+				*output++ = vertex;
+			}
+		});
+
+		for (const ObjChunk& chunk : chunks)
+		{
+			if (!chunk.Error.empty())
+			{
+				outError = chunk.Error;
+				return false;
+			}
+		}
+
+		return true;
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "VkMesh.h"
+
+#include <string>
+
+namespace VKE
+{
+	//multithreaded loader for the v/vn/vt/f/usemtl/mtllib subset of wavefront OBJ.
+	//the file is mapped, split into chunks at line boundaries and every chunk is parsed on its own thread.
+	//the per-chunk attribute arrays are then concatenated and the face corners resolved in parallel
+	//into a single pre-sized array of triangle corners (polygons are fan triangulated)
+	class ObjLoader
+	{
+	public:
+		//threadCount of 0 uses one thread per hardware thread.
+		//the output matches the tinyobj import: Color holds the normal and the V coordinate is flipped.
+		//outTriangleMaterials gets the index into outMaterials of every triangle. the materials are the file's
+		//material library, plus an entry for every usemtl it doesn't define and a "default" one for faces before the first usemtl
+		static bool LoadTriangles(const char* filename, std::vector<Vertex>& outCorners, std::vector<uint32_t>& outTriangleMaterials,
+			std::vector<MeshMaterial>& outMaterials, std::string& outError, uint32_t threadCount = 0);
+
+		//reads the newmtl/Kd/map_Kd/map_d subset of a .mtl file. texture paths are made relative to the working directory
+		static bool LoadMaterialLibrary(const char* filename, std::vector<MeshMaterial>& outMaterials, std::string& outError);
+
+		//path of the material library LoadTriangles reads for the OBJ text in data: the first mtllib, next to the OBJ. empty without one
+		static std::string FindMaterialLibrary(const char* filename, const char* data, size_t size);
+	};
+}
@@ -0,0 +1,286 @@
+#include "VkObjectCuller.h"
+
+#include "VkParallel.h"
+#include "VulkanEngine.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <limits>
+
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+//MSVC compiles the intrinsics of any instruction set without a flag
+#define VKE_TARGET_AVX2
+#else
+#define VKE_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+namespace VKE
+{
+	namespace
+	{
+		//spheres tested together by the widest path, the arrays are padded to a multiple of it
+		constexpr uint32_t SIMD_WIDTH = 8;
+		//threads a single Cull runs on at most
+		constexpr uint32_t MAX_CHUNKS = 64;
+
+		uint32_t GetChunkCount(uint32_t count, uint32_t threadCount, const WorkerPool& workers)
+		{
+			if (threadCount == 0)
+			{
+				threadCount = workers.GetThreadCount();
+			}
+
+			return std::clamp(count / ObjectCuller::MIN_CHUNK_SIZE, 1u, threadCount);
+		}
+
+		//chunk boundaries stay multiples of SIMD_WIDTH
+		uint32_t GetChunkSize(uint32_t paddedCount, uint32_t chunkCount)
+		{
+			const uint32_t chunkSize = (paddedCount + chunkCount - 1) / chunkCount;
+			return (chunkSize + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+		}
+
+		//the sphere is culled if it is entirely behind one of the planes: dot(n, c) + d < -r
+		uint32_t CullScalar(const Frustum& frustum, const float* x, const float* y, const float* z, const float* r, uint32_t begin, uint32_t end, uint32_t* visible)
+		{
+			uint32_t visibleCount = 0;
+			for (uint32_t i = begin; i < end; i++)
+			{
+				bool inside = true;
+				for (const glm::vec4& plane : frustum.Planes)
+				{
+					inside = inside && plane.x * x[i] + plane.y * y[i] + plane.z * z[i] + plane.w >= -r[i];
+				}
+
+				if (inside)
+				{
+					visible[visibleCount++] = i;
+				}
+			}
+
+			return visibleCount;
+		}
+
+		//writes begin + the index of every set bit
+		uint32_t WriteVisible(uint32_t mask, uint32_t begin, uint32_t* visible)
+		{
+			uint32_t visibleCount = 0;
+			while (mask != 0)
+			{
+				visible[visibleCount++] = begin + std::countr_zero(mask);
+				mask &= mask - 1;
+			}
+
+			return visibleCount;
+		}
+
+		uint32_t CullSSE(const Frustum& frustum, const float* x, const float* y, const float* z, const float* r, uint32_t begin, uint32_t end, uint32_t* visible)
+		{
+			__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+			for (int plane = 0; plane < 6; plane++)
+			{
+				planeX[plane] = _mm_set1_ps(frustum.Planes[plane].x);
+				planeY[plane] = _mm_set1_ps(frustum.Planes[plane].y);
+				planeZ[plane] = _mm_set1_ps(frustum.Planes[plane].z);
+				planeW[plane] = _mm_set1_ps(frustum.Planes[plane].w);
+			}
+
+			const __m128 zero = _mm_setzero_ps();
+
+			uint32_t visibleCount = 0;
+			for (uint32_t i = begin; i < end; i += 4)
+			{
+				const __m128 centerX = _mm_loadu_ps(x + i);
+				const __m128 centerY = _mm_loadu_ps(y + i);
+				const __m128 centerZ = _mm_loadu_ps(z + i);
+				const __m128 radius = _mm_loadu_ps(r + i);
+
+				//lanes with dot(n, c) + d + r < 0 for any plane are outside
+				__m128 outside = zero;
+				for (int plane = 0; plane < 6; plane++)
+				{
+					__m128 distance = _mm_add_ps(_mm_mul_ps(planeX[plane], centerX), planeW[plane]);
+					distance = _mm_add_ps(distance, _mm_mul_ps(planeY[plane], centerY));
+					distance = _mm_add_ps(distance, _mm_mul_ps(planeZ[plane], centerZ));
+					outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+				}
+
+				const uint32_t mask = ~static_cast<uint32_t>(_mm_movemask_ps(outside)) & 0xF;
+				visibleCount += WriteVisible(mask, i, visible + visibleCount);
+			}
+
+			return visibleCount;
+		}
+
+		VKE_TARGET_AVX2 uint32_t CullAVX2(const Frustum& frustum, const float* x, const float* y, const float* z, const float* r, uint32_t begin, uint32_t end, uint32_t* visible)
+		{
+			__m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+			for (int plane = 0; plane < 6; plane++)
+			{
+				planeX[plane] = _mm256_set1_ps(frustum.Planes[plane].x);
+				planeY[plane] = _mm256_set1_ps(frustum.Planes[plane].y);
+				planeZ[plane] = _mm256_set1_ps(frustum.Planes[plane].z);
+				planeW[plane] = _mm256_set1_ps(frustum.Planes[plane].w);
+			}
+
+			const __m256 zero = _mm256_setzero_ps();
+
+			uint32_t visibleCount = 0;
+			for (uint32_t i = begin; i < end; i += 8)
+			{
+				const __m256 centerX = _mm256_loadu_ps(x + i);
+				const __m256 centerY = _mm256_loadu_ps(y + i);
+				const __m256 centerZ = _mm256_loadu_ps(z + i);
+				const __m256 radius = _mm256_loadu_ps(r + i);
+
+				__m256 outside = zero;
+				for (int plane = 0; plane < 6; plane++)
+				{
+					__m256 distance = _mm256_fmadd_ps(planeX[plane], centerX, planeW[plane]);
+					distance = _mm256_fmadd_ps(planeY[plane], centerY, distance);
+					distance = _mm256_fmadd_ps(planeZ[plane], centerZ, distance);
+					outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_LT_OQ));
+				}
+
+				const uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_ps(outside)) & 0xFF;
+				visibleCount += WriteVisible(mask, i, visible + visibleCount);
+			}
+
+			return visibleCount;
+		}
+
+		bool IsAVX2Supported()
+		{
+#if defined(_MSC_VER)
+			int info[4];
+			__cpuid(info, 0);
+			if (info[0] < 7)
+				return false;
+
+			//the OS has to save the ymm registers
+			__cpuid(info, 1);
+			const bool osxsave = (info[2] & (1 << 27)) != 0;
+			const bool fma = (info[2] & (1 << 12)) != 0;
+			if (!osxsave || !fma || (_xgetbv(0) & 0x6) != 0x6)
+				return false;
+
+			__cpuidex(info, 7, 0);
+			return (info[1] & (1 << 5)) != 0;
+#else
+			return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+		}
+	}
+
+	const char* GetCullPathName(CullPath path)
+	{
+		switch (path)
+		{
+		case CullPath::SSE:
+			return "SSE";
+		case CullPath::AVX2:
+			return "AVX2";
+		default:
+			return "scalar";
+		}
+	}
+
+	void ObjectCuller::Update(const RenderObject* objects, uint32_t count, WorkerPool& workers, uint32_t threadCount)
+	{
+		m_Objects = objects;
+		m_Count = count;
+		m_Valid = true;
+
+		const uint32_t paddedCount = (count + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+		m_CenterX.resize(paddedCount);
+		m_CenterY.resize(paddedCount);
+		m_CenterZ.resize(paddedCount);
+		m_Radius.resize(paddedCount);
+
+		//the padding is outside of every frustum, a radius of -infinity fails every plane
+		for (uint32_t i = count; i < paddedCount; i++)
+		{
+			m_CenterX[i] = m_CenterY[i] = m_CenterZ[i] = 0.0f;
+			m_Radius[i] = -std::numeric_limits<float>::infinity();
+		}
+
+		const uint32_t chunkCount = GetChunkCount(count, threadCount, workers);
+		const uint32_t chunkSize = (count + chunkCount - 1) / chunkCount;
+
+		workers.Run(chunkCount, [&](uint32_t chunk)
+		{
+			const uint32_t begin = chunk * chunkSize;
+			const uint32_t end = std::min(count, begin + chunkSize);
+
+			for (uint32_t i = begin; i < end; i++)
+			{
+				const RenderObject& object = objects[i];
+
+				const glm::vec3 center = glm::vec3(object.transformMatrix * glm::vec4(object.mesh->GetBoundsCenter(), 1.0f));
+				m_CenterX[i] = center.x;
+				m_CenterY[i] = center.y;
+				m_CenterZ[i] = center.z;
+				m_Radius[i] = object.instances != nullptr ? std::numeric_limits<float>::infinity() : object.mesh->GetBoundsRadius() * GetMaxScale(object.transformMatrix);
+			}
+		});
+	}
+
+	uint32_t ObjectCuller::Cull(const Frustum& frustum, uint32_t* visible, WorkerPool& workers, uint32_t threadCount, CullPath path) const
+	{
+		if (m_Count == 0)
+			return 0;
+
+		const uint32_t paddedCount = static_cast<uint32_t>(m_Radius.size());
+		const uint32_t chunkCount = std::min(GetChunkCount(m_Count, threadCount, workers), MAX_CHUNKS);
+		const uint32_t chunkSize = GetChunkSize(paddedCount, chunkCount);
+
+		//every chunk compacts its indices at the start of its own range of visible, which can't hold more than the chunk's objects
+		uint32_t chunkVisible[MAX_CHUNKS];
+
+		workers.Run(chunkCount, [&](uint32_t chunk)
+		{
+			const uint32_t begin = std::min(paddedCount, chunk * chunkSize);
+			const uint32_t end = std::min(paddedCount, begin + chunkSize);
+			chunkVisible[chunk] = CullRange(frustum, begin, end, visible + begin, path);
+		});
+
+		//then the ranges are moved together
+		uint32_t visibleCount = chunkVisible[0];
+		for (uint32_t chunk = 1; chunk < chunkCount; chunk++)
+		{
+			memmove(visible + visibleCount, visible + std::min(paddedCount, chunk * chunkSize), chunkVisible[chunk] * sizeof(uint32_t));
+			visibleCount += chunkVisible[chunk];
+		}
+
+		return visibleCount;
+	}
+
+	uint32_t ObjectCuller::CullRange(const Frustum& frustum, uint32_t begin, uint32_t end, uint32_t* visible, CullPath path) const
+	{
+		const float* x = m_CenterX.data();
+		const float* y = m_CenterY.data();
+		const float* z = m_CenterZ.data();
+		const float* r = m_Radius.data();
+
+		switch (path)
+		{
+		case CullPath::AVX2:
+			return CullAVX2(frustum, x, y, z, r, begin, end, visible);
+		case CullPath::SSE:
+			return CullSSE(frustum, x, y, z, r, begin, end, visible);
+		default:
+			return CullScalar(frustum, x, y, z, r, begin, end, visible);
+		}
+	}
+
+	CullPath ObjectCuller::GetSupportedPath()
+	{
+		//x64 always has SSE2
+		static const CullPath path = IsAVX2Supported() ? CullPath::AVX2 : CullPath::SSE;
+		return path;
+	}
+}
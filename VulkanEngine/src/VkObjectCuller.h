@@ -0,0 +1,66 @@
+#pragma once
+
+#include "VkCulling.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace VKE
+{
+	struct RenderObject;
+	class WorkerPool;
+
+	//how ObjectCuller::Cull tests the spheres: one at a time, four with SSE or eight with AVX2
+	enum class CullPath
+	{
+		Scalar,
+		SSE,
+		AVX2
+	};
+
+	const char* GetCullPathName(CullPath path);
+
+	//world space bounding spheres of the render objects, kept as separate arrays of center x, y, z and radius so the frustum test
+	//runs over four or eight objects per instruction. the arrays are padded to a multiple of eight with spheres that are always culled.
+	//
+	//the spheres are computed by Update from the meshes' import time bounds and the objects' transforms. objects with an instance
+	//group get an infinite radius, their instances aren't covered by the mesh's bounds.
+	//
+	//they are cached until Invalidate: the culler can't see objects or transforms change behind the same pointer and count,
+	//whoever changes them has to call it or the stale spheres keep being tested
+	class ObjectCuller
+	{
+	public:
+		//objects tested by one thread at least, fewer aren't worth starting a thread for
+		static constexpr uint32_t MIN_CHUNK_SIZE = 16384;
+
+		//recomputes the spheres of every object, on threadCount threads of workers for large scenes. 0 uses all of them
+		void Update(const RenderObject* objects, uint32_t count, WorkerPool& workers, uint32_t threadCount = 0);
+		//whether Update was last called with these objects and they weren't invalidated since
+		bool IsCurrent(const RenderObject* objects, uint32_t count) const { return m_Valid && objects == m_Objects && count == m_Count; }
+		//after objects were replaced or their transforms, meshes or instances changed, the next IsCurrent fails
+		void Invalidate() { m_Valid = false; }
+
+		//writes the indices of the objects intersecting the frustum to visible in ascending order and returns how many there are.
+		//visible needs room for GetCount() indices
+		uint32_t Cull(const Frustum& frustum, uint32_t* visible, WorkerPool& workers, uint32_t threadCount = 1, CullPath path = GetSupportedPath()) const;
+
+		//the widest path the CPU runs, checked once
+		static CullPath GetSupportedPath();
+
+		uint32_t GetCount() const { return m_Count; }
+
+	private:
+		//the objects in [begin, end) of the padded arrays, end is a multiple of eight
+		uint32_t CullRange(const Frustum& frustum, uint32_t begin, uint32_t end, uint32_t* visible, CullPath path) const;
+
+		const RenderObject* m_Objects = nullptr;
+		uint32_t m_Count = 0;
+		bool m_Valid = false;
+
+		std::vector<float> m_CenterX;
+		std::vector<float> m_CenterY;
+		std::vector<float> m_CenterZ;
+		std::vector<float> m_Radius;
+	};
+}
@@ -0,0 +1,122 @@
+#include "VkParallel.h"
+
+#include <algorithm>
+
+namespace VKE
+{
+	namespace
+	{
+		//set while a thread runs jobs of the pool, a Run from inside a job can't wait for the threads it is running on
+		thread_local bool t_InJob = false;
+	}
+
+	void WorkerPool::Init(uint32_t threadCount)
+	{
+		Shutdown();
+
+		if (threadCount == 0)
+		{
+			threadCount = std::max(1u, std::thread::hardware_concurrency());
+		}
+
+		m_Stop = false;
+		m_Threads.reserve(threadCount - 1);
+		for (uint32_t i = 1; i < threadCount; i++)
+		{
+			m_Threads.emplace_back([this]() { WorkerLoop(); });
+		}
+	}
+
+	void WorkerPool::Shutdown()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Stop = true;
+		}
+		m_WorkReady.notify_all();
+
+		for (std::thread& thread : m_Threads)
+		{
+			thread.join();
+		}
+		m_Threads.clear();
+	}
+
+	void WorkerPool::Dispatch(size_t count, InvokeFunction invoke, void* context)
+	{
+		if (count == 0)
+			return;
+
+		if (count == 1 || m_Threads.empty() || t_InJob)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				invoke(context, i);
+			}
+			return;
+		}
+
+		std::lock_guard<std::mutex> dispatchLock(m_DispatchMutex);
+
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			//a worker that woke up late for the last job may still be looking at it
+			m_WorkDone.wait(lock, [this]() { return m_Busy == 0; });
+
+			m_Invoke = invoke;
+			m_Context = context;
+			m_Count = count;
+			m_NextIndex.store(0, std::memory_order_relaxed);
+			m_Generation++;
+		}
+		m_WorkReady.notify_all();
+
+		t_InJob = true;
+		RunJobs();
+		t_InJob = false;
+
+		//every index is taken, the jobs still running belong to busy workers
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_WorkDone.wait(lock, [this]() { return m_Busy == 0; });
+	}
+
+	void WorkerPool::RunJobs()
+	{
+		for (size_t i = m_NextIndex.fetch_add(1, std::memory_order_relaxed); i < m_Count; i = m_NextIndex.fetch_add(1, std::memory_order_relaxed))
+		{
+			m_Invoke(m_Context, i);
+		}
+	}
+
+	void WorkerPool::WorkerLoop()
+	{
+		t_InJob = true;
+
+		uint64_t generation = 0;
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_Mutex);
+				m_WorkReady.wait(lock, [&]() { return m_Stop || m_Generation != generation; });
+				if (m_Stop)
+					return;
+
+				generation = m_Generation;
+				m_Busy++;
+			}
+
+			//the job isn't replaced while this worker is busy
+			RunJobs();
+
+			bool idle;
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				idle = --m_Busy == 0;
+			}
+			if (idle)
+			{
+				m_WorkDone.notify_all();
+			}
+		}
+	}
+}
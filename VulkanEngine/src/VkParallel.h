@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace VKE
+{
+	//runs job(i) for every i in [0, count) on its own thread and waits for all of them. a count of 1 runs on the calling thread.
+	//starts the threads on every call, for one-off work like loading. per frame work goes to a WorkerPool
+	template<typename Job>
+	void RunParallel(size_t count, Job&& job)
+	{
+		if (count == 1)
+		{
+			job(0);
+			return;
+		}
+
+		std::vector<std::thread> threads;
+		threads.reserve(count);
+
+		for (size_t i = 0; i < count; i++)
+		{
+			threads.emplace_back([&job, i]() { job(i); });
+		}
+
+		for (std::thread& thread : threads)
+		{
+			thread.join();
+		}
+	}
+
+	//threads started once that take the jobs of Run, together with the calling thread.
+	//Run doesn't allocate: the job is passed by pointer and the threads pick the next index from a shared counter
+	class WorkerPool
+	{
+	public:
+		WorkerPool() = default;
+		WorkerPool(const WorkerPool&) = delete;
+		WorkerPool& operator=(const WorkerPool&) = delete;
+		~WorkerPool() { Shutdown(); }
+
+		//starts threadCount - 1 workers, the thread calling Run is the last one. 0 uses one per hardware thread
+		void Init(uint32_t threadCount = 0);
+		//waits for the workers to exit, Run afterwards stays on the calling thread
+		void Shutdown();
+
+		//runs job(i) for every i in [0, count) and waits for all of them. every index runs once, on any of the threads.
+		//calls from inside a job and calls without workers run the jobs one after another on the calling thread
+		template<typename Job>
+		void Run(size_t count, Job&& job)
+		{
+			using JobType = std::remove_reference_t<Job>;
+			Dispatch(count, [](void* context, size_t i) { (*static_cast<JobType*>(context))(i); }, const_cast<void*>(static_cast<const void*>(&job)));
+		}
+
+		//the workers plus the calling thread
+		uint32_t GetThreadCount() const { return static_cast<uint32_t>(m_Threads.size()) + 1; }
+
+	private:
+		using InvokeFunction = void (*)(void* context, size_t index);
+
+		void Dispatch(size_t count, InvokeFunction invoke, void* context);
+		//takes indices of the current job until there are none left
+		void RunJobs();
+		void WorkerLoop();
+
+		std::vector<std::thread> m_Threads;
+
+		//one Run at a time
+		std::mutex m_DispatchMutex;
+
+		//guards everything below but m_NextIndex
+		std::mutex m_Mutex;
+		std::condition_variable m_WorkReady;
+		std::condition_variable m_WorkDone;
+
+		InvokeFunction m_Invoke = nullptr;
+		void* m_Context = nullptr;
+		size_t m_Count = 0;
+		std::atomic<size_t> m_NextIndex = 0;
+		//bumped by every Run, workers join a job once
+		uint64_t m_Generation = 0;
+		//workers inside RunJobs, the job is only replaced once they all left
+		uint32_t m_Busy = 0;
+		bool m_Stop = false;
+	};
+}
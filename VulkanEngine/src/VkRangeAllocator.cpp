@@ -0,0 +1,272 @@
+#include "VkRangeAllocator.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+
+namespace VKE
+{
+	void RangeAllocator::Init(uint32_t capacity)
+	{
+		m_Capacity = capacity;
+		m_UsedSize = 0;
+
+		m_Blocks.clear();
+		m_UnusedBlocks.clear();
+		m_Allocations.clear();
+
+		m_FirstLevelBitmap = 0;
+		for (uint32_t firstLevel = 0; firstLevel < FIRST_LEVEL_COUNT; firstLevel++)
+		{
+			m_SecondLevelBitmaps[firstLevel] = 0;
+			for (uint32_t secondLevel = 0; secondLevel < SECOND_LEVEL_COUNT; secondLevel++)
+			{
+				m_FreeLists[firstLevel][secondLevel] = NO_BLOCK;
+			}
+		}
+
+		if (capacity > 0)
+		{
+			InsertFree(CreateBlock(0, capacity, NO_BLOCK, NO_BLOCK));
+		}
+	}
+
+	uint32_t RangeAllocator::Allocate(uint32_t size)
+	{
+		if (size == 0)
+			return INVALID_OFFSET;
+
+		const uint32_t block = FindFree(size);
+		if (block == NO_BLOCK)
+			return INVALID_OFFSET;
+
+		RemoveFree(block);
+
+		//give the tail back as a free block of its own
+		if (m_Blocks[block].Size > size)
+		{
+			const uint32_t remainder = CreateBlock(m_Blocks[block].Offset + size, m_Blocks[block].Size - size, block, m_Blocks[block].NextPhysical);
+
+			if (m_Blocks[block].NextPhysical != NO_BLOCK)
+			{
+				m_Blocks[m_Blocks[block].NextPhysical].PreviousPhysical = remainder;
+			}
+
+			m_Blocks[block].NextPhysical = remainder;
+			m_Blocks[block].Size = size;
+
+			InsertFree(remainder);
+		}
+
+		m_UsedSize += size;
+		m_Allocations[m_Blocks[block].Offset] = block;
+
+		return m_Blocks[block].Offset;
+	}
+
+	void RangeAllocator::Free(uint32_t offset)
+	{
+		auto it = m_Allocations.find(offset);
+		assert(it != m_Allocations.end());
+		if (it == m_Allocations.end())
+			return;
+
+		uint32_t block = it->second;
+		m_Allocations.erase(it);
+		m_UsedSize -= m_Blocks[block].Size;
+
+		//merge with the free neighbours, so free space never stays split up
+		const uint32_t next = m_Blocks[block].NextPhysical;
+		if (next != NO_BLOCK && m_Blocks[next].IsFree)
+		{
+			RemoveFree(next);
+
+			m_Blocks[block].Size += m_Blocks[next].Size;
+			m_Blocks[block].NextPhysical = m_Blocks[next].NextPhysical;
+			if (m_Blocks[next].NextPhysical != NO_BLOCK)
+			{
+				m_Blocks[m_Blocks[next].NextPhysical].PreviousPhysical = block;
+			}
+
+			ReleaseBlock(next);
+		}
+
+		const uint32_t previous = m_Blocks[block].PreviousPhysical;
+		if (previous != NO_BLOCK && m_Blocks[previous].IsFree)
+		{
+			RemoveFree(previous);
+
+			m_Blocks[previous].Size += m_Blocks[block].Size;
+			m_Blocks[previous].NextPhysical = m_Blocks[block].NextPhysical;
+			if (m_Blocks[block].NextPhysical != NO_BLOCK)
+			{
+				m_Blocks[m_Blocks[block].NextPhysical].PreviousPhysical = previous;
+			}
+
+			ReleaseBlock(block);
+			block = previous;
+		}
+
+		InsertFree(block);
+	}
+
+	void RangeAllocator::Compact(uint32_t capacity, std::vector<RangeMove>& outMoves)
+	{
+		//live ranges in address order
+		std::vector<std::pair<uint32_t, uint32_t>> ranges;
+		ranges.reserve(m_Allocations.size());
+		for (const auto& [offset, block] : m_Allocations)
+		{
+			ranges.push_back({ offset, m_Blocks[block].Size });
+		}
+
+		std::sort(ranges.begin(), ranges.end());
+
+		Init(std::max(capacity, m_UsedSize));
+
+		outMoves.clear();
+		for (const auto& [offset, size] : ranges)
+		{
+			//the free space is a single block at the end, so every allocation lands right after the previous one
+			outMoves.push_back({ offset, Allocate(size), size });
+		}
+	}
+
+	uint32_t RangeAllocator::GetLargestFreeBlock() const
+	{
+		if (m_FirstLevelBitmap == 0)
+			return 0;
+
+		//the highest non-empty bucket holds the largest blocks
+		const uint32_t firstLevel = std::bit_width(m_FirstLevelBitmap) - 1;
+		const uint32_t secondLevel = std::bit_width(m_SecondLevelBitmaps[firstLevel]) - 1;
+
+		uint32_t largest = 0;
+		for (uint32_t block = m_FreeLists[firstLevel][secondLevel]; block != NO_BLOCK; block = m_Blocks[block].NextFree)
+		{
+			largest = std::max(largest, m_Blocks[block].Size);
+		}
+
+		return largest;
+	}
+
+	void RangeAllocator::MapSize(uint32_t size, uint32_t& outFirstLevel, uint32_t& outSecondLevel)
+	{
+		//sizes below SECOND_LEVEL_COUNT get one bucket each in the first level
+		if (size < SECOND_LEVEL_COUNT)
+		{
+			outFirstLevel = 0;
+			outSecondLevel = size;
+			return;
+		}
+
+		const uint32_t highestBit = std::bit_width(size) - 1;
+		outFirstLevel = highestBit - SECOND_LEVEL_BITS + 1;
+		outSecondLevel = (size >> (highestBit - SECOND_LEVEL_BITS)) ^ SECOND_LEVEL_COUNT;
+	}
+
+	uint32_t RangeAllocator::CreateBlock(uint32_t offset, uint32_t size, uint32_t previousPhysical, uint32_t nextPhysical)
+	{
+		uint32_t block;
+		if (!m_UnusedBlocks.empty())
+		{
+			block = m_UnusedBlocks.back();
+			m_UnusedBlocks.pop_back();
+		}
+		else
+		{
+			block = static_cast<uint32_t>(m_Blocks.size());
+			m_Blocks.emplace_back();
+		}
+
+		m_Blocks[block] = { offset, size, previousPhysical, nextPhysical, NO_BLOCK, NO_BLOCK, false };
+		return block;
+	}
+
+	void RangeAllocator::ReleaseBlock(uint32_t block)
+	{
+		m_UnusedBlocks.push_back(block);
+	}
+
+	void RangeAllocator::InsertFree(uint32_t block)
+	{
+		uint32_t firstLevel, secondLevel;
+		MapSize(m_Blocks[block].Size, firstLevel, secondLevel);
+
+		const uint32_t head = m_FreeLists[firstLevel][secondLevel];
+
+		m_Blocks[block].IsFree = true;
+		m_Blocks[block].PreviousFree = NO_BLOCK;
+		m_Blocks[block].NextFree = head;
+
+		if (head != NO_BLOCK)
+		{
+			m_Blocks[head].PreviousFree = block;
+		}
+
+		m_FreeLists[firstLevel][secondLevel] = block;
+		m_FirstLevelBitmap |= 1u << firstLevel;
+		m_SecondLevelBitmaps[firstLevel] |= 1u << secondLevel;
+	}
+
+	void RangeAllocator::RemoveFree(uint32_t block)
+	{
+		uint32_t firstLevel, secondLevel;
+		MapSize(m_Blocks[block].Size, firstLevel, secondLevel);
+
+		const uint32_t previous = m_Blocks[block].PreviousFree;
+		const uint32_t next = m_Blocks[block].NextFree;
+
+		if (previous != NO_BLOCK)
+			m_Blocks[previous].NextFree = next;
+		else
+			m_FreeLists[firstLevel][secondLevel] = next;
+
+		if (next != NO_BLOCK)
+			m_Blocks[next].PreviousFree = previous;
+
+		if (m_FreeLists[firstLevel][secondLevel] == NO_BLOCK)
+		{
+			m_SecondLevelBitmaps[firstLevel] &= ~(1u << secondLevel);
+			if (m_SecondLevelBitmaps[firstLevel] == 0)
+			{
+				m_FirstLevelBitmap &= ~(1u << firstLevel);
+			}
+		}
+
+		m_Blocks[block].IsFree = false;
+	}
+
+	uint32_t RangeAllocator::FindFree(uint32_t size) const
+	{
+		//round the size up to the next bucket boundary, so every block of the bucket found is large enough
+		uint32_t searchSize = size;
+		if (size >= SECOND_LEVEL_COUNT)
+		{
+			const uint64_t rounded = uint64_t(size) + (1u << (std::bit_width(size) - 1 - SECOND_LEVEL_BITS)) - 1;
+			if (rounded > UINT32_MAX)
+				return NO_BLOCK;
+
+			searchSize = static_cast<uint32_t>(rounded);
+		}
+
+		uint32_t firstLevel, secondLevel;
+		MapSize(searchSize, firstLevel, secondLevel);
+
+		//buckets of this first level that are at least as large
+		uint32_t secondLevelMap = m_SecondLevelBitmaps[firstLevel] & (~0u << secondLevel);
+		if (secondLevelMap == 0)
+		{
+			//otherwise the smallest bucket of a larger first level
+			const uint32_t firstLevelMap = firstLevel + 1 < 32 ? m_FirstLevelBitmap & (~0u << (firstLevel + 1)) : 0;
+			if (firstLevelMap == 0)
+				return NO_BLOCK;
+
+			firstLevel = std::countr_zero(firstLevelMap);
+			secondLevelMap = m_SecondLevelBitmaps[firstLevel];
+		}
+
+		secondLevel = std::countr_zero(secondLevelMap);
+		return m_FreeLists[firstLevel][secondLevel];
+	}
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace VKE
+{
+	//where a live range ends up after compaction
+	struct RangeMove
+	{
+		uint32_t SourceOffset;
+		uint32_t DestinationOffset;
+		uint32_t Size;
+	};
+
+	//two-level segregated fit (TLSF, Masmano et al. 2004) allocator of ranges inside a fixed capacity.
+	//it only does the bookkeeping, the units are whatever the owner counts in (vertices, indices, bytes).
+	//allocation and freeing are O(1): free blocks sit in lists bucketed by the highest bit of their size
+	//and the next SECOND_LEVEL_BITS bits, with bitmaps to find the first non-empty bucket that fits
+	class RangeAllocator
+	{
+	public:
+		static constexpr uint32_t INVALID_OFFSET = ~0u;
+
+		void Init(uint32_t capacity);
+
+		//returns INVALID_OFFSET if no free block is large enough
+		uint32_t Allocate(uint32_t size);
+		void Free(uint32_t offset);
+
+		//packs the live ranges to the front, keeping their order, and resizes to capacity (at least the used size).
+		//outMoves gets every live range, moved or not, so the owner can copy them all into a new buffer and patch its offsets
+		void Compact(uint32_t capacity, std::vector<RangeMove>& outMoves);
+
+		uint32_t GetCapacity() const { return m_Capacity; }
+		uint32_t GetUsedSize() const { return m_UsedSize; }
+		uint32_t GetAllocationCount() const { return static_cast<uint32_t>(m_Allocations.size()); }
+		uint32_t GetLargestFreeBlock() const;
+
+	private:
+		static constexpr uint32_t SECOND_LEVEL_BITS = 4;
+		static constexpr uint32_t SECOND_LEVEL_COUNT = 1 << SECOND_LEVEL_BITS;
+		static constexpr uint32_t FIRST_LEVEL_COUNT = 32 - SECOND_LEVEL_BITS + 1;
+		static constexpr uint32_t NO_BLOCK = ~0u;
+
+		struct Block
+		{
+			uint32_t Offset;
+			uint32_t Size;
+
+			//neighbours in address order
+			uint32_t PreviousPhysical;
+			uint32_t NextPhysical;
+
+			//neighbours in the free list of the block's bucket
+			uint32_t PreviousFree;
+			uint32_t NextFree;
+
+			bool IsFree;
+		};
+
+		static void MapSize(uint32_t size, uint32_t& outFirstLevel, uint32_t& outSecondLevel);
+
+		uint32_t CreateBlock(uint32_t offset, uint32_t size, uint32_t previousPhysical, uint32_t nextPhysical);
+		void ReleaseBlock(uint32_t block);
+
+		void InsertFree(uint32_t block);
+		void RemoveFree(uint32_t block);
+		uint32_t FindFree(uint32_t size) const;
+
+		uint32_t m_Capacity = 0;
+		uint32_t m_UsedSize = 0;
+
+		std::vector<Block> m_Blocks;
+		std::vector<uint32_t> m_UnusedBlocks;
+
+		uint32_t m_FirstLevelBitmap = 0;
+		uint32_t m_SecondLevelBitmaps[FIRST_LEVEL_COUNT] = {};
+		uint32_t m_FreeLists[FIRST_LEVEL_COUNT][SECOND_LEVEL_COUNT];
+
+		//offset of every live allocation to its block
+		std::unordered_map<uint32_t, uint32_t> m_Allocations;
+	};
+}
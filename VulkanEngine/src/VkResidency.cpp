@@ -0,0 +1,228 @@
+#include "VkResidency.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+namespace VKE
+{
+	namespace
+	{
+		double ToMegabytes(VkDeviceSize bytes)
+		{
+			return double(bytes) / (1024.0 * 1024.0);
+		}
+	}
+
+	const char* GetResidencyPriorityName(ResidencyPriority priority)
+	{
+		switch (priority)
+		{
+		case ResidencyPriority::Low:
+			return "low";
+		case ResidencyPriority::Normal:
+			return "normal";
+		case ResidencyPriority::High:
+			return "high";
+		case ResidencyPriority::Pinned:
+			return "pinned";
+		default:
+			return "unknown";
+		}
+	}
+
+	void ResidencyManager::Init(VmaAllocator allocator, bool budgetExtension, uint32_t framesInFlight)
+	{
+		m_Allocator = allocator;
+		m_BudgetExtension = budgetExtension;
+		m_FramesInFlight = framesInFlight;
+
+		RefreshBudgets();
+	}
+
+	uint32_t ResidencyManager::Register(const std::string& name, ResidencyPriority priority, VkDeviceSize size, std::function<void()>&& evict, std::function<void()>&& restream)
+	{
+		Resource resource;
+		resource.Name = name;
+		resource.Priority = priority;
+		resource.Size = size;
+		resource.LastUsedFrame = m_FrameNumber;
+		resource.Evict = std::move(evict);
+		resource.Restream = std::move(restream);
+
+		m_Resources.push_back(std::move(resource));
+		return static_cast<uint32_t>(m_Resources.size() - 1);
+	}
+
+	void ResidencyManager::SetPriority(uint32_t handle, ResidencyPriority priority)
+	{
+		assert(handle < m_Resources.size());
+		m_Resources[handle].Priority = priority;
+	}
+
+	bool ResidencyManager::Touch(uint32_t handle)
+	{
+		if (handle == INVALID_HANDLE)
+			return true;
+
+		Resource& resource = m_Resources[handle];
+		resource.LastUsedFrame = m_FrameNumber;
+
+		if (!resource.Resident)
+		{
+			resource.RestreamRequested = true;
+			return false;
+		}
+
+		return true;
+	}
+
+	bool ResidencyManager::IsResident(uint32_t handle) const
+	{
+		return handle == INVALID_HANDLE || m_Resources[handle].Resident;
+	}
+
+	void ResidencyManager::Update(uint64_t frameNumber)
+	{
+		m_FrameNumber = frameNumber;
+
+		//with VK_EXT_memory_budget enabled this is also when VMA fetches the budget from the driver
+		vmaSetCurrentFrameIndex(m_Allocator, static_cast<uint32_t>(frameNumber));
+		RefreshBudgets();
+
+		if (GetExcess(0, EVICTION_THRESHOLD) > 0)
+		{
+			m_Statistics.OverBudgetFrames++;
+
+			Evict(GetExcess(0, EVICTION_TARGET));
+			RefreshBudgets();
+		}
+
+		//what doesn't fit yet is asked for again the next time it is drawn
+		for (Resource& resource : m_Resources)
+		{
+			if (!resource.RestreamRequested)
+				continue;
+
+			resource.RestreamRequested = false;
+			if (!MakeRoom(resource.Size))
+				continue;
+
+			resource.Restream();
+			resource.Resident = true;
+
+			m_Statistics.Restreams++;
+			m_Statistics.RestreamedBytes += resource.Size;
+		}
+	}
+
+	bool ResidencyManager::MakeRoom(VkDeviceSize size)
+	{
+		RefreshBudgets();
+		if (GetExcess(size, EVICTION_THRESHOLD) == 0)
+			return true;
+
+		Evict(GetExcess(size, EVICTION_TARGET));
+		RefreshBudgets();
+
+		return GetExcess(size, EVICTION_THRESHOLD) == 0;
+	}
+
+	void ResidencyManager::PrintStatistics() const
+	{
+		std::cout << "Memory budget: " << (m_BudgetExtension ? "VK_EXT_memory_budget" : "estimated by VMA, VK_EXT_memory_budget not available") << std::endl;
+
+		for (size_t heap = 0; heap < m_Heaps.size(); heap++)
+		{
+			const HeapStatistics& statistics = m_Heaps[heap];
+			std::cout << "  heap " << heap << ((statistics.Flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? " (device local)" : " (host)") << ": "
+				<< ToMegabytes(statistics.Usage) << " of " << ToMegabytes(statistics.Budget) << " MB budget used, "
+				<< ToMegabytes(statistics.AllocationBytes) << " MB allocated in " << ToMegabytes(statistics.BlockBytes) << " MB of blocks, heap size "
+				<< ToMegabytes(statistics.Size) << " MB" << std::endl;
+		}
+
+		std::cout << "Residency: " << m_Resources.size() << " resources, " << m_Statistics.Evictions << " evictions (" << ToMegabytes(m_Statistics.EvictedBytes) << " MB), "
+			<< m_Statistics.Restreams << " restreams (" << ToMegabytes(m_Statistics.RestreamedBytes) << " MB), "
+			<< m_Statistics.OverBudgetFrames << " frames over " << EVICTION_THRESHOLD * 100.0f << "% of the budget" << std::endl;
+	}
+
+	void ResidencyManager::RefreshBudgets()
+	{
+		const VkPhysicalDeviceMemoryProperties* memoryProperties;
+		vmaGetMemoryProperties(m_Allocator, &memoryProperties);
+
+		VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+		vmaGetBudget(m_Allocator, budgets);
+
+		m_Heaps.resize(memoryProperties->memoryHeapCount);
+		for (uint32_t heap = 0; heap < memoryProperties->memoryHeapCount; heap++)
+		{
+			HeapStatistics& statistics = m_Heaps[heap];
+			statistics.Flags = memoryProperties->memoryHeaps[heap].flags;
+			statistics.Size = memoryProperties->memoryHeaps[heap].size;
+			statistics.Budget = budgets[heap].budget;
+			statistics.Usage = budgets[heap].usage;
+			statistics.BlockBytes = budgets[heap].blockBytes;
+			statistics.AllocationBytes = budgets[heap].allocationBytes;
+		}
+	}
+
+	VkDeviceSize ResidencyManager::GetExcess(VkDeviceSize extra, float fraction) const
+	{
+		//textures and geometry are allocated in device local memory, which can be any device local heap
+		VkDeviceSize usage = extra;
+		VkDeviceSize budget = 0;
+		for (const HeapStatistics& statistics : m_Heaps)
+		{
+			if (statistics.Flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+			{
+				usage += statistics.Usage;
+				budget += statistics.Budget;
+			}
+		}
+
+		const VkDeviceSize limit = static_cast<VkDeviceSize>(double(budget) * fraction);
+		return usage > limit ? usage - limit : 0;
+	}
+
+	VkDeviceSize ResidencyManager::Evict(VkDeviceSize bytes)
+	{
+		//frames still in flight may read what they drew with. the member keeps its capacity between evictions
+		std::vector<Resource*>& candidates = m_EvictionCandidates;
+		candidates.clear();
+		for (Resource& resource : m_Resources)
+		{
+			if (resource.Resident && resource.Priority != ResidencyPriority::Pinned && resource.LastUsedFrame + m_FramesInFlight <= m_FrameNumber)
+			{
+				candidates.push_back(&resource);
+			}
+		}
+
+		std::sort(candidates.begin(), candidates.end(), [](const Resource* a, const Resource* b)
+		{
+			if (a->Priority != b->Priority)
+				return a->Priority < b->Priority;
+
+			return a->LastUsedFrame < b->LastUsedFrame;
+		});
+
+		VkDeviceSize freed = 0;
+		for (Resource* resource : candidates)
+		{
+			if (freed >= bytes)
+				break;
+
+			resource->Evict();
+			resource->Resident = false;
+			freed += resource->Size;
+
+			m_Statistics.Evictions++;
+			m_Statistics.EvictedBytes += resource->Size;
+
+			std::cout << "Evicted " << resource->Name << " (" << GetResidencyPriorityName(resource->Priority) << " priority, " << ToMegabytes(resource->Size)
+				<< " MB, last used " << m_FrameNumber - resource->LastUsedFrame << " frames ago)" << std::endl;
+		}
+
+		return freed;
+	}
+}
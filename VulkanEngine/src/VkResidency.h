@@ -0,0 +1,116 @@
+#pragma once
+
+#include "VkTypes.h"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace VKE
+{
+	//which resources go first when memory runs low: lower priorities before higher ones, the least recently used first
+	//within a priority. pinned resources are never evicted
+	enum class ResidencyPriority : uint8_t
+	{
+		Low,
+		Normal,
+		High,
+		Pinned
+	};
+
+	const char* GetResidencyPriorityName(ResidencyPriority priority);
+
+	//budget and usage of one memory heap, as of the last update
+	struct HeapStatistics
+	{
+		VkMemoryHeapFlags Flags = 0;
+		VkDeviceSize Size = 0;
+		//what the application may use, from VK_EXT_memory_budget if enabled, estimated by VMA otherwise
+		VkDeviceSize Budget = 0;
+		//used by this and every other process if the extension is enabled, by this allocator otherwise
+		VkDeviceSize Usage = 0;
+		//memory blocks VMA allocated and the part of them handed out
+		VkDeviceSize BlockBytes = 0;
+		VkDeviceSize AllocationBytes = 0;
+	};
+
+	//eviction counters since startup
+	struct ResidencyStatistics
+	{
+		uint64_t Evictions = 0;
+		uint64_t EvictedBytes = 0;
+		uint64_t Restreams = 0;
+		uint64_t RestreamedBytes = 0;
+		//updates that found a device local heap over the threshold
+		uint64_t OverBudgetFrames = 0;
+	};
+
+	//keeps the device local memory under its budget. registered resources are marked when they are drawn,
+	//and when usage nears the budget the least recently used ones are evicted through their callbacks.
+	//an evicted resource is streamed back in at the next update after something tries to draw it
+	class ResidencyManager
+	{
+	public:
+		static constexpr uint32_t INVALID_HANDLE = UINT32_MAX;
+		//eviction starts once the device local heaps use this much of their budget
+		static constexpr float EVICTION_THRESHOLD = 0.9f;
+		//and goes on until they are down to this, so it doesn't start again with the next allocation
+		static constexpr float EVICTION_TARGET = 0.8f;
+
+		//resources used in the last framesInFlight frames may still be read by the GPU and are never evicted
+		void Init(VmaAllocator allocator, bool budgetExtension, uint32_t framesInFlight);
+
+		//evict frees the resource's memory, restream loads it again. size is what evicting it gives back
+		uint32_t Register(const std::string& name, ResidencyPriority priority, VkDeviceSize size, std::function<void()>&& evict, std::function<void()>&& restream);
+		void SetPriority(uint32_t handle, ResidencyPriority priority);
+
+		//marks the resource as used by the current frame and, if it was evicted, asks for it to be streamed back in.
+		//returns false while it isn't resident. untracked handles are always resident
+		bool Touch(uint32_t handle);
+		bool IsResident(uint32_t handle) const;
+
+		//once per frame, after waiting for the frame's fence and before recording it: refreshes the budgets,
+		//evicts while over the threshold and streams back in what was asked for
+		void Update(uint64_t frameNumber);
+		//evicts until an allocation of size would stay under the threshold. false if that isn't possible
+		bool MakeRoom(VkDeviceSize size);
+
+		bool HasBudgetExtension() const { return m_BudgetExtension; }
+		const std::vector<HeapStatistics>& GetHeapStatistics() const { return m_Heaps; }
+		const ResidencyStatistics& GetStatistics() const { return m_Statistics; }
+		void PrintStatistics() const;
+
+	private:
+		struct Resource
+		{
+			std::string Name;
+			ResidencyPriority Priority = ResidencyPriority::Normal;
+			VkDeviceSize Size = 0;
+			uint64_t LastUsedFrame = 0;
+			bool Resident = true;
+			bool RestreamRequested = false;
+
+			std::function<void()> Evict;
+			std::function<void()> Restream;
+		};
+
+		void RefreshBudgets();
+		//bytes the device local heaps are over the threshold with extra more allocated, 0 if they aren't
+		VkDeviceSize GetExcess(VkDeviceSize extra, float fraction) const;
+		//evicts the lowest priority, least recently used resources until at least bytes are freed, returns how much was
+		VkDeviceSize Evict(VkDeviceSize bytes);
+
+		VmaAllocator m_Allocator = VK_NULL_HANDLE;
+		bool m_BudgetExtension = false;
+		uint32_t m_FramesInFlight = 1;
+		uint64_t m_FrameNumber = 0;
+
+		std::vector<Resource> m_Resources;
+		std::vector<HeapStatistics> m_Heaps;
+		//Evict's working array
+		std::vector<Resource*> m_EvictionCandidates;
+
+		ResidencyStatistics m_Statistics;
+	};
+}
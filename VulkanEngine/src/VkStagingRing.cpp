@@ -0,0 +1,442 @@
+#include "VkStagingRing.h"
+
+#include "VkInit.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+
+namespace VKE
+{
+	void StagingRing::Init(VkDevice device, VmaAllocator allocator, const VmaAllocationCreateInfo& memoryInfo, VkQueue queue, uint32_t queueFamily, uint32_t graphicsFamily, VkDeviceSize size)
+	{
+		m_Device = device;
+		m_Allocator = allocator;
+		m_MemoryInfo = memoryInfo;
+		m_Queue = queue;
+
+		m_QueueFamily = queueFamily;
+		m_GraphicsFamily = graphicsFamily;
+		m_OwnershipTransfer = queueFamily != graphicsFamily;
+
+		VkCommandPoolCreateInfo commandPoolInfo = VkInit::CommandPoolCreateInfo(queueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+		VkResult result = vkCreateCommandPool(m_Device, &commandPoolInfo, nullptr, &m_CommandPool);
+		assert(result == VK_SUCCESS);
+
+		VkCommandBuffer commandBuffers[SUBMISSION_COUNT];
+		VkCommandBufferAllocateInfo cmdAllocInfo = VkInit::CommadBufferAllocateInfo(m_CommandPool, SUBMISSION_COUNT, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+		result = vkAllocateCommandBuffers(m_Device, &cmdAllocInfo, commandBuffers);
+		assert(result == VK_SUCCESS);
+
+		VkFenceCreateInfo fenceCreateInfo = VkInit::FenceCreateInfo();
+		for (uint32_t i = 0; i < SUBMISSION_COUNT; i++)
+		{
+			m_Submissions[i].CommandBuffer = commandBuffers[i];
+
+			result = vkCreateFence(m_Device, &fenceCreateInfo, nullptr, &m_Submissions[i].Fence);
+			assert(result == VK_SUCCESS);
+		}
+
+		CreateBuffer(size);
+	}
+
+	void StagingRing::Destroy()
+	{
+		Flush();
+
+		DestroyBuffer();
+
+		for (Submission& submission : m_Submissions)
+		{
+			vkDestroyFence(m_Device, submission.Fence, nullptr);
+			submission = Submission{};
+		}
+
+		//frees the command buffers too
+		vkDestroyCommandPool(m_Device, m_CommandPool, nullptr);
+		m_CommandPool = VK_NULL_HANDLE;
+	}
+
+	StagingAllocation StagingRing::Reserve(VkDeviceSize size, VkDeviceSize alignment)
+	{
+		assert(std::has_single_bit(alignment));
+
+		//a reservation larger than the whole ring gets a new ring, once nothing uses the old one. a batch puts it into an overflow buffer
+		if (size > m_Size && !m_Batching)
+		{
+			Flush();
+			DestroyBuffer();
+			CreateBuffer(std::bit_ceil(size));
+
+			m_Statistics.Resizes++;
+		}
+
+		Retire();
+
+		bool stalled = false;
+		const auto stallStart = std::chrono::high_resolution_clock::now();
+
+		uint64_t start;
+		while (true)
+		{
+			//an idle, empty ring starts over at the front, so a large reservation doesn't have to skip the end
+			if (m_Tail == m_Head && m_InFlightCount == 0)
+			{
+				m_Head = 0;
+				m_Tail = 0;
+				m_SubmittedHead = 0;
+			}
+
+			const VkDeviceSize offset = m_Head % m_Size;
+			const VkDeviceSize alignedOffset = (offset + alignment - 1) & ~(alignment - 1);
+
+			//an allocation never wraps around, it skips the rest of the buffer instead
+			start = alignedOffset + size <= m_Size ? m_Head + (alignedOffset - offset) : m_Head + (m_Size - offset);
+
+			if (start + size - m_Tail <= m_Size)
+				break;
+
+			//a batch goes out in one submission, so it can't wait for space to come back
+			if (m_Batching)
+				return ReserveOverflow(size, alignment);
+
+			//the space is held by reservations that aren't submitted yet
+			if (m_InFlightCount == 0)
+			{
+				Submit();
+			}
+
+			stalled = true;
+			WaitOldest();
+		}
+
+		if (stalled)
+		{
+			m_Statistics.Stalls++;
+			m_Statistics.StallMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - stallStart).count();
+		}
+
+		m_Head = start + size;
+
+		m_Statistics.BytesReserved += size;
+		m_Statistics.Reservations++;
+
+		StagingAllocation allocation;
+		allocation.Buffer = m_Buffer.Buffer;
+		allocation.Offset = start % m_Size;
+		allocation.Data = m_Data + allocation.Offset;
+		return allocation;
+	}
+
+	VkCommandBuffer StagingRing::GetCommandBuffer()
+	{
+		//every slot is in flight, the recording one has to wait for the oldest
+		if (m_InFlightCount == SUBMISSION_COUNT)
+		{
+			WaitOldest();
+		}
+
+		Submission& submission = m_Submissions[(m_FirstInFlight + m_InFlightCount) % SUBMISSION_COUNT];
+
+		if (!m_Recording)
+		{
+			VkCommandBufferBeginInfo cmdBeginInfo = VkInit::CommandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+			VkResult result = vkBeginCommandBuffer(submission.CommandBuffer, &cmdBeginInfo);
+			assert(result == VK_SUCCESS);
+
+			m_Recording = true;
+		}
+
+		return submission.CommandBuffer;
+	}
+
+	uint64_t StagingRing::Submit()
+	{
+		if (!m_Recording && m_SubmittedHead == m_Head)
+			return m_NextToken - 1;
+
+		//reservations without copies still need a submission to release their space
+		VkCommandBuffer cmd = GetCommandBuffer();
+
+		//on the graphics queue a barrier makes the copies visible to everything that reads geometry, uniforms, storage buffers or textures after this submission.
+		//a transfer queue can't name those stages, there the release barriers already did it
+		if (!m_OwnershipTransfer)
+		{
+			VkMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				0, 1, &barrier, 0, nullptr, 0, nullptr);
+		}
+
+		VkResult result = vkEndCommandBuffer(cmd);
+		assert(result == VK_SUCCESS);
+
+		Submission& submission = m_Submissions[(m_FirstInFlight + m_InFlightCount) % SUBMISSION_COUNT];
+		submission.End = m_Head;
+		submission.Token = m_NextToken++;
+
+		VkSubmitInfo submit = VkInit::SubmitInfo(&cmd);
+		result = vkQueueSubmit(m_Queue, 1, &submit, submission.Fence);
+		assert(result == VK_SUCCESS);
+
+		m_Recording = false;
+		m_InFlightCount++;
+		m_SubmittedHead = m_Head;
+
+		if (m_OwnershipTransfer)
+		{
+			m_RecordingAcquire.Token = submission.Token;
+			m_PendingAcquires.push_back(std::move(m_RecordingAcquire));
+			m_RecordingAcquire = PendingAcquire{};
+		}
+
+		m_Statistics.Submits++;
+
+		return submission.Token;
+	}
+
+	void StagingRing::ReleaseBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size)
+	{
+		//on the graphics queue the barrier at the end of the submission covers it
+		if (!m_OwnershipTransfer)
+			return;
+
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
+		barrier.srcQueueFamilyIndex = m_QueueFamily;
+		barrier.dstQueueFamilyIndex = m_GraphicsFamily;
+		barrier.buffer = buffer;
+		barrier.offset = offset;
+		barrier.size = size;
+
+		vkCmdPipelineBarrier(GetCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+		m_RecordingAcquire.BufferBarriers.push_back(barrier);
+	}
+
+	void StagingRing::ReleaseImage(VkImage image, const VkImageSubresourceRange& range, VkImageLayout oldLayout, VkImageLayout newLayout)
+	{
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = oldLayout;
+		barrier.newLayout = newLayout;
+		barrier.image = image;
+		barrier.subresourceRange = range;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		if (!m_OwnershipTransfer)
+		{
+			//a plain transition on the graphics queue
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+			vkCmdPipelineBarrier(GetCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+			return;
+		}
+
+		//the release and the acquire name the same layouts, the transition happens once between them
+		barrier.srcQueueFamilyIndex = m_QueueFamily;
+		barrier.dstQueueFamilyIndex = m_GraphicsFamily;
+		barrier.dstAccessMask = 0;
+
+		vkCmdPipelineBarrier(GetCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		m_RecordingAcquire.ImageBarriers.push_back(barrier);
+	}
+
+	void StagingRing::CmdAcquire(VkCommandBuffer cmd)
+	{
+		Retire();
+
+		//on the graphics queue everything submitted is ordered before the commands that come after it
+		if (!m_OwnershipTransfer)
+		{
+			m_AcquiredToken = m_NextToken - 1;
+			return;
+		}
+
+		//members that keep their capacity, a frame without uploads to acquire doesn't allocate
+		std::vector<VkBufferMemoryBarrier>& bufferBarriers = m_AcquireBufferBarriers;
+		std::vector<VkImageMemoryBarrier>& imageBarriers = m_AcquireImageBarriers;
+		bufferBarriers.clear();
+		imageBarriers.clear();
+
+		//the fence of a finished submission was seen signaled, so its releases happened before this command buffer gets submitted
+		while (!m_PendingAcquires.empty() && m_PendingAcquires.front().Token <= m_CompletedToken)
+		{
+			PendingAcquire& acquire = m_PendingAcquires.front();
+			bufferBarriers.insert(bufferBarriers.end(), acquire.BufferBarriers.begin(), acquire.BufferBarriers.end());
+			imageBarriers.insert(imageBarriers.end(), acquire.ImageBarriers.begin(), acquire.ImageBarriers.end());
+
+			m_AcquiredToken = acquire.Token;
+			m_PendingAcquires.pop_front();
+		}
+
+		if (!bufferBarriers.empty() || !imageBarriers.empty())
+		{
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+				0, nullptr, static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(), static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+		}
+	}
+
+	bool StagingRing::IsComplete(uint64_t token)
+	{
+		Retire();
+
+		return token <= m_CompletedToken;
+	}
+
+	void StagingRing::Wait(uint64_t token)
+	{
+		while (m_CompletedToken < token && m_InFlightCount > 0)
+		{
+			WaitOldest();
+		}
+	}
+
+	void StagingRing::Flush()
+	{
+		Wait(Submit());
+	}
+
+	void StagingRing::BeginBatch()
+	{
+		assert(!m_Batching);
+		m_Batching = true;
+	}
+
+	void StagingRing::EndBatch()
+	{
+		assert(m_Batching);
+		m_Batching = false;
+
+		Flush();
+
+		//nothing reads the overflow buffers anymore, they all go at once
+		for (OverflowBuffer& overflow : m_OverflowBuffers)
+		{
+			vmaUnmapMemory(m_Allocator, overflow.Buffer.Allocation);
+			vmaDestroyBuffer(m_Allocator, overflow.Buffer.Buffer, overflow.Buffer.Allocation);
+		}
+
+		m_OverflowBuffers.clear();
+	}
+
+	void StagingRing::PrintStatistics() const
+	{
+		std::cout << "Staging ring: " << m_Statistics.BytesReserved / (1024.0 * 1024.0) << " MB in " << m_Statistics.Reservations << " reservations, "
+			<< m_Statistics.Submits << " submits, " << m_Statistics.Stalls << " stalls (" << m_Statistics.StallMilliseconds << " ms), "
+			<< m_Statistics.Resizes << " resizes, " << m_Statistics.OverflowBytes / (1024.0 * 1024.0) << " MB overflowed" << std::endl;
+	}
+
+	StagingAllocation StagingRing::ReserveOverflow(VkDeviceSize size, VkDeviceSize alignment)
+	{
+		OverflowBuffer* overflow = m_OverflowBuffers.empty() ? nullptr : &m_OverflowBuffers.back();
+		VkDeviceSize offset = overflow ? (overflow->Used + alignment - 1) & ~(alignment - 1) : 0;
+
+		if (overflow == nullptr || offset + size > overflow->Size)
+		{
+			OverflowBuffer newOverflow;
+			newOverflow.Size = std::max(m_Size, std::bit_ceil(size));
+
+			VkBufferCreateInfo bufferInfo = {};
+			bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			bufferInfo.pNext = nullptr;
+			bufferInfo.size = newOverflow.Size;
+			bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+			VkResult result = vmaCreateBuffer(m_Allocator, &bufferInfo, &m_MemoryInfo, &newOverflow.Buffer.Buffer, &newOverflow.Buffer.Allocation, nullptr);
+			assert(result == VK_SUCCESS);
+
+			result = vmaMapMemory(m_Allocator, newOverflow.Buffer.Allocation, (void**)&newOverflow.Data);
+			assert(result == VK_SUCCESS);
+
+			m_OverflowBuffers.push_back(newOverflow);
+			overflow = &m_OverflowBuffers.back();
+			offset = 0;
+		}
+
+		overflow->Used = offset + size;
+
+		m_Statistics.BytesReserved += size;
+		m_Statistics.OverflowBytes += size;
+		m_Statistics.Reservations++;
+
+		StagingAllocation allocation;
+		allocation.Buffer = overflow->Buffer.Buffer;
+		allocation.Offset = offset;
+		allocation.Data = overflow->Data + offset;
+		return allocation;
+	}
+
+	void StagingRing::CreateBuffer(VkDeviceSize size)
+	{
+		VkBufferCreateInfo bufferInfo = {};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.pNext = nullptr;
+		bufferInfo.size = size;
+		bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+		//the memory is host coherent, the writes need no flush before the submit
+		VkResult result = vmaCreateBuffer(m_Allocator, &bufferInfo, &m_MemoryInfo, &m_Buffer.Buffer, &m_Buffer.Allocation, nullptr);
+		assert(result == VK_SUCCESS);
+
+		//mapped for the whole lifetime of the ring
+		result = vmaMapMemory(m_Allocator, m_Buffer.Allocation, (void**)&m_Data);
+		assert(result == VK_SUCCESS);
+
+		m_Size = size;
+		m_Head = 0;
+		m_Tail = 0;
+		m_SubmittedHead = 0;
+	}
+
+	void StagingRing::DestroyBuffer()
+	{
+		vmaUnmapMemory(m_Allocator, m_Buffer.Allocation);
+		vmaDestroyBuffer(m_Allocator, m_Buffer.Buffer, m_Buffer.Allocation);
+
+		m_Buffer = {};
+		m_Data = nullptr;
+		m_Size = 0;
+	}
+
+	void StagingRing::Retire()
+	{
+		while (m_InFlightCount > 0)
+		{
+			Submission& submission = m_Submissions[m_FirstInFlight];
+			if (vkGetFenceStatus(m_Device, submission.Fence) != VK_SUCCESS)
+				break;
+
+			vkResetFences(m_Device, 1, &submission.Fence);
+			vkResetCommandBuffer(submission.CommandBuffer, 0);
+
+			m_Tail = submission.End;
+			m_CompletedToken = submission.Token;
+
+			m_FirstInFlight = (m_FirstInFlight + 1) % SUBMISSION_COUNT;
+			m_InFlightCount--;
+		}
+	}
+
+	void StagingRing::WaitOldest()
+	{
+		assert(m_InFlightCount > 0);
+
+		vkWaitForFences(m_Device, 1, &m_Submissions[m_FirstInFlight].Fence, true, UINT64_MAX);
+		Retire();
+	}
+}
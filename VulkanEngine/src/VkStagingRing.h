@@ -0,0 +1,171 @@
+#pragma once
+
+#include "VkTypes.h"
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace VKE
+{
+	//space handed out by the staging ring, Data is Buffer's memory at Offset
+	struct StagingAllocation
+	{
+		VkBuffer Buffer = VK_NULL_HANDLE;
+		VkDeviceSize Offset = 0;
+		void* Data = nullptr;
+	};
+
+	//upload counters since startup
+	struct StagingStatistics
+	{
+		uint64_t BytesReserved = 0;
+		uint64_t Reservations = 0;
+		uint64_t Submits = 0;
+		//reservations that had to wait for the GPU to release space
+		uint64_t Stalls = 0;
+		double StallMilliseconds = 0.0;
+		//reservations larger than the ring, which replace it with a larger one
+		uint64_t Resizes = 0;
+		//bytes a batch didn't fit into the ring
+		uint64_t OverflowBytes = 0;
+	};
+
+	//persistently mapped staging buffer used as a ring. callers reserve space, write their data into it, record
+	//the copies out of it into GetCommandBuffer() and release the written resources to the graphics queue.
+	//Submit() sends the recorded copies to the queue with a fence, and the space reserved before it is recycled once that fence signals.
+	//the copies of a reservation have to be recorded before the next Reserve, which may submit.
+	//
+	//on a queue of another family than graphics the uploads run asynchronously: the release barriers hand the resources
+	//over and CmdAcquire records the matching acquire barriers on the graphics side once a submission has finished.
+	//on the graphics queue itself the same calls only order the copies before later rendering
+	class StagingRing
+	{
+	public:
+		static constexpr VkDeviceSize DEFAULT_SIZE = 64 * 1024 * 1024;
+		//submissions that can be in flight at once
+		static constexpr uint32_t SUBMISSION_COUNT = 8;
+
+		//memoryInfo places the ring and the overflow buffers, it has to ask for host visible, host coherent memory
+		void Init(VkDevice device, VmaAllocator allocator, const VmaAllocationCreateInfo& memoryInfo, VkQueue queue, uint32_t queueFamily, uint32_t graphicsFamily, VkDeviceSize size = DEFAULT_SIZE);
+		void Destroy();
+
+		//waits for older submissions if the ring is full, alignment has to be a power of two
+		StagingAllocation Reserve(VkDeviceSize size, VkDeviceSize alignment = 16);
+
+		//command buffer collecting the copies until the next Submit
+		VkCommandBuffer GetCommandBuffer();
+		//token the commands recorded now will be submitted with
+		uint64_t GetRecordingToken() const { return m_NextToken; }
+
+		//hand a range written by the recorded copies to the graphics queue, to be read as vertices, indices or a storage buffer
+		void ReleaseBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size);
+		//hand an image written by the recorded copies to the graphics queue, transitioning it from oldLayout to newLayout for sampling
+		void ReleaseImage(VkImage image, const VkImageSubresourceRange& range, VkImageLayout oldLayout, VkImageLayout newLayout);
+
+		//submits the recorded copies. returns the token of the submission, or of the last one if nothing was recorded since
+		uint64_t Submit();
+
+		//records into a graphics command buffer the acquire barriers of every finished submission, without waiting for the others
+		void CmdAcquire(VkCommandBuffer cmd);
+		//the graphics queue may read what was uploaded with the token
+		bool IsAcquired(uint64_t token) const { return token <= m_AcquiredToken; }
+		//nothing is recorded, and everything submitted has been acquired by the graphics queue
+		bool IsIdle() const { return !m_Recording && m_AcquiredToken + 1 == m_NextToken; }
+		bool UsesOwnershipTransfer() const { return m_OwnershipTransfer; }
+
+		bool IsComplete(uint64_t token);
+		void Wait(uint64_t token);
+		//submits and waits for everything
+		void Flush();
+
+		//collects everything recorded until EndBatch into a single submission. reservations that don't fit into the ring
+		//go to overflow buffers instead of waiting for it, they are freed together once the batch is done
+		void BeginBatch();
+		//submits the batch and waits for it
+		void EndBatch();
+		bool IsBatching() const { return m_Batching; }
+
+		const StagingStatistics& GetStatistics() const { return m_Statistics; }
+		void PrintStatistics() const;
+
+	private:
+		struct Submission
+		{
+			VkCommandBuffer CommandBuffer = VK_NULL_HANDLE;
+			VkFence Fence = VK_NULL_HANDLE;
+			//ring position up to which the space is released when the fence signals
+			uint64_t End = 0;
+			uint64_t Token = 0;
+		};
+
+		//temporary staging memory of a batch
+		struct OverflowBuffer
+		{
+			AllocatedBuffer Buffer = {};
+			uint8_t* Data = nullptr;
+			VkDeviceSize Size = 0;
+			VkDeviceSize Used = 0;
+		};
+
+		StagingAllocation ReserveOverflow(VkDeviceSize size, VkDeviceSize alignment);
+
+		void CreateBuffer(VkDeviceSize size);
+		void DestroyBuffer();
+
+		//releases the space of the submissions that have finished, in order
+		void Retire();
+		//blocks until the oldest submission in flight is done
+		void WaitOldest();
+
+		//acquire barriers of one submission, recorded on the graphics queue once it is done
+		struct PendingAcquire
+		{
+			uint64_t Token = 0;
+			std::vector<VkBufferMemoryBarrier> BufferBarriers;
+			std::vector<VkImageMemoryBarrier> ImageBarriers;
+		};
+
+		VkDevice m_Device = VK_NULL_HANDLE;
+		VmaAllocator m_Allocator = VK_NULL_HANDLE;
+		VmaAllocationCreateInfo m_MemoryInfo = {};
+		VkQueue m_Queue = VK_NULL_HANDLE;
+		VkCommandPool m_CommandPool = VK_NULL_HANDLE;
+
+		uint32_t m_QueueFamily = 0;
+		uint32_t m_GraphicsFamily = 0;
+		bool m_OwnershipTransfer = false;
+
+		AllocatedBuffer m_Buffer = {};
+		uint8_t* m_Data = nullptr;
+		VkDeviceSize m_Size = 0;
+
+		//positions only grow, the byte in the buffer is position % m_Size.
+		//[m_Tail, m_Head) is in use, [m_SubmittedHead, m_Head) by reservations that aren't submitted yet
+		uint64_t m_Head = 0;
+		uint64_t m_Tail = 0;
+		uint64_t m_SubmittedHead = 0;
+
+		Submission m_Submissions[SUBMISSION_COUNT];
+		uint32_t m_FirstInFlight = 0;
+		uint32_t m_InFlightCount = 0;
+		//the slot after the ones in flight is recording
+		bool m_Recording = false;
+
+		uint64_t m_NextToken = 1;
+		uint64_t m_CompletedToken = 0;
+		uint64_t m_AcquiredToken = 0;
+
+		//acquires of the recording submission, then of the submitted ones in order
+		PendingAcquire m_RecordingAcquire;
+		std::deque<PendingAcquire> m_PendingAcquires;
+		//what CmdAcquire records, gathered from the finished submissions
+		std::vector<VkBufferMemoryBarrier> m_AcquireBufferBarriers;
+		std::vector<VkImageMemoryBarrier> m_AcquireImageBarriers;
+
+		bool m_Batching = false;
+		std::vector<OverflowBuffer> m_OverflowBuffers;
+
+		StagingStatistics m_Statistics;
+	};
+}
@@ -12,10 +12,27 @@ namespace VKE
 		VmaAllocation Allocation;
 	};
 
+	//host visible buffer that stays mapped for its whole lifetime
+	struct MappedBuffer
+	{
+		AllocatedBuffer Buffer;
+		uint8_t* Data = nullptr;
+		//the memory isn't host coherent, writes have to be flushed before the GPU reads them
+		bool NeedsFlush = false;
+
+		//typed pointer into the mapping
+		template<typename T>
+		T* As(size_t offset = 0) const { return reinterpret_cast<T*>(Data + offset); }
+	};
+
 	struct AllocatedImage 
 	{
 		VkImage Image;
 		VmaAllocation Allocation;
+
+		//what the image was created with, to create it again elsewhere
+		VkExtent3D Extent = {};
+		VkFormat Format = VK_FORMAT_UNDEFINED;
 	};
 
 }
@@ -2,6 +2,7 @@
 
 #include "VkInit.h"
 
+#include <cstdlib>
 #include <iostream>
 
 #define STB_IMAGE_IMPLEMENTATION
@@ -43,6 +44,20 @@ namespace VKE
 		return true;
 	}
 
+	VkShaderModule VkUtils::LoadRequiredShaderModule(const std::string& filePath, VkDevice device)
+	{
+		VkShaderModule shaderModule = VK_NULL_HANDLE;
+		if (!LoadShaderModule(filePath, device, &shaderModule))
+		{
+			//a pipeline built from an invalid module fails much later and far less clearly
+			std::cout << "Error when building the shader module " << filePath << std::endl;
+			std::abort();
+		}
+
+		std::cout << "Shader module " << filePath << " successfully loaded" << std::endl;
+		return shaderModule;
+	}
+
 	bool VkUtils::LoadImageFromFile(VulkanEngine& engine, const char* file, AllocatedImage& outImage)
 	{
 		int texWidth, texHeight, texChannels;
@@ -61,14 +76,9 @@ namespace VKE
 		//the format R8G8B8A8 matches exactly with the pixels loaded from stb_image lib
 		VkFormat image_format = VK_FORMAT_R8G8B8A8_SRGB;
 
-		//allocate temporary buffer for holding texture data to upload
-		AllocatedBuffer stagingBuffer = engine.CreateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-
-		//copy data to buffer
-		void* data;
-		vmaMapMemory(engine.m_Allocator, stagingBuffer.Allocation, &data);
-		memcpy(data, pixel_ptr, static_cast<size_t>(imageSize));
-		vmaUnmapMemory(engine.m_Allocator, stagingBuffer.Allocation);
+		//copy data to the staging ring, image copies need the offset aligned to the texel size
+		StagingAllocation staging = engine.m_StagingRing.Reserve(imageSize, 16);
+		memcpy(staging.Data, pixel_ptr, static_cast<size_t>(imageSize));
 		//we no longer need the loaded data, so we can free the pixels as they are now in the staging buffer
 		stbi_image_free(pixels);
 
@@ -77,71 +87,59 @@ namespace VKE
 		imageExtent.height = static_cast<uint32_t>(texHeight);
 		imageExtent.depth = 1;
 
-		VkImageCreateInfo dimg_info = VkInit::ImageCreateInfo(image_format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, imageExtent);
+		//transfer source too, defragmentation copies textures it moves
+		VkImageCreateInfo dimg_info = VkInit::ImageCreateInfo(image_format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, imageExtent);
 
 		AllocatedImage newImage;
+		newImage.Extent = imageExtent;
+		newImage.Format = image_format;
 
-		VmaAllocationCreateInfo dimg_allocinfo = {};
-		dimg_allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+		//optimally tiled, so always copied in from staging memory
+		VmaAllocationCreateInfo dimg_allocinfo = engine.m_MemoryPlacement.GetAllocationInfo(MemoryClass::Image);
 
 		//allocate and create the image
 		vmaCreateImage(engine.m_Allocator, &dimg_info, &dimg_allocinfo, &newImage.Image, &newImage.Allocation, nullptr);
 
-		engine.ImmediateSubmit([&](VkCommandBuffer cmd) 
-		{
-			VkImageSubresourceRange range;
-			range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			range.baseMipLevel = 0;
-			range.levelCount = 1;
-			range.baseArrayLayer = 0;
-			range.layerCount = 1;
-
-			VkImageMemoryBarrier imageBarrier_toTransfer = {};
-			imageBarrier_toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-
-			imageBarrier_toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-			imageBarrier_toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-			imageBarrier_toTransfer.image = newImage.Image;
-			imageBarrier_toTransfer.subresourceRange = range;
+		//the transitions and the copy run with the staging ring's next submission
+		VkCommandBuffer cmd = engine.m_StagingRing.GetCommandBuffer();
 
-			imageBarrier_toTransfer.srcAccessMask = 0;
-			imageBarrier_toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		VkImageSubresourceRange range;
+		range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		range.baseMipLevel = 0;
+		range.levelCount = 1;
+		range.baseArrayLayer = 0;
+		range.layerCount = 1;
 
-			//barrier the image into the transfer-receive layout
-			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier_toTransfer);
+		VkImageMemoryBarrier imageBarrier_toTransfer = {};
+		imageBarrier_toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 
-			VkBufferImageCopy copyRegion = {};
-			copyRegion.bufferOffset = 0;
-			copyRegion.bufferRowLength = 0;
-			copyRegion.bufferImageHeight = 0;
+		imageBarrier_toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageBarrier_toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		imageBarrier_toTransfer.image = newImage.Image;
+		imageBarrier_toTransfer.subresourceRange = range;
 
-			copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			copyRegion.imageSubresource.mipLevel = 0;
-			copyRegion.imageSubresource.baseArrayLayer = 0;
-			copyRegion.imageSubresource.layerCount = 1;
-			copyRegion.imageExtent = imageExtent;
+		imageBarrier_toTransfer.srcAccessMask = 0;
+		imageBarrier_toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
 
-			//copy the buffer into the image
-			vkCmdCopyBufferToImage(cmd, stagingBuffer.Buffer, newImage.Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+		//barrier the image into the transfer-receive layout
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier_toTransfer);
 
-			VkImageMemoryBarrier imageBarrier_toReadable = imageBarrier_toTransfer;
+		VkBufferImageCopy copyRegion = {};
+		copyRegion.bufferOffset = staging.Offset;
+		copyRegion.bufferRowLength = 0;
+		copyRegion.bufferImageHeight = 0;
 
-			imageBarrier_toReadable.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-			imageBarrier_toReadable.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		copyRegion.imageSubresource.mipLevel = 0;
+		copyRegion.imageSubresource.baseArrayLayer = 0;
+		copyRegion.imageSubresource.layerCount = 1;
+		copyRegion.imageExtent = imageExtent;
 
-			imageBarrier_toReadable.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-			imageBarrier_toReadable.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-			//barrier the image into the shader readable layout
-			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier_toReadable);
-		});
-
-		engine.m_MainDeletionQueue.push_function([=]() 
-		{
-			vmaDestroyImage(engine.m_Allocator, newImage.Image, newImage.Allocation);
-		});
+		//copy the buffer into the image
+		vkCmdCopyBufferToImage(cmd, staging.Buffer, newImage.Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
 
-		vmaDestroyBuffer(engine.m_Allocator, stagingBuffer.Buffer, stagingBuffer.Allocation);
+		//transition the image into the shader readable layout and hand it to the graphics queue
+		engine.m_StagingRing.ReleaseImage(newImage.Image, range, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
 		std::cout << "Texture loaded successfully " << file << std::endl;
 
@@ -15,6 +15,8 @@ namespace VKE
 	public:
 		// Loads a shader module from a spir-v file. Returns false if it errors.
 		static bool LoadShaderModule(const std::string& filePath, VkDevice device, VkShaderModule* outShaderModule);
+		// For shaders the engine can't run without, a missing or invalid module aborts in every build.
+		static VkShaderModule LoadRequiredShaderModule(const std::string& filePath, VkDevice device);
 
 		static bool LoadImageFromFile(VulkanEngine& engine, const char* file, AllocatedImage& outImage);
 	};
@@ -1,4 +1,5 @@
 #include "VulkanEngine.h"
+#include "VkAllocationCounter.h"
 
 #define VMA_IMPLEMENTATION
 #include "vma/vk_mem_alloc.h"
@@ -17,22 +18,80 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
 
 namespace VKE
 {
+	//texture of materials that don't name one
+	static const char* DEFAULT_TEXTURE_PATH = "res/assets/lost_empire-RGBA.png";
+	static const float CAMERA_FIELD_OF_VIEW = glm::radians(70.f);
+	static const float CAMERA_NEAR_PLANE = 0.1f;
+	//draw distances are quantized as a fraction of it in the draw sort key
+	static const float CAMERA_FAR_PLANE = 200.0f;
+
 	void VulkanEngine::Init()
 	{
+		m_Workers.Init();
+
 		InitWindow();
 		InitVulkan();
 
+		const auto uploadStart = std::chrono::high_resolution_clock::now();
+		const StagingStatistics uploadsBefore = m_StagingRing.GetStatistics();
+
+		//every texture and mesh of the scene goes out in one submission with one wait
+		if (m_BatchStartupUploads)
+		{
+			m_StagingRing.BeginBatch();
+		}
+
 		LoadImages();
 		LoadMeshes();
 
 		InitScene();
+
+		if (m_GpuDriven && !m_GpuDrivenSupported)
+		{
+			std::cout << "GPU-driven rendering needs multiDrawIndirect and drawIndirectFirstInstance, drawing on the CPU" << std::endl;
+			m_GpuDriven = false;
+		}
+
+		if (m_GpuDriven)
+		{
+			m_GpuScene.Build(*this, m_Renderables.data(), static_cast<uint32_t>(m_Renderables.size()));
+		}
+
+		if (m_BatchStartupUploads)
+		{
+			m_StagingRing.EndBatch();
+		}
+
+		//the scene's textures have to be usable from the first frame on
+		FlushUploads();
+
+		const StagingStatistics& uploadsAfter = m_StagingRing.GetStatistics();
+		const uint64_t uploadCount = uploadsAfter.Reservations - uploadsBefore.Reservations;
+		const uint64_t submitCount = uploadsAfter.Submits - uploadsBefore.Submits;
+		const double uploadMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - uploadStart).count();
+
+		//run once with --no-upload-batch to get the time of submitting every upload on its own
+		std::cout << "Startup uploads: " << uploadCount << " uploads (" << (uploadsAfter.BytesReserved - uploadsBefore.BytesReserved) / (1024.0 * 1024.0) << " MB) in "
+			<< submitCount << " submits, " << uploadMilliseconds << " ms loading and uploading";
+		if (m_BatchStartupUploads && uploadCount > submitCount)
+		{
+			std::cout << ", " << uploadCount - submitCount << " submits and fence waits saved by batching";
+		}
+		std::cout << std::endl;
 	}
 
 	void VulkanEngine::Run()
 	{
 		while (!glfwWindowShouldClose(m_Window)) 
 		{
+			//the frame's own work, the other threads' jobs included. polling the window is left out
+			const uint64_t allocationsBefore = GetHeapAllocationCount();
 			Draw();
+			const uint64_t allocations = GetHeapAllocationCount() - allocationsBefore;
+
+			m_FrameHeapAllocations += allocations;
+			m_AllocatingFrames += allocations > 0 ? 1 : 0;
+			m_CountedFrames++;
 
 			glfwPollEvents();
 		}
@@ -42,6 +101,9 @@ namespace VKE
 	{
 		VkResult result;
 
+		//uploads recorded since the last frame go to the queue ahead of it
+		m_StagingRing.Submit();
+
 		// Wait until the GPU has finished rendering the last frame. Timeout of 1 second
 		result = vkWaitForFences(m_Device, 1, &GetCurrentFrame().m_RenderFence, true, 1000000000);
 		assert(result == VK_SUCCESS);
@@ -49,6 +111,13 @@ namespace VKE
 		result = vkResetFences(m_Device, 1, &GetCurrentFrame().m_RenderFence);
 		assert(result == VK_SUCCESS);
 
+		//the GPU is done with everything this frame allocated last time around
+		GetCurrentFrame().deletionQueue.Flush();
+		GetCurrentFrame().cpuArena.Reset();
+		GetCurrentFrame().transientAllocator.Reset();
+
+		UpdateResidency();
+
 		uint32_t swapchainImageIndex;
 		result = vkAcquireNextImageKHR(m_Device, m_SwapChain, 1000000000, GetCurrentFrame().m_PresentSemaphore, nullptr, &swapchainImageIndex);
 		assert(result == VK_SUCCESS);
@@ -70,32 +139,17 @@ namespace VKE
 		result = vkBeginCommandBuffer(cmd, &cmdBeginInfo);
 		assert(result == VK_SUCCESS);
 
-		// Make a clear-color from frame number. This will flash with a 120*pi frame period.
-		VkClearValue clearValue;
-		// float flash = std::abs(std::sin(m_FrameNumber / 120.f));
-		clearValue.color = { { 0.0f, 0.0f, 0.f, 1.0f } };
-
-		//clear depth at 1
-		VkClearValue depthClear;
-		depthClear.depthStencil.depth = 1.f;
-
-		// Start the main renderpass.
-		// We will use the clear color from above, and the framebuffer of the index the swapchain gave us
-		VkRenderPassBeginInfo rpInfo = VkInit::RenderPassBeginInfo(m_RenderPass, m_SwapChainExtent, m_FrameBuffers[swapchainImageIndex]);
-
-		//connect clear values
-		rpInfo.clearValueCount = 2;
-
-		VkClearValue clearValues[] = { clearValue, depthClear };
-
-		rpInfo.pClearValues = &clearValues[0];
-
-		vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
+		//take over the uploads that have finished, the others are polled again next frame
+		m_StagingRing.CmdAcquire(cmd);
 
-		DrawObjects(cmd, m_Renderables.data(), m_Renderables.size());
+		//copies of the resources moved this frame, ahead of the render pass that draws with them
+		if (m_BackgroundDefragmentation || m_Defragmenter.IsRunning())
+		{
+			m_Defragmenter.Update(*this, cmd, m_FrameNumber);
+		}
 
-		//finalize the render pass
-		vkCmdEndRenderPass(cmd);
+		m_RecordMilliseconds += RecordScene(cmd, swapchainImageIndex);
+		m_DrawStatistics += m_FrameDrawStatistics;
 
 		//finalize the command buffer (we can no longer add commands, but it can now be executed)
 		result = vkEndCommandBuffer(cmd);
@@ -122,6 +176,8 @@ namespace VKE
 		submit.commandBufferCount = 1;
 		submit.pCommandBuffers = &cmd;
 
+		GetCurrentFrame().transientAllocator.Flush();
+
 		//submit command buffer to the queue and execute it.
 		// _renderFence will now block until the graphic commands finish execution
 		result = vkQueueSubmit(m_GraphicsQueue, 1, &submit, GetCurrentFrame().m_RenderFence);
@@ -149,10 +205,247 @@ namespace VKE
 		m_FrameNumber++;
 	}
 
+	double VulkanEngine::RecordScene(VkCommandBuffer cmd, uint32_t swapchainImageIndex)
+	{
+		const auto recordStart = std::chrono::high_resolution_clock::now();
+
+		m_FrameDrawStatistics = {};
+
+		const Frustum frustum = Frustum::FromMatrix(GetProjectionMatrix() * GetViewMatrix());
+
+		//the GPU scene is culled ahead of the render pass, a compute shader writes the draw commands of its visible objects
+		const uint32_t frameIndex = m_FrameNumber % FRAME_OVERLAP;
+		const bool drawGpuScene = m_GpuDriven && m_GpuScene.Update(*this, frameIndex, GetCurrentFrame().globalDescriptor);
+		if (drawGpuScene)
+		{
+			m_GpuScene.CmdCull(cmd, frameIndex, frustum);
+		}
+
+		//the draw lists only get the objects inside the frustum
+		const uint32_t renderableCount = static_cast<uint32_t>(m_Renderables.size());
+		const uint32_t* visible = nullptr;
+		uint32_t visibleCount = renderableCount;
+		if (m_FrustumCulling)
+		{
+			if (!m_ObjectCuller.IsCurrent(m_Renderables.data(), renderableCount))
+			{
+				m_ObjectCuller.Update(m_Renderables.data(), renderableCount, m_Workers, m_CullingThreads);
+			}
+
+			uint32_t* visibleIndices = GetFrameArena().AllocateArray<uint32_t>(renderableCount);
+			visibleCount = m_ObjectCuller.Cull(frustum, visibleIndices, m_Workers, m_CullingThreads);
+			visible = visibleIndices;
+
+			m_ObjectStatistics.Total += renderableCount;
+			m_ObjectStatistics.Visible += visibleCount;
+		}
+
+		//every object's matrix is written once, the draws only pass the object's index
+		WriteObjectTransforms(m_Renderables.data(), renderableCount);
+		const DrawContext context = PrepareDraws(frustum);
+
+		//the depth only list is empty without the prepass
+		const DrawList depthList = m_DepthPrepass ? BuildDrawList(m_Renderables.data(), visible, visibleCount, true) : DrawList{};
+		const DrawList mainList = BuildDrawList(m_Renderables.data(), visible, visibleCount);
+
+		//large frames are split across threads, which record secondary command buffers executed inside the render pass
+		const uint32_t threadCount = GetRecordingThreadCount(depthList.Count + mainList.Count);
+
+		// Make a clear-color from frame number. This will flash with a 120*pi frame period.
+		VkClearValue clearValue;
+		// float flash = std::abs(std::sin(m_FrameNumber / 120.f));
+		clearValue.color = { { 0.0f, 0.0f, 0.f, 1.0f } };
+
+		//clear depth at 1
+		VkClearValue depthClear;
+		depthClear.depthStencil.depth = 1.f;
+
+		// Start the main renderpass.
+		// We will use the clear color from above, and the framebuffer of the index the swapchain gave us
+		VkRenderPassBeginInfo rpInfo = VkInit::RenderPassBeginInfo(m_RenderPass, m_SwapChainExtent, m_FrameBuffers[swapchainImageIndex]);
+
+		//connect clear values
+		rpInfo.clearValueCount = 2;
+
+		VkClearValue clearValues[] = { clearValue, depthClear };
+
+		rpInfo.pClearValues = &clearValues[0];
+
+		vkCmdBeginRenderPass(cmd, &rpInfo, threadCount > 1 ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+
+		if (threadCount > 1)
+		{
+			RecordDrawsParallel(cmd, m_FrameBuffers[swapchainImageIndex], depthList, mainList, context, drawGpuScene, threadCount);
+		}
+		else
+		{
+			//lay down the depth of the opaque objects first, so the main pass shades every pixel once
+			if (m_DepthPrepass)
+			{
+				DrawObjects(cmd, m_Renderables.data(), depthList.Order, depthList.Count, context, m_FrameDrawStatistics, m_ClusterStatistics, true);
+				if (drawGpuScene)
+				{
+					DrawIndirect(cmd, context, m_FrameDrawStatistics, true);
+				}
+			}
+
+			DrawObjects(cmd, m_Renderables.data(), mainList.Order, mainList.Count, context, m_FrameDrawStatistics, m_ClusterStatistics);
+			if (drawGpuScene)
+			{
+				DrawIndirect(cmd, context, m_FrameDrawStatistics, false);
+			}
+		}
+
+		//finalize the render pass
+		vkCmdEndRenderPass(cmd);
+
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - recordStart).count();
+	}
+
+	uint32_t VulkanEngine::GetRecordingThreadCount(uint32_t drawCount) const
+	{
+		uint32_t threadCount = m_RecordingThreads;
+		if (threadCount == 0)
+		{
+			threadCount = m_Workers.GetThreadCount();
+		}
+
+		//a thread's share has to be worth starting it and executing another secondary command buffer
+		return std::clamp(drawCount / MIN_DRAWS_PER_RECORDING_THREAD, 1u, std::min(threadCount, MAX_RECORDING_THREADS));
+	}
+
+	void VulkanEngine::RecordDrawsParallel(VkCommandBuffer cmd, VkFramebuffer framebuffer, const DrawList& depthList, const DrawList& mainList, const DrawContext& context, bool drawGpuScene, uint32_t threadCount)
+	{
+		FrameData& frame = GetCurrentFrame();
+
+		//the secondaries continue the render pass, they inherit it and the framebuffer
+		const VkCommandBufferInheritanceInfo inheritanceInfo = VkInit::CommandBufferInheritanceInfo(m_RenderPass, 0, framebuffer);
+		VkCommandBufferBeginInfo beginInfo = VkInit::CommandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+		beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+		DrawStatistics statistics[MAX_RECORDING_THREADS];
+		CullingStatistics clusters[MAX_RECORDING_THREADS];
+
+		//every thread draws a consecutive share of both sorted lists, the last one also the GPU scene.
+		//recording only reads the engine, what is written is the thread's own command pool and statistics
+		m_Workers.Run(threadCount, [&](size_t thread)
+		{
+			RecordingThread& recording = frame.recordingThreads[thread];
+
+			//the frame's fence has signalled, nothing of the pool is in use
+			VkResult result = vkResetCommandPool(m_Device, recording.CommandPool, 0);
+			assert(result == VK_SUCCESS);
+
+			for (uint32_t pass = m_DepthPrepass ? 0 : 1; pass < 2; pass++)
+			{
+				const bool depthOnly = pass == 0;
+				const DrawList& drawList = depthOnly ? depthList : mainList;
+
+				const uint32_t begin = static_cast<uint32_t>(uint64_t(drawList.Count) * thread / threadCount);
+				const uint32_t end = static_cast<uint32_t>(uint64_t(drawList.Count) * (thread + 1) / threadCount);
+
+				VkCommandBuffer secondary = recording.CommandBuffers[pass];
+				result = vkBeginCommandBuffer(secondary, &beginInfo);
+				assert(result == VK_SUCCESS);
+
+				DrawObjects(secondary, m_Renderables.data(), drawList.Order + begin, end - begin, context, statistics[thread], clusters[thread], depthOnly);
+				if (drawGpuScene && thread == threadCount - 1)
+				{
+					DrawIndirect(secondary, context, statistics[thread], depthOnly);
+				}
+
+				result = vkEndCommandBuffer(secondary);
+				assert(result == VK_SUCCESS);
+			}
+		});
+
+		//the depth only share of every thread goes before the main pass of any of them
+		VkCommandBuffer secondaries[2 * MAX_RECORDING_THREADS];
+		uint32_t secondaryCount = 0;
+		for (uint32_t pass = m_DepthPrepass ? 0 : 1; pass < 2; pass++)
+		{
+			for (uint32_t thread = 0; thread < threadCount; thread++)
+			{
+				secondaries[secondaryCount++] = frame.recordingThreads[thread].CommandBuffers[pass];
+			}
+		}
+
+		vkCmdExecuteCommands(cmd, secondaryCount, secondaries);
+
+		for (uint32_t thread = 0; thread < threadCount; thread++)
+		{
+			m_FrameDrawStatistics += statistics[thread];
+			m_ClusterStatistics.Total += clusters[thread].Total;
+			m_ClusterStatistics.Visible += clusters[thread].Visible;
+		}
+	}
+
 	void VulkanEngine::Cleanup()
 	{
+		//uploads nobody drew yet still target buffers that are about to be destroyed
+		m_StagingRing.Flush();
 		vkDeviceWaitIdle(m_Device);
 
+		m_Workers.Shutdown();
+
+		m_GpuScene.PrintStatistics();
+		m_GpuScene.Destroy(*this);
+
+		//the deletions of the frames in flight come first, the defragmenter's retired resources and the GPU scene's buffers are among them
+		for (int i = 0; i < FRAME_OVERLAP; i++)
+		{
+			m_Frames[i].deletionQueue.Flush();
+		}
+
+		m_Defragmenter.Finish(*this);
+
+		if (m_FrameNumber > 0 && m_ObjectStatistics.Total > 0)
+		{
+			std::cout << "Frustum culling (" << GetCullPathName(ObjectCuller::GetSupportedPath()) << "): " << m_ObjectStatistics.Visible / m_FrameNumber << " of " << m_ObjectStatistics.Total / m_FrameNumber
+				<< " objects drawn per frame (" << 100.0 * double(m_ObjectStatistics.Visible) / double(m_ObjectStatistics.Total) << "%)" << std::endl;
+		}
+
+		if (m_FrameNumber > 0 && m_ClusterStatistics.Total > 0)
+		{
+			std::cout << "Cluster culling: " << m_ClusterStatistics.Visible / m_FrameNumber << " of " << m_ClusterStatistics.Total / m_FrameNumber
+				<< " meshlets drawn per frame (" << 100.0 * double(m_ClusterStatistics.Visible) / double(m_ClusterStatistics.Total) << "%)" << std::endl;
+		}
+
+		if (m_FrameNumber > 0)
+		{
+			std::cout << "Draw state (" << (m_SortDrawList ? "sorted" : "unsorted") << "): per frame " << m_DrawStatistics.Draws / m_FrameNumber << " draws, "
+				<< m_DrawStatistics.PipelineBinds / m_FrameNumber << " pipeline binds, " << m_DrawStatistics.DescriptorSetBinds / m_FrameNumber << " descriptor set binds, "
+				<< m_DrawStatistics.VertexBufferBinds / m_FrameNumber << " vertex buffer binds, " << m_DrawStatistics.PushConstants / m_FrameNumber << " push constants" << std::endl;
+			std::cout << "Command recording: " << m_RecordMilliseconds / m_FrameNumber << " ms per frame" << (m_GpuDriven ? ", GPU-driven" : "") << std::endl;
+		}
+
+		m_Geometry.PrintStatistics();
+		m_StagingRing.PrintStatistics();
+		m_Residency.PrintStatistics();
+		m_Defragmenter.PrintStatistics();
+
+		VkDeviceSize transientPeak = 0;
+		for (int i = 0; i < FRAME_OVERLAP; i++)
+		{
+			transientPeak = std::max(transientPeak, m_Frames[i].transientAllocator.GetHighWaterMark());
+		}
+		std::cout << "Transient frame data: peak " << transientPeak << " of " << FrameAllocator::DEFAULT_SIZE << " bytes per frame" << std::endl;
+
+		size_t arenaPeak = 0;
+		uint64_t arenaOverflows = 0;
+		for (int i = 0; i < FRAME_OVERLAP; i++)
+		{
+			arenaPeak = std::max(arenaPeak, m_Frames[i].cpuArena.GetHighWaterMark());
+			arenaOverflows += m_Frames[i].cpuArena.GetOverflowCount();
+			m_Frames[i].cpuArena.Destroy();
+		}
+		std::cout << "Frame arena: peak " << arenaPeak << " of " << FrameArena::DEFAULT_SIZE << " bytes per frame, " << arenaOverflows << " allocations fell back to the heap" << std::endl;
+
+		if (HEAP_ALLOCATIONS_COUNTED && m_CountedFrames > 0)
+		{
+			std::cout << "Heap allocations: " << m_FrameHeapAllocations << " in " << m_CountedFrames << " frames, " << m_AllocatingFrames << " frames allocated" << std::endl;
+		}
+
 		m_MainDeletionQueue.flush();
 
 		vkDestroySwapchainKHR(m_Device, m_SwapChain, nullptr);
@@ -175,7 +468,7 @@ namespace VKE
 
 		for (auto& texture : m_LoadedTextures)
 		{
-			vkDestroyImageView(m_Device, texture.second.ImageView, nullptr);
+			EvictTexture(texture.second);
 		}
 
 		vkDestroyImageView(m_Device, m_DepthImageView, nullptr);
@@ -225,6 +518,12 @@ namespace VKE
 		CreateSyncStructures();
 		CreateDescriptors();
 		CreateGraphicsPipeline();
+
+		//without its culling pipeline the GPU scene is treated like a device that can't draw it
+		if (m_GpuDrivenSupported && !m_GpuScene.Init(*this, m_CmdDrawIndexedIndirectCount != nullptr))
+		{
+			m_GpuDrivenSupported = false;
+		}
 	}
 
 	void VulkanEngine::CreateInstance()
@@ -330,6 +629,10 @@ namespace VKE
 
 		std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 		std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value() };
+		if (indices.transferFamily.has_value())
+		{
+			uniqueQueueFamilies.insert(indices.transferFamily.value());
+		}
 
 		float queuePriority = 1.0f;
 		for (uint32_t queueFamily : uniqueQueueFamilies)
@@ -342,7 +645,14 @@ namespace VKE
 			queueCreateInfos.push_back(queueCreateInfo);
 		}
 
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(m_PhysicalDevice, &supportedFeatures);
+
+		//the GPU scene draws a batch's objects with one multi draw, and passes the object's index as firstInstance
 		VkPhysicalDeviceFeatures deviceFeatures = {};
+		m_GpuDrivenSupported = supportedFeatures.multiDrawIndirect && supportedFeatures.drawIndirectFirstInstance;
+		deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+		deviceFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
 
 		VkDeviceCreateInfo createInfo = {};
 		createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -350,8 +660,23 @@ namespace VKE
 		createInfo.pQueueCreateInfos = queueCreateInfos.data();
 		createInfo.pEnabledFeatures = &deviceFeatures;
 
-		createInfo.enabledExtensionCount = static_cast<uint32_t>(m_DeviceExtensions.size());
-		createInfo.ppEnabledExtensionNames = m_DeviceExtensions.data();
+		//VK_EXT_memory_budget lets VMA report the budget the driver gives us instead of estimating it from the heap sizes
+		std::vector<const char*> deviceExtensions = m_DeviceExtensions;
+		m_MemoryBudgetSupported = IsDeviceExtensionAvailable(m_PhysicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		if (m_MemoryBudgetSupported)
+		{
+			deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		}
+
+		//lets the culling shader's count decide how many of a batch's draws are made, core only from Vulkan 1.2
+		const bool drawIndirectCountSupported = IsDeviceExtensionAvailable(m_PhysicalDevice, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+		if (drawIndirectCountSupported)
+		{
+			deviceExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+		}
+
+		createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
+		createInfo.ppEnabledExtensionNames = deviceExtensions.data();
 
 		if (m_EnableValidationLayers)
 		{
@@ -366,8 +691,22 @@ namespace VKE
 		VkResult result = vkCreateDevice(m_PhysicalDevice, &createInfo, nullptr, &m_Device);
 		assert(result == VK_SUCCESS); // Failed to create logical device!
 
+		if (drawIndirectCountSupported)
+		{
+			m_CmdDrawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(vkGetDeviceProcAddr(m_Device, "vkCmdDrawIndexedIndirectCountKHR"));
+		}
+
 		vkGetDeviceQueue(m_Device, indices.graphicsFamily.value(), 0, &m_GraphicsQueue);
 		vkGetDeviceQueue(m_Device, indices.presentFamily.value(), 0, &m_PresentQueue);
+
+		if (indices.transferFamily.has_value())
+		{
+			vkGetDeviceQueue(m_Device, indices.transferFamily.value(), 0, &m_TransferQueue);
+		}
+		else
+		{
+			m_TransferQueue = m_GraphicsQueue;
+		}
 	}
 
 	void VulkanEngine::CreateSwapChain()
@@ -443,12 +782,12 @@ namespace VKE
 		VkImageCreateInfo dimg_info = VkInit::ImageCreateInfo(m_DepthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, depthImageExtent);
 
 		//for the depth image, we want to allocate it from GPU local memory
-		VmaAllocationCreateInfo dimg_allocinfo = {};
-		dimg_allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
-		dimg_allocinfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		VmaAllocationCreateInfo dimg_allocinfo = m_MemoryPlacement.GetAllocationInfo(MemoryClass::Image);
 
 		//allocate and create the image
 		vmaCreateImage(m_Allocator, &dimg_info, &dimg_allocinfo, &m_DepthImage.Image, &m_DepthImage.Allocation, nullptr);
+		m_DepthImage.Extent = depthImageExtent;
+		m_DepthImage.Format = m_DepthFormat;
 
 		//build an image-view for the depth image to use for rendering
 		VkImageViewCreateInfo dview_info = VkInit::ImageViewCreateInfo(m_DepthFormat, m_DepthImage.Image, VK_IMAGE_ASPECT_DEPTH_BIT);
@@ -505,6 +844,28 @@ namespace VKE
 			result = vkAllocateCommandBuffers(m_Device, &cmdAllocInfo, &m_Frames[i].m_MainCommandBuffer);
 			assert(result == VK_SUCCESS);
 
+			//a pool per recording thread, reset as a whole by the thread every frame
+			VkCommandPoolCreateInfo recordingPoolInfo = VkInit::CommandPoolCreateInfo(indices.graphicsFamily.value(), VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+			for (RecordingThread& recording : m_Frames[i].recordingThreads)
+			{
+				result = vkCreateCommandPool(m_Device, &recordingPoolInfo, nullptr, &recording.CommandPool);
+				assert(result == VK_SUCCESS);
+
+				VkCommandBufferAllocateInfo secondaryAllocInfo = VkInit::CommadBufferAllocateInfo(recording.CommandPool, 2, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+
+				result = vkAllocateCommandBuffers(m_Device, &secondaryAllocInfo, recording.CommandBuffers);
+				assert(result == VK_SUCCESS);
+
+				m_MainDeletionQueue.push_function([=]()
+				{
+					vkDestroyCommandPool(m_Device, recording.CommandPool, nullptr);
+				});
+			}
+
+			//what the frame records on the CPU side, allocated once so the render loop doesn't go to the heap
+			m_Frames[i].cpuArena.Init();
+			m_Frames[i].deletionQueue.Init(m_Frames[i].cpuArena);
+
 			m_MainDeletionQueue.push_function([=]() 
 			{
 				vkDestroyCommandPool(m_Device, m_Frames[i].m_CommandPool, nullptr);
@@ -527,6 +888,24 @@ namespace VKE
 		VkCommandBuffer cmd;
 		result = vkAllocateCommandBuffers(m_Device, &cmdAllocInfo, &m_UploadContext.m_CommandBuffer);
 		assert(result == VK_SUCCESS);
+
+		//uploads run on the transfer queue, which is the graphics queue if the device has no transfer only family
+		const uint32_t transferFamily = indices.transferFamily.value_or(indices.graphicsFamily.value());
+		m_StagingRing.Init(m_Device, m_Allocator, m_MemoryPlacement.GetAllocationInfo(MemoryClass::Staging), m_TransferQueue, transferFamily, indices.graphicsFamily.value());
+
+		if (indices.transferFamily.has_value())
+		{
+			std::cout << "Uploading on the dedicated transfer queue family " << transferFamily << std::endl;
+		}
+		else
+		{
+			std::cout << "No transfer only queue family, uploading on the graphics queue" << std::endl;
+		}
+
+		m_MainDeletionQueue.push_function([=]() 
+		{
+			m_StagingRing.Destroy();
+		});
 	}
 
 	void VulkanEngine::CreateRenderPass()
@@ -695,25 +1074,9 @@ namespace VKE
 
 	void VulkanEngine::CreateGraphicsPipeline()
 	{
-		VkShaderModule triangleFragShader;
-		if (!VkUtils::LoadShaderModule("res/shaders/triangle.frag.spv", m_Device, &triangleFragShader))
-		{
-			std::cout << "Error when building the triangle fragment shader module." << std::endl;
-		}
-		else 
-		{
-			std::cout << "Triangle fragment shader successfully loaded." << std::endl;
-		}
+		VkShaderModule triangleFragShader = VkUtils::LoadRequiredShaderModule("res/shaders/triangle.frag.spv", m_Device);
 
-		VkShaderModule triangleVertexShader;
-		if (!VkUtils::LoadShaderModule("res/shaders/triangle.vert.spv", m_Device, &triangleVertexShader))
-		{
-			std::cout << "Error when building the triangle vertex shader module." << std::endl;
-		}
-		else 
-		{
-			std::cout << "Triangle vertex shader successfully loaded." << std::endl;
-		}
+		VkShaderModule triangleVertexShader = VkUtils::LoadRequiredShaderModule("res/shaders/triangle.vert.spv", m_Device);
 
 		//build the pipeline layout that controls the inputs/outputs of the shader
 		//we are not using descriptor sets or other systems yet, so no need to use anything other than empty default
@@ -764,54 +1127,17 @@ namespace VKE
 		//finally build the pipeline
 		m_TrianglePipeline = pipelineBuilder.BuildPipeline(m_Device, m_RenderPass);
 
-		//build the mesh pipeline
-		VertexInputDescription vertexDescription = Vertex::GetVertexDescription();
-
-		//connect the pipeline builder vertex input info to the one we get from Vertex
-		pipelineBuilder.m_VertexInputInfo.pVertexAttributeDescriptions = vertexDescription.Attributes.data();
-		pipelineBuilder.m_VertexInputInfo.vertexAttributeDescriptionCount = vertexDescription.Attributes.size();
-
-		pipelineBuilder.m_VertexInputInfo.pVertexBindingDescriptions = vertexDescription.Bindings.data();
-		pipelineBuilder.m_VertexInputInfo.vertexBindingDescriptionCount = vertexDescription.Bindings.size();
-
 		//clear the shader stages for the builder
 		pipelineBuilder.m_ShaderStages.clear();
 
-		//compile mesh vertex shader
-		VkShaderModule meshVertShader;
-		if (!VkUtils::LoadShaderModule("res/shaders/triangleMesh.vert.spv", m_Device, &meshVertShader))
-		{
-			std::cout << "Error when building the triangle vertex shader module" << std::endl;
-		}
-		else {
-			std::cout << "Red Triangle vertex shader successfully loaded" << std::endl;
-		}
-
 		//compile mesh fragment shader
-		VkShaderModule meshFragShader;
-		if (!VkUtils::LoadShaderModule("res/shaders/default_lit.frag.spv", m_Device, &meshFragShader))
-		{
-			std::cout << "Error when building the triangle fragment shader module" << std::endl;
-		}
-		else {
-			std::cout << "Red Triangle fragment shader successfully loaded" << std::endl;
-		}
+		VkShaderModule meshFragShader = VkUtils::LoadRequiredShaderModule("res/shaders/default_lit.frag.spv", m_Device);
 
 		//compile mesh texured fragment shader
-		VkShaderModule texMeshFragShader;
-		if (!VkUtils::LoadShaderModule("res/shaders/textured_lit.frag.spv", m_Device, &texMeshFragShader))
-		{
-			std::cout << "Error when building the triangle fragment shader module" << std::endl;
-		}
-		else {
-			std::cout << "Red Triangle fragment shader successfully loaded" << std::endl;
-		}
-
-		//add the other shaders
-		pipelineBuilder.m_ShaderStages.push_back(VkInit::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, meshVertShader));
+		VkShaderModule texMeshFragShader = VkUtils::LoadRequiredShaderModule("res/shaders/textured_lit.frag.spv", m_Device);
 
-		//make sure that triangleFragShader is holding the compiled colored_triangle.frag
-		pipelineBuilder.m_ShaderStages.push_back(VkInit::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, meshFragShader));
+		//compile the textured fragment shader variant that discards transparent texels
+		VkShaderModule texMeshAlphaTestFragShader = VkUtils::LoadRequiredShaderModule("res/shaders/textured_lit_alphatest.frag.spv", m_Device);
 
 		//we start from just the default empty pipeline layout info
 		VkPipelineLayoutCreateInfo meshPipelineLayoutInfo = VkInit::PipelineLayoutCreateInfo();
@@ -820,8 +1146,8 @@ namespace VKE
 		VkPushConstantRange pushConstant;
 		//this push constant range starts at the beginning
 		pushConstant.offset = 0;
-		//this push constant range takes up the size of a MeshPushConstants struct
-		pushConstant.size = sizeof(MeshPushConstants);
+		//this push constant range takes up the size of an ObjectPushConstants struct, only the instanced pipelines read it
+		pushConstant.size = sizeof(ObjectPushConstants);
 		//this push constant range is accessible only in the vertex shader
 		pushConstant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
@@ -836,13 +1162,6 @@ namespace VKE
 		result = vkCreatePipelineLayout(m_Device, &meshPipelineLayoutInfo, nullptr, &m_MeshPipelineLayout);
 		assert(result == VK_SUCCESS);
 
-		pipelineBuilder.m_PipelineLayout = m_MeshPipelineLayout;
-
-		//build the mesh triangle pipeline
-		m_MeshPipeline = pipelineBuilder.BuildPipeline(m_Device, m_RenderPass);
-
-		CreateMaterial(m_MeshPipeline, m_MeshPipelineLayout, "defaultMesh");
-
 		//create pipeline layout for the textured mesh, which has 3 descriptor sets
 		//we start from  the normal mesh layout
 		VkPipelineLayoutCreateInfo textured_pipeline_layout_info = meshPipelineLayoutInfo;
@@ -856,46 +1175,239 @@ namespace VKE
 		result = vkCreatePipelineLayout(m_Device, &textured_pipeline_layout_info, nullptr, &texturedPipeLayout);
 		assert(result == VK_SUCCESS);
 
-		pipelineBuilder.m_ShaderStages.clear();
+		//depth only pipelines share one vertex shader for every format, it only reads the position
+		VkShaderModule depthOnlyVertShader = VkUtils::LoadRequiredShaderModule("res/shaders/depthOnly.vert.spv", m_Device);
 
-		//add the other shaders
-		pipelineBuilder.m_ShaderStages.push_back(VkInit::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, meshVertShader));
+		//the instanced variant also reads the instance's model matrix
+		VkShaderModule depthOnlyInstancedVertShader = VkUtils::LoadRequiredShaderModule("res/shaders/depthOnlyInstanced.vert.spv", m_Device);
 
-		//make sure that triangleFragShader is holding the compiled colored_triangle.frag
-		pipelineBuilder.m_ShaderStages.push_back(VkInit::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, texMeshFragShader));
+		//the indirect variant reads the object's matrix from the GPU scene
+		VkShaderModule depthOnlyIndirectVertShader = VkUtils::LoadRequiredShaderModule("res/shaders/depthOnlyIndirect.vert.spv", m_Device);
 
-		pipelineBuilder.m_PipelineLayout = texturedPipeLayout;
+		//every vertex format gets its own vertex shader, which decodes the format, and every format and layout its own set of mesh pipelines
+		for (uint32_t formatIndex = 0; formatIndex < static_cast<uint32_t>(VertexFormat::Count); formatIndex++)
+		{
+			const VertexFormat format = static_cast<VertexFormat>(formatIndex);
 
-		//build the mesh triangle pipeline
-		m_TexturedMeshPipeline = pipelineBuilder.BuildPipeline(m_Device, m_RenderPass);
+			//compile mesh vertex shader
+			VkShaderModule meshVertShader = VkUtils::LoadRequiredShaderModule(GetVertexShaderPath(format), m_Device);
 
-		CreateMaterial(m_TexturedMeshPipeline, texturedPipeLayout, "texturedMesh");
+			VkShaderModule meshInstancedVertShader = VkUtils::LoadRequiredShaderModule(GetVertexShaderPath(format, VertexShaderVariant::Instanced), m_Device);
 
-		//deleting all of the vulkan shaders
-		vkDestroyShaderModule(m_Device, meshVertShader, nullptr);
-		vkDestroyShaderModule(m_Device, meshFragShader, nullptr);
-		vkDestroyShaderModule(m_Device, texMeshFragShader, nullptr);
-		vkDestroyShaderModule(m_Device, triangleFragShader, nullptr);
-		vkDestroyShaderModule(m_Device, triangleVertexShader, nullptr);
+			VkShaderModule meshIndirectVertShader = VkUtils::LoadRequiredShaderModule(GetVertexShaderPath(format, VertexShaderVariant::Indirect), m_Device);
 
-		m_MainDeletionQueue.push_function([=]()
-		{
-			vkDestroyPipeline(m_Device, m_TexturedMeshPipeline, nullptr);
-			vkDestroyPipelineLayout(m_Device, texturedPipeLayout, nullptr);
-		});
-	}
+			for (uint32_t layoutIndex = 0; layoutIndex < static_cast<uint32_t>(VertexLayout::Count); layoutIndex++)
+			{
+				const VertexLayout layout = static_cast<VertexLayout>(layoutIndex);
 
-	void VulkanEngine::CreateAllocator()
-	{
-		//initialize the memory allocator
-		VmaAllocatorCreateInfo allocatorInfo = {};
-		allocatorInfo.physicalDevice = m_PhysicalDevice;
+				VertexInputDescription vertexDescription = GetVertexDescription(format, layout);
+
+				//connect the pipeline builder vertex input info to the one we get from the format
+				pipelineBuilder.m_VertexInputInfo.pVertexAttributeDescriptions = vertexDescription.Attributes.data();
+				pipelineBuilder.m_VertexInputInfo.vertexAttributeDescriptionCount = vertexDescription.Attributes.size();
+
+				pipelineBuilder.m_VertexInputInfo.pVertexBindingDescriptions = vertexDescription.Bindings.data();
+				pipelineBuilder.m_VertexInputInfo.vertexBindingDescriptionCount = vertexDescription.Bindings.size();
+
+				pipelineBuilder.m_ShaderStages.clear();
+
+				//add the other shaders
+				pipelineBuilder.m_ShaderStages.push_back(VkInit::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, meshVertShader));
+
+				//make sure that triangleFragShader is holding the compiled colored_triangle.frag
+				pipelineBuilder.m_ShaderStages.push_back(VkInit::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, meshFragShader));
+
+				pipelineBuilder.m_PipelineLayout = m_MeshPipelineLayout;
+
+				//build the mesh triangle pipeline
+				VkPipeline meshPipeline = pipelineBuilder.BuildPipeline(m_Device, m_RenderPass);
+
+				Material* meshMaterial = CreateMaterial(meshPipeline, m_MeshPipelineLayout, GetMaterialName("defaultMesh", format, layout));
+
+				pipelineBuilder.m_ShaderStages.clear();
+
+				//add the other shaders
+				pipelineBuilder.m_ShaderStages.push_back(VkInit::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, meshVertShader));
+
+				//make sure that triangleFragShader is holding the compiled colored_triangle.frag
+				pipelineBuilder.m_ShaderStages.push_back(VkInit::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, texMeshFragShader));
+
+				pipelineBuilder.m_PipelineLayout = texturedPipeLayout;
+
+				//build the textured mesh pipeline
+				VkPipeline texturedMeshPipeline = pipelineBuilder.BuildPipeline(m_Device, m_RenderPass);
+
+				Material* texturedMaterial = CreateMaterial(texturedMeshPipeline, texturedPipeLayout, GetMaterialName("texturedMesh", format, layout));
+
+				pipelineBuilder.m_ShaderStages.clear();
+
+				pipelineBuilder.m_ShaderStages.push_back(VkInit::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, meshVertShader));
+				pipelineBuilder.m_ShaderStages.push_back(VkInit::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, texMeshAlphaTestFragShader));
+
+				//build the alpha tested textured pipeline, for cutout materials
+				VkPipeline alphaTestMeshPipeline = pipelineBuilder.BuildPipeline(m_Device, m_RenderPass);
+
+				Material* alphaTestMaterial = CreateMaterial(alphaTestMeshPipeline, texturedPipeLayout, GetMaterialName("texturedMeshAlphaTest", format, layout));
+
+				//indirect variants for the GPU scene, the same state with the vertex shader reading the object's matrix from the object buffer
+				pipelineBuilder.m_ShaderStages[0] = VkInit::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, meshIndirectVertShader);
+				alphaTestMaterial->indirectPipeline = pipelineBuilder.BuildPipeline(m_Device, m_RenderPass);
+
+				pipelineBuilder.m_ShaderStages[1] = VkInit::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, texMeshFragShader);
+				texturedMaterial->indirectPipeline = pipelineBuilder.BuildPipeline(m_Device, m_RenderPass);
+
+				pipelineBuilder.m_ShaderStages[1] = VkInit::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, meshFragShader);
+				pipelineBuilder.m_PipelineLayout = m_MeshPipelineLayout;
+				meshMaterial->indirectPipeline = pipelineBuilder.BuildPipeline(m_Device, m_RenderPass);
+
+				//depth only pipeline, it binds nothing but the position stream and has no fragment shader
+				VertexInputDescription positionDescription = GetPositionDescription(format, layout);
+
+				pipelineBuilder.m_VertexInputInfo.pVertexAttributeDescriptions = positionDescription.Attributes.data();
+				pipelineBuilder.m_VertexInputInfo.vertexAttributeDescriptionCount = positionDescription.Attributes.size();
+
+				pipelineBuilder.m_VertexInputInfo.pVertexBindingDescriptions = positionDescription.Bindings.data();
+				pipelineBuilder.m_VertexInputInfo.vertexBindingDescriptionCount = positionDescription.Bindings.size();
+
+				pipelineBuilder.m_ShaderStages.clear();
+				pipelineBuilder.m_ShaderStages.push_back(VkInit::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, depthOnlyVertShader));
+
+				pipelineBuilder.m_PipelineLayout = m_MeshPipelineLayout;
+
+				const VkColorComponentFlags colorWriteMask = pipelineBuilder.m_ColorBlendAttachment.colorWriteMask;
+				pipelineBuilder.m_ColorBlendAttachment.colorWriteMask = 0;
+
+				VkPipeline depthOnlyPipeline = pipelineBuilder.BuildPipeline(m_Device, m_RenderPass);
+
+				pipelineBuilder.m_ShaderStages[0] = VkInit::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, depthOnlyIndirectVertShader);
+				VkPipeline depthOnlyIndirectPipeline = pipelineBuilder.BuildPipeline(m_Device, m_RenderPass);
+
+				pipelineBuilder.m_ColorBlendAttachment.colorWriteMask = colorWriteMask;
+
+				//opaque materials lay down their depth with it, alpha tested ones need their texture and keep none
+				Material* depthOnlyMaterial = CreateMaterial(depthOnlyPipeline, m_MeshPipelineLayout, GetMaterialName("depthOnly", format, layout));
+				depthOnlyMaterial->indirectPipeline = depthOnlyIndirectPipeline;
+				meshMaterial->depthMaterial = depthOnlyMaterial;
+				texturedMaterial->depthMaterial = depthOnlyMaterial;
+
+				//instanced variants of the default and depth only pipelines, which read the model matrices from the instance binding
+				VertexInputDescription instancedDescription = GetVertexDescription(format, layout);
+				AddInstanceAttributes(instancedDescription);
+
+				pipelineBuilder.m_VertexInputInfo.pVertexAttributeDescriptions = instancedDescription.Attributes.data();
+				pipelineBuilder.m_VertexInputInfo.vertexAttributeDescriptionCount = instancedDescription.Attributes.size();
+
+				pipelineBuilder.m_VertexInputInfo.pVertexBindingDescriptions = instancedDescription.Bindings.data();
+				pipelineBuilder.m_VertexInputInfo.vertexBindingDescriptionCount = instancedDescription.Bindings.size();
+
+				pipelineBuilder.m_ShaderStages.clear();
+				pipelineBuilder.m_ShaderStages.push_back(VkInit::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, meshInstancedVertShader));
+				pipelineBuilder.m_ShaderStages.push_back(VkInit::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, meshFragShader));
+
+				VkPipeline meshInstancedPipeline = pipelineBuilder.BuildPipeline(m_Device, m_RenderPass);
+
+				Material* meshInstancedMaterial = CreateMaterial(meshInstancedPipeline, m_MeshPipelineLayout, GetMaterialName("defaultMeshInstanced", format, layout));
+
+				VertexInputDescription instancedPositionDescription = GetPositionDescription(format, layout);
+				AddInstanceAttributes(instancedPositionDescription);
+
+				pipelineBuilder.m_VertexInputInfo.pVertexAttributeDescriptions = instancedPositionDescription.Attributes.data();
+				pipelineBuilder.m_VertexInputInfo.vertexAttributeDescriptionCount = instancedPositionDescription.Attributes.size();
+
+				pipelineBuilder.m_VertexInputInfo.pVertexBindingDescriptions = instancedPositionDescription.Bindings.data();
+				pipelineBuilder.m_VertexInputInfo.vertexBindingDescriptionCount = instancedPositionDescription.Bindings.size();
+
+				pipelineBuilder.m_ShaderStages.clear();
+				pipelineBuilder.m_ShaderStages.push_back(VkInit::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, depthOnlyInstancedVertShader));
+
+				pipelineBuilder.m_ColorBlendAttachment.colorWriteMask = 0;
+
+				VkPipeline depthOnlyInstancedPipeline = pipelineBuilder.BuildPipeline(m_Device, m_RenderPass);
+
+				pipelineBuilder.m_ColorBlendAttachment.colorWriteMask = colorWriteMask;
+
+				meshInstancedMaterial->depthMaterial = CreateMaterial(depthOnlyInstancedPipeline, m_MeshPipelineLayout, GetMaterialName("depthOnlyInstanced", format, layout));
+
+				if (format == VertexFormat::Full && layout == VertexLayout::Interleaved)
+				{
+					//the full format pipelines are destroyed in Cleanup
+					m_MeshPipeline = meshPipeline;
+					m_TexturedMeshPipeline = texturedMeshPipeline;
+				}
+				else
+				{
+					m_MainDeletionQueue.push_function([=]()
+					{
+						vkDestroyPipeline(m_Device, meshPipeline, nullptr);
+						vkDestroyPipeline(m_Device, texturedMeshPipeline, nullptr);
+					});
+				}
+
+				m_MainDeletionQueue.push_function([=]()
+				{
+					vkDestroyPipeline(m_Device, alphaTestMeshPipeline, nullptr);
+					vkDestroyPipeline(m_Device, depthOnlyPipeline, nullptr);
+					vkDestroyPipeline(m_Device, meshInstancedPipeline, nullptr);
+					vkDestroyPipeline(m_Device, depthOnlyInstancedPipeline, nullptr);
+				});
+
+				const VkPipeline indirectPipelines[] = { meshMaterial->indirectPipeline, texturedMaterial->indirectPipeline, alphaTestMaterial->indirectPipeline, depthOnlyIndirectPipeline };
+				m_MainDeletionQueue.push_function([=]()
+				{
+					for (VkPipeline pipeline : indirectPipelines)
+					{
+						vkDestroyPipeline(m_Device, pipeline, nullptr);
+					}
+				});
+			}
+
+			vkDestroyShaderModule(m_Device, meshVertShader, nullptr);
+			vkDestroyShaderModule(m_Device, meshInstancedVertShader, nullptr);
+			vkDestroyShaderModule(m_Device, meshIndirectVertShader, nullptr);
+		}
+
+		//deleting all of the vulkan shaders
+		vkDestroyShaderModule(m_Device, depthOnlyIndirectVertShader, nullptr);
+		vkDestroyShaderModule(m_Device, meshFragShader, nullptr);
+		vkDestroyShaderModule(m_Device, texMeshFragShader, nullptr);
+		vkDestroyShaderModule(m_Device, texMeshAlphaTestFragShader, nullptr);
+		vkDestroyShaderModule(m_Device, depthOnlyVertShader, nullptr);
+		vkDestroyShaderModule(m_Device, depthOnlyInstancedVertShader, nullptr);
+		vkDestroyShaderModule(m_Device, triangleFragShader, nullptr);
+		vkDestroyShaderModule(m_Device, triangleVertexShader, nullptr);
+
+		m_MainDeletionQueue.push_function([=]()
+		{
+			vkDestroyPipeline(m_Device, m_TexturedMeshPipeline, nullptr);
+			vkDestroyPipelineLayout(m_Device, texturedPipeLayout, nullptr);
+		});
+	}
+
+	void VulkanEngine::CreateAllocator()
+	{
+		//initialize the memory allocator
+		VmaAllocatorCreateInfo allocatorInfo = {};
+		allocatorInfo.physicalDevice = m_PhysicalDevice;
 		allocatorInfo.device = m_Device;
 		allocatorInfo.instance = m_Instance;
+
+		//the budget query goes through vkGetPhysicalDeviceMemoryProperties2, core since Vulkan 1.1
+		if (m_MemoryBudgetSupported)
+		{
+			allocatorInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+			allocatorInfo.vulkanApiVersion = VK_API_VERSION_1_1;
+		}
+
 		vmaCreateAllocator(&allocatorInfo, &m_Allocator);
+
+		m_MemoryPlacement.Init(m_Allocator);
+		m_MemoryPlacement.PrintReport();
+
+		m_Residency.Init(m_Allocator, m_MemoryBudgetSupported, FRAME_OVERLAP);
+		std::cout << "Memory budget: " << (m_MemoryBudgetSupported ? "VK_EXT_memory_budget enabled" : "VK_EXT_memory_budget not available, estimated from the heap sizes") << std::endl;
 	}
 
-	AllocatedBuffer VulkanEngine::CreateBuffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage)
+	AllocatedBuffer VulkanEngine::CreateBuffer(size_t allocSize, VkBufferUsageFlags usage, MemoryClass memoryClass)
 	{
 		//allocate vertex buffer
 		VkBufferCreateInfo bufferInfo = {};
@@ -905,8 +1417,7 @@ namespace VKE
 		bufferInfo.size = allocSize;
 		bufferInfo.usage = usage;
 
-		VmaAllocationCreateInfo vmaallocInfo = {};
-		vmaallocInfo.usage = memoryUsage;
+		VmaAllocationCreateInfo vmaallocInfo = m_MemoryPlacement.GetAllocationInfo(memoryClass);
 
 		AllocatedBuffer newBuffer;
 
@@ -917,17 +1428,68 @@ namespace VKE
 		return newBuffer;
 	}
 
+	MappedBuffer VulkanEngine::CreateMappedBuffer(size_t allocSize, VkBufferUsageFlags usage, MemoryClass memoryClass)
+	{
+		assert(m_MemoryPlacement.Get(memoryClass).Access != HostAccess::None);
+
+		VkBufferCreateInfo bufferInfo = {};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.pNext = nullptr;
+
+		bufferInfo.size = allocSize;
+		bufferInfo.usage = usage;
+
+		//VMA keeps the allocation mapped until it is freed
+		VmaAllocationCreateInfo vmaallocInfo = m_MemoryPlacement.GetAllocationInfo(memoryClass);
+		vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+		MappedBuffer newBuffer;
+		VmaAllocationInfo allocationInfo;
+
+		VkResult res = vmaCreateBuffer(m_Allocator, &bufferInfo, &vmaallocInfo, &newBuffer.Buffer.Buffer, &newBuffer.Buffer.Allocation, &allocationInfo);
+		assert(res == VK_SUCCESS);
+
+		newBuffer.Data = static_cast<uint8_t*>(allocationInfo.pMappedData);
+		assert(newBuffer.Data != nullptr);
+
+		//host visible device local memory is not always host coherent
+		VkMemoryPropertyFlags memoryFlags;
+		vmaGetMemoryTypeProperties(m_Allocator, allocationInfo.memoryType, &memoryFlags);
+		newBuffer.NeedsFlush = (memoryFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == 0;
+
+		return newBuffer;
+	}
+
+	void VulkanEngine::FlushMappedBuffer(const MappedBuffer& buffer, VkDeviceSize offset, VkDeviceSize size)
+	{
+		//VMA rounds the range out to nonCoherentAtomSize
+		if (buffer.NeedsFlush)
+		{
+			vmaFlushAllocation(m_Allocator, buffer.Buffer.Allocation, offset, size);
+		}
+	}
+
+	GPUCameraData* VulkanEngine::GetCameraData()
+	{
+		return GetCurrentFrame().cameraBuffer.As<GPUCameraData>();
+	}
+
 	void VulkanEngine::CreateDescriptors()
 	{
-		const size_t sceneParamBufferSize = FRAME_OVERLAP * PadUniformBufferSize(sizeof(GPUSceneData));
-		m_SceneParameterBuffer = CreateBuffer(sceneParamBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+		//the slices start at multiples of their size, which is a multiple of any offset alignment a device can ask for
+		m_TransientBuffer = CreateMappedBuffer(FRAME_OVERLAP * FrameAllocator::DEFAULT_SIZE, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+		for (int i = 0; i < FRAME_OVERLAP; i++)
+		{
+			m_Frames[i].transientAllocator.Init(m_Allocator, m_TransientBuffer, i * FrameAllocator::DEFAULT_SIZE, FrameAllocator::DEFAULT_SIZE,
+				m_GpuProperties.limits.minUniformBufferOffsetAlignment, m_GpuProperties.limits.minStorageBufferOffsetAlignment);
+		}
 
-		//create a descriptor pool that will hold 10 uniform buffers
+		//create a descriptor pool that will hold 10 uniform buffers. the texture sets come from m_TexturePools
 		std::vector<VkDescriptorPoolSize> sizes =
 		{
 			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10 },
 			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 10 },
-			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 10 }
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10 }
 		};
 
 		VkDescriptorPoolCreateInfo pool_info = {};
@@ -945,13 +1507,19 @@ namespace VKE
 		//binding for scene data at 1
 		VkDescriptorSetLayoutBinding sceneBind = VkInit::DescriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 1);
 
-		VkDescriptorSetLayoutBinding bindings[] = { cameraBind, sceneBind };
+		//binding for the GPU scene's objects, only read by the indirect pipelines and written once the scene is drawn
+		VkDescriptorSetLayoutBinding objectBind = VkInit::DescriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, OBJECT_BUFFER_BINDING);
+
+		//binding for the render matrices of the objects drawn from the CPU, written every frame
+		VkDescriptorSetLayoutBinding transformBind = VkInit::DescriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, TRANSFORM_BUFFER_BINDING);
+
+		VkDescriptorSetLayoutBinding bindings[] = { cameraBind, sceneBind, objectBind, transformBind };
 
 		VkDescriptorSetLayoutCreateInfo setinfo = {};
 		setinfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 		setinfo.pNext = nullptr;
 		//we are going to have 1 binding
-		setinfo.bindingCount = 2;
+		setinfo.bindingCount = 4;
 		//no flags
 		setinfo.flags = 0;
 		//point to the camera buffer binding
@@ -973,7 +1541,7 @@ namespace VKE
 
 		for (int i = 0; i < FRAME_OVERLAP; i++)
 		{
-			m_Frames[i].cameraBuffer = CreateBuffer(sizeof(GPUCameraData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+			m_Frames[i].cameraBuffer = CreateMappedBuffer(sizeof(GPUCameraData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
 
 			//allocate one descriptor set for each frame
 			VkDescriptorSetAllocateInfo allocInfo = {};
@@ -991,14 +1559,15 @@ namespace VKE
 			//information about the buffer we want to point at in the descriptor
 			VkDescriptorBufferInfo cameraInfo;
 			//it will be the camera buffer
-			cameraInfo.buffer = m_Frames[i].cameraBuffer.Buffer;
+			cameraInfo.buffer = m_Frames[i].cameraBuffer.Buffer.Buffer;
 			//at 0 offset
 			cameraInfo.offset = 0;
 			//of the size of a camera data struct
 			cameraInfo.range = sizeof(GPUCameraData);
 
 			VkDescriptorBufferInfo sceneInfo;
-			sceneInfo.buffer = m_SceneParameterBuffer.Buffer;
+			//the scene data is pushed to the frame allocator every frame and found through the dynamic offset
+			sceneInfo.buffer = m_TransientBuffer.Buffer.Buffer;
 			sceneInfo.offset = 0;
 			sceneInfo.range = sizeof(GPUSceneData);
 
@@ -1009,6 +1578,8 @@ namespace VKE
 			VkWriteDescriptorSet setWrites[] = { cameraWrite, sceneWrite };
 
 			vkUpdateDescriptorSets(m_Device, 2, setWrites, 0, nullptr);
+
+			ReserveTransformBuffer(m_Frames[i], INITIAL_TRANSFORM_CAPACITY);
 		}
 
 		// add buffers to deletion queues
@@ -1016,13 +1587,14 @@ namespace VKE
 		{
 			m_MainDeletionQueue.push_function([&, i]()
 			{
-				vmaDestroyBuffer(m_Allocator, m_Frames[i].cameraBuffer.Buffer, m_Frames[i].cameraBuffer.Allocation);
+				vmaDestroyBuffer(m_Allocator, m_Frames[i].cameraBuffer.Buffer.Buffer, m_Frames[i].cameraBuffer.Buffer.Allocation);
+				vmaDestroyBuffer(m_Allocator, m_Frames[i].transformBuffer.Buffer.Buffer, m_Frames[i].transformBuffer.Buffer.Allocation);
 			});
 		}
 
 		m_MainDeletionQueue.push_function([&]()
 		{
-			vmaDestroyBuffer(m_Allocator, m_SceneParameterBuffer.Buffer, m_SceneParameterBuffer.Allocation);
+			vmaDestroyBuffer(m_Allocator, m_TransientBuffer.Buffer.Buffer, m_TransientBuffer.Buffer.Allocation);
 		});
 
 		// add descriptor set layout to deletion queues
@@ -1031,6 +1603,12 @@ namespace VKE
 			vkDestroyDescriptorSetLayout(m_Device, m_SingleTextureSetLayout, nullptr);
 			vkDestroyDescriptorSetLayout(m_Device, m_GlobalSetLayout, nullptr);
 			vkDestroyDescriptorPool(m_Device, m_DescriptorPool, nullptr);
+
+			for (VkDescriptorPool pool : m_TexturePools)
+			{
+				vkDestroyDescriptorPool(m_Device, pool, nullptr);
+			}
+			m_TexturePools.clear();
 		});
 	}
 
@@ -1185,20 +1763,30 @@ namespace VKE
 		int i = 0;
 		for (const auto& queueFamily : queueFamilies)
 		{
-			if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+			if (!indices.isComplete())
 			{
-				indices.graphicsFamily = i;
-			}
+				if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+				{
+					indices.graphicsFamily = i;
+				}
+
+				VkBool32 presentSupport = false;
+				vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_Surface, &presentSupport);
 
-			VkBool32 presentSupport = false;
-			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_Surface, &presentSupport);
+				if (presentSupport)
+				{
+					indices.presentFamily = i;
+				}
+			}
 
-			if (presentSupport)
+			//a family that can only copy is usually backed by the DMA engines, which run next to rendering
+			const VkQueueFlags transferOnlyMask = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT;
+			if (!indices.transferFamily.has_value() && (queueFamily.queueFlags & transferOnlyMask) == VK_QUEUE_TRANSFER_BIT)
 			{
-				indices.presentFamily = i;
+				indices.transferFamily = i;
 			}
 
-			if (indices.isComplete())
+			if (indices.isComplete() && indices.transferFamily.has_value())
 			{
 				break;
 			}
@@ -1307,6 +1895,23 @@ namespace VKE
 		return requiredExtensions.empty();
 	}
 
+	bool VulkanEngine::IsDeviceExtensionAvailable(VkPhysicalDevice device, const char* extensionName)
+	{
+		uint32_t extensionCount;
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+		std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+		for (const auto& extension : availableExtensions)
+		{
+			if (strcmp(extension.extensionName, extensionName) == 0)
+				return true;
+		}
+
+		return false;
+	}
+
 	VkPipeline PipelineBuilder::BuildPipeline(VkDevice device, VkRenderPass pass)
 	{
 		//make viewport state from our stored viewport and scissor.
@@ -1366,6 +1971,12 @@ namespace VKE
 
 	void VulkanEngine::LoadMeshes()
 	{
+		//compaction replaces the geometry buffers, so destroy whichever are current at shutdown
+		m_MainDeletionQueue.push_function([=]() 
+		{
+			m_Geometry.Destroy(*this);
+		});
+
 		m_TriangleMesh.Vertices.resize(3);
 
 		// Vertex positions.
@@ -1378,88 +1989,148 @@ namespace VKE
 		m_TriangleMesh.Vertices[1].Color = { 0.f, 1.f, 0.f };
 		m_TriangleMesh.Vertices[2].Color = { 0.f, 1.f, 0.f };
 
-		//load the monkey
-		m_MonkeyMesh.LoadFromObj("res/assets/monkey_smooth.obj");
+		m_TriangleMesh.Indices = { 0, 1, 2 };
+		m_TriangleMesh.SetSingleSubmesh();
+		m_TriangleMesh.ComputeBounds();
+		m_TriangleMesh.GenerateLods("triangle");
 
-		UploadMesh(m_TriangleMesh);
-		UploadMesh(m_MonkeyMesh);
+		//load the monkey
+		m_MonkeyMesh.LoadFromObjCached("res/assets/monkey_smooth.obj", VertexFormat::PackedNoColor);
+		m_MonkeyMesh.Layout = VertexLayout::Split;
 
+		//meshes are uploaded where they are kept, compaction patches the geometry ranges of the meshes in m_Meshes
 		m_Meshes["monkey"] = m_MonkeyMesh;
 		m_Meshes["triangle"] = m_TriangleMesh;
 
-		Mesh lostEmpire{};
-		lostEmpire.LoadFromObj("res/assets/lost_empire.obj");
+		UploadMesh(m_Meshes["triangle"], "triangle", ResidencyPriority::Low);
+		UploadMesh(m_Meshes["monkey"], "monkey");
 
-		UploadMesh(lostEmpire);
+		Mesh lostEmpire{};
+		//the textured pipeline never reads the vertex color, so the empire can drop it
+		lostEmpire.LoadFromObjCached("res/assets/lost_empire.obj", VertexFormat::PackedNoColor);
+		lostEmpire.Layout = VertexLayout::Split;
 
 		m_Meshes["empire"] = lostEmpire;
+		UploadMesh(m_Meshes["empire"], "empire", ResidencyPriority::High);
 	}
 
-	void VulkanEngine::UploadMesh(Mesh& mesh)
+	void VulkanEngine::UploadMesh(Mesh& mesh, const std::string& name, ResidencyPriority priority)
 	{
-		const size_t bufferSize = mesh.Vertices.size() * sizeof(Vertex);
+		const size_t vertexBufferSize = mesh.GetGpuVertexSize();
+		const size_t indexBufferSize = mesh.GetIndexCount() * sizeof(uint32_t);
 
-		//allocate staging buffer
-		VkBufferCreateInfo stagingBufferInfo = {};
-		stagingBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		stagingBufferInfo.pNext = nullptr;
-		stagingBufferInfo.size = bufferSize;
-		stagingBufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+		//reserve the mesh's ranges of the geometry buffer, if it is too full pack it and grow it until the mesh fits
+		if (!m_Geometry.Allocate(*this, mesh))
+		{
+			CompactGeometry(&mesh);
 
-		//let the VMA library know that this data should be on CPU RAM
-		VmaAllocationCreateInfo vmaallocInfo = {};
-		vmaallocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+			const bool allocated = m_Geometry.Allocate(*this, mesh);
+			assert(allocated);
+		}
 
-		AllocatedBuffer stagingBuffer;
+		if (m_MemoryPlacement.IsDirect(MemoryClass::Geometry))
+		{
+			//the geometry buffers are host visible VRAM, the data goes straight into the mesh's ranges.
+			//host writes are visible to every later submission, nothing waits on an upload
+			m_Geometry.WriteDirect(*this, mesh);
+			mesh.UploadToken = 0;
+		}
+		else
+		{
+			//stage the vertices followed by the indices, the copies run with the ring's next submission
+			StagingAllocation staging = m_StagingRing.Reserve(vertexBufferSize + indexBufferSize);
 
-		//allocate the buffer
-		VkResult result = vmaCreateBuffer(m_Allocator, &stagingBufferInfo, &vmaallocInfo, &stagingBuffer.Buffer, &stagingBuffer.Allocation, nullptr);
-		assert(result == VK_SUCCESS);
+			char* data = static_cast<char*>(staging.Data);
+			mesh.WriteGpuVertices(data);
+			memcpy(data + vertexBufferSize, mesh.GetIndexData(), indexBufferSize);
 
-		void* data;
-		vmaMapMemory(m_Allocator, stagingBuffer.Allocation, &data);
-		memcpy(data, mesh.Vertices.data(), mesh.Vertices.size() * sizeof(Vertex));
-		vmaUnmapMemory(m_Allocator, stagingBuffer.Allocation);
+			m_Geometry.RecordUpload(m_StagingRing, mesh, staging);
+			mesh.UploadToken = m_StagingRing.GetRecordingToken();
 
-		//allocate vertex buffer
-		VkBufferCreateInfo vertexBufferInfo = {};
-		vertexBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		vertexBufferInfo.pNext = nullptr;
-		//this is the total size, in bytes, of the buffer we are allocating
-		vertexBufferInfo.size = bufferSize;
-		//this buffer is going to be used as a Vertex Buffer
-		vertexBufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+			//unbatched, every upload is submitted and waited for on its own
+			if (!m_BatchStartupUploads)
+			{
+				FlushUploads();
+			}
+		}
 
-		//let the VMA library know that this data should be GPU native
-		vmaallocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+		if (mesh.ResidencyHandle == ResidencyManager::INVALID_HANDLE)
+		{
+			//mesh pointers into m_Meshes stay valid, and the CPU side data is kept to upload it again
+			Mesh* meshPointer = &mesh;
+			mesh.ResidencyHandle = m_Residency.Register(name, priority, vertexBufferSize + indexBufferSize,
+				[this, meshPointer]() { m_Geometry.Free(*meshPointer); m_GeometryEvicted = true; },
+				[this, meshPointer, name]() { UploadMesh(*meshPointer, name); });
 
-		//allocate the buffer
-		result = vmaCreateBuffer(m_Allocator, &vertexBufferInfo, &vmaallocInfo, &mesh.VertexBuffer.Buffer, &mesh.VertexBuffer.Allocation, nullptr);
-		assert(result == VK_SUCCESS);
+			mesh.SortId = m_NextMeshSortId++;
+		}
+	}
+
+	void VulkanEngine::UpdateResidency()
+	{
+		//nothing may free what a running defragmentation could move, evictions and restreams wait for it to finish
+		if (m_Defragmenter.IsRunning())
+			return;
 
-		ImmediateSubmit([=](VkCommandBuffer cmd) 
+		m_Residency.Update(m_FrameNumber);
+
+		//nothing of this frame is recorded yet, so the geometry buffers can still be replaced
+		if (m_GeometryEvicted)
 		{
-			VkBufferCopy copy;
-			copy.dstOffset = 0;
-			copy.srcOffset = 0;
-			copy.size = bufferSize;
-			vkCmdCopyBuffer(cmd, stagingBuffer.Buffer, mesh.VertexBuffer.Buffer, 1, &copy);
-		});
+			m_GeometryEvicted = false;
+			CompactGeometry();
+		}
 
-		//add the destruction of mesh buffer to the deletion queue
-		m_MainDeletionQueue.push_function([=]() 
+		//restreamed data goes to the queue right away instead of with the next frame
+		m_StagingRing.Submit();
+	}
+
+	void VulkanEngine::FlushUploads()
+	{
+		m_StagingRing.Flush();
+
+		if (m_StagingRing.UsesOwnershipTransfer())
 		{
-			vmaDestroyBuffer(m_Allocator, mesh.VertexBuffer.Buffer, mesh.VertexBuffer.Allocation);
-		});
+			ImmediateSubmit([&](VkCommandBuffer cmd) 
+			{
+				m_StagingRing.CmdAcquire(cmd);
+			});
+		}
+		else
+		{
+			//nothing to record, the uploads are already ordered before later graphics work
+			m_StagingRing.CmdAcquire(VK_NULL_HANDLE);
+		}
+	}
+
+	void VulkanEngine::FreeMesh(Mesh& mesh)
+	{
+		vkDeviceWaitIdle(m_Device);
 
-		vmaDestroyBuffer(m_Allocator, stagingBuffer.Buffer, stagingBuffer.Allocation);
+		m_Geometry.Free(mesh);
+	}
+
+	void VulkanEngine::CompactGeometry(const Mesh* pending)
+	{
+		//the old buffers are destroyed once their ranges are copied out, so pending uploads into them have to land first
+		FlushUploads();
+		vkDeviceWaitIdle(m_Device);
+
+		std::vector<Mesh*> meshes;
+		meshes.reserve(m_Meshes.size());
+		for (auto& [name, mesh] : m_Meshes)
+		{
+			meshes.push_back(&mesh);
+		}
+
+		m_Geometry.Compact(*this, meshes, pending);
 	}
 
 	void VulkanEngine::InitScene()
 	{
 		RenderObject monkey;
 		monkey.mesh = GetMesh("monkey");
-		monkey.material = GetMaterial("defaultMesh");
+		monkey.material = GetMaterial("defaultMesh", monkey.mesh->Format, monkey.mesh->Layout);
 		monkey.transformMatrix = glm::mat4{ 1.0f };
 
 		m_Renderables.push_back(monkey);
@@ -1470,51 +2141,76 @@ namespace VKE
 		VkSampler blockySampler;
 		vkCreateSampler(m_Device, &samplerInfo, nullptr, &blockySampler);
 
-		RenderObject map;
-		map.mesh = GetMesh("empire");
-		map.material = GetMaterial("texturedMesh");
-		map.transformMatrix = glm::translate(glm::vec3{ 5, -10, 0 });
+		//one object per submesh of the empire, each with the material its .mtl entry asks for
+		Mesh* empire = GetMesh("empire");
 
-		//allocate the descriptor set for single-texture to use on the material
-		VkDescriptorSetAllocateInfo allocInfo = {};
-		allocInfo.pNext = nullptr;
-		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		allocInfo.descriptorPool = m_DescriptorPool;
-		allocInfo.descriptorSetCount = 1;
-		allocInfo.pSetLayouts = &m_SingleTextureSetLayout;
-
-		vkAllocateDescriptorSets(m_Device, &allocInfo, &map.material->textureSet);
-
-		//write to the descriptor set so that it points to our empire_diffuse texture
-		VkDescriptorImageInfo imageBufferInfo;
-		imageBufferInfo.sampler = blockySampler;
-		imageBufferInfo.imageView = m_LoadedTextures["empire_diffuse"].ImageView;
-		imageBufferInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		std::vector<RenderObject> empireObjects;
+		for (uint32_t i = 0; i < empire->Submeshes.size(); i++)
+		{
+			RenderObject map;
+			map.mesh = empire;
+			map.submesh = i;
+			map.material = GetTexturedMaterial(empire->Materials[empire->Submeshes[i].MaterialIndex], empire->Format, empire->Layout, blockySampler);
+			if (map.material == nullptr)
+				continue;
 
-		VkWriteDescriptorSet texture1 = VkInit::WriteDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, map.material->textureSet, &imageBufferInfo, 0);
+			map.transformMatrix = glm::translate(glm::vec3{ 5, -10, 0 });
 
-		vkUpdateDescriptorSets(m_Device, 1, &texture1, 0, nullptr);
+			empireObjects.push_back(map);
+		}
 
-		m_Renderables.push_back(map);
+		//keep the submeshes that share a material next to each other, so the pipeline is bound once per material
+		std::stable_sort(empireObjects.begin(), empireObjects.end(), [](const RenderObject& a, const RenderObject& b) { return a.material < b.material; });
+		m_Renderables.insert(m_Renderables.end(), empireObjects.begin(), empireObjects.end());
 
 		m_MainDeletionQueue.push_function([=]()
 		{
 			vkDestroySampler(m_Device, blockySampler, m_Allocator->GetAllocationCallbacks());
 		});
 
-		for (int x = -20; x <= 20; x++) {
-			for (int y = -20; y <= 20; y++) {
+		//the triangle grid, filled row by row around the origin
+		const uint32_t gridSide = static_cast<uint32_t>(std::ceil(std::sqrt(double(m_TriangleInstanceCount))));
+		const int gridHalf = static_cast<int>(gridSide / 2);
+
+		std::vector<glm::mat4> translations;
+		translations.reserve(m_TriangleInstanceCount);
+		for (uint32_t i = 0; i < m_TriangleInstanceCount; i++)
+		{
+			const int x = static_cast<int>(i % gridSide) - gridHalf;
+			const int y = static_cast<int>(i / gridSide) - gridHalf;
+			translations.push_back(glm::translate(glm::mat4{ 1.0 }, glm::vec3(x, 0, y)));
+		}
+
+		Mesh* triangleMesh = GetMesh("triangle");
+		glm::mat4 scale = glm::scale(glm::mat4{ 1.0 }, glm::vec3(0.2, 0.2, 0.2));
 
+		if (m_Instancing)
+		{
+			//one push constant and one draw for the whole grid, the scale applies to every triangle before its translation
+			RenderObject triangles;
+			triangles.mesh = triangleMesh;
+			triangles.material = GetMaterial("defaultMeshInstanced", triangleMesh->Format, triangleMesh->Layout);
+			triangles.transformMatrix = scale;
+			triangles.instances = CreateInstanceGroup("triangles", translations);
+
+			m_Renderables.push_back(triangles);
+		}
+		else
+		{
+			for (const glm::mat4& translation : translations)
+			{
 				RenderObject triangle;
-				triangle.mesh = GetMesh("triangle");
+				triangle.mesh = triangleMesh;
 				triangle.material = GetMaterial("defaultMesh");
-				glm::mat4 translation = glm::translate(glm::mat4{ 1.0 }, glm::vec3(x, 0, y));
-				glm::mat4 scale = glm::scale(glm::mat4{ 1.0 }, glm::vec3(0.2, 0.2, 0.2));
 				triangle.transformMatrix = translation * scale;
 
 				m_Renderables.push_back(triangle);
 			}
 		}
+
+		MarkRenderablesChanged();
+
+		std::cout << "Triangle grid: " << m_TriangleInstanceCount << (m_Instancing ? " instances in one draw" : " objects, one draw each") << std::endl;
 	}
 
 	Material* VulkanEngine::CreateMaterial(VkPipeline pipeline, VkPipelineLayout layout, const std::string& name)
@@ -1522,10 +2218,178 @@ namespace VKE
 		Material mat;
 		mat.pipeline = pipeline;
 		mat.pipelineLayout = layout;
+
+		//materials sharing a pipeline share its id
+		auto pipelineId = m_PipelineSortIds.try_emplace(pipeline, static_cast<uint32_t>(m_PipelineSortIds.size())).first;
+		mat.pipelineSortId = pipelineId->second;
+		mat.sortId = m_NextMaterialSortId++;
+
 		m_Materials[name] = mat;
 		return &m_Materials[name];
 	}
 
+	std::string VulkanEngine::GetMaterialName(const std::string& name, VertexFormat format, VertexLayout layout)
+	{
+		//full format interleaved materials keep their plain name
+		std::string materialName = name;
+
+		if (format != VertexFormat::Full)
+			materialName += std::string("_") + GetVertexFormatName(format);
+
+		if (layout != VertexLayout::Interleaved)
+			materialName += std::string("_") + GetVertexLayoutName(layout);
+
+		return materialName;
+	}
+
+	const char* VulkanEngine::GetVertexShaderPath(VertexFormat format, VertexShaderVariant variant)
+	{
+		static const char* const paths[][3] =
+		{
+			{ "res/shaders/triangleMesh.vert.spv", "res/shaders/triangleMeshInstanced.vert.spv", "res/shaders/triangleMeshIndirect.vert.spv" },
+			{ "res/shaders/packedMesh.vert.spv", "res/shaders/packedMeshInstanced.vert.spv", "res/shaders/packedMeshIndirect.vert.spv" },
+			{ "res/shaders/packedMeshNoColor.vert.spv", "res/shaders/packedMeshNoColorInstanced.vert.spv", "res/shaders/packedMeshNoColorIndirect.vert.spv" }
+		};
+
+		const uint32_t variantIndex = static_cast<uint32_t>(variant);
+		switch (format)
+		{
+		case VertexFormat::Packed:
+			return paths[1][variantIndex];
+		case VertexFormat::PackedNoColor:
+			return paths[2][variantIndex];
+		default:
+			return paths[0][variantIndex];
+		}
+	}
+
+	Material* VulkanEngine::GetTexturedMaterial(const MeshMaterial& meshMaterial, VertexFormat format, VertexLayout layout, VkSampler sampler)
+	{
+		//a separate alpha map marks cutout materials, their diffuse texture carries the alpha channel
+		const std::string baseName = GetMaterialName(meshMaterial.AlphaTexture.empty() ? "texturedMesh" : "texturedMeshAlphaTest", format, layout);
+
+		Texture* texture = meshMaterial.DiffuseTexture.empty() ? nullptr : LoadTexture(meshMaterial.DiffuseTexture);
+		if (texture == nullptr)
+		{
+			texture = LoadTexture(DEFAULT_TEXTURE_PATH);
+		}
+
+		const std::string name = baseName + ":" + (meshMaterial.DiffuseTexture.empty() ? DEFAULT_TEXTURE_PATH : meshMaterial.DiffuseTexture);
+
+		if (Material* material = GetMaterial(name))
+			return material;
+
+		//allocate the descriptor set for single-texture to use on the material. a textured pipeline can't draw without one
+		VkDescriptorSet* fallbackTextureSet = GetFallbackTextureSet(sampler);
+		const VkDescriptorSet textureSet = AllocateTextureSet();
+		if (fallbackTextureSet == nullptr || textureSet == VK_NULL_HANDLE)
+		{
+			std::cout << "No texture descriptor set for " << name << ", its objects aren't drawn" << std::endl;
+			return nullptr;
+		}
+
+		Material* baseMaterial = GetMaterial(baseName);
+		Material* material = CreateMaterial(baseMaterial->pipeline, baseMaterial->pipelineLayout, name);
+		material->depthMaterial = baseMaterial->depthMaterial;
+		material->indirectPipeline = baseMaterial->indirectPipeline;
+		material->textureSet = textureSet;
+
+		//write to the descriptor set so that it points to the material's texture, and again whenever the texture is streamed back in
+		WriteTextureDescriptor(material->textureSet, sampler, texture->ImageView);
+		texture->Bindings.push_back({ &material->textureSet, sampler });
+
+		material->texture = texture;
+		material->fallbackTextureSet = fallbackTextureSet;
+
+		return material;
+	}
+
+	VkDescriptorSet* VulkanEngine::GetFallbackTextureSet(VkSampler sampler)
+	{
+		auto it = m_FallbackTextureSets.find(sampler);
+		if (it != m_FallbackTextureSets.end())
+			return &it->second;
+
+		VkDescriptorSet set = AllocateTextureSet();
+		if (set == VK_NULL_HANDLE)
+			return nullptr;
+
+		//the default texture is pinned, it is never evicted
+		WriteTextureDescriptor(set, sampler, LoadTexture(DEFAULT_TEXTURE_PATH, ResidencyPriority::Pinned)->ImageView);
+
+		//the map's values stay where they are, materials and the default texture's bindings point at them
+		VkDescriptorSet* fallbackSet = &(m_FallbackTextureSets[sampler] = set);
+		m_LoadedTextures[DEFAULT_TEXTURE_PATH].Bindings.push_back({ fallbackSet, sampler });
+
+		return fallbackSet;
+	}
+
+	VkDescriptorSet VulkanEngine::AllocateTextureSet()
+	{
+		VkDescriptorSetAllocateInfo allocInfo = {};
+		allocInfo.pNext = nullptr;
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &m_SingleTextureSetLayout;
+
+		//sets are never freed, only the newest pool can have room left
+		if (m_TextureSetCount == m_TextureSetCapacity && CreateTexturePool(std::max(MIN_TEXTURE_SETS_PER_POOL, m_TextureSetCapacity)) == VK_NULL_HANDLE)
+		{
+			std::cout << "Failed to create a texture descriptor pool" << std::endl;
+			return VK_NULL_HANDLE;
+		}
+
+		allocInfo.descriptorPool = m_TexturePools.back();
+
+		VkDescriptorSet set;
+		VkResult result = vkAllocateDescriptorSets(m_Device, &allocInfo, &set);
+		if (result != VK_SUCCESS)
+		{
+			std::cout << "Failed to allocate a texture descriptor set: " << result << std::endl;
+			return VK_NULL_HANDLE;
+		}
+
+		m_TextureSetCount++;
+		return set;
+	}
+
+	VkDescriptorPool VulkanEngine::CreateTexturePool(uint32_t setCount)
+	{
+		VkDescriptorPoolSize size = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, setCount };
+
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.flags = 0;
+		poolInfo.maxSets = setCount;
+		poolInfo.poolSizeCount = 1;
+		poolInfo.pPoolSizes = &size;
+
+		VkDescriptorPool pool;
+		if (vkCreateDescriptorPool(m_Device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+			return VK_NULL_HANDLE;
+
+		m_TexturePools.push_back(pool);
+		m_TextureSetCapacity += setCount;
+		return pool;
+	}
+
+	void VulkanEngine::WriteTextureDescriptor(VkDescriptorSet set, VkSampler sampler, VkImageView imageView)
+	{
+		VkDescriptorImageInfo imageBufferInfo;
+		imageBufferInfo.sampler = sampler;
+		imageBufferInfo.imageView = imageView;
+		imageBufferInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+		VkWriteDescriptorSet texture1 = VkInit::WriteDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, set, &imageBufferInfo, 0);
+
+		vkUpdateDescriptorSets(m_Device, 1, &texture1, 0, nullptr);
+	}
+
+	Material* VulkanEngine::GetMaterial(const std::string& name, VertexFormat format, VertexLayout layout)
+	{
+		return GetMaterial(GetMaterialName(name, format, layout));
+	}
+
 	Material* VulkanEngine::GetMaterial(const std::string& name)
 	{
 		//search for the object, and return nullptr if not found
@@ -1550,16 +2414,140 @@ namespace VKE
 		}
 	}
 
+	InstanceGroup* VulkanEngine::CreateInstanceGroup(const std::string& name, const std::vector<glm::mat4>& transforms)
+	{
+		InstanceGroup& group = m_InstanceGroups[name];
+		assert(group.InstanceCount == 0 && !transforms.empty());
+
+		const size_t bufferSize = transforms.size() * sizeof(glm::mat4);
+
+		group.InstanceCount = static_cast<uint32_t>(transforms.size());
+		group.InstanceBuffer = CreateBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, MemoryClass::Geometry);
+
+		//read like vertices, so the matrices go wherever the geometry does
+		if (m_MemoryPlacement.IsDirect(MemoryClass::Geometry))
+		{
+			void* data;
+			VkResult result = vmaMapMemory(m_Allocator, group.InstanceBuffer.Allocation, &data);
+			assert(result == VK_SUCCESS);
+
+			memcpy(data, transforms.data(), bufferSize);
 
-	void VulkanEngine::DrawObjects(VkCommandBuffer cmd, RenderObject* first, int count)
+			vmaFlushAllocation(m_Allocator, group.InstanceBuffer.Allocation, 0, bufferSize);
+			vmaUnmapMemory(m_Allocator, group.InstanceBuffer.Allocation);
+		}
+		else
+		{
+			StagingAllocation staging = m_StagingRing.Reserve(bufferSize);
+			memcpy(staging.Data, transforms.data(), bufferSize);
+
+			VkBufferCopy copy;
+			copy.srcOffset = staging.Offset;
+			copy.dstOffset = 0;
+			copy.size = bufferSize;
+			vkCmdCopyBuffer(m_StagingRing.GetCommandBuffer(), staging.Buffer, group.InstanceBuffer.Buffer, 1, &copy);
+			m_StagingRing.ReleaseBuffer(group.InstanceBuffer.Buffer, 0, bufferSize);
+
+			group.UploadToken = m_StagingRing.GetRecordingToken();
+
+			if (!m_BatchStartupUploads)
+			{
+				FlushUploads();
+			}
+		}
+
+		AllocatedBuffer instanceBuffer = group.InstanceBuffer;
+		m_MainDeletionQueue.push_function([=]()
+		{
+			vmaDestroyBuffer(m_Allocator, instanceBuffer.Buffer, instanceBuffer.Allocation);
+		});
+
+		return &group;
+	}
+
+	DrawList VulkanEngine::BuildDrawList(const RenderObject* objects, const uint32_t* indices, uint32_t count, bool depthOnly)
 	{
-		//camera view
-		glm::vec3 camPos = { 0.f,-6.f,-10.f };
+		FrameArena& arena = GetFrameArena();
 
-		glm::mat4 view = glm::translate(glm::mat4(1.f), camPos);
-		//camera projection
-		glm::mat4 projection = glm::perspective(glm::radians(70.f), 1700.f / 900.f, 0.1f, 200.0f);
+		DrawEntry* entries = arena.AllocateArray<DrawEntry>(count);
+		uint32_t drawCount = 0;
+
+		for (uint32_t j = 0; j < count; j++)
+		{
+			const uint32_t i = indices != nullptr ? indices[j] : j;
+			const RenderObject& object = objects[i];
+
+			//drawn by DrawIndirect
+			if (m_GpuDriven && m_GpuScene.IsBuilt() && GpuScene::CanDraw(object))
+				continue;
+
+			//materials without a depth only variant are left to the main pass
+			const Material* material = depthOnly ? object.material->depthMaterial : object.material;
+			if (material == nullptr)
+				continue;
+
+			//evicted meshes are skipped, the residency manager streams them back in at the start of the next frame
+			if (!m_Residency.Touch(object.mesh->ResidencyHandle))
+				continue;
+
+			//still on its way from the transfer queue
+			if (!m_StagingRing.IsAcquired(object.mesh->UploadToken) || (object.instances != nullptr && !m_StagingRing.IsAcquired(object.instances->UploadToken)))
+				continue;
+
+			//the texture is only checked while recording, which may happen on other threads, so it is touched here
+			if (object.material->texture != nullptr)
+			{
+				m_Residency.Touch(object.material->texture->ResidencyHandle);
+			}
+
+			//what the depth prepass covers goes first, the alpha tested rest is drawn over it
+			const uint32_t pass = object.material->depthMaterial != nullptr ? 0 : 1;
+			const uint32_t pool = static_cast<uint32_t>(object.mesh->Format) * static_cast<uint32_t>(VertexLayout::Count) + static_cast<uint32_t>(object.mesh->Layout);
+
+			const glm::vec3 center = glm::vec3(object.transformMatrix * glm::vec4(object.mesh->GetBoundsCenter(), 1.0f));
+			const float depth = glm::length(center - m_CameraPosition) / CAMERA_FAR_PLANE;
+
+			entries[drawCount].Key = DrawKey::Make(pass, material->pipelineSortId, material->sortId, pool, object.mesh->SortId, depth);
+			entries[drawCount].Index = i;
+			drawCount++;
+		}
+
+		if (m_SortDrawList)
+		{
+			DrawEntry* scratch = arena.AllocateArray<DrawEntry>(drawCount);
+			RadixSortDraws(entries, scratch, drawCount);
+		}
+
+		uint32_t* order = arena.AllocateArray<uint32_t>(drawCount);
+		for (uint32_t i = 0; i < drawCount; i++)
+		{
+			order[i] = entries[i].Index;
+		}
+
+		DrawList drawList;
+		drawList.Order = order;
+		drawList.Count = drawCount;
+		return drawList;
+	}
+
+	glm::mat4 VulkanEngine::GetViewMatrix() const
+	{
+		return glm::translate(glm::mat4(1.f), -m_CameraPosition);
+	}
+
+	glm::mat4 VulkanEngine::GetProjectionMatrix() const
+	{
+		glm::mat4 projection = glm::perspective(CAMERA_FIELD_OF_VIEW, 1700.f / 900.f, CAMERA_NEAR_PLANE, CAMERA_FAR_PLANE);
 		projection[1][1] *= -1;
+		return projection;
+	}
+
+	DrawContext VulkanEngine::PrepareDraws(const Frustum& frustum)
+	{
+		//camera view
+		glm::mat4 view = GetViewMatrix();
+		//camera projection
+		glm::mat4 projection = GetProjectionMatrix();
 
 		//fill a GPU camera data struct
 		GPUCameraData camData;
@@ -1567,65 +2555,384 @@ namespace VKE
 		camData.view = view;
 		camData.viewproj = projection * view;
 
-		//and copy it to the buffer
-		void* data;
-		vmaMapMemory(m_Allocator, GetCurrentFrame().cameraBuffer.Allocation, &data);
-		memcpy(data, &camData, sizeof(GPUCameraData));
-		vmaUnmapMemory(m_Allocator, GetCurrentFrame().cameraBuffer.Allocation);
+		//and copy it to the buffer. the mapping may be write combined, so it is written once and never read back
+		*GetCameraData() = camData;
+		FlushMappedBuffer(GetCurrentFrame().cameraBuffer, 0, sizeof(GPUCameraData));
 
 		float framed = (m_FrameNumber / 120.f);
 		m_SceneParameters.ambientColor = { sin(framed), 0, cos(framed), 1 };
-		char* sceneData;
-		vmaMapMemory(m_Allocator, m_SceneParameterBuffer.Allocation, (void**)&sceneData);
-		int frameIndex = m_FrameNumber % FRAME_OVERLAP;
-		sceneData += PadUniformBufferSize(sizeof(GPUSceneData)) * frameIndex;
-		memcpy(sceneData, &m_SceneParameters, sizeof(GPUSceneData));
-		vmaUnmapMemory(m_Allocator, m_SceneParameterBuffer.Allocation);
 
-		Mesh* lastMesh = nullptr;
-		Material* lastMaterial = nullptr;
+		DrawContext context;
+		context.SceneOffset = GetFrameAllocator().PushUniform(m_SceneParameters).Offset;
+		context.CameraFrustum = frustum;
+		context.CameraPosition = m_CameraPosition;
+		//world units at distance 1 map to this many pixels
+		context.ProjectionScale = m_SwapChainExtent.height / (2.0f * tan(CAMERA_FIELD_OF_VIEW * 0.5f));
+		context.NearPlane = CAMERA_NEAR_PLANE;
+		context.LodErrorThreshold = m_LodErrorThreshold * exp2(m_LodBias);
+		return context;
+	}
+
+	void VulkanEngine::WriteObjectTransforms(const RenderObject* objects, uint32_t count)
+	{
+		FrameData& frame = GetCurrentFrame();
+		ReserveTransformBuffer(frame, count);
+
+		glm::mat4* matrices = frame.transformBuffer.As<glm::mat4>();
+
+		const uint32_t chunkCount = std::clamp(count / MIN_TRANSFORMS_PER_THREAD, 1u, m_Workers.GetThreadCount());
+		const uint32_t chunkSize = (count + chunkCount - 1) / chunkCount;
+
+		m_Workers.Run(chunkCount, [&](uint32_t chunk)
+		{
+			const uint32_t begin = chunk * chunkSize;
+			const uint32_t end = std::min(count, begin + chunkSize);
+
+			//transform * GetDequantizationMatrix() without the matrix product: the dequantization scales the first three columns
+			//and moves the translation. full meshes scale by 1 and move by 0, so every object takes the same four multiply-adds per column.
+			//the mapping may be write combined, each matrix is built in registers and stored once
+			for (uint32_t i = begin; i < end; i++)
+			{
+				const glm::mat4& transform = objects[i].transformMatrix;
+				const glm::vec3 scale = objects[i].mesh->GetDequantizationScale();
+				const glm::vec3 offset = objects[i].mesh->GetDequantizationOffset();
+
+				glm::mat4 renderMatrix;
+				renderMatrix[0] = transform[0] * scale.x;
+				renderMatrix[1] = transform[1] * scale.y;
+				renderMatrix[2] = transform[2] * scale.z;
+				renderMatrix[3] = transform[0] * offset.x + transform[1] * offset.y + transform[2] * offset.z + transform[3];
+				matrices[i] = renderMatrix;
+			}
+		});
+
+		FlushMappedBuffer(frame.transformBuffer, 0, VkDeviceSize(count) * sizeof(glm::mat4));
+	}
+
+	void VulkanEngine::ReserveTransformBuffer(FrameData& frame, uint32_t count)
+	{
+		if (count <= frame.transformCapacity)
+			return;
 
-		for (int i = 0; i < count; i++)
+		//the frame's fence has signalled, but the buffer goes through the deletion queue like everything else the frame's commands used
+		if (frame.transformCapacity > 0)
 		{
-			RenderObject& object = first[i];
+			const AllocatedBuffer oldBuffer = frame.transformBuffer.Buffer;
+			frame.deletionQueue.Push([this, oldBuffer]()
+			{
+				vmaDestroyBuffer(m_Allocator, oldBuffer.Buffer, oldBuffer.Allocation);
+			});
+		}
+
+		//doubling keeps a growing scene from reallocating every frame
+		frame.transformCapacity = std::max(count, frame.transformCapacity * 2);
+		frame.transformBuffer = CreateMappedBuffer(VkDeviceSize(frame.transformCapacity) * sizeof(glm::mat4), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+		VkDescriptorBufferInfo transformInfo;
+		transformInfo.buffer = frame.transformBuffer.Buffer.Buffer;
+		transformInfo.offset = 0;
+		transformInfo.range = VK_WHOLE_SIZE;
+
+		//nothing recorded for the frame has bound the set yet
+		VkWriteDescriptorSet transformWrite = VkInit::WritDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frame.globalDescriptor, &transformInfo, TRANSFORM_BUFFER_BINDING);
+		vkUpdateDescriptorSets(m_Device, 1, &transformWrite, 0, nullptr);
+	}
+
+	void VulkanEngine::DrawObjects(VkCommandBuffer cmd, const RenderObject* objects, const uint32_t* order, uint32_t count, const DrawContext& context, DrawStatistics& statistics, CullingStatistics& clusters, bool depthOnly)
+	{
+		//what is bound, each of them is only bound again when the next draw needs something else
+		const GeometryPool* lastPool = nullptr;
+		VkPipeline lastPipeline = VK_NULL_HANDLE;
+		VkPipelineLayout lastLayout = VK_NULL_HANDLE;
+		VkDescriptorSet lastTextureSet = VK_NULL_HANDLE;
+
+		//every mesh's indices live in the one index buffer
+		vkCmdBindIndexBuffer(cmd, m_Geometry.GetIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+
+		for (uint32_t drawIndex = 0; drawIndex < count; drawIndex++)
+		{
+			const uint32_t objectIndex = order[drawIndex];
+			const RenderObject& object = objects[objectIndex];
+
+			const Submesh* submesh = object.mesh->Submeshes.empty() ? nullptr : &object.mesh->Submeshes[object.submesh];
+			const InstanceGroup* instances = object.instances;
+
+			//the instances are spread out, one level of detail for all of them would be too coarse for the closest ones
+			const MeshLod* lod = nullptr;
+			if (instances != nullptr)
+			{
+				lod = submesh && submesh->LodCount > 0 ? &object.mesh->Lods[submesh->FirstLod] : nullptr;
+			}
+			else if (submesh != nullptr)
+			{
+				lod = SelectLod(*object.mesh, *submesh, object.transformMatrix, context.CameraPosition, context.ProjectionScale, context.NearPlane, context.LodErrorThreshold);
+			}
+
+			//the coarsest level is empty, the object is too small to see
+			if (lod != nullptr && lod->IndexCount == 0)
+				continue;
+
+			//BuildDrawList only took objects with a material for the pass
+			const Material* material = depthOnly ? object.material->depthMaterial : object.material;
 
 			//only bind the pipeline if it doesn't match with the already bound one
-			if (object.material != lastMaterial) 
+			if (material->pipeline != lastPipeline) 
+			{
+				vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipeline);
+				lastPipeline = material->pipeline;
+				statistics.PipelineBinds++;
+			}
+
+			//the sets bound so far are only kept across pipelines that share the layout
+			if (material->pipelineLayout != lastLayout)
 			{
-				vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipeline);
-				lastMaterial = object.material;
+				lastLayout = material->pipelineLayout;
+				lastTextureSet = VK_NULL_HANDLE;
 
 				//offset for our scene buffer
-				uint32_t uniformOffset = PadUniformBufferSize(sizeof(GPUSceneData)) * frameIndex;
+				uint32_t uniformOffset = context.SceneOffset;
 
-				//bind the descriptor set when changing pipeline
-				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipelineLayout, 0, 1, &GetCurrentFrame().globalDescriptor, 1, &uniformOffset);
+				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipelineLayout, 0, 1, &GetCurrentFrame().globalDescriptor, 1, &uniformOffset);
+				statistics.DescriptorSetBinds++;
+			}
 
-				if (object.material->textureSet != VK_NULL_HANDLE) 
+			if (material->textureSet != VK_NULL_HANDLE) 
+			{
+				const VkDescriptorSet textureSet = GetDrawableTextureSet(*material);
+
+				//texture descriptor, materials sorted next to each other often share it
+				if (textureSet != lastTextureSet)
 				{
-					//texture descriptor
-					vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipelineLayout, 1, 1, &object.material->textureSet, 0, nullptr);
+					vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipelineLayout, 1, 1, &textureSet, 0, nullptr);
+					lastTextureSet = textureSet;
+					statistics.DescriptorSetBinds++;
 				}
 			}
 
-			MeshPushConstants constants;
-			constants.renderMatrix = object.transformMatrix;
+			//meshes of the same format and layout share their vertex buffers, switching between them only changes the draw's offsets
+			const GeometryPool* pool = m_Geometry.GetPool(object.mesh->Format, object.mesh->Layout);
+			if (pool != lastPool) 
+			{
+				//split pools bind their attribute stream as binding 1, depth only pipelines read nothing but binding 0
+				const VkBuffer buffers[] = { pool->Streams[0].Buffer, pool->Streams[1].Buffer };
+				const VkDeviceSize offsets[] = { 0, 0 };
+				const uint32_t bindingCount = depthOnly ? 1 : pool->StreamCount;
+
+				vkCmdBindVertexBuffers(cmd, 0, bindingCount, buffers, offsets);
+				lastPool = pool;
+				statistics.VertexBufferBinds++;
+			}
+
+			//the vertex shader finds the object's matrix through gl_InstanceIndex, which starts at firstInstance.
+			//instance groups read their instance matrices at gl_InstanceIndex, they push the object's index instead
+			uint32_t instanceCount = 1;
+			uint32_t firstInstance = objectIndex;
+			if (instances != nullptr)
+			{
+				const VkDeviceSize offset = 0;
+				vkCmdBindVertexBuffers(cmd, INSTANCE_BINDING, 1, &instances->InstanceBuffer.Buffer, &offset);
+				instanceCount = instances->InstanceCount;
+				firstInstance = 0;
+				statistics.VertexBufferBinds++;
+
+				ObjectPushConstants constants;
+				constants.objectIndex = objectIndex;
+				vkCmdPushConstants(cmd, material->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ObjectPushConstants), &constants);
+				statistics.PushConstants++;
+			}
+
+			const GeometryRange& geometry = object.mesh->Geometry;
+
+			//we can now draw. the meshlet bounds are tested against a single transform, instance groups draw every cluster
+			if (m_ClusterCulling && instances == nullptr && lod != nullptr && submesh->MeshletCount > 0 && lod == &object.mesh->Lods[submesh->FirstLod])
+			{
+				const uint32_t visibleMeshlets = DrawMeshlets(cmd, *object.mesh, *submesh, object.transformMatrix, objectIndex, context, statistics);
+
+				//the depth pass culls the same clusters again, count them once
+				if (!depthOnly)
+				{
+					clusters.Total += submesh->MeshletCount;
+					clusters.Visible += visibleMeshlets;
+				}
+			}
+			else if (lod != nullptr)
+			{
+				vkCmdDrawIndexed(cmd, lod->IndexCount, instanceCount, geometry.FirstIndex + lod->FirstIndex, geometry.VertexOffset, firstInstance);
+				statistics.Draws++;
+			}
+			else
+			{
+				vkCmdDrawIndexed(cmd, geometry.IndexCount, instanceCount, geometry.FirstIndex, geometry.VertexOffset, firstInstance);
+				statistics.Draws++;
+			}
+		}
+	}
+
+	void VulkanEngine::DrawIndirect(VkCommandBuffer cmd, const DrawContext& context, DrawStatistics& statistics, bool depthOnly)
+	{
+		const uint32_t frameIndex = m_FrameNumber % FRAME_OVERLAP;
+		const VkBuffer commandBuffer = m_GpuScene.GetCommandBuffer(frameIndex);
+		const VkBuffer countBuffer = m_GpuScene.GetCountBuffer(frameIndex);
+		const uint32_t commandStride = sizeof(VkDrawIndexedIndirectCommand);
+
+		const GeometryPool* lastPool = nullptr;
+		VkPipeline lastPipeline = VK_NULL_HANDLE;
+		VkPipelineLayout lastLayout = VK_NULL_HANDLE;
+		VkDescriptorSet lastTextureSet = VK_NULL_HANDLE;
+
+		vkCmdBindIndexBuffer(cmd, m_Geometry.GetIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+
+		const std::vector<GpuBatch>& batches = m_GpuScene.GetBatches();
+		for (uint32_t batchIndex = 0; batchIndex < batches.size(); batchIndex++)
+		{
+			const GpuBatch& batch = batches[batchIndex];
+
+			const Material* material = depthOnly ? batch.BatchMaterial->depthMaterial : batch.BatchMaterial;
+			if (material == nullptr || material->indirectPipeline == VK_NULL_HANDLE)
+				continue;
+
+			if (material->indirectPipeline != lastPipeline)
+			{
+				vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->indirectPipeline);
+				lastPipeline = material->indirectPipeline;
+				statistics.PipelineBinds++;
+			}
+
+			if (material->pipelineLayout != lastLayout)
+			{
+				lastLayout = material->pipelineLayout;
+				lastTextureSet = VK_NULL_HANDLE;
+
+				uint32_t uniformOffset = context.SceneOffset;
+				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipelineLayout, 0, 1, &GetCurrentFrame().globalDescriptor, 1, &uniformOffset);
+				statistics.DescriptorSetBinds++;
+			}
+
+			if (material->textureSet != VK_NULL_HANDLE)
+			{
+				const VkDescriptorSet textureSet = GetDrawableTextureSet(*material);
+				if (textureSet != lastTextureSet)
+				{
+					vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipelineLayout, 1, 1, &textureSet, 0, nullptr);
+					lastTextureSet = textureSet;
+					statistics.DescriptorSetBinds++;
+				}
+			}
+
+			if (batch.Pool != lastPool)
+			{
+				const VkBuffer buffers[] = { batch.Pool->Streams[0].Buffer, batch.Pool->Streams[1].Buffer };
+				const VkDeviceSize offsets[] = { 0, 0 };
+				const uint32_t bindingCount = depthOnly ? 1 : batch.Pool->StreamCount;
+
+				vkCmdBindVertexBuffers(cmd, 0, bindingCount, buffers, offsets);
+				lastPool = batch.Pool;
+				statistics.VertexBufferBinds++;
+			}
+
+			//the culling shader wrote the batch's visible objects to the front of its range and counted them.
+			//without draw counts the whole range is drawn, culled objects have no instances
+			const VkDeviceSize commandOffset = VkDeviceSize(batch.FirstCommand) * commandStride;
+			if (m_GpuScene.UsesDrawCount())
+			{
+				m_CmdDrawIndexedIndirectCount(cmd, commandBuffer, commandOffset, countBuffer, batchIndex * sizeof(uint32_t), batch.Capacity, commandStride);
+			}
+			else
+			{
+				vkCmdDrawIndexedIndirect(cmd, commandBuffer, commandOffset, batch.Capacity, commandStride);
+			}
+			statistics.Draws++;
+		}
+	}
+
+	VkDescriptorSet VulkanEngine::GetDrawableTextureSet(const Material& material) const
+	{
+		//the default texture stands in while the material's texture is evicted or still uploading
+		if (material.texture != nullptr && (!m_Residency.IsResident(material.texture->ResidencyHandle) || !m_StagingRing.IsAcquired(material.texture->UploadToken)))
+		{
+			return *material.fallbackTextureSet;
+		}
+
+		return material.textureSet;
+	}
+
+	uint32_t VulkanEngine::DrawMeshlets(VkCommandBuffer cmd, const Mesh& mesh, const Submesh& submesh, const glm::mat4& transform, uint32_t objectIndex, const DrawContext& context, DrawStatistics& statistics)
+	{
+		const float scale = GetMaxScale(transform);
+		const glm::mat3 rotation = glm::mat3(transform);
+
+		const GeometryRange& geometry = mesh.Geometry;
+
+		//visible meshlets that follow each other in the index buffer are merged into one draw
+		uint32_t runFirstIndex = 0;
+		uint32_t runIndexCount = 0;
+		uint32_t visibleCount = 0;
+
+		for (uint32_t i = submesh.FirstMeshlet; i < submesh.FirstMeshlet + submesh.MeshletCount; i++)
+		{
+			const Meshlet& meshlet = mesh.Meshlets[i];
 
-			//upload the mesh to the GPU via push constants
-			vkCmdPushConstants(cmd, object.material->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+			const glm::vec3 center = glm::vec3(transform * glm::vec4(meshlet.Center, 1.0f));
+			const float radius = meshlet.Radius * scale;
 
-			//only bind the mesh if it's a different one from last bind
-			if (object.mesh != lastMesh) 
+			bool visible = context.CameraFrustum.IntersectsSphere(center, radius);
+			if (visible && meshlet.ConeCutoff < 1.0f)
 			{
-				//bind the mesh vertex buffer with offset 0
-				VkDeviceSize offset = 0;
-				vkCmdBindVertexBuffers(cmd, 0, 1, &object.mesh->VertexBuffer.Buffer, &offset);
-				lastMesh = object.mesh;
+				const glm::vec3 coneAxis = glm::normalize(rotation * meshlet.ConeAxis);
+				visible = !IsConeBackfacing(center, radius, coneAxis, meshlet.ConeCutoff, context.CameraPosition);
 			}
 
-			//we can now draw
-			vkCmdDraw(cmd, object.mesh->Vertices.size(), 1, 0, 0);
+			if (!visible)
+				continue;
+
+			visibleCount++;
+
+			if (runIndexCount > 0 && runFirstIndex + runIndexCount == meshlet.FirstIndex)
+			{
+				runIndexCount += meshlet.IndexCount;
+				continue;
+			}
+
+			if (runIndexCount > 0)
+			{
+				vkCmdDrawIndexed(cmd, runIndexCount, 1, geometry.FirstIndex + runFirstIndex, geometry.VertexOffset, objectIndex);
+				statistics.Draws++;
+			}
+
+			runFirstIndex = meshlet.FirstIndex;
+			runIndexCount = meshlet.IndexCount;
 		}
+
+		if (runIndexCount > 0)
+		{
+			vkCmdDrawIndexed(cmd, runIndexCount, 1, geometry.FirstIndex + runFirstIndex, geometry.VertexOffset, objectIndex);
+			statistics.Draws++;
+		}
+
+		return visibleCount;
+	}
+
+	const MeshLod* VulkanEngine::SelectLod(const Mesh& mesh, const Submesh& submesh, const glm::mat4& transform, const glm::vec3& cameraPosition, float projectionScale, float nearPlane, float errorThreshold)
+	{
+		if (submesh.LodCount == 0)
+			return nullptr;
+
+		//the largest axis scale bounds how much the transform magnifies the error
+		const float scale = GetMaxScale(transform);
+
+		//the distance comes from the whole mesh, so neighbouring submeshes switch levels together
+		const glm::vec3 center = glm::vec3(transform * glm::vec4(mesh.GetBoundsCenter(), 1.0f));
+		const float distance = glm::max(glm::length(center - cameraPosition) - mesh.GetBoundsRadius() * scale, nearPlane);
+
+		//coarsest level whose error stays below the threshold on screen
+		for (uint32_t i = submesh.LodCount - 1; i > 0; i--)
+		{
+			const MeshLod& lod = mesh.Lods[submesh.FirstLod + i];
+			if (lod.Error * scale * projectionScale / distance <= errorThreshold)
+				return &lod;
+		}
+
+		return &mesh.Lods[submesh.FirstLod];
 	}
 
 	FrameData& VulkanEngine::GetCurrentFrame()
@@ -1665,13 +2972,68 @@ namespace VKE
 
 	void VulkanEngine::LoadImages()
 	{
-		Texture lostEmpire;
+		//fallback for materials without a diffuse map and for textures that aren't resident, it is never evicted.
+		//the other textures are loaded as materials ask for them
+		LoadTexture(DEFAULT_TEXTURE_PATH, ResidencyPriority::Pinned);
+	}
+
+	Texture* VulkanEngine::LoadTexture(const std::string& path, ResidencyPriority priority)
+	{
+		auto it = m_LoadedTextures.find(path);
+		if (it != m_LoadedTextures.end())
+			return &it->second;
+
+		Texture texture;
+		texture.Path = path;
+
+		if (!StreamTexture(texture))
+			return nullptr;
+
+		VmaAllocationInfo allocationInfo;
+		vmaGetAllocationInfo(m_Allocator, texture.Image.Allocation, &allocationInfo);
+
+		//map nodes don't move, the callbacks can keep the pointer
+		Texture* loaded = &(m_LoadedTextures[path] = texture);
+		loaded->ResidencyHandle = m_Residency.Register(path, priority, allocationInfo.size,
+			[this, loaded]() { EvictTexture(*loaded); },
+			[this, loaded]() { StreamTexture(*loaded); });
+
+		return loaded;
+	}
+
+	bool VulkanEngine::StreamTexture(Texture& texture)
+	{
+		if (!VkUtils::LoadImageFromFile(*this, texture.Path.c_str(), texture.Image))
+			return false;
+
+		texture.UploadToken = m_StagingRing.GetRecordingToken();
+
+		if (!m_BatchStartupUploads)
+		{
+			FlushUploads();
+		}
 
-		VkUtils::LoadImageFromFile(*this, "res/assets/lost_empire-RGBA.png", lostEmpire.Image);
+		VkImageViewCreateInfo imageinfo = VkInit::ImageViewCreateInfo(VK_FORMAT_R8G8B8A8_SRGB, texture.Image.Image, VK_IMAGE_ASPECT_COLOR_BIT);
+		vkCreateImageView(m_Device, &imageinfo, nullptr, &texture.ImageView);
+
+		//the materials have drawn with the fallback set since the eviction, so their own sets aren't in use
+		for (const Texture::Binding& binding : texture.Bindings)
+		{
+			WriteTextureDescriptor(*binding.Set, binding.Sampler, texture.ImageView);
+		}
+
+		return true;
+	}
+
+	void VulkanEngine::EvictTexture(Texture& texture)
+	{
+		if (texture.ImageView == VK_NULL_HANDLE)
+			return;
 
-		VkImageViewCreateInfo imageinfo = VkInit::ImageViewCreateInfo(VK_FORMAT_R8G8B8A8_SRGB, lostEmpire.Image.Image, VK_IMAGE_ASPECT_COLOR_BIT);
-		vkCreateImageView(m_Device, &imageinfo, nullptr, &lostEmpire.ImageView);
+		vkDestroyImageView(m_Device, texture.ImageView, nullptr);
+		vmaDestroyImage(m_Allocator, texture.Image.Image, texture.Image.Allocation);
 
-		m_LoadedTextures["empire_diffuse"] = lostEmpire;
+		texture.ImageView = VK_NULL_HANDLE;
+		texture.Image = {};
 	}
 }
\ No newline at end of file
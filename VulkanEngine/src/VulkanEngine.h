@@ -2,8 +2,20 @@
 
 #include <GLFW/glfw3.h>
 
+#include "VkCulling.h"
+#include "VkDefragmenter.h"
+#include "VkDrawList.h"
+#include "VkFrameArena.h"
+#include "VkFrameAllocator.h"
+#include "VkGeometryBuffer.h"
+#include "VkGpuScene.h"
 #include "VkInit.h"
+#include "VkMemoryPlacement.h"
 #include "VkMesh.h"
+#include "VkObjectCuller.h"
+#include "VkParallel.h"
+#include "VkResidency.h"
+#include "VkStagingRing.h"
 
 #include <set>
 #include <vector>
@@ -17,6 +29,7 @@
 #include <unordered_map>
 #include <deque>
 #include <functional>
+#include <chrono>
 
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
@@ -25,29 +38,74 @@ namespace VKE
 {
 	struct Texture
 	{
-		AllocatedImage Image;
-		VkImageView ImageView;
+		AllocatedImage Image = {};
+		VkImageView ImageView = VK_NULL_HANDLE;
+
+		std::string Path;
+		//the image and view are destroyed while the residency manager has the texture evicted
+		uint32_t ResidencyHandle = ResidencyManager::INVALID_HANDLE;
+		//staging ring submission carrying the pixels
+		uint64_t UploadToken = 0;
+
+		//descriptor sets pointing at the texture, rewritten when it is streamed back in. Set points at where the set is
+		//bound from, defragmentation writes a moved texture into Spare and swaps the two instead of rewriting a set in use
+		struct Binding
+		{
+			VkDescriptorSet* Set;
+			VkSampler Sampler;
+			VkDescriptorSet Spare = VK_NULL_HANDLE;
+		};
+		std::vector<Binding> Bindings;
 	};
 
 	struct Material 
 	{
 		VkDescriptorSet textureSet { VK_NULL_HANDLE };
+		//the texture textureSet points at, and the default texture's set bound instead while it is evicted or on its way back
+		Texture* texture = nullptr;
+		VkDescriptorSet* fallbackTextureSet = nullptr;
 		VkPipeline pipeline;
 		VkPipelineLayout pipelineLayout;
+
+		//same state, vertex shader reading the object's matrix from the GPU scene. VK_NULL_HANDLE if the material is only drawn by DrawObjects
+		VkPipeline indirectPipeline = VK_NULL_HANDLE;
+
+		//position only variant for depth passes, nullptr if the material can't be drawn without its fragment shader
+		Material* depthMaterial = nullptr;
+
+		//small ids of the material and its pipeline, fields of the draw sort key
+		uint32_t sortId = 0;
+		uint32_t pipelineSortId = 0;
+	};
+
+	//model matrices of many copies of a mesh, in a per instance vertex buffer
+	struct InstanceGroup
+	{
+		AllocatedBuffer InstanceBuffer = {};
+		uint32_t InstanceCount = 0;
+		//the upload of the matrices, the group isn't drawn before the graphics queue has it
+		uint64_t UploadToken = 0;
 	};
 
 	struct RenderObject 
 	{
 		Mesh* mesh;
+		//index into mesh->Submeshes, the object draws only that material's triangles
+		uint32_t submesh = 0;
 		Material* material;
 
 		glm::mat4 transformMatrix;
+
+		//drawn once per instance of the group with a single instanced draw, material has to be an instanced variant.
+		//transformMatrix is then applied in the space of each instance, before its matrix
+		InstanceGroup* instances = nullptr;
 	};
 
-	struct MeshPushConstants 
+	//push constants of the instance groups' draws. every other draw passes its object's index as firstInstance
+	struct ObjectPushConstants
 	{
-		glm::vec4 data;
-		glm::mat4 renderMatrix;
+		//index of the object's matrix in the frame's transform buffer
+		uint32_t objectIndex;
 	};
 
 	struct GPUCameraData 
@@ -66,6 +124,16 @@ namespace VKE
 		glm::vec4 sunlightColor;
 	};
 
+	//threads a frame's draws are recorded on at most
+	constexpr uint32_t MAX_RECORDING_THREADS = 16;
+
+	//command pool of one recording thread and its secondary command buffers, one for the depth prepass and one for the main pass
+	struct RecordingThread
+	{
+		VkCommandPool CommandPool = VK_NULL_HANDLE;
+		VkCommandBuffer CommandBuffers[2] = {};
+	};
+
 	struct FrameData 
 	{
 		VkSemaphore m_PresentSemaphore, m_RenderSemaphore;
@@ -74,12 +142,49 @@ namespace VKE
 		VkCommandPool m_CommandPool;
 		VkCommandBuffer m_MainCommandBuffer;
 
+		//the threads only ever record into the frame's own pools, the frame's fence tells when they can be reset
+		RecordingThread recordingThreads[MAX_RECORDING_THREADS];
+
 		//buffer that holds a single GPUCameraData to use when rendering
-		AllocatedBuffer cameraBuffer;
+		MappedBuffer cameraBuffer;
+
+		//render matrix of every object, written by WriteObjectTransforms and read by the vertex shaders at TRANSFORM_BUFFER_BINDING.
+		//replaced by a larger buffer when the scene outgrows it
+		MappedBuffer transformBuffer;
+		uint32_t transformCapacity = 0;
+
+		//this frame's slice of m_TransientBuffer, reset once m_RenderFence has signalled
+		FrameAllocator transientAllocator;
+
+		//CPU memory for the frame's temporary data, reset together with transientAllocator
+		FrameArena cpuArena;
+		//destroys what the frame's commands may still use once m_RenderFence has signalled, stored in cpuArena
+		FrameDeletionQueue deletionQueue;
 
 		VkDescriptorSet globalDescriptor;
 	};
 
+	//objects or meshlets tested and drawn since startup
+	struct CullingStatistics
+	{
+		uint64_t Total = 0;
+		uint64_t Visible = 0;
+	};
+
+	//what every draw of the frame shares, written before any of them is recorded
+	struct DrawContext
+	{
+		//dynamic offset of the frame's scene uniform
+		uint32_t SceneOffset = 0;
+		Frustum CameraFrustum = {};
+		glm::vec3 CameraPosition = glm::vec3(0.0f);
+
+		//level of detail selection, see SelectLod
+		float ProjectionScale = 0.0f;
+		float NearPlane = 0.0f;
+		float LodErrorThreshold = 0.0f;
+	};
+
 	//number of frames to overlap when rendering
 	constexpr unsigned int FRAME_OVERLAP = 2;
 
@@ -87,6 +192,8 @@ namespace VKE
 	{
 		std::optional<uint32_t> graphicsFamily;
 		std::optional<uint32_t> presentFamily;
+		//a family with transfer but neither graphics nor compute, if the device has one
+		std::optional<uint32_t> transferFamily;
 
 		bool isComplete()
 		{
@@ -147,28 +254,157 @@ namespace VKE
 		VkCommandBuffer m_CommandBuffer;
 	};
 
+	//which vertex shader of a format: one matrix per draw, per instance from the instance buffer, or per object from the GPU scene
+	enum class VertexShaderVariant
+	{
+		Default,
+		Instanced,
+		Indirect
+	};
+
 	class VulkanEngine
 	{
 	public:
+		//storage buffer binding of the global set holding the GPU scene's objects
+		static constexpr uint32_t OBJECT_BUFFER_BINDING = 2;
+		//storage buffer binding of the global set holding the frame's render matrices, see FrameData::transformBuffer
+		static constexpr uint32_t TRANSFORM_BUFFER_BINDING = 3;
+
 		void Init();
 		void Run();
 		void Draw();
 		void Cleanup();
 
 	public:
+		//after changing it or the objects in it, call MarkRenderablesChanged
 		std::vector<RenderObject> m_Renderables;
+		//drops what is cached from m_Renderables: the culler's bounding spheres
+		void MarkRenderablesChanged() { m_ObjectCuller.Invalidate(); }
 
 		std::unordered_map<std::string, Material> m_Materials;
 		std::unordered_map<std::string, Mesh> m_Meshes;
 
+		//vertices and indices of every uploaded mesh
+		GeometryBuffer m_Geometry;
+		//gives the mesh's geometry ranges back, waits for the GPU so no frame in flight still reads them
+		void FreeMesh(Mesh& mesh);
+		//packs the geometry of every mesh in m_Meshes into buffers sized to fit it and pending
+		void CompactGeometry(const Mesh* pending = nullptr);
+
 		//create material and add it to the map
 		Material* CreateMaterial(VkPipeline pipeline, VkPipelineLayout layout, const std::string& name);
 		//returns nullptr if it can't be found
 		Material* GetMaterial(const std::string& name);
+		//variant of the material whose pipeline reads the given vertex format and layout
+		Material* GetMaterial(const std::string& name, VertexFormat format, VertexLayout layout = VertexLayout::Interleaved);
+		static std::string GetMaterialName(const std::string& name, VertexFormat format, VertexLayout layout = VertexLayout::Interleaved);
+		//textured material for a mesh material, shared by every material with the same texture and alpha mode.
+		//nullptr if no descriptor set is left for it
+		Material* GetTexturedMaterial(const MeshMaterial& meshMaterial, VertexFormat format, VertexLayout layout, VkSampler sampler);
+		//vertex shader that decodes the given vertex format
+		static const char* GetVertexShaderPath(VertexFormat format, VertexShaderVariant variant = VertexShaderVariant::Default);
 		//returns nullptr if it can't be found
 		Mesh* GetMesh(const std::string& name);
-		//our draw function
-		void DrawObjects(VkCommandBuffer cmd, RenderObject* first, int count);
+
+		//instance groups, keyed by name
+		std::unordered_map<std::string, InstanceGroup> m_InstanceGroups;
+		//uploads the matrices into the group's instance buffer, destroyed at cleanup
+		InstanceGroup* CreateInstanceGroup(const std::string& name, const std::vector<glm::mat4>& transforms);
+
+		//triangles in the grid of the scene, laid out in a square
+		uint32_t m_TriangleInstanceCount = 41 * 41;
+		//the grid as one instance group, off it is one object per triangle to compare against
+		bool m_Instancing = true;
+		//the objects a pass draws, ordered by their DrawKey. the depth only list leaves out objects without a depthMaterial.
+		//indices picks count of the objects, nullptr takes the first count
+		DrawList BuildDrawList(const RenderObject* objects, const uint32_t* indices, uint32_t count, bool depthOnly = false);
+
+		//world space bounds of m_Renderables, updated when the vector changes size or moves and after MarkRenderablesChanged
+		ObjectCuller m_ObjectCuller;
+		//test the objects against the frustum before the draw lists are built
+		bool m_FrustumCulling = true;
+		//threads the objects are culled on, 0 for every thread of m_Workers. small scenes stay on the calling thread
+		uint32_t m_CullingThreads = 0;
+		CullingStatistics m_ObjectStatistics;
+		//writes the camera and scene uniforms of the frame
+		DrawContext PrepareDraws(const Frustum& frustum);
+
+		//objects whose matrices are written by one thread at least
+		static constexpr uint32_t MIN_TRANSFORMS_PER_THREAD = 16384;
+		//the transform buffers start with room for this many objects
+		static constexpr uint32_t INITIAL_TRANSFORM_CAPACITY = 1024;
+		//writes the render matrix of every object to the frame's transform buffer, where the draws find it by the object's index
+		void WriteObjectTransforms(const RenderObject* objects, uint32_t count);
+		//grows the frame's transform buffer to hold count matrices and points the frame's global set at it
+		void ReserveTransformBuffer(FrameData& frame, uint32_t count);
+
+		//our draw function, for count objects of a draw list. the depth only variant draws the objects with their materials' depthMaterial.
+		//the matrices of objects have to be written by WriteObjectTransforms this frame.
+		//it only reads the engine, the recording threads call it at the same time with their own statistics
+		void DrawObjects(VkCommandBuffer cmd, const RenderObject* objects, const uint32_t* order, uint32_t count, const DrawContext& context,
+			DrawStatistics& statistics, CullingStatistics& clusters, bool depthOnly = false);
+		//textureSet of the material, or the default texture's while the texture isn't drawable
+		VkDescriptorSet GetDrawableTextureSet(const Material& material) const;
+
+		//started in Init, the per frame work of the culler, the transforms and the recording runs on it
+		WorkerPool m_Workers;
+		//threads the draws are recorded on, 0 for every thread of m_Workers. 1 records everything into the primary command buffer
+		uint32_t m_RecordingThreads = 0;
+		//draws a recording thread gets at least
+		static constexpr uint32_t MIN_DRAWS_PER_RECORDING_THREAD = 2048;
+		uint32_t GetRecordingThreadCount(uint32_t drawCount) const;
+		//records the lists into secondary command buffers on threadCount threads and executes them, inside the render pass
+		void RecordDrawsParallel(VkCommandBuffer cmd, VkFramebuffer framebuffer, const DrawList& depthList, const DrawList& mainList, const DrawContext& context, bool drawGpuScene, uint32_t threadCount);
+
+		//the render pass of the frame with everything drawn in it, returns the milliseconds spent recording
+		double RecordScene(VkCommandBuffer cmd, uint32_t swapchainImageIndex);
+		double m_RecordMilliseconds = 0.0;
+
+		//the objects GpuScene::CanDraw takes are culled by a compute shader and drawn with one indirect draw per batch
+		GpuScene m_GpuScene;
+		bool m_GpuDriven = false;
+		//multiDrawIndirect and drawIndirectFirstInstance are enabled
+		bool m_GpuDrivenSupported = false;
+		//VK_KHR_draw_indirect_count, nullptr if the device doesn't have it
+		PFN_vkCmdDrawIndexedIndirectCountKHR m_CmdDrawIndexedIndirectCount = nullptr;
+		//one vkCmdDrawIndexedIndirect(Count) per batch of the GPU scene
+		void DrawIndirect(VkCommandBuffer cmd, const DrawContext& context, DrawStatistics& statistics, bool depthOnly = false);
+
+		glm::mat4 GetViewMatrix() const;
+		//with y flipped for Vulkan's clip space
+		glm::mat4 GetProjectionMatrix() const;
+
+		glm::vec3 m_CameraPosition = { 0.f, 6.f, 10.f };
+
+		//sort the draw lists, off they keep the order of m_Renderables to compare against
+		bool m_SortDrawList = true;
+		//binds and draws recorded this frame, and summed over every frame
+		DrawStatistics m_FrameDrawStatistics;
+		DrawStatistics m_DrawStatistics;
+		//sort ids handed out to pipelines, materials and meshes
+		std::unordered_map<VkPipeline, uint32_t> m_PipelineSortIds;
+		uint32_t m_NextMaterialSortId = 0;
+		uint32_t m_NextMeshSortId = 0;
+		//picks the level of detail of the submesh from its projected error, nullptr if it has no levels
+		static const MeshLod* SelectLod(const Mesh& mesh, const Submesh& submesh, const glm::mat4& transform, const glm::vec3& cameraPosition, float projectionScale, float nearPlane, float errorThreshold);
+
+		//a level of detail is used while its error projects to at most m_LodErrorThreshold pixels.
+		//each step of m_LodBias doubles the threshold, so positive values pick coarser levels
+		float m_LodErrorThreshold = 1.0f;
+		float m_LodBias = 0.0f;
+
+		//draws only the meshlets of the submesh's finest level of detail that are inside the frustum and not facing away, returns how many.
+		//objectIndex finds the object's matrix in the transform buffer
+		uint32_t DrawMeshlets(VkCommandBuffer cmd, const Mesh& mesh, const Submesh& submesh, const glm::mat4& transform, uint32_t objectIndex, const DrawContext& context, DrawStatistics& statistics);
+
+		bool m_ClusterCulling = true;
+		CullingStatistics m_ClusterStatistics;
+
+		//draw the opaque objects depth only before the main pass
+		bool m_DepthPrepass = false;
+
+		//record every startup upload into one submission. off, each upload is submitted and waited for on its own, to compare against
+		bool m_BatchStartupUploads = true;
 
 		//frame storage
 		FrameData m_Frames[FRAME_OVERLAP];
@@ -177,11 +413,37 @@ namespace VKE
 
 		UploadContext m_UploadContext;
 
+		//staging memory of every upload, the copies recorded into it are submitted at the start of each frame
+		//and taken over by the frame that finds them finished
+		StagingRing m_StagingRing;
+		//submits the recorded uploads and waits until the graphics queue owns them
+		void FlushUploads();
+
 		void ImmediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function);
 
-		//texture hashmap
+		//texture hashmap, keyed by file path
 		std::unordered_map<std::string, Texture> m_LoadedTextures;
 		void LoadImages();
+		//loads the image once and returns the cached texture after that, nullptr if it can't be read
+		Texture* LoadTexture(const std::string& path, ResidencyPriority priority = ResidencyPriority::Normal);
+
+		//memory every class of resource is allocated from, and whether it is written directly or through staging copies
+		MemoryPlacement m_MemoryPlacement;
+
+		//keeps the textures and meshes within the device local memory budget
+		ResidencyManager m_Residency;
+
+		//moves textures and geometry buffers together a few at a time when the device memory blocks are fragmented
+		Defragmenter m_Defragmenter;
+		bool m_BackgroundDefragmentation = true;
+
+		//single texture set from the texture pools, a new pool is created when they are full. VK_NULL_HANDLE if that fails too
+		VkDescriptorSet AllocateTextureSet();
+		//adds a pool with room for setCount texture sets, VK_NULL_HANDLE if it can't be created
+		VkDescriptorPool CreateTexturePool(uint32_t setCount);
+		void WriteTextureDescriptor(VkDescriptorSet set, VkSampler sampler, VkImageView imageView);
+
+		VkDevice GetDevice() const { return m_Device; }
 
 		VkDescriptorSetLayout m_SingleTextureSetLayout;
 
@@ -195,6 +457,8 @@ namespace VKE
 		VkSurfaceKHR m_Surface;
 		VkQueue m_GraphicsQueue;
 		VkQueue m_PresentQueue;
+		//the graphics queue if there's no transfer only family
+		VkQueue m_TransferQueue;
 
 		VkSwapchainKHR m_SwapChain;
 		VkFormat m_SwapChainImageFormat;
@@ -213,6 +477,11 @@ namespace VKE
 
 		uint32_t m_FrameNumber = 0;
 
+		//operator new calls made by the frames of Run, only counted in debug builds
+		uint64_t m_FrameHeapAllocations = 0;
+		uint64_t m_AllocatingFrames = 0;
+		uint64_t m_CountedFrames = 0;
+
 		VkPipelineLayout m_TrianglePipelineLayout;
 		VkPipeline m_TrianglePipeline;
 
@@ -231,7 +500,8 @@ namespace VKE
 		VkPhysicalDeviceProperties m_GpuProperties;
 
 		GPUSceneData m_SceneParameters;
-		AllocatedBuffer m_SceneParameterBuffer;
+		//uniform and storage data written for a single frame, one FrameAllocator slice per frame in flight
+		MappedBuffer m_TransientBuffer;
 
 		const std::vector<const char*> m_DeviceExtensions = 
 		{
@@ -249,6 +519,13 @@ namespace VKE
 		VkDescriptorSetLayout m_GlobalSetLayout;
 		VkDescriptorPool m_DescriptorPool;
 
+		//texture sets: materials, fallbacks and the defragmenter's spares. every new pool holds as many sets as all before it,
+		//so the number of pools grows with the log of the textures loaded
+		static constexpr uint32_t MIN_TEXTURE_SETS_PER_POOL = 64;
+		std::vector<VkDescriptorPool> m_TexturePools;
+		uint32_t m_TextureSetCount = 0;
+		uint32_t m_TextureSetCapacity = 0;
+
 		void InitWindow();
 		void InitVulkan();
 
@@ -267,7 +544,20 @@ namespace VKE
 		void CreateAllocator();
 
 	public:
-		AllocatedBuffer CreateBuffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage);
+		//in the memory m_MemoryPlacement picked for the class
+		AllocatedBuffer CreateBuffer(size_t allocSize, VkBufferUsageFlags usage, MemoryClass memoryClass);
+		//host visible buffer mapped once at creation, destroyed with vmaDestroyBuffer like any other. the class has to be one the CPU writes
+		MappedBuffer CreateMappedBuffer(size_t allocSize, VkBufferUsageFlags usage, MemoryClass memoryClass = MemoryClass::FrameData);
+		//makes the writes to [offset, offset + size) visible to the GPU, nothing to do on host coherent memory
+		void FlushMappedBuffer(const MappedBuffer& buffer, VkDeviceSize offset, VkDeviceSize size);
+
+		//the current frame's camera uniforms, written straight into the mapped buffer
+		GPUCameraData* GetCameraData();
+		//transient data of the current frame, bound with dynamic offsets
+		FrameAllocator& GetFrameAllocator() { return GetCurrentFrame().transientAllocator; }
+		//CPU memory valid until the current frame is done on the GPU, see FrameVector
+		FrameArena& GetFrameArena() { return GetCurrentFrame().cpuArena; }
+		FrameDeletionQueue& GetFrameDeletionQueue() { return GetCurrentFrame().deletionQueue; }
 
 	private:
 		void CreateDescriptors();
@@ -290,6 +580,7 @@ namespace VKE
 
 		// Swapchain set up.
 		bool CheckDeviceExtensionSupport(VkPhysicalDevice device);
+		bool IsDeviceExtensionAvailable(VkPhysicalDevice device, const char* extensionName);
 		SwapChainSupportDetails QuerySwapChainSupport(VkPhysicalDevice device);
 		VkSurfaceFormatKHR ChooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats);
 		VkPresentModeKHR ChooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes);
@@ -298,7 +589,21 @@ namespace VKE
 		size_t PadUniformBufferSize(size_t originalSize);
 
 		void LoadMeshes();
-		void UploadMesh(Mesh& mesh);
+		//registers the mesh with the residency manager on its first upload, a restream uploads it again
+		void UploadMesh(Mesh& mesh, const std::string& name, ResidencyPriority priority = ResidencyPriority::Normal);
+
+		//creates the texture's image and view from its file, and points the descriptor sets of its bindings at the new view
+		bool StreamTexture(Texture& texture);
+		void EvictTexture(Texture& texture);
+		//default texture set for materials whose texture isn't resident, one per sampler. nullptr if no set can be allocated
+		VkDescriptorSet* GetFallbackTextureSet(VkSampler sampler);
+		std::unordered_map<VkSampler, VkDescriptorSet> m_FallbackTextureSets;
+
+		//evicts and restreams for the frame about to be recorded
+		void UpdateResidency();
+		bool m_MemoryBudgetSupported = false;
+		//evicted meshes only give their ranges back, the geometry buffers shrink when compacted
+		bool m_GeometryEvicted = false;
 		void InitScene();
 	};
 }
\ No newline at end of file
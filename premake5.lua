@@ -13,6 +13,13 @@ workspace "VulkanPlayground"
 -- Variable to hold output directory.
 outputdir = "%{cfg.buildcfg}-%{cfg.architecture}"
 
+-- Counting heap allocations replaces the global operator new, so it is opt-in: premake5 --count-allocations vs2022
+newoption
+{
+    trigger = "count-allocations",
+    description = "Count every heap allocation made through operator new and report the frames that allocated"
+}
+
 -- Engine project.
 project "VulkanEngine"
     location "VulkanEngine"
@@ -68,6 +75,9 @@ project "VulkanEngine"
     filter "configurations:Release"
         defines { "RELEASE" }
         optimize "On"
+
+    filter "options:count-allocations"
+        defines { "VKE_COUNT_ALLOCATIONS" }
         
     filter { "system:windows", "configurations:Debug" }
         buildoptions "/MDd"
@@ -114,6 +124,12 @@ project "VulkanApp"
         "VulkanEngine"
     }
 
+    -- The shader modules are compiled and validated from their sources, never committed by hand.
+    filter "system:windows"
+        prebuildcommands { "cd res/shaders && call compile.bat nopause" }
+
+    filter {}
+
     filter "system:windows"
         systemversion "latest"
 